@@ -7,6 +7,16 @@ import os
 
 functions = list()
 outfiles = list()
+entries = list()
+
+# split a model name like r9.4_450bps.nucleotide.6mer.template
+# into the kit, alphabet, strand and k of its key
+def parse_model_name(name):
+    fields = name.split(".")
+    k_idx = [i for i, f in enumerate(fields) if f.endswith("mer") and f[:-3].isdigit()][0]
+    kit = ".".join(fields[:k_idx - 1])
+    strand = ".".join(fields[k_idx + 1:])
+    return (kit, fields[k_idx - 1], strand, int(fields[k_idx][:-3]))
 
 for model_file in sys.stdin:
     model_file = model_file.rstrip()
@@ -20,6 +30,10 @@ for model_file in sys.stdin:
         sys.exit(1)
 
     functions.append(function_name)
+    model_name = os.path.basename(model_file)
+    if model_name.endswith(".model"):
+        model_name = model_name[:-len(".model")]
+    entries.append(parse_model_name(model_name) + (function_name,))
     outfiles.append(outfile)
 
 print("// Autogenerated from convert_all_models.py")
@@ -27,7 +41,7 @@ for f in outfiles:
     print("#include \"%s\"" % f)
 
 print("\n// Autogenerated from convert_all_models.py")
-print("const static std::vector<PoreModel> builtin_models({")
-print("\t" + ",\n\t".join([f + "()" for f in functions]))
-print("});")
+print("const static BuiltinModel builtin_models[] = {")
+print("\t" + ",\n\t".join(["{ \"%s\", \"%s\", \"%s\", %d, %s }" % e for e in entries]))
+print("};")
 
@@ -49,7 +49,7 @@ print("#ifndef NANOPOLISH_%s_INL" % args.function_name.upper())
 print("#define NANOPOLISH_%s_INL" % args.function_name.upper())
 
 data_name = "%s_data" % args.function_name
-print("static std::vector<double> %s = {" % data_name)
+print("static const double %s[] = {" % data_name)
 for ki, t in enumerate(model):
 
     is_last = ki == len(model) - 1
@@ -66,15 +66,16 @@ assign("k", K)
 
 num_states = len(model)
 
-print("\ttmp.states.resize(%d);" % num_states)
+print("\tstd::vector<PoreModelStateParams> states(%d);" % num_states)
 print("\tfor(size_t i = 0; i < %d; ++i) {" % num_states)
-print("\t\ttmp.states[i].level_mean = %s[4*i + 0];" % data_name)
-print("\t\ttmp.states[i].level_stdv = %s[4*i + 1];" % data_name)
-print("\t\ttmp.states[i].sd_mean = %s[4*i + 2];" % data_name)
-print("\t\ttmp.states[i].sd_stdv = %s[4*i + 3];" % data_name)
-print("\t\ttmp.states[i].update_sd_lambda();")
-print("\t\ttmp.states[i].update_logs();")
+print("\t\tstates[i].level_mean = %s[4*i + 0];" % data_name)
+print("\t\tstates[i].level_stdv = %s[4*i + 1];" % data_name)
+print("\t\tstates[i].sd_mean = %s[4*i + 2];" % data_name)
+print("\t\tstates[i].sd_stdv = %s[4*i + 3];" % data_name)
+print("\t\tstates[i].update_sd_lambda();")
+print("\t\tstates[i].update_logs();")
 print("\t}")
+print("\ttmp.update_states(states);")
 
 if "alphabet" in header_kv:
     print("\ttmp.pmalphabet = get_alphabet_by_name(%s);" % (quote(header_kv["alphabet"])))
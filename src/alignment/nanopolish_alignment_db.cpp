@@ -12,6 +12,7 @@
 #include "htslib/faidx.h"
 #include "htslib/hts.h"
 #include "htslib/sam.h"
+#include "nanopolish_bam_utils.h"
 #include "nanopolish_methyltrain.h"
 
 // Various file handle and structures
@@ -447,8 +448,7 @@ BamHandles _initialize_bam_itr(const std::string& bam_filename,
     BamHandles handles;
 
     // load bam file
-    handles.bam_fh = sam_open(bam_filename.c_str(), "r");
-    assert(handles.bam_fh != NULL);
+    handles.bam_fh = open_bam_file(bam_filename, "r");
 
     // load bam index file
     hts_idx_t* bam_idx = sam_index_load(handles.bam_fh, bam_filename.c_str());
@@ -656,12 +656,14 @@ std::vector<EventAlignment> AlignmentDB::_build_event_alignment(const EventAlign
         assert(kmer.size() == k);
 
         // ref data
-        ea.ref_name = "read"; // not needed
+        ea.ref_id = intern_ref_name("read"); // not needed
         ea.read_idx = -1; // not needed
-        ea.ref_kmer = kmer;
+        ea.alphabet = &gDNAAlphabet;
+        ea.k = k;
+        ea.ref_kmer_rank = gDNAAlphabet.kmer_rank(kmer.c_str(), k);
         ea.strand_idx = event_record.strand;
         ea.rc = event_record.rc;
-        ea.model_kmer = kmer;
+        ea.model_kmer_rank = ea.ref_kmer_rank;
         ea.hmm_state = 'M';
         alignment.push_back(ea);
     }
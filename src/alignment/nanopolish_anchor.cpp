@@ -10,6 +10,8 @@
 #include <string>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
+#include <algorithm>
 #include "htslib/faidx.h"
 #include "nanopolish_common.h"
 #include "nanopolish_anchor.h"
@@ -86,6 +88,47 @@ std::vector<AlignedSegment> get_aligned_segments(const bam1_t* record, int read_
     return out;
 }
 
+SquiggleReadRange get_read_range_for_ref_region(const bam1_t* record, int region_start, int region_end)
+{
+    if(region_start == -1 || region_end == -1) {
+        return SquiggleReadRange();
+    }
+
+    int min_read_pos = INT_MAX;
+    int max_read_pos = -1;
+    std::vector<AlignedSegment> segments = get_aligned_segments(record);
+    for(const AlignedSegment& segment : segments) {
+        for(const AlignedPair& ap : segment) {
+            if(ap.ref_pos >= region_start && ap.ref_pos <= region_end) {
+                min_read_pos = std::min(min_read_pos, ap.read_pos);
+                max_read_pos = std::max(max_read_pos, ap.read_pos);
+            }
+        }
+    }
+
+    if(max_read_pos == -1) {
+        return SquiggleReadRange();
+    }
+
+    // the read positions are the ones get_aligned_segments gives the event aligner, which
+    // do not count hard clipped bases, so the range covers the bases the aligner looks up
+    if(!bam_is_rev(record)) {
+        return SquiggleReadRange(min_read_pos, max_read_pos + 1);
+    }
+
+    // the read positions are on the reference strand, flip them using the length of the
+    // read, as SquiggleRead::flip_k_strand does with the read sequence
+    const uint32_t* cigar = bam_get_cigar(record);
+    uint32_t n_cigar = record->core.n_cigar;
+    int read_length = bam_cigar2qlen(n_cigar, cigar);
+    for(uint32_t ci = 0; ci < n_cigar; ++ci) {
+        if(bam_cigar_op(cigar[ci]) == BAM_CHARD_CLIP) {
+            read_length += bam_cigar_oplen(cigar[ci]);
+        }
+    }
+    return SquiggleReadRange(std::max(read_length - max_read_pos - 1, 0), read_length - min_read_pos);
+}
+
 std::vector<int> uniformally_sample_read_positions(const std::vector<AlignedPair>& aligned_pairs,
                                                    int ref_start,
                                                    int ref_end,
@@ -45,4 +45,10 @@ typedef std::vector<AlignedPair>::const_iterator AlignedPairConstIter;
 typedef std::vector<AlignedPair> AlignedSegment;
 std::vector<AlignedSegment> get_aligned_segments(const bam1_t* record, int read_stride = 1);
 
+// Return the bases of the read, in the orientation it was sequenced, that are aligned
+// to reference positions [region_start, region_end]. Like get_aligned_segments, the
+// positions do not count hard clipped bases. The range is not set if region_start
+// is -1 or no bases are aligned to the region
+SquiggleReadRange get_read_range_for_ref_region(const bam1_t* record, int region_start, int region_end);
+
 #endif
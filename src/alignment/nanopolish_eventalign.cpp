@@ -20,7 +20,10 @@
 #include <omp.h>
 #include <getopt.h>
 #include <iterator>
-#include "htslib/faidx.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include "nanopolish_eventalign.h"
 #include "nanopolish_iupac.h"
 #include "nanopolish_poremodel.h"
@@ -32,9 +35,15 @@
 #include "nanopolish_hmm_input_sequence.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_bam_processor.h"
+#include "nanopolish_bam_utils.h"
+#include "nanopolish_reorder_buffer.h"
+#include "nanopolish_text_format.h"
+#include "nanopolish_eventalign_binary.h"
+#include "nanopolish_indexed_output.h"
 #include "H5pubconf.h"
 #include "profiler.h"
 #include "progress.h"
+#include "nanopolish_fast5_cache.h"
 
 //
 using namespace std::placeholders;
@@ -57,20 +66,33 @@ static const char *EVENTALIGN_USAGE_MESSAGE =
 "  -v, --verbose                        display verbose output\n"
 "      --version                        display version\n"
 "      --help                           display this help and exit\n"
-"      --sam                            write output in SAM format\n"
+"      --sam                            write output in SAM format, the same as --format sam\n"
+"      --format=STR                     write output as tsv, sam or binary (default: tsv). Binary output\n"
+"                                       can be converted to tsv with nanopolish eventalign-view\n"
+"      --indexed-output=FILE            write the tsv output bgzip compressed to FILE, with an index of the\n"
+"                                       reads for nanopolish view-region, instead of stdout\n"
 "  -w, --window=STR                     compute the consensus for window STR (format: ctg:start_id-end_id)\n"
 "  -r, --reads=FILE                     the 2D ONT reads are in fasta FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the genome we are computing a consensus for is in FILE\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
 "  -q, --min-mapping-quality=NUM        only use reads with mapping quality at least NUM (default: 0)\n"
 "      --scale-events                   scale events to the model, rather than vice-versa\n"
 "      --progress                       print out a progress message\n"
+"      --signal-cache                   load the events of each read from the cache built by nanopolish index --precompute-events\n"
+"      --fast5-cache-size=NUM           keep up to NUM fast5 files open per thread (default: 4)\n"
 "  -n, --print-read-names               print read names instead of indexes\n"
 "      --summary=FILE                   summarize the alignment of each read/strand in FILE\n"
 "      --samples                        write the raw samples for the event to the tsv output\n"
 "      --signal-index                   write the raw signal start and end index values for the event to the tsv output\n"
 "      --models-fofn=FILE               read alternative k-mer models from FILE\n"
+"      --collapse                       write one tsv row for each run of events aligned to the same reference\n"
+"                                       position and model k-mer, with the duration weighted level and a num_events column\n"
+"      --pileup                         write the statistics of the events at each reference position, over all reads,\n"
+"                                       instead of the events\n"
+"      --banded-align                   align each read in one pass of the HMM within an adaptive band, rather than\n"
+"                                       in overlapping chunks of the reference\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 namespace opt
@@ -82,9 +104,13 @@ namespace opt
     static std::string region;
     static std::string summary_file;
     static std::string models_fofn;
-    static int output_sam = 0;
+    static std::string output_format = "tsv";
+    static std::string indexed_output_file;
     static int progress = 0;
+    static int signal_cache = 0;
+    static int fast5_cache_size = FAST5_CACHE_DEFAULT_SIZE;
     static int num_threads = 1;
+    static int io_threads = -1;
     static int scale_events = 0;
     static int batch_size = 512;
     static int min_mapping_quality = 0;
@@ -92,11 +118,14 @@ namespace opt
     static bool full_output;
     static bool write_samples = false;
     static bool write_signal_index = false;
+    static bool collapse = false;
+    static bool pileup = false;
+    static bool banded_align = false;
 }
 
 static const char* shortopts = "r:b:g:t:w:q:vn";
 
-enum { OPT_HELP = 1, OPT_VERSION, OPT_PROGRESS, OPT_SAM, OPT_SUMMARY, OPT_SCALE_EVENTS, OPT_MODELS_FOFN, OPT_SAMPLES, OPT_SIGNAL_INDEX };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_PROGRESS, OPT_SAM, OPT_SUMMARY, OPT_SCALE_EVENTS, OPT_MODELS_FOFN, OPT_SAMPLES, OPT_SIGNAL_INDEX, OPT_SIGNAL_CACHE, OPT_FAST5_CACHE_SIZE, OPT_IO_THREADS, OPT_FORMAT, OPT_INDEXED_OUTPUT, OPT_COLLAPSE, OPT_PILEUP, OPT_BANDED_ALIGN };
 
 static const struct option longopts[] = {
     { "verbose",             no_argument,       NULL, 'v' },
@@ -113,18 +142,37 @@ static const struct option longopts[] = {
     { "signal-index",        no_argument,       NULL, OPT_SIGNAL_INDEX },
     { "scale-events",        no_argument,       NULL, OPT_SCALE_EVENTS },
     { "sam",                 no_argument,       NULL, OPT_SAM },
+    { "format",              required_argument, NULL, OPT_FORMAT },
+    { "indexed-output",      required_argument, NULL, OPT_INDEXED_OUTPUT },
+    { "collapse",            no_argument,       NULL, OPT_COLLAPSE },
+    { "pileup",              no_argument,       NULL, OPT_PILEUP },
+    { "banded-align",        no_argument,       NULL, OPT_BANDED_ALIGN },
     { "progress",            no_argument,       NULL, OPT_PROGRESS },
+    { "signal-cache",        no_argument,       NULL, OPT_SIGNAL_CACHE },
+    { "fast5-cache-size",    required_argument, NULL, OPT_FAST5_CACHE_SIZE },
+    { "io-threads",          required_argument, NULL, OPT_IO_THREADS },
     { "help",                no_argument,       NULL, OPT_HELP },
     { "version",             no_argument,       NULL, OPT_VERSION },
     { NULL, 0, NULL, 0 }
 };
 
-// convenience wrapper for the two output modes
+// convenience wrapper for the output modes
 struct EventalignWriter
 {
     FILE* tsv_fp;
     htsFile* sam_fp;
     FILE* summary_fp;
+
+    // keeps the output in bam order
+    ReorderBuffer* output;
+
+    EventalignBinaryWriter* binary_writer;
+
+    // the tsv output, when it is written to a compressed file with a read index
+    IndexedOutputWriter* indexed_tsv;
+
+    // the --pileup statistics, only used by the thread writing the output
+    EventalignPileup* pileup;
 };
 
 // Summarize the event alignment for a read strand
@@ -204,43 +252,63 @@ int get_end_pair(const std::vector<AlignedPair>& aligned_pairs, int ref_pos_max,
     return aligned_pairs.size() - 1;
 }
 
-// get the specified reference region, threadsafe
-std::string get_reference_region_ts(const faidx_t* fai, const char* ref_name, int start, int end, int* fetched_len)
-{
+//
+//
+//
 
-    // faidx_fetch_seq is not threadsafe
-    char* cref_seq;
-    #pragma omp critical
-    cref_seq = faidx_fetch_seq(fai, ref_name, start, end, fetched_len);
+// The interned contig names. A deque keeps the strings in place as names are added
+static std::mutex g_ref_names_mutex;
+static std::deque<std::string> g_ref_names;
+static std::unordered_map<std::string, uint32_t> g_ref_name_ids;
 
-    assert(cref_seq != NULL);
+uint32_t intern_ref_name(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(g_ref_names_mutex);
+    auto iter = g_ref_name_ids.find(name);
+    if(iter != g_ref_name_ids.end()) {
+        return iter->second;
+    }
 
-    std::string out(cref_seq);
-    free(cref_seq);
-    return out;
+    uint32_t ref_id = g_ref_names.size();
+    g_ref_names.push_back(name);
+    g_ref_name_ids.insert(std::make_pair(name, ref_id));
+    return ref_id;
 }
 
-//
-//
-//
+const std::string& get_interned_ref_name(uint32_t ref_id)
+{
+    std::lock_guard<std::mutex> lock(g_ref_names_mutex);
+    assert(ref_id < g_ref_names.size());
+    return g_ref_names[ref_id];
+}
 
-void emit_tsv_header(FILE* fp)
+void emit_tsv_header(FILE* fp, bool print_read_names, bool write_signal_index, bool write_samples, bool collapsed)
 {
     fprintf(fp, "%s\t%s\t%s\t%s\t%s\t", "contig", "position", "reference_kmer",
-            (not opt::print_read_names? "read_index" : "read_name"), "strand");
+            (not print_read_names? "read_index" : "read_name"), "strand");
     fprintf(fp, "%s\t%s\t%s\t%s\t", "event_index", "event_level_mean", "event_stdv", "event_length");
     fprintf(fp, "%s\t%s\t%s\t%s", "model_kmer", "model_mean", "model_stdv", "standardized_level");
 
-    if(opt::write_signal_index) {
+    if(write_signal_index) {
         fprintf(fp, "\t%s\t%s", "start_idx", "end_idx");
     }
 
-    if(opt::write_samples) {
+    if(write_samples) {
         fprintf(fp, "\t%s", "samples");
     }
+
+    if(collapsed) {
+        fprintf(fp, "\t%s", "num_events");
+    }
     fprintf(fp, "\n");
 }
 
+void emit_pileup_tsv_header(FILE* fp)
+{
+    fprintf(fp, "%s\t%s\t%s\t%s\t%s\t", "contig", "position", "reference_kmer", "num_reads", "num_events");
+    fprintf(fp, "%s\t%s\t%s\t%s\n", "event_level_mean", "event_level_stdv", "mean_read_duration", "mean_standardized_level");
+}
+
 void emit_sam_header(samFile* fp, const bam_hdr_t* hdr)
 {
     int ret = sam_hdr_write(fp, hdr);
@@ -324,14 +392,13 @@ std::vector<uint32_t> event_alignment_to_cigar(const std::vector<EventAlignment>
     return out;
 }
 
-void emit_event_alignment_sam(htsFile* fp,
-                              const SquiggleRead& sr,
-                              const bam_hdr_t* base_hdr,
-                              const bam1_t* base_record,
-                              const std::vector<EventAlignment>& alignments)
+// Build the sam record for the alignment of one strand, or NULL if there is nothing aligned
+bam1_t* make_event_alignment_sam_record(const SquiggleRead& sr,
+                                        const bam1_t* base_record,
+                                        const std::vector<EventAlignment>& alignments)
 {
     if(alignments.empty())
-        return;
+        return NULL;
     bam1_t* event_record = bam_init1();
 
     // Variable-length data
@@ -385,7 +452,14 @@ void emit_event_alignment_sam(htsFile* fp,
 
     int stride = alignments.front().event_idx < alignments.back().event_idx ? 1 : -1;
     bam_aux_append(event_record, "ES", 'i', 4, reinterpret_cast<uint8_t*>(&stride));
+    return event_record;
+}
 
+// Write a record from make_event_alignment_sam_record and free it
+void write_event_alignment_sam_record(htsFile* fp,
+                                      const bam_hdr_t* base_hdr,
+                                      bam1_t* event_record)
+{
     int ret = sam_write1(fp, base_hdr, event_record);
     if(ret < 0) {
         fprintf(stderr, "error writing sam record\n");
@@ -395,78 +469,127 @@ void emit_event_alignment_sam(htsFile* fp,
     bam_destroy1(event_record); // automatically frees malloc'd segment
 }
 
-void emit_event_alignment_tsv(FILE* fp,
-                              const SquiggleRead& sr,
-                              uint32_t strand_idx,
-                              const EventAlignmentParameters& params,
-                              const std::vector<EventAlignment>& alignments)
+EventAlignmentValues get_event_alignment_values(const SquiggleRead& sr,
+                                                const PoreModel* pore_model,
+                                                const EventAlignment& ea,
+                                                bool scale_events)
 {
-    assert(params.alphabet == "");
-    const PoreModel* pore_model = params.get_model();
-    uint32_t k = pore_model->k;
-    for(size_t i = 0; i < alignments.size(); ++i) {
+    EventAlignmentValues values;
+    values.event_level_mean = sr.get_unscaled_level(ea.event_idx, ea.strand_idx);
+    values.event_stdv = sr.get_stdv(ea.event_idx, ea.strand_idx);
+    values.event_length = sr.get_duration(ea.event_idx, ea.strand_idx);
+    values.model_mean = 0.0;
+    values.model_stdv = 0.0;
 
-        const EventAlignment& ea = alignments[i];
+    uint32_t rank = ea.hmm_state != 'B' ? ea.get_model_kmer_rank(pore_model->pmalphabet) : 0;
 
-        // basic information
-        if (not opt::print_read_names)
-        {
-            fprintf(fp, "%s\t%d\t%s\t%zu\t%c\t",
-                    ea.ref_name.c_str(),
-                    ea.ref_position,
-                    ea.ref_kmer.c_str(),
-                    ea.read_idx,
-                    "tc"[ea.strand_idx]);
+    if(scale_events) {
+
+        // scale reads to the model
+        values.event_level_mean = sr.get_fully_scaled_level(ea.event_idx, ea.strand_idx);
+
+        // unscaled model parameters
+        if(ea.hmm_state != 'B') {
+            PoreModelStateParams model = pore_model->get_parameters(rank);
+            values.model_mean = model.level_mean;
+            values.model_stdv = model.level_stdv;
         }
-        else
-        {
-            fprintf(fp, "%s\t%d\t%s\t%s\t%c\t",
-                    ea.ref_name.c_str(),
-                    ea.ref_position,
-                    ea.ref_kmer.c_str(),
-                    sr.read_name.c_str(),
-                    "tc"[ea.strand_idx]);
+    } else {
+
+        // scale model to the reads
+        if(ea.hmm_state != 'B') {
+            GaussianParameters model = sr.get_scaled_gaussian_from_pore_model_state(*pore_model, ea.strand_idx, rank);
+            values.model_mean = model.mean;
+            values.model_stdv = model.stdv;
         }
+    }
 
-        // event information
-        float event_mean = sr.get_unscaled_level(ea.event_idx, ea.strand_idx);
-        float event_stdv = sr.get_stdv(ea.event_idx, ea.strand_idx);
-        float event_duration = sr.get_duration(ea.event_idx, ea.strand_idx);
-        uint32_t rank = pore_model->pmalphabet->kmer_rank(ea.model_kmer.c_str(), k);
-        float model_mean = 0.0;
-        float model_stdv = 0.0;
-
-        if(opt::scale_events) {
-
-            // scale reads to the model
-            event_mean = sr.get_fully_scaled_level(ea.event_idx, ea.strand_idx);
-
-            // unscaled model parameters
-            if(ea.hmm_state != 'B') {
-                PoreModelStateParams model = pore_model->get_parameters(rank);
-                model_mean = model.level_mean;
-                model_stdv = model.level_stdv;
-            }
-        } else {
+    values.standardized_level = (values.event_level_mean - values.model_mean) / (sqrt(sr.scalings[ea.strand_idx].var) * values.model_stdv);
+    return values;
+}
 
-            // scale model to the reads
-            if(ea.hmm_state != 'B') {
-                GaussianParameters model = sr.get_scaled_gaussian_from_pore_model_state(*pore_model, ea.strand_idx, rank);
-                model_mean = model.mean;
-                model_stdv = model.stdv;
-            }
-        }
+void append_event_alignment_tsv_row(std::string& out,
+                                    const std::string& contig,
+                                    int ref_position,
+                                    const std::string& ref_kmer,
+                                    const std::string& read_id,
+                                    int strand_idx,
+                                    int event_idx,
+                                    const std::string& model_kmer,
+                                    const EventAlignmentValues& values)
+{
+    // basic information
+    out.append(contig);
+    out.push_back('\t');
+    append_int(out, ref_position);
+    out.push_back('\t');
+    out.append(ref_kmer);
+    out.push_back('\t');
+    out.append(read_id);
+    out.push_back('\t');
+    out.push_back("tc"[strand_idx]);
+    out.push_back('\t');
+
+    // event information
+    append_int(out, event_idx);
+    out.push_back('\t');
+    append_fixed(out, values.event_level_mean, 2);
+    out.push_back('\t');
+    append_fixed(out, values.event_stdv, 3);
+    out.push_back('\t');
+    append_fixed(out, values.event_length, 5);
+    out.push_back('\t');
+    out.append(model_kmer);
+    out.push_back('\t');
+    append_fixed(out, values.model_mean, 2);
+    out.push_back('\t');
+    append_fixed(out, values.model_stdv, 2);
+    out.push_back('\t');
+    append_fixed(out, values.standardized_level, 2);
+}
+
+void format_event_alignment_tsv(std::string& out,
+                                const SquiggleRead& sr,
+                                uint32_t strand_idx,
+                                const EventAlignmentParameters& params,
+                                const std::vector<EventAlignment>& alignments)
+{
+    assert(params.alphabet == "");
+    const PoreModel* pore_model = params.get_model();
+    if(alignments.empty()) {
+        return;
+    }
+
+    // most rows are under 100 characters, reserving up front avoids regrowing the buffer
+    out.reserve(out.size() + alignments.size() * 100);
 
-        float standard_level = (event_mean - model_mean) / (sqrt(sr.scalings[ea.strand_idx].var) * model_stdv);
-        fprintf(fp, "%d\t%.2lf\t%.3lf\t%.5lf\t", ea.event_idx, event_mean, event_stdv, event_duration);
-        fprintf(fp, "%s\t%.2lf\t%.2lf\t%.2lf", ea.model_kmer.c_str(),
-                                               model_mean,
-                                               model_stdv,
-                                               standard_level);
+    std::string read_id;
+    if (not opt::print_read_names) {
+        append_uint(read_id, alignments.front().read_idx);
+    } else {
+        read_id = sr.read_name;
+    }
+
+    // every event of the alignment is on the same contig
+    const std::string& contig = alignments.front().get_ref_name();
+    std::string ref_kmer;
+    std::string model_kmer;
+
+    for(size_t i = 0; i < alignments.size(); ++i) {
+
+        const EventAlignment& ea = alignments[i];
+        EventAlignmentValues values = get_event_alignment_values(sr, pore_model, ea, opt::scale_events);
+        ea.get_ref_kmer(ref_kmer);
+        ea.get_model_kmer(model_kmer);
+        append_event_alignment_tsv_row(out, contig, ea.ref_position, ref_kmer, read_id,
+                                       ea.strand_idx, ea.event_idx, model_kmer, values);
 
         if(opt::write_signal_index) {
             std::pair<size_t, size_t> signal_idx = sr.get_event_sample_idx(ea.strand_idx, ea.event_idx);
-            fprintf(fp, "\t%zu\t%zu", signal_idx.first, signal_idx.second);
+            out.push_back('\t');
+            append_uint(out, signal_idx.first);
+            out.push_back('\t');
+            append_uint(out, signal_idx.second);
         }
 
         if(opt::write_samples) {
@@ -477,10 +600,260 @@ void emit_event_alignment_tsv(FILE* fp,
             // remove training comma
             std::string sample_str = sample_ss.str();
             sample_str.resize(sample_str.size() - 1);
-            fprintf(fp, "\t%s", sample_str.c_str());
+            out.push_back('\t');
+            out.append(sample_str);
+        }
+        out.push_back('\n');
+    }
+}
+
+void format_event_alignment_binary(EventalignBinaryBlock& block,
+                                   const SquiggleRead& sr,
+                                   uint32_t strand_idx,
+                                   const EventAlignmentParameters& params,
+                                   const std::vector<EventAlignment>& alignments)
+{
+    assert(params.alphabet == "");
+    const PoreModel* pore_model = params.get_model();
+    const Alphabet* alphabet = pore_model->pmalphabet;
+
+    block.read_idx = alignments.empty() ? params.read_idx : alignments.front().read_idx;
+    block.strand_idx = strand_idx;
+    block.k = pore_model->k;
+    block.read_name = sr.read_name;
+    block.contig = alignments.empty() ? "" : alignments.front().get_ref_name();
+    block.alphabet_name = alphabet->get_name();
+    block.records.resize(alignments.size());
+
+    // the model values are derived from these when the file is read
+    block.model_id = pore_model->handle;
+    block.shift = sr.scalings[strand_idx].shift;
+    block.scale = sr.scalings[strand_idx].scale;
+    block.var = sr.scalings[strand_idx].var;
+
+    for(size_t i = 0; i < alignments.size(); ++i) {
+        const EventAlignment& ea = alignments[i];
+
+        EventalignBinaryRecord& record = block.records[i];
+        record.ref_position = ea.ref_position;
+        record.event_idx = ea.event_idx;
+        if(ea.alphabet == alphabet && ea.k == block.k) {
+            record.ref_kmer = ea.ref_kmer_rank;
+        } else {
+            record.ref_kmer = block.encode_kmer(alphabet, ea.get_ref_kmer());
+        }
+
+        // background events have no model level, which is marked by storing the kmer as a string
+        if(ea.hmm_state == 'B') {
+            record.model_kmer = block.encode_string_kmer(ea.get_model_kmer());
+        } else if(ea.alphabet == alphabet && ea.k == block.k) {
+            record.model_kmer = ea.model_kmer_rank;
+        } else {
+            record.model_kmer = block.encode_kmer(alphabet, ea.get_model_kmer());
+        }
+
+        record.event_level_mean = opt::scale_events ? sr.get_fully_scaled_level(ea.event_idx, ea.strand_idx)
+                                                    : sr.get_unscaled_level(ea.event_idx, ea.strand_idx);
+        record.event_stdv = sr.get_stdv(ea.event_idx, ea.strand_idx);
+        record.event_length = sr.get_duration(ea.event_idx, ea.strand_idx);
+
+        if(opt::write_signal_index) {
+            std::pair<size_t, size_t> signal_idx = sr.get_event_sample_idx(ea.strand_idx, ea.event_idx);
+            block.signal_idx.push_back(signal_idx.first);
+            block.signal_idx.push_back(signal_idx.second);
+        }
+    }
+}
+
+void format_collapsed_event_alignment_tsv(std::string& out,
+                                          const SquiggleRead& sr,
+                                          uint32_t strand_idx,
+                                          const EventAlignmentParameters& params,
+                                          const std::vector<EventAlignment>& alignments)
+{
+    assert(params.alphabet == "");
+    const PoreModel* pore_model = params.get_model();
+    if(alignments.empty()) {
+        return;
+    }
+
+    std::string read_id;
+    if (not opt::print_read_names) {
+        append_uint(read_id, alignments.front().read_idx);
+    } else {
+        read_id = sr.read_name;
+    }
+
+    const std::string& contig = alignments.front().get_ref_name();
+    std::string ref_kmer;
+    std::string model_kmer;
+
+    size_t i = 0;
+    while(i < alignments.size()) {
+        const EventAlignment& first = alignments[i];
+        EventAlignmentValues values = get_event_alignment_values(sr, pore_model, first, opt::scale_events);
+
+        // merge the run of events in the same state, weighting each event by its duration
+        double sum_length = 0.0;
+        double sum_level = 0.0;
+        double sum_level_sq = 0.0;
+        size_t start_idx = -1;
+        size_t end_idx = 0;
+        size_t j = i;
+        for(; j < alignments.size(); ++j) {
+            const EventAlignment& ea = alignments[j];
+            bool same_model_kmer = ea.hmm_state == 'B' ? first.hmm_state == 'B' :
+                                   first.hmm_state != 'B' && ea.model_kmer_rank == first.model_kmer_rank;
+            if(ea.ref_position != first.ref_position || !same_model_kmer) {
+                break;
+            }
+
+            EventAlignmentValues ev = j == i ? values : get_event_alignment_values(sr, pore_model, ea, opt::scale_events);
+            sum_length += ev.event_length;
+            sum_level += ev.event_length * ev.event_level_mean;
+            sum_level_sq += ev.event_length * (ev.event_stdv * ev.event_stdv + ev.event_level_mean * ev.event_level_mean);
+
+            if(opt::write_signal_index) {
+                std::pair<size_t, size_t> signal_idx = sr.get_event_sample_idx(ea.strand_idx, ea.event_idx);
+                start_idx = std::min(start_idx, signal_idx.first);
+                end_idx = std::max(end_idx, signal_idx.second);
+            }
+        }
+
+        if(sum_length > 0.0) {
+            double mean = sum_level / sum_length;
+            values.event_level_mean = mean;
+            values.event_stdv = sqrt(std::max(sum_level_sq / sum_length - mean * mean, 0.0));
+        }
+        values.event_length = sum_length;
+        values.standardized_level = (values.event_level_mean - values.model_mean) / (sqrt(sr.scalings[first.strand_idx].var) * values.model_stdv);
+
+        first.get_ref_kmer(ref_kmer);
+        first.get_model_kmer(model_kmer);
+        append_event_alignment_tsv_row(out, contig, first.ref_position, ref_kmer, read_id,
+                                       first.strand_idx, first.event_idx, model_kmer, values);
+
+        if(opt::write_signal_index) {
+            out.push_back('\t');
+            append_uint(out, start_idx);
+            out.push_back('\t');
+            append_uint(out, end_idx);
+        }
+
+        out.push_back('\t');
+        append_uint(out, j - i);
+        out.push_back('\n');
+        i = j;
+    }
+}
+
+// add the events of a read strand to the statistics of the positions they are aligned to
+void add_event_alignment_to_pileup(std::map<int, EventalignPileupColumn>& columns,
+                                   const SquiggleRead& sr,
+                                   uint32_t strand_idx,
+                                   const EventAlignmentParameters& params,
+                                   const std::vector<EventAlignment>& alignments)
+{
+    assert(params.alphabet == "");
+    const PoreModel* pore_model = params.get_model();
+
+    int prev_ref_position = -1;
+    EventalignPileupColumn* column = NULL;
+    for(const EventAlignment& ea : alignments) {
+
+        // background events have no model level to be standardized against
+        if(ea.hmm_state == 'B') {
+            continue;
+        }
+
+        if(column == NULL || ea.ref_position != prev_ref_position) {
+            column = &columns[ea.ref_position];
+            if(column->num_reads == 0) {
+                ea.get_ref_kmer(column->ref_kmer);
+            }
+
+            // the events of a read at a position are consecutive
+            column->num_reads += 1;
+            prev_ref_position = ea.ref_position;
+        }
+
+        EventAlignmentValues values = get_event_alignment_values(sr, pore_model, ea, opt::scale_events);
+        column->num_events += 1;
+        column->sum_level += values.event_level_mean;
+        column->sum_level_sq += values.event_level_mean * values.event_level_mean;
+        column->sum_duration += values.event_length;
+        column->sum_standardized_level += values.standardized_level;
+    }
+}
+
+//
+void EventalignPileup::add(const std::string& contig,
+                           int read_start,
+                           const std::map<int, EventalignPileupColumn>& columns,
+                           std::string& out)
+{
+    // the reads of the previous contig are done
+    if(contig != m_contig) {
+        flush_before(INT_MAX, out);
+        m_contig = contig;
+    }
+    flush_before(read_start, out);
+
+    for(const auto& column_iter : columns) {
+        const EventalignPileupColumn& in = column_iter.second;
+        EventalignPileupColumn& column = m_columns[column_iter.first];
+        if(column.num_reads == 0) {
+            column.ref_kmer = in.ref_kmer;
         }
-        fprintf(fp, "\n");
+        column.num_reads += in.num_reads;
+        column.num_events += in.num_events;
+        column.sum_level += in.sum_level;
+        column.sum_level_sq += in.sum_level_sq;
+        column.sum_duration += in.sum_duration;
+        column.sum_standardized_level += in.sum_standardized_level;
+    }
+}
+
+//
+void EventalignPileup::flush_before(int position, std::string& out)
+{
+    auto end_iter = m_columns.lower_bound(position);
+    for(auto iter = m_columns.begin(); iter != end_iter; ++iter) {
+        const EventalignPileupColumn& column = iter->second;
+        double mean = column.sum_level / column.num_events;
+        double var = std::max(column.sum_level_sq / column.num_events - mean * mean, 0.0);
+
+        out.append(m_contig);
+        out.push_back('\t');
+        append_int(out, iter->first);
+        out.push_back('\t');
+        out.append(column.ref_kmer);
+        out.push_back('\t');
+        append_int(out, column.num_reads);
+        out.push_back('\t');
+        append_int(out, column.num_events);
+        out.push_back('\t');
+        append_fixed(out, mean, 2);
+        out.push_back('\t');
+        append_fixed(out, sqrt(var), 3);
+        out.push_back('\t');
+        append_fixed(out, column.sum_duration / column.num_reads, 5);
+        out.push_back('\t');
+        append_fixed(out, column.sum_standardized_level / column.num_events, 2);
+        out.push_back('\n');
     }
+    m_columns.erase(m_columns.begin(), end_iter);
+}
+
+void emit_event_alignment_tsv(FILE* fp,
+                              const SquiggleRead& sr,
+                              uint32_t strand_idx,
+                              const EventAlignmentParameters& params,
+                              const std::vector<EventAlignment>& alignments)
+{
+    std::string out;
+    format_event_alignment_tsv(out, sr, strand_idx, params, alignments);
+    fwrite(out.data(), 1, out.size(), fp);
 }
 
 EventalignSummary summarize_alignment(const SquiggleRead& sr,
@@ -492,7 +865,6 @@ EventalignSummary summarize_alignment(const SquiggleRead& sr,
 
     assert(params.alphabet == "");
     const PoreModel* pore_model = params.get_model();
-    uint32_t k = pore_model->k;
 
     size_t prev_ref_pos = std::string::npos;
 
@@ -519,7 +891,7 @@ EventalignSummary summarize_alignment(const SquiggleRead& sr,
         summary.sum_duration += sr.get_duration(ea.event_idx, ea.strand_idx);
 
         if(ea.hmm_state == 'M') {
-            uint32_t rank = pore_model->pmalphabet->kmer_rank(ea.model_kmer.c_str(), k);
+            uint32_t rank = ea.get_model_kmer_rank(pore_model->pmalphabet);
             double z = z_score(sr, *pore_model, rank, ea.event_idx, ea.strand_idx);
             summary.sum_z_score += z;
         }
@@ -537,7 +909,7 @@ EventalignSummary summarize_alignment(const SquiggleRead& sr,
 
 // Realign the read in event space
 void realign_read(const ReadDB& read_db,
-                  const faidx_t* fai,
+                  const ReferenceDB& ref_db,
                   const EventalignWriter& writer,
                   const bam_hdr_t* hdr,
                   const bam1_t* record,
@@ -555,7 +927,9 @@ void realign_read(const ReadDB& read_db,
     } else {
         sr_flag = 0;
     }
-    SquiggleRead sr(read_name, read_db, sr_flag);
+    // only the signal for the bases aligned to the region is needed
+    SquiggleReadRange read_range = get_read_range_for_ref_region(record, region_start, region_end);
+    SquiggleRead sr(read_name, read_db, sr_flag, read_range);
 
     if(opt::verbose > 1) {
         fprintf(stderr, "Realigning %s [%zu %zu]\n",
@@ -571,7 +945,7 @@ void realign_read(const ReadDB& read_db,
 
         EventAlignmentParameters params;
         params.sr = &sr;
-        params.fai = fai;
+        params.ref_db = &ref_db;
         params.hdr = hdr;
         params.record = record;
         params.strand_idx = strand_idx;
@@ -579,6 +953,7 @@ void realign_read(const ReadDB& read_db,
         params.read_idx = read_idx;
         params.region_start = region_start;
         params.region_end = region_end;
+        params.banded_align = opt::banded_align;
 
         std::vector<EventAlignment> alignment = align_read_to_ref(params);
 
@@ -587,33 +962,193 @@ void realign_read(const ReadDB& read_db,
             summary = summarize_alignment(sr, strand_idx, params, alignment);
         }
 
-        // write to disk
-        #pragma omp critical
-        {
-            if(opt::output_sam) {
-                emit_event_alignment_sam(writer.sam_fp, sr, hdr, record, alignment);
+        // the output is written once the reads before this one are done
+        if(opt::output_format == "sam") {
+            bam1_t* event_record = make_event_alignment_sam_record(sr, record, alignment);
+            if(event_record != NULL) {
+                htsFile* sam_fp = writer.sam_fp;
+                writer.output->add(read_idx, [sam_fp, hdr, event_record]() {
+                    write_event_alignment_sam_record(sam_fp, hdr, event_record);
+                });
+            }
+        } else if(opt::pileup) {
+            // the columns of this read are merged in bam order, which writes out the positions
+            // before the start of the read as no later read can be aligned to them
+            std::shared_ptr<std::map<int, EventalignPileupColumn>> columns = std::make_shared<std::map<int, EventalignPileupColumn>>();
+            add_event_alignment_to_pileup(*columns, sr, strand_idx, params, alignment);
+            if(!columns->empty()) {
+                EventalignPileup* pileup = writer.pileup;
+                FILE* tsv_fp = writer.tsv_fp;
+                std::string contig = alignment.front().get_ref_name();
+                int read_start = record->core.pos;
+                writer.output->add(read_idx, [pileup, tsv_fp, contig, read_start, columns]() {
+                    std::string out;
+                    pileup->add(contig, read_start, *columns, out);
+                    fwrite(out.data(), 1, out.size(), tsv_fp);
+                });
+            }
+        } else if(opt::output_format == "binary") {
+            EventalignBinaryBlock block;
+            format_event_alignment_binary(block, sr, strand_idx, params, alignment);
+            if(!block.records.empty()) {
+                std::shared_ptr<std::string> data = std::make_shared<std::string>();
+                EventalignBinaryWriter::serialize(block, *data);
+
+                // the index entry of the block is added when it is written
+                EventalignBinaryWriter* binary_writer = writer.binary_writer;
+                const PoreModel* pore_model = params.get_model();
+                std::string contig = block.contig;
+                int32_t ref_start, ref_end;
+                block.get_reference_span(ref_start, ref_end);
+                writer.output->add(read_idx, [binary_writer, pore_model, data, read_idx, contig, ref_start, ref_end]() {
+                    binary_writer->write(*data, pore_model, read_idx, contig, ref_start, ref_end);
+                });
+            }
+        } else {
+            // formatted on this thread, only the finished buffer is handed to the writer
+            std::string out;
+            if(opt::collapse) {
+                format_collapsed_event_alignment_tsv(out, sr, strand_idx, params, alignment);
             } else {
-                emit_event_alignment_tsv(writer.tsv_fp, sr, strand_idx, params, alignment);
+                format_event_alignment_tsv(out, sr, strand_idx, params, alignment);
             }
 
-            if(writer.summary_fp != NULL && summary.num_events > 0) {
-                assert(params.alphabet == "");
-                const PoreModel* pore_model = params.get_model();
-                SquiggleScalings& scalings = sr.scalings[strand_idx];
-                fprintf(writer.summary_fp, "%zu\t%s\t%s\t", read_idx, read_name.c_str(), sr.fast5_path.c_str());
-                fprintf(writer.summary_fp, "%s\t%s\t", pore_model->name.c_str(), strand_idx == 0 ? "template" : "complement");
-                fprintf(writer.summary_fp, "%d\t%d\t%d\t%d\t", summary.num_events, summary.num_steps, summary.num_skips, summary.num_stays);
-                fprintf(writer.summary_fp, "%.2lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\n", summary.sum_duration, scalings.shift, scalings.scale, scalings.drift, scalings.var);
+            if(writer.indexed_tsv != NULL && !alignment.empty()) {
+                std::shared_ptr<std::string> data = std::make_shared<std::string>(std::move(out));
+                IndexedOutputWriter* indexed_tsv = writer.indexed_tsv;
+                std::string contig = alignment.front().get_ref_name();
+                int ref_start = alignment.front().ref_position;
+                int ref_end = ref_start;
+                for(const EventAlignment& ea : alignment) {
+                    ref_start = std::min(ref_start, ea.ref_position);
+                    ref_end = std::max(ref_end, ea.ref_position);
+                }
+                writer.output->add(read_idx, [indexed_tsv, data, contig, ref_start, ref_end]() {
+                    indexed_tsv->write(*data, contig, ref_start, ref_end);
+                });
+            } else if(writer.indexed_tsv == NULL) {
+                writer.output->add(read_idx, writer.tsv_fp, std::move(out));
+            }
+        }
+
+        if(writer.summary_fp != NULL && summary.num_events > 0) {
+            assert(params.alphabet == "");
+            const PoreModel* pore_model = params.get_model();
+            SquiggleScalings& scalings = sr.scalings[strand_idx];
+            ReadOutputStream out;
+            fprintf(out.fp(), "%zu\t%s\t%s\t", read_idx, read_name.c_str(), sr.fast5_path.c_str());
+            fprintf(out.fp(), "%s\t%s\t", pore_model->name.c_str(), strand_idx == 0 ? "template" : "complement");
+            fprintf(out.fp(), "%d\t%d\t%d\t%d\t", summary.num_events, summary.num_steps, summary.num_skips, summary.num_stays);
+            fprintf(out.fp(), "%.2lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\n", summary.sum_duration, scalings.shift, scalings.scale, scalings.drift, scalings.var);
+            writer.output->add(read_idx, writer.summary_fp, out.release());
+        }
+    }
+}
+
+// Align the events of a bam segment to its reference in one pass of the profile HMM, within a band that
+// follows the events the basecalled read maps each reference kmer to. Returns false if the segment
+// could not be aligned this way so it can be aligned in chunks instead
+static bool align_segment_banded(const EventAlignmentParameters& params,
+                                 const AlignedSegment& aligned_pairs,
+                                 const std::string& ref_seq,
+                                 const std::string& rc_ref_seq,
+                                 int ref_offset,
+                                 uint32_t ref_id,
+                                 int first_event,
+                                 int last_event,
+                                 std::vector<EventAlignment>& alignment_output)
+{
+    const PoreModel* pore_model = params.get_model();
+    const uint32_t k = params.sr->get_model_k(params.strand_idx);
+    bool do_base_rc = bam_is_rev(params.record);
+    bool rc_flags[2] = { do_base_rc, !do_base_rc }; // indexed by strand
+
+    int start_ref = aligned_pairs.front().ref_pos;
+    int s = start_ref - ref_offset;
+    int l = aligned_pairs.back().ref_pos - start_ref + 1;
+
+    HMMInputSequence hmm_sequence(ref_seq.substr(s, l), rc_ref_seq.substr(ref_seq.length() - s - l, l), pore_model->pmalphabet);
+    if(hmm_sequence.length() < 2 * k || abs(first_event - last_event) < 2) {
+        return false;
+    }
+    hmm_sequence.precompute_kmer_ranks(k);
+
+    HMMInputData input;
+    input.read = params.sr;
+    input.pore_model = pore_model;
+    input.event_start_idx = first_event;
+    input.event_stop_idx = last_event;
+    input.strand = params.strand_idx;
+    input.event_stride = first_event < last_event ? 1 : -1;
+    input.rc = rc_flags[params.strand_idx];
+
+    // the seed is the event the basecaller gave the read kmer aligned to each reference
+    // kmer, or the last aligned read kmer before it when it is deleted from the read
+    int n_kmers = hmm_sequence.length() - k + 1;
+    int n_events = abs(last_event - first_event) + 1;
+    std::vector<int> kmer_seed_rows(n_kmers, 0);
+    size_t pair_idx = 0;
+    int seed_read_kidx = -1;
+    int seed_row = 0;
+    for(int ki = 1; ki < n_kmers; ++ki) {
+        while(pair_idx + 1 < aligned_pairs.size() && aligned_pairs[pair_idx + 1].ref_pos <= start_ref + ki) {
+            pair_idx += 1;
+        }
+
+        int read_kidx = aligned_pairs[pair_idx].read_pos;
+        if(do_base_rc) {
+            read_kidx = params.sr->flip_k_strand(read_kidx, k);
+        }
+
+        if(read_kidx != seed_read_kidx) {
+            seed_read_kidx = read_kidx;
+            int event_idx = params.sr->get_closest_event_to(read_kidx, params.strand_idx);
+            if(event_idx != -1) {
+                int row = (event_idx - first_event) * input.event_stride;
+                seed_row = std::min(std::max(row, seed_row), n_events - 1);
             }
         }
+        kmer_seed_rows[ki] = seed_row;
+    }
+
+    std::vector<HMMAlignmentState> event_alignment = profile_hmm_align_banded(hmm_sequence, input, kmer_seed_rows);
+    if(event_alignment.empty()) {
+        return false;
+    }
+
+    for(size_t i = 0; i < event_alignment.size(); ++i) {
+        const HMMAlignmentState& as = event_alignment[i];
+        if(as.state == 'K') {
+            continue;
+        }
+
+        EventAlignment ea;
+        ea.ref_id = ref_id;
+        ea.ref_position = start_ref + as.kmer_idx;
+        ea.alphabet = pore_model->pmalphabet;
+        ea.k = k;
+        ea.ref_kmer_rank = hmm_sequence.get_kmer_rank(as.kmer_idx, k, false);
+        ea.read_idx = params.read_idx;
+        ea.strand_idx = params.strand_idx;
+        ea.event_idx = as.event_idx;
+        ea.rc = input.rc;
+        ea.hmm_state = as.state;
+        ea.model_kmer_rank = ea.hmm_state != 'B' ? hmm_sequence.get_kmer_rank(as.kmer_idx, k, input.rc) : 0;
+        alignment_output.push_back(ea);
     }
+
+#if EVENTALIGN_TRAIN
+    params.sr->parameters[params.strand_idx].add_training_from_alignment(hmm_sequence, input, event_alignment);
+    global_training[params.strand_idx].add_training_from_alignment(hmm_sequence, input, event_alignment);
+#endif
+    return true;
 }
 
 std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& params)
 {
     // Sanity check input parameters
     assert(params.sr != NULL);
-    assert(params.fai != NULL);
+    assert(params.ref_db != NULL);
     assert(params.hdr != NULL);
     assert(params.record != NULL);
     assert(params.strand_idx < NUM_STRANDS);
@@ -626,11 +1161,9 @@ std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& pa
     int fetched_len = 0;
     int ref_offset = params.record->core.pos;
     std::string ref_name(params.hdr->target_name[params.record->core.tid]);
-    std::string ref_seq = get_reference_region_ts(params.fai, ref_name.c_str(), ref_offset,
-                                                  bam_endpos(params.record), &fetched_len);
-
-    // convert to upper case
-    std::transform(ref_seq.begin(), ref_seq.end(), ref_seq.begin(), ::toupper);
+    uint32_t ref_id = intern_ref_name(ref_name);
+    std::string ref_seq = params.ref_db->get_subsequence(ref_name, ref_offset,
+                                                         bam_endpos(params.record), &fetched_len);
 
     // k from read pore model
     const uint32_t k = params.sr->get_model_k(params.strand_idx);
@@ -684,6 +1217,14 @@ std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& pa
         int last_event = params.sr->get_closest_event_to(read_kidx_end, params.strand_idx);
         bool forward = first_event < last_event;
 
+        // each event of the segment is output at most once
+        alignment_output.reserve(alignment_output.size() + abs(last_event - first_event) + 1);
+
+        if(params.banded_align &&
+           align_segment_banded(params, aligned_pairs, ref_seq, rc_ref_seq, ref_offset, ref_id, first_event, last_event, alignment_output)) {
+            continue;
+        }
+
         int curr_start_event = first_event;
         int curr_start_ref = aligned_pairs.front().ref_pos;
         int curr_pair_idx = 0;
@@ -715,6 +1256,7 @@ std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& pa
             if(hmm_sequence.length() < 2 * k) {
                 break;
             }
+            hmm_sequence.precompute_kmer_ranks(k);
 
             // Set up HMM input
             HMMInputData input;
@@ -775,9 +1317,13 @@ std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& pa
                     EventAlignment ea;
 
                     // ref
-                    ea.ref_name = ref_name;
+                    ea.ref_id = ref_id;
                     ea.ref_position = curr_start_ref + as.kmer_idx;
-                    ea.ref_kmer = ref_seq.substr(ea.ref_position - ref_offset, k);
+                    ea.alphabet = pore_model->pmalphabet;
+                    ea.k = k;
+
+                    // the forward strand of hmm_sequence starts at curr_start_ref
+                    ea.ref_kmer_rank = hmm_sequence.get_kmer_rank(as.kmer_idx, k, false);
 
                     // event
                     ea.read_idx = params.read_idx;
@@ -788,11 +1334,7 @@ std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& pa
                     // hmm
                     ea.hmm_state = as.state;
 
-                    if(ea.hmm_state != 'B') {
-                        ea.model_kmer = hmm_sequence.get_kmer(as.kmer_idx, k, input.rc);
-                    } else {
-                        ea.model_kmer = std::string(k, 'N');
-                    }
+                    ea.model_kmer_rank = ea.hmm_state != 'B' ? hmm_sequence.get_kmer_rank(as.kmer_idx, k, input.rc) : 0;
 
                     // store
                     alignment_output.push_back(ea);
@@ -846,8 +1388,16 @@ void parse_eventalign_options(int argc, char** argv)
             case OPT_MODELS_FOFN: arg >> opt::models_fofn; break;
             case OPT_SCALE_EVENTS: opt::scale_events = true; break;
             case OPT_SUMMARY: arg >> opt::summary_file; break;
-            case OPT_SAM: opt::output_sam = true; break;
+            case OPT_SAM: opt::output_format = "sam"; break;
+            case OPT_FORMAT: arg >> opt::output_format; break;
+            case OPT_INDEXED_OUTPUT: arg >> opt::indexed_output_file; break;
+            case OPT_COLLAPSE: opt::collapse = true; break;
+            case OPT_PILEUP: opt::pileup = true; break;
+            case OPT_BANDED_ALIGN: opt::banded_align = true; break;
             case OPT_PROGRESS: opt::progress = true; break;
+            case OPT_SIGNAL_CACHE: opt::signal_cache = true; break;
+            case OPT_FAST5_CACHE_SIZE: arg >> opt::fast5_cache_size; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
             case OPT_HELP:
                 std::cout << EVENTALIGN_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -871,6 +1421,46 @@ void parse_eventalign_options(int argc, char** argv)
         die = true;
     }
 
+    if(opt::fast5_cache_size < 0) {
+        std::cerr << SUBPROGRAM ": invalid fast5 cache size: " << opt::fast5_cache_size << "\n";
+        die = true;
+    }
+
+    if(opt::output_format != "tsv" && opt::output_format != "sam" && opt::output_format != "binary") {
+        std::cerr << SUBPROGRAM ": unknown output format: " << opt::output_format << "\n";
+        die = true;
+    }
+
+    if(opt::output_format == "binary" && opt::write_samples) {
+        std::cerr << SUBPROGRAM ": --samples cannot be written in the binary format, use --signal-index for the sample range\n";
+        die = true;
+    }
+
+    if(!opt::indexed_output_file.empty() && opt::output_format != "tsv") {
+        std::cerr << SUBPROGRAM ": --indexed-output can only be used with the tsv format\n";
+        die = true;
+    }
+
+    if((opt::collapse || opt::pileup) && opt::output_format != "tsv") {
+        std::cerr << SUBPROGRAM ": --collapse and --pileup can only be used with the tsv format\n";
+        die = true;
+    }
+
+    if(opt::collapse && opt::pileup) {
+        std::cerr << SUBPROGRAM ": --collapse and --pileup cannot be used together\n";
+        die = true;
+    }
+
+    if(opt::collapse && opt::write_samples) {
+        std::cerr << SUBPROGRAM ": --samples cannot be written with --collapse\n";
+        die = true;
+    }
+
+    if(opt::pileup && (opt::write_samples || opt::write_signal_index || !opt::indexed_output_file.empty())) {
+        std::cerr << SUBPROGRAM ": --samples, --signal-index and --indexed-output cannot be used with --pileup\n";
+        die = true;
+    }
+
     if(opt::reads_file.empty()) {
         std::cerr << SUBPROGRAM ": a --reads file must be provided\n";
         die = true;
@@ -901,13 +1491,20 @@ void parse_eventalign_options(int argc, char** argv)
 int eventalign_main(int argc, char** argv)
 {
     parse_eventalign_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
     omp_set_num_threads(opt::num_threads);
+    fast5_cache_set_size(opt::fast5_cache_size);
 
     ReadDB read_db;
     read_db.load(opt::reads_file);
+    if(opt::signal_cache) {
+        read_db.open_signal_cache();
+    }
 
-    // load reference fai file
-    faidx_t *fai = fai_load(opt::genome_file.c_str());
+    // load the reference genome into memory
+    ReferenceDB ref_db;
+    ref_db.load(opt::genome_file);
 
 #ifndef H5_HAVE_THREADSAFE
     if(opt::num_threads > 1) {
@@ -918,7 +1515,13 @@ int eventalign_main(int argc, char** argv)
 #endif
 
     // Initialize output
-    EventalignWriter writer = { NULL, NULL, NULL };
+    ReorderBuffer output(2 * opt::batch_size);
+    EventalignWriter writer = { NULL, NULL, NULL, &output, NULL, NULL, NULL };
+
+    EventalignPileup pileup;
+    if(opt::pileup) {
+        writer.pileup = &pileup;
+    }
 
     if(!opt::summary_file.empty()) {
         writer.summary_fp = fopen(opt::summary_file.c_str(), "w");
@@ -930,30 +1533,64 @@ int eventalign_main(int argc, char** argv)
     // the BamProcessor framework calls the input function with the
     // bam record, read index, etc passed as parameters
     // bind the other parameters the worker function needs here
-    auto f = std::bind(realign_read, std::ref(read_db), std::ref(fai), std::ref(writer), _1, _2, _3, _4, _5);
+    auto f = std::bind(realign_read, std::ref(read_db), std::ref(ref_db), std::ref(writer), _1, _2, _3, _4, _5);
     BamProcessor processor(opt::bam_file, opt::region, opt::num_threads);
+    processor.set_fast5_locality(&read_db);
+    processor.set_reorder_buffer(&output);
     processor.set_min_mapping_quality(opt::min_mapping_quality);
 
     // Copy the bam header to std
-    if(opt::output_sam) {
-        writer.sam_fp = hts_open("-", "w");
+    if(opt::output_format == "sam") {
+        writer.sam_fp = open_bam_file("-", "w");
         emit_sam_header(writer.sam_fp, processor.get_bam_header());
+    } else if(opt::output_format == "binary") {
+        uint32_t flags = (opt::write_signal_index ? EVENTALIGN_BINARY_FLAG_SIGNAL_INDEX : 0) |
+                         (opt::scale_events ? EVENTALIGN_BINARY_FLAG_SCALE_EVENTS : 0);
+        writer.binary_writer = new EventalignBinaryWriter(stdout, flags);
+    } else if(!opt::indexed_output_file.empty()) {
+        writer.indexed_tsv = new IndexedOutputWriter(opt::indexed_output_file);
+        ReadOutputStream header;
+        emit_tsv_header(header.fp(), opt::print_read_names, opt::write_signal_index, opt::write_samples, opt::collapse);
+        writer.indexed_tsv->write_header(header.release());
+    } else if(opt::pileup) {
+        writer.tsv_fp = stdout;
+        emit_pileup_tsv_header(writer.tsv_fp);
     } else {
         writer.tsv_fp = stdout;
-        emit_tsv_header(writer.tsv_fp);
+        emit_tsv_header(writer.tsv_fp, opt::print_read_names, opt::write_signal_index, opt::write_samples, opt::collapse);
     }
 
     // run
     processor.parallel_run(f);
 
+    if(opt::verbose > 0) {
+        fast5_cache_print_stats();
+        processor.print_stats();
+    }
+
     if(writer.sam_fp != NULL) {
         hts_close(writer.sam_fp);
     }
 
+    if(writer.binary_writer != NULL) {
+        writer.binary_writer->finish();
+        delete writer.binary_writer;
+    }
+
+    if(writer.pileup != NULL) {
+        std::string out;
+        writer.pileup->flush(out);
+        fwrite(out.data(), 1, out.size(), writer.tsv_fp);
+    }
+
+    if(writer.indexed_tsv != NULL) {
+        writer.indexed_tsv->close();
+        delete writer.indexed_tsv;
+    }
+
     if(writer.summary_fp != NULL) {
         fclose(writer.summary_fp);
     }
 
-    fai_destroy(fai);
     return EXIT_SUCCESS;
 }
@@ -9,10 +9,14 @@
 #ifndef NANOPOLISH_EVENTALIGN_H
 #define NANOPOLISH_EVENTALIGN_H
 
-#include "htslib/faidx.h"
+#include <limits.h>
+#include <map>
 #include "htslib/sam.h"
 #include "nanopolish_alphabet.h"
 #include "nanopolish_common.h"
+#include "nanopolish_reference_db.h"
+
+struct EventalignBinaryBlock;
 
 //
 // Structs
@@ -22,7 +26,7 @@ struct EventAlignmentParameters
     EventAlignmentParameters()
     {
         sr = NULL;
-        fai = NULL;
+        ref_db = NULL;
         hdr = NULL;
         record = NULL;
         strand_idx = NUM_STRANDS;
@@ -31,6 +35,7 @@ struct EventAlignmentParameters
         read_idx = -1;
         region_start = -1;
         region_end = -1;
+        banded_align = false;
     }
 
     // returns the pore model that should be used, based on the alphabet
@@ -38,7 +43,7 @@ struct EventAlignmentParameters
 
     // Mandatory
     SquiggleRead* sr;
-    const faidx_t* fai;
+    const ReferenceDB* ref_db;
     const bam_hdr_t* hdr;
     const bam1_t* record;
     size_t strand_idx;
@@ -48,29 +53,184 @@ struct EventAlignmentParameters
     int read_idx;
     int region_start;
     int region_end;
+
+    // align each segment in one pass of the banded HMM instead of in chunks
+    bool banded_align;
 };
 
+// Store the name once and return the id to use for it in EventAlignment::ref_id
+uint32_t intern_ref_name(const std::string& name);
+
+// The name for an id from intern_ref_name
+const std::string& get_interned_ref_name(uint32_t ref_id);
+
+// The alignment of one event to a reference kmer. The kmers are stored as
+// ranks in alphabet so aligning a read does not allocate a string per event,
+// use the accessors to get them as strings for output
 struct EventAlignment
 {
+    // event data
+    size_t read_idx;
+
+    // the alphabet of the kmer ranks
+    const Alphabet* alphabet;
+
     // ref data
-    std::string ref_name;
-    std::string ref_kmer;
     int ref_position;
+    uint32_t ref_id;
+    uint32_t ref_kmer_rank;
+
+    // hmm data, the rank is not set for 'B' states
+    uint32_t model_kmer_rank;
 
     // event data
-    size_t read_idx;
-    int strand_idx;
     int event_idx;
+    uint8_t strand_idx;
+    uint8_t k;
     bool rc;
-
-    // hmm data
-    std::string model_kmer;
     char hmm_state;
+
+    //
+    const std::string& get_ref_name() const { return get_interned_ref_name(ref_id); }
+
+    //
+    void get_ref_kmer(std::string& kmer) const
+    {
+        kmer.resize(k);
+        alphabet->unrank_kmer(ref_kmer_rank, kmer);
+    }
+
+    // the model kmer of 'B' states is all N
+    void get_model_kmer(std::string& kmer) const
+    {
+        if(hmm_state == 'B') {
+            kmer.assign(k, 'N');
+        } else {
+            kmer.resize(k);
+            alphabet->unrank_kmer(model_kmer_rank, kmer);
+        }
+    }
+
+    std::string get_ref_kmer() const { std::string kmer; get_ref_kmer(kmer); return kmer; }
+    std::string get_model_kmer() const { std::string kmer; get_model_kmer(kmer); return kmer; }
+
+    // the rank of the model kmer in other_alphabet, which only needs
+    // the string when it is not the alphabet the kmer was ranked in
+    uint32_t get_model_kmer_rank(const Alphabet* other_alphabet) const
+    {
+        return other_alphabet == alphabet ? model_kmer_rank : other_alphabet->kmer_rank(get_model_kmer().c_str(), k);
+    }
+};
+
+// The numbers written for each aligned event
+struct EventAlignmentValues
+{
+    float event_level_mean;
+    float event_stdv;
+    float event_length;
+    float model_mean;
+    float model_stdv;
+    float standardized_level;
+};
+
+// The statistics of the events aligned to a reference position, over all reads
+struct EventalignPileupColumn
+{
+    std::string ref_kmer;
+    int num_reads = 0;
+    int num_events = 0;
+    double sum_level = 0.0;
+    double sum_level_sq = 0.0;
+    double sum_duration = 0.0;
+    double sum_standardized_level = 0.0;
+};
+
+// The --pileup statistics of the positions that reads can still be aligned to.
+// Reads are added in bam order, so once a read starting at some position is added
+// no later read can add to the positions before it, and those are written out
+class EventalignPileup
+{
+    public:
+
+        // add the columns of a read strand aligned to contig from read_start, appending
+        // the rows of the positions that are now complete to out
+        void add(const std::string& contig,
+                 int read_start,
+                 const std::map<int, EventalignPileupColumn>& columns,
+                 std::string& out);
+
+        // append the rows of all remaining positions, after the last read
+        void flush(std::string& out) { flush_before(INT_MAX, out); }
+
+        // the number of positions held
+        size_t size() const { return m_columns.size(); }
+
+    private:
+
+        void flush_before(int position, std::string& out);
+
+        std::string m_contig;
+        std::map<int, EventalignPileupColumn> m_columns;
 };
 
 // Entry point from nanopolish.cpp
 int eventalign_main(int argc, char** argv);
 
+// compute the output values for an aligned event, with the events scaled
+// to the model if scale_events is true or the model scaled to the events otherwise
+EventAlignmentValues get_event_alignment_values(const SquiggleRead& sr,
+                                                const PoreModel* pore_model,
+                                                const EventAlignment& ea,
+                                                bool scale_events);
+
+// append the columns of the tsv output that are always written, without the newline.
+// read_id is the read index, or the read name
+void append_event_alignment_tsv_row(std::string& out,
+                                    const std::string& contig,
+                                    int ref_position,
+                                    const std::string& ref_kmer,
+                                    const std::string& read_id,
+                                    int strand_idx,
+                                    int event_idx,
+                                    const std::string& model_kmer,
+                                    const EventAlignmentValues& values);
+
+// append the alignment as a tab-separated table to out
+void format_event_alignment_tsv(std::string& out,
+                                const SquiggleRead& sr,
+                                uint32_t strand_idx,
+                                const EventAlignmentParameters& params,
+                                const std::vector<EventAlignment>& alignments);
+
+// append the alignment to out with one row for each run of consecutive events aligned to the same
+// reference position and model kmer. The level of the row is the duration weighted mean of the
+// events, the length is their total duration and a last column has the number of events
+void format_collapsed_event_alignment_tsv(std::string& out,
+                                          const SquiggleRead& sr,
+                                          uint32_t strand_idx,
+                                          const EventAlignmentParameters& params,
+                                          const std::vector<EventAlignment>& alignments);
+
+// fill block with the alignment, for the binary output
+void format_event_alignment_binary(EventalignBinaryBlock& block,
+                                   const SquiggleRead& sr,
+                                   uint32_t strand_idx,
+                                   const EventAlignmentParameters& params,
+                                   const std::vector<EventAlignment>& alignments);
+
+// add the events of a read strand to the statistics of the positions they are aligned to
+void add_event_alignment_to_pileup(std::map<int, EventalignPileupColumn>& columns,
+                                   const SquiggleRead& sr,
+                                   uint32_t strand_idx,
+                                   const EventAlignmentParameters& params,
+                                   const std::vector<EventAlignment>& alignments);
+
+// print the header line of the tsv output, collapsed adds the num_events column of --collapse
+void emit_tsv_header(FILE* fp, bool print_read_names, bool write_signal_index, bool write_samples, bool collapsed = false);
+
+// print the header line of the --pileup output
+void emit_pileup_tsv_header(FILE* fp);
+
 // print the alignment as a tab-separated table
 void emit_event_alignment_tsv(FILE* fp,
                               const SquiggleRead& sr,
@@ -81,7 +241,4 @@ void emit_event_alignment_tsv(FILE* fp,
 // The main function to realign a read
 std::vector<EventAlignment> align_read_to_ref(const EventAlignmentParameters& params);
 
-// get the specified reference region, threadsafe
-std::string get_reference_region_ts(const faidx_t* fai, const char* ref_name, int start, int end, int* fetched_len);
-
 #endif
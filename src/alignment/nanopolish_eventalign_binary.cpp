@@ -0,0 +1,469 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_eventalign_binary -- compact binary version of
+// the eventalign output, with fixed-width records for each
+// event grouped into one block per read strand
+//
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "nanopolish_alphabet.h"
+#include "nanopolish_poremodel.h"
+#include "nanopolish_eventalign_binary.h"
+
+// the first bytes of the file, the digits are the format version
+static const char EVENTALIGN_BINARY_MAGIC[8] = { 'N', 'P', 'E', 'V', 'A', '0', '0', '2' };
+
+// the start of each block, each model and of the index that follows the last block
+static const char EVENTALIGN_BINARY_BLOCK_TAG[4] = { 'N', 'P', 'E', 'B' };
+static const char EVENTALIGN_BINARY_MODEL_TAG[4] = { 'N', 'P', 'E', 'M' };
+static const char EVENTALIGN_BINARY_INDEX_MAGIC[8] = { 'N', 'P', 'E', 'V', 'A', 'I', 'D', 'X' };
+
+// the last bytes of the file, after the offset of the index
+static const char EVENTALIGN_BINARY_END_MAGIC[8] = { 'N', 'P', 'E', 'V', 'A', 'E', 'N', 'D' };
+
+// the block has sample ranges after the records
+#define BLOCK_FLAG_SIGNAL_INDEX 1
+
+//
+template<typename T>
+static void append_value(std::string& out, const T& value)
+{
+    out.append((const char*)&value, sizeof(T));
+}
+
+//
+static void append_string(std::string& out, const std::string& str)
+{
+    append_value(out, (uint32_t)str.length());
+    out.append(str);
+}
+
+//
+uint32_t EventalignBinaryBlock::encode_kmer(const Alphabet* alphabet, const std::string& kmer)
+{
+    // only use ranks when every kmer of the alphabet has one below the string flag
+    bool can_rank = kmer.length() == k && alphabet->get_num_strings(k) <= EVENTALIGN_BINARY_STRING_KMER;
+    const uint8_t* rank_table = alphabet->get_rank_table();
+    for(size_t i = 0; can_rank && i < kmer.length(); ++i) {
+        can_rank = alphabet->base(rank_table[(uint8_t)kmer[i]]) == kmer[i];
+    }
+
+    if(can_rank) {
+        return alphabet->kmer_rank(kmer.c_str(), k);
+    }
+    return encode_string_kmer(kmer);
+}
+
+//
+uint32_t EventalignBinaryBlock::encode_string_kmer(const std::string& kmer)
+{
+    // most unrankable kmers in a block are the same (all N), so reuse them
+    auto iter = std::find(strings.begin(), strings.end(), kmer);
+    uint32_t idx = iter - strings.begin();
+    if(iter == strings.end()) {
+        strings.push_back(kmer);
+    }
+    return EVENTALIGN_BINARY_STRING_KMER | idx;
+}
+
+//
+void EventalignBinaryBlock::decode_kmer(const Alphabet* alphabet, uint32_t code, std::string& kmer) const
+{
+    if(code & EVENTALIGN_BINARY_STRING_KMER) {
+        size_t idx = code & ~EVENTALIGN_BINARY_STRING_KMER;
+        if(idx >= strings.size()) {
+            fprintf(stderr, "error: malformed eventalign binary block for read %s\n", read_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        kmer = strings[idx];
+        return;
+    }
+
+    kmer.resize(k);
+    alphabet->unrank_kmer(code, kmer);
+}
+
+//
+void EventalignBinaryBlock::get_reference_span(int32_t& start, int32_t& end) const
+{
+    start = records.empty() ? 0 : records.front().ref_position;
+    end = start;
+    for(const EventalignBinaryRecord& record : records) {
+        start = std::min(start, record.ref_position);
+        end = std::max(end, record.ref_position);
+    }
+}
+
+//
+EventalignBinaryWriter::EventalignBinaryWriter(FILE* fp, uint32_t flags) : m_fp(fp), m_offset(0)
+{
+    write_bytes(EVENTALIGN_BINARY_MAGIC, sizeof(EVENTALIGN_BINARY_MAGIC));
+    uint32_t header[2] = { flags, 0 };
+    write_bytes(header, sizeof(header));
+}
+
+//
+void EventalignBinaryWriter::serialize(const EventalignBinaryBlock& block, std::string& out)
+{
+    bool has_signal_idx = !block.signal_idx.empty();
+    assert(!has_signal_idx || block.signal_idx.size() == 2 * block.records.size());
+
+    std::string body;
+    body.reserve(128 + block.records.size() * (sizeof(EventalignBinaryRecord) + 2 * sizeof(uint64_t)));
+    append_value(body, block.read_idx);
+    append_value(body, block.strand_idx);
+    append_value(body, block.k);
+    append_value(body, (uint32_t)(has_signal_idx ? BLOCK_FLAG_SIGNAL_INDEX : 0));
+    append_value(body, (uint32_t)(3 + block.strings.size()));
+    append_value(body, (uint32_t)block.records.size());
+    append_value(body, block.model_id);
+    append_value(body, block.shift);
+    append_value(body, block.scale);
+    append_value(body, block.var);
+
+    append_string(body, block.read_name);
+    append_string(body, block.contig);
+    append_string(body, block.alphabet_name);
+    for(const std::string& str : block.strings) {
+        append_string(body, str);
+    }
+
+    body.append((const char*)block.records.data(), block.records.size() * sizeof(EventalignBinaryRecord));
+    if(has_signal_idx) {
+        body.append((const char*)block.signal_idx.data(), block.signal_idx.size() * sizeof(uint64_t));
+    }
+
+    out.append(EVENTALIGN_BINARY_BLOCK_TAG, sizeof(EVENTALIGN_BINARY_BLOCK_TAG));
+    append_value(out, (uint32_t)body.size());
+    out.append(body);
+}
+
+//
+void EventalignBinaryWriter::write(const std::string& data,
+                                   const PoreModel* model,
+                                   uint64_t read_idx,
+                                   const std::string& contig,
+                                   int32_t ref_start,
+                                   int32_t ref_end)
+{
+    // the blocks refer to their model by handle
+    assert(model->handle >= 0 && model->level_stdv.size() == model->level_mean.size());
+    uint32_t model_id = model->handle;
+    if(m_model_offsets.find(model_id) == m_model_offsets.end()) {
+        m_model_offsets[model_id] = m_offset;
+
+        std::string body;
+        append_value(body, model_id);
+        append_value(body, (uint32_t)model->level_mean.size());
+        body.append((const char*)model->level_mean.data(), model->level_mean.size() * sizeof(float));
+        body.append((const char*)model->level_stdv.data(), model->level_stdv.size() * sizeof(float));
+
+        std::string chunk(EVENTALIGN_BINARY_MODEL_TAG, sizeof(EVENTALIGN_BINARY_MODEL_TAG));
+        append_value(chunk, (uint32_t)body.size());
+        chunk.append(body);
+        write_bytes(chunk.data(), chunk.size());
+    }
+
+    auto iter = m_contig_ids.find(contig);
+    if(iter == m_contig_ids.end()) {
+        iter = m_contig_ids.insert(std::make_pair(contig, m_contigs.size())).first;
+        m_contigs.push_back(contig);
+    }
+
+    IndexEntry entry = { m_offset, read_idx, iter->second, ref_start, ref_end, 0 };
+    m_index.push_back(entry);
+    write_bytes(data.data(), data.size());
+}
+
+//
+void EventalignBinaryWriter::finish()
+{
+    uint64_t index_offset = m_offset;
+    std::string index;
+    index.append(EVENTALIGN_BINARY_INDEX_MAGIC, sizeof(EVENTALIGN_BINARY_INDEX_MAGIC));
+    append_value(index, (uint32_t)m_contigs.size());
+    for(const std::string& contig : m_contigs) {
+        append_string(index, contig);
+    }
+    append_value(index, (uint32_t)m_model_offsets.size());
+    for(const auto& iter : m_model_offsets) {
+        append_value(index, iter.second);
+    }
+    append_value(index, (uint64_t)m_index.size());
+    index.append((const char*)m_index.data(), m_index.size() * sizeof(IndexEntry));
+
+    append_value(index, index_offset);
+    index.append(EVENTALIGN_BINARY_END_MAGIC, sizeof(EVENTALIGN_BINARY_END_MAGIC));
+    write_bytes(index.data(), index.size());
+
+    if(fflush(m_fp) != 0) {
+        fprintf(stderr, "error: could not write the eventalign output\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+void EventalignBinaryWriter::write_bytes(const void* data, size_t size)
+{
+    if(fwrite(data, 1, size, m_fp) != size) {
+        fprintf(stderr, "error: could not write the eventalign output\n");
+        exit(EXIT_FAILURE);
+    }
+    m_offset += size;
+}
+
+//
+EventalignBinaryReader::EventalignBinaryReader(const std::string& filename) : m_filename(filename),
+                                                                              m_flags(0),
+                                                                              m_use_block_list(false),
+                                                                              m_next_block(0)
+{
+    m_fp = filename == "-" ? stdin : fopen(filename.c_str(), "rb");
+    if(m_fp == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    char magic[sizeof(EVENTALIGN_BINARY_MAGIC)];
+    uint32_t header[2];
+    if(fread(magic, sizeof(magic), 1, m_fp) != 1 ||
+       memcmp(magic, EVENTALIGN_BINARY_MAGIC, sizeof(magic)) != 0 ||
+       fread(header, sizeof(header), 1, m_fp) != 1) {
+        fprintf(stderr, "error: %s is not eventalign binary output for this version of nanopolish\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    m_flags = header[0];
+}
+
+//
+EventalignBinaryReader::~EventalignBinaryReader()
+{
+    if(m_fp != stdin) {
+        fclose(m_fp);
+    }
+}
+
+//
+bool EventalignBinaryReader::read_block(EventalignBinaryBlock& block)
+{
+    if(m_use_block_list) {
+        if(m_next_block >= m_block_list.size()) {
+            return false;
+        }
+        if(fseeko(m_fp, m_block_list[m_next_block++], SEEK_SET) != 0) {
+            fprintf(stderr, "error: could not seek in %s\n", m_filename.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char tag[sizeof(EVENTALIGN_BINARY_BLOCK_TAG)];
+    while(true) {
+        if(fread(tag, sizeof(tag), 1, m_fp) != 1) {
+            fprintf(stderr, "warning: %s has no index, it may be truncated\n", m_filename.c_str());
+            return false;
+        }
+
+        // the levels of a model come before its first block
+        if(memcmp(tag, EVENTALIGN_BINARY_MODEL_TAG, sizeof(tag)) != 0) {
+            break;
+        }
+        read_model();
+    }
+
+    // the index follows the last block
+    if(memcmp(tag, EVENTALIGN_BINARY_BLOCK_TAG, sizeof(tag)) != 0) {
+        if(memcmp(tag, EVENTALIGN_BINARY_INDEX_MAGIC, sizeof(tag)) != 0) {
+            fprintf(stderr, "error: malformed eventalign binary file %s\n", m_filename.c_str());
+            exit(EXIT_FAILURE);
+        }
+        return false;
+    }
+
+    uint32_t block_size;
+    uint32_t fields[6];
+    read_bytes(&block_size, sizeof(block_size));
+    read_bytes(&block.read_idx, sizeof(block.read_idx));
+    read_bytes(fields, sizeof(fields));
+    read_bytes(&block.shift, sizeof(block.shift));
+    read_bytes(&block.scale, sizeof(block.scale));
+    read_bytes(&block.var, sizeof(block.var));
+    block.strand_idx = fields[0];
+    block.k = fields[1];
+    uint32_t block_flags = fields[2];
+    uint32_t num_strings = fields[3];
+    uint32_t num_records = fields[4];
+    block.model_id = fields[5];
+
+    if(num_strings < 3 || m_models.find(block.model_id) == m_models.end()) {
+        fprintf(stderr, "error: malformed eventalign binary file %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> strings(num_strings);
+    for(std::string& str : strings) {
+        uint32_t length;
+        read_bytes(&length, sizeof(length));
+        str.resize(length);
+        if(length > 0) {
+            read_bytes(&str[0], length);
+        }
+    }
+    block.read_name = strings[0];
+    block.contig = strings[1];
+    block.alphabet_name = strings[2];
+    block.strings.assign(strings.begin() + 3, strings.end());
+
+    block.records.resize(num_records);
+    read_bytes(block.records.data(), num_records * sizeof(EventalignBinaryRecord));
+
+    block.signal_idx.clear();
+    if(block_flags & BLOCK_FLAG_SIGNAL_INDEX) {
+        block.signal_idx.resize(2 * num_records);
+        read_bytes(block.signal_idx.data(), block.signal_idx.size() * sizeof(uint64_t));
+    }
+    return true;
+}
+
+//
+EventAlignmentValues EventalignBinaryReader::get_values(const EventalignBinaryBlock& block, const EventalignBinaryRecord& record) const
+{
+    EventAlignmentValues values;
+    values.event_level_mean = record.event_level_mean;
+    values.event_stdv = record.event_stdv;
+    values.event_length = record.event_length;
+    values.model_mean = 0.0;
+    values.model_stdv = 0.0;
+
+    // the same as get_event_alignment_values, the model is scaled to the
+    // reads unless the event levels were scaled to the model
+    if(!(record.model_kmer & EVENTALIGN_BINARY_STRING_KMER)) {
+        const EventalignBinaryModel& model = m_models.find(block.model_id)->second;
+        if(record.model_kmer >= model.level_mean.size()) {
+            fprintf(stderr, "error: malformed eventalign binary block for read %s\n", block.read_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        if(m_flags & EVENTALIGN_BINARY_FLAG_SCALE_EVENTS) {
+            values.model_mean = model.level_mean[record.model_kmer];
+            values.model_stdv = model.level_stdv[record.model_kmer];
+        } else {
+            values.model_mean = block.scale * model.level_mean[record.model_kmer] + block.shift;
+            values.model_stdv = model.level_stdv[record.model_kmer] * block.var;
+        }
+    }
+
+    values.standardized_level = (values.event_level_mean - values.model_mean) / (sqrt(block.var) * values.model_stdv);
+    return values;
+}
+
+//
+void EventalignBinaryReader::read_model()
+{
+    uint32_t chunk_size;
+    uint32_t model_id;
+    uint32_t num_states;
+    read_bytes(&chunk_size, sizeof(chunk_size));
+    read_bytes(&model_id, sizeof(model_id));
+    read_bytes(&num_states, sizeof(num_states));
+    if(chunk_size != 2 * sizeof(uint32_t) + 2 * num_states * sizeof(float)) {
+        fprintf(stderr, "error: malformed eventalign binary file %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    EventalignBinaryModel& model = m_models[model_id];
+    model.level_mean.resize(num_states);
+    model.level_stdv.resize(num_states);
+    read_bytes(model.level_mean.data(), num_states * sizeof(float));
+    read_bytes(model.level_stdv.data(), num_states * sizeof(float));
+}
+
+//
+void EventalignBinaryReader::set_region(const std::string& contig, int start, int end)
+{
+    // the footer has the offset of the index
+    uint64_t index_offset;
+    char magic[sizeof(EVENTALIGN_BINARY_END_MAGIC)];
+    if(fseeko(m_fp, -(off_t)(sizeof(index_offset) + sizeof(magic)), SEEK_END) != 0) {
+        fprintf(stderr, "error: %s must be a file, not a stream, to select a region\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    read_bytes(&index_offset, sizeof(index_offset));
+    read_bytes(magic, sizeof(magic));
+    if(memcmp(magic, EVENTALIGN_BINARY_END_MAGIC, sizeof(magic)) != 0 || fseeko(m_fp, index_offset, SEEK_SET) != 0) {
+        fprintf(stderr, "error: %s has no index, it may be truncated\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    char index_magic[sizeof(EVENTALIGN_BINARY_INDEX_MAGIC)];
+    read_bytes(index_magic, sizeof(index_magic));
+    if(memcmp(index_magic, EVENTALIGN_BINARY_INDEX_MAGIC, sizeof(index_magic)) != 0) {
+        fprintf(stderr, "error: malformed eventalign binary index in %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t num_contigs;
+    read_bytes(&num_contigs, sizeof(num_contigs));
+    uint32_t contig_id = -1;
+    for(uint32_t i = 0; i < num_contigs; ++i) {
+        uint32_t length;
+        read_bytes(&length, sizeof(length));
+        std::string name(length, '\0');
+        if(length > 0) {
+            read_bytes(&name[0], length);
+        }
+        if(name == contig) {
+            contig_id = i;
+        }
+    }
+
+    uint32_t num_models;
+    read_bytes(&num_models, sizeof(num_models));
+    std::vector<uint64_t> model_offsets(num_models);
+    read_bytes(model_offsets.data(), num_models * sizeof(uint64_t));
+
+    // the index entries, in the layout of EventalignBinaryWriter::IndexEntry
+    uint64_t num_blocks;
+    read_bytes(&num_blocks, sizeof(num_blocks));
+    m_block_list.clear();
+    for(uint64_t i = 0; i < num_blocks; ++i) {
+        uint64_t offset_and_read[2];
+        int32_t entry[4];
+        read_bytes(offset_and_read, sizeof(offset_and_read));
+        read_bytes(entry, sizeof(entry));
+        if((uint32_t)entry[0] == contig_id && entry[1] <= end && entry[2] >= start) {
+            m_block_list.push_back(offset_and_read[0]);
+        }
+    }
+
+    // the blocks are read out of order, so load every model up front
+    char tag[sizeof(EVENTALIGN_BINARY_MODEL_TAG)];
+    for(uint64_t offset : model_offsets) {
+        if(fseeko(m_fp, offset, SEEK_SET) != 0) {
+            fprintf(stderr, "error: could not seek in %s\n", m_filename.c_str());
+            exit(EXIT_FAILURE);
+        }
+        read_bytes(tag, sizeof(tag));
+        if(memcmp(tag, EVENTALIGN_BINARY_MODEL_TAG, sizeof(tag)) != 0) {
+            fprintf(stderr, "error: malformed eventalign binary index in %s\n", m_filename.c_str());
+            exit(EXIT_FAILURE);
+        }
+        read_model();
+    }
+    m_use_block_list = true;
+    m_next_block = 0;
+}
+
+//
+void EventalignBinaryReader::read_bytes(void* data, size_t size)
+{
+    if(size > 0 && fread(data, size, 1, m_fp) != 1) {
+        fprintf(stderr, "error: unexpected end of file in %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,189 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_eventalign_binary -- compact binary version of
+// the eventalign output, with fixed-width records for each
+// event grouped into one block per read strand
+//
+// File layout:
+//   header: magic, flags
+//   blocks: one per aligned read strand, each a tag, its length and the
+//           read's strings, scalings, records and optionally sample ranges.
+//           The levels of a pore model are written once, before the first
+//           block that uses it
+//   index: magic, the contig names, the offsets of the models and the
+//          offset and reference span of each block
+//   footer: the offset of the index, magic
+//
+// The model mean, model stdv and standardized level of the tsv output are
+// not stored, they are computed from the model kmer, the block's scalings
+// and the levels of its model when the file is read
+//
+#ifndef NANOPOLISH_EVENTALIGN_BINARY_H
+#define NANOPOLISH_EVENTALIGN_BINARY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "nanopolish_eventalign.h"
+
+class Alphabet;
+class PoreModel;
+
+// the blocks have the start and end sample index of each event
+#define EVENTALIGN_BINARY_FLAG_SIGNAL_INDEX 1
+
+// the event levels were scaled to the model (--scale-events)
+#define EVENTALIGN_BINARY_FLAG_SCALE_EVENTS 2
+
+// set in a kmer code when the kmer could not be ranked in the block's alphabet
+// (it has an N for example), the rest of the code is an index into the block's strings
+#define EVENTALIGN_BINARY_STRING_KMER 0x80000000u
+
+// One aligned event
+struct EventalignBinaryRecord
+{
+    int32_t ref_position;
+    int32_t event_idx;
+
+    // kmer ranks in the block's alphabet, or EVENTALIGN_BINARY_STRING_KMER | string index.
+    // The model kmer is a string when the event has no model level (an HMM background state)
+    uint32_t ref_kmer;
+    uint32_t model_kmer;
+
+    float event_level_mean;
+    float event_stdv;
+    float event_length;
+};
+
+// The levels of a pore model, indexed by kmer rank
+struct EventalignBinaryModel
+{
+    std::vector<float> level_mean;
+    std::vector<float> level_stdv;
+};
+
+// The alignment of one strand of a read
+struct EventalignBinaryBlock
+{
+    uint64_t read_idx = 0;
+    uint32_t strand_idx = 0;
+    uint32_t k = 0;
+
+    // the handle of the pore model, and the scalings of the strand to it
+    uint32_t model_id = 0;
+    double shift = 0.0;
+    double scale = 1.0;
+    double var = 1.0;
+
+    std::string read_name;
+    std::string contig;
+    std::string alphabet_name;
+
+    // kmers that could not be ranked
+    std::vector<std::string> strings;
+
+    std::vector<EventalignBinaryRecord> records;
+
+    // the start and end sample of each record, only with EVENTALIGN_BINARY_FLAG_SIGNAL_INDEX
+    std::vector<uint64_t> signal_idx;
+
+    // the code to store for kmer
+    uint32_t encode_kmer(const Alphabet* alphabet, const std::string& kmer);
+
+    // the code to store for kmer, as a string even if it could be ranked
+    uint32_t encode_string_kmer(const std::string& kmer);
+
+    // write the kmer for code into kmer
+    void decode_kmer(const Alphabet* alphabet, uint32_t code, std::string& kmer) const;
+
+    // the smallest and largest reference positions of the records
+    void get_reference_span(int32_t& start, int32_t& end) const;
+};
+
+// Writes the header, then blocks in the order they are given, and the index when finished
+class EventalignBinaryWriter
+{
+    public:
+        EventalignBinaryWriter(FILE* fp, uint32_t flags);
+
+        // serialize a block, this is safe to do on any thread
+        static void serialize(const EventalignBinaryBlock& block, std::string& out);
+
+        // write a block from serialize and add it to the index, after the levels of its
+        // model if this is the first block to use it. Only one thread can write at a time
+        void write(const std::string& data,
+                   const PoreModel* model,
+                   uint64_t read_idx,
+                   const std::string& contig,
+                   int32_t ref_start,
+                   int32_t ref_end);
+
+        // write the index, after the last block
+        void finish();
+
+    private:
+
+        struct IndexEntry
+        {
+            uint64_t offset;
+            uint64_t read_idx;
+            uint32_t contig_id;
+            int32_t ref_start;
+            int32_t ref_end;
+            uint32_t padding;
+        };
+
+        void write_bytes(const void* data, size_t size);
+
+        FILE* m_fp;
+        uint64_t m_offset;
+        std::map<std::string, uint32_t> m_contig_ids;
+        std::vector<std::string> m_contigs;
+        std::map<uint32_t, uint64_t> m_model_offsets;
+        std::vector<IndexEntry> m_index;
+};
+
+// Reads the blocks of a file in order, or the blocks overlapping a region using the index
+class EventalignBinaryReader
+{
+    public:
+        // "-" reads from stdin
+        EventalignBinaryReader(const std::string& filename);
+        ~EventalignBinaryReader();
+
+        uint32_t get_flags() const { return m_flags; }
+
+        // read the next block, returns false at the end of the blocks
+        bool read_block(EventalignBinaryBlock& block);
+
+        // the tsv values of a record of block
+        EventAlignmentValues get_values(const EventalignBinaryBlock& block, const EventalignBinaryRecord& record) const;
+
+        // load the index and set up read_block to only return blocks that overlap the
+        // region. Exits with an error if the input is not seekable
+        void set_region(const std::string& contig, int start, int end);
+
+    private:
+
+        // read the levels of a model, after its tag
+        void read_model();
+
+        void read_bytes(void* data, size_t size);
+
+        std::string m_filename;
+        FILE* m_fp;
+        uint32_t m_flags;
+        std::map<uint32_t, EventalignBinaryModel> m_models;
+
+        // the blocks to read when a region is set
+        bool m_use_block_list;
+        std::vector<uint64_t> m_block_list;
+        size_t m_next_block;
+};
+
+#endif
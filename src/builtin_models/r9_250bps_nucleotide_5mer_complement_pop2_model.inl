@@ -1,7 +1,7 @@
 // Autogenerated by convert_model_to_header.py
 #ifndef NANOPOLISH_INITIALIZE_R9_250BPS_NUCLEOTIDE_5MER_COMPLEMENT_POP2_MODEL_BUILTIN_INL
 #define NANOPOLISH_INITIALIZE_R9_250BPS_NUCLEOTIDE_5MER_COMPLEMENT_POP2_MODEL_BUILTIN_INL
-static std::vector<double> initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data = {
+static const double initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[] = {
 		86.09431, 2.01966, 0.00000, 0.00000, // AAAAA
 		77.82778, 2.27326, 0.00000, 0.00000, // AAAAC
 		84.12958, 2.10125, 0.00000, 0.00000, // AAAAG
@@ -1032,15 +1032,16 @@ PoreModel initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin()
 	PoreModel tmp;
 	tmp.model_filename = "etc/r9-models/r9_250bps.nucleotide.5mer.complement.pop2.model";
 	tmp.k = 5;
-	tmp.states.resize(1024);
+	std::vector<PoreModelStateParams> states(1024);
 	for(size_t i = 0; i < 1024; ++i) {
-		tmp.states[i].level_mean = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 0];
-		tmp.states[i].level_stdv = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 1];
-		tmp.states[i].sd_mean = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 2];
-		tmp.states[i].sd_stdv = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 3];
-		tmp.states[i].update_sd_lambda();
-		tmp.states[i].update_logs();
+		states[i].level_mean = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 0];
+		states[i].level_stdv = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 1];
+		states[i].sd_mean = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 2];
+		states[i].sd_stdv = initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin_data[4*i + 3];
+		states[i].update_sd_lambda();
+		states[i].update_logs();
 	}
+	tmp.update_states(states);
 	tmp.pmalphabet = best_alphabet("ACTG");
 	tmp.set_metadata("r9_250bps", "complement.pop2");
 	return tmp;
@@ -1,7 +1,7 @@
 // Autogenerated by convert_model_to_header.py
 #ifndef NANOPOLISH_INITIALIZE_R9_250BPS_NUCLEOTIDE_6MER_COMPLEMENT_POP1_MODEL_BUILTIN_INL
 #define NANOPOLISH_INITIALIZE_R9_250BPS_NUCLEOTIDE_6MER_COMPLEMENT_POP1_MODEL_BUILTIN_INL
-static std::vector<double> initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data = {
+static const double initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[] = {
 		83.45932, 1.59164, 1.32118, 0.54878, // AAAAAA
 		81.12888, 1.61684, 1.46396, 0.64011, // AAAAAC
 		82.52962, 1.61513, 1.32973, 0.55412, // AAAAAG
@@ -4104,15 +4104,16 @@ PoreModel initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin()
 	PoreModel tmp;
 	tmp.model_filename = "etc/r9-models/r9_250bps.nucleotide.6mer.complement.pop1.model";
 	tmp.k = 6;
-	tmp.states.resize(4096);
+	std::vector<PoreModelStateParams> states(4096);
 	for(size_t i = 0; i < 4096; ++i) {
-		tmp.states[i].level_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 0];
-		tmp.states[i].level_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 1];
-		tmp.states[i].sd_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 2];
-		tmp.states[i].sd_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 3];
-		tmp.states[i].update_sd_lambda();
-		tmp.states[i].update_logs();
+		states[i].level_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 0];
+		states[i].level_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 1];
+		states[i].sd_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 2];
+		states[i].sd_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin_data[4*i + 3];
+		states[i].update_sd_lambda();
+		states[i].update_logs();
 	}
+	tmp.update_states(states);
 	tmp.pmalphabet = best_alphabet("ACTG");
 	tmp.set_metadata("r9_250bps", "complement.pop1");
 	return tmp;
@@ -1,7 +1,7 @@
 // Autogenerated by convert_model_to_header.py
 #ifndef NANOPOLISH_INITIALIZE_R9_250BPS_NUCLEOTIDE_6MER_COMPLEMENT_POP2_MODEL_BUILTIN_INL
 #define NANOPOLISH_INITIALIZE_R9_250BPS_NUCLEOTIDE_6MER_COMPLEMENT_POP2_MODEL_BUILTIN_INL
-static std::vector<double> initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data = {
+static const double initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[] = {
 		87.01302, 1.99386, 1.49296, 0.64272, // AAAAAA
 		85.69311, 2.03025, 1.64646, 0.74434, // AAAAAC
 		85.94361, 1.95965, 1.48717, 0.63898, // AAAAAG
@@ -4104,15 +4104,16 @@ PoreModel initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin()
 	PoreModel tmp;
 	tmp.model_filename = "etc/r9-models/r9_250bps.nucleotide.6mer.complement.pop2.model";
 	tmp.k = 6;
-	tmp.states.resize(4096);
+	std::vector<PoreModelStateParams> states(4096);
 	for(size_t i = 0; i < 4096; ++i) {
-		tmp.states[i].level_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 0];
-		tmp.states[i].level_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 1];
-		tmp.states[i].sd_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 2];
-		tmp.states[i].sd_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 3];
-		tmp.states[i].update_sd_lambda();
-		tmp.states[i].update_logs();
+		states[i].level_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 0];
+		states[i].level_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 1];
+		states[i].sd_mean = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 2];
+		states[i].sd_stdv = initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin_data[4*i + 3];
+		states[i].update_sd_lambda();
+		states[i].update_logs();
 	}
+	tmp.update_states(states);
 	tmp.pmalphabet = best_alphabet("ACTG");
 	tmp.set_metadata("r9_250bps", "complement.pop2");
 	return tmp;
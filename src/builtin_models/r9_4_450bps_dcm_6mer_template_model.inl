@@ -1,7 +1,7 @@
 // Autogenerated by convert_model_to_header.py
 #ifndef NANOPOLISH_INITIALIZE_R9_4_450BPS_DCM_6MER_TEMPLATE_MODEL_BUILTIN_INL
 #define NANOPOLISH_INITIALIZE_R9_4_450BPS_DCM_6MER_TEMPLATE_MODEL_BUILTIN_INL
-static std::vector<double> initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data = {
+static const double initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[] = {
 		86.48630, 1.51785, 0.94148, 0.60936, // AAAAAA
 		83.94880, 1.51785, 1.07705, 0.74561, // AAAAAC
 		85.47540, 1.51785, 0.95343, 0.62100, // AAAAAG
@@ -15633,15 +15633,16 @@ PoreModel initialize_r9_4_450bps_dcm_6mer_template_model_builtin()
 	PoreModel tmp;
 	tmp.model_filename = "etc/r9-models/r9.4_450bps.dcm.6mer.template.model";
 	tmp.k = 6;
-	tmp.states.resize(15625);
+	std::vector<PoreModelStateParams> states(15625);
 	for(size_t i = 0; i < 15625; ++i) {
-		tmp.states[i].level_mean = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 0];
-		tmp.states[i].level_stdv = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 1];
-		tmp.states[i].sd_mean = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 2];
-		tmp.states[i].sd_stdv = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 3];
-		tmp.states[i].update_sd_lambda();
-		tmp.states[i].update_logs();
+		states[i].level_mean = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 0];
+		states[i].level_stdv = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 1];
+		states[i].sd_mean = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 2];
+		states[i].sd_stdv = initialize_r9_4_450bps_dcm_6mer_template_model_builtin_data[4*i + 3];
+		states[i].update_sd_lambda();
+		states[i].update_logs();
 	}
+	tmp.update_states(states);
 	tmp.pmalphabet = get_alphabet_by_name("dcm");
 	tmp.set_metadata("r9.4_450bps", "template");
 	return tmp;
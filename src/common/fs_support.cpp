@@ -35,3 +35,32 @@ std::vector< std::string > list_directory(const std::string& file_name)
     closedir(dir);
     return res;
 }
+
+//
+std::vector< directory_entry > list_directory_entries(const std::string& file_name)
+{
+    std::vector< directory_entry > res;
+    DIR* dir;
+    struct dirent *ent;
+
+    dir = opendir(file_name.c_str());
+    if(not dir) {
+        return res;
+    }
+    while((ent = readdir(dir)) != nullptr) {
+        std::string name = ent->d_name;
+        if(name == "." or name == "..") {
+            continue;
+        }
+
+        directory_entry entry = { name, ent->d_type == DT_DIR };
+        if(ent->d_type == DT_UNKNOWN or ent->d_type == DT_LNK) {
+            struct stat file_stat;
+            std::string full_name = file_name + "/" + name;
+            entry.is_directory = stat(full_name.c_str(), &file_stat) == 0 and S_ISDIR(file_stat.st_mode);
+        }
+        res.push_back(entry);
+    }
+    closedir(dir);
+    return res;
+}
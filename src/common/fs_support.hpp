@@ -16,4 +16,16 @@ bool is_directory(const std::string& file_name);
 // return a vector of files within the given directory
 std::vector< std::string > list_directory(const std::string& file_name);
 
+//
+struct directory_entry
+{
+    std::string name;
+    bool is_directory;
+};
+
+// return the entries within the given directory, except . and ..
+// the type of each entry is taken from readdir so only entries
+// the filesystem does not report a type for (or links) are stat()ed
+std::vector< directory_entry > list_directory_entries(const std::string& file_name);
+
 #endif
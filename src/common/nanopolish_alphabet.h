@@ -9,6 +9,7 @@
 #define NANOPOLISH_ALPHABET_H
 
 #include <string>
+#include <vector>
 #include <cstring>
 #include <inttypes.h>
 #include <assert.h>
@@ -55,6 +56,53 @@ inline RecognitionMatch match_to_site(const std::string& str, size_t i, const ch
     return match;
 }
 
+// Calculate the rank of every k-mer of fwd, and optionally of every k-mer
+// of rc read from the opposite end, in a single pass. Each rank is updated from the
+// previous one by removing the leading base and appending the next base
+// so the work is linear in the sequence length rather than in length * k.
+// ALPHABET_SIZE is a template parameter so the multiplications are by a
+// compile-time constant for the common alphabets.
+template<uint32_t ALPHABET_SIZE>
+inline void rolling_kmer_ranks(const uint8_t* rank_table,
+                               uint32_t alphabet_size,
+                               const char* fwd,
+                               const char* rc,
+                               size_t num_kmers,
+                               uint32_t k,
+                               uint32_t* fwd_ranks,
+                               uint32_t* rc_ranks)
+{
+    assert(k > 0);
+    const uint32_t s = ALPHABET_SIZE != 0 ? ALPHABET_SIZE : alphabet_size;
+
+    // weight of the leading base of a k-mer
+    uint32_t lead = 1;
+    for(uint32_t i = 1; i < k; ++i) {
+        lead *= s;
+    }
+
+    uint32_t fr = 0;
+    uint32_t rr = 0;
+    for(uint32_t i = 0; i < k - 1; ++i) {
+        fr = fr * s + rank_table[(uint8_t)fwd[i]];
+        if(rc != NULL) {
+            rr = rr * s + rank_table[(uint8_t)rc[i]];
+        }
+    }
+
+    for(size_t i = 0; i < num_kmers; ++i) {
+        fr = fr * s + rank_table[(uint8_t)fwd[i + k - 1]];
+        fwd_ranks[i] = fr;
+        fr -= rank_table[(uint8_t)fwd[i]] * lead;
+
+        if(rc != NULL) {
+            rr = rr * s + rank_table[(uint8_t)rc[i + k - 1]];
+            rc_ranks[num_kmers - i - 1] = rr;
+            rr -= rank_table[(uint8_t)rc[i]] * lead;
+        }
+    }
+}
+
 // Abstract base class for alphabets
 class Alphabet
 {
@@ -73,20 +121,63 @@ class Alphabet
         virtual const char* get_recognition_site_methylated(size_t i) const = 0;
         virtual const char* get_recognition_site_methylated_complement(size_t i) const = 0;
 
+        // the base-to-rank lookup table, so that ranks can be
+        // computed without a virtual call per base
+        virtual const uint8_t* get_rank_table() const = 0;
+
         // return the lexicographic rank of the kmer amongst all strings of 
         // length k for this alphabet
         inline uint32_t kmer_rank(const char* str, uint32_t k) const
         {
-            uint32_t p = 1;
+            const uint8_t* rank_table = get_rank_table();
+            const uint32_t s = size();
             uint32_t r = 0;
-
-            // from last base to first
             for(uint32_t i = 0; i < k; ++i) {
-                r += rank(str[k - i - 1]) * p;
-                p *= size();
+                r = r * s + rank_table[(uint8_t)str[i]];
             }
             return r;
         }
+
+        // Calculate the ranks of all k-mers of fwd in one pass. If rc is not NULL,
+        // rc_ranks[i] is set to the rank of the k-mer of rc that covers the same
+        // positions as the i-th k-mer of fwd (the same indexing as
+        // HMMInputSequence::get_kmer_rank with do_rc set)
+        inline void kmer_ranks(const std::string& fwd,
+                               const std::string* rc,
+                               uint32_t k,
+                               std::vector<uint32_t>& fwd_ranks,
+                               std::vector<uint32_t>* rc_ranks) const
+        {
+            size_t num_kmers = fwd.length() >= k ? fwd.length() - k + 1 : 0;
+            fwd_ranks.resize(num_kmers);
+            if(rc_ranks != NULL) {
+                assert(rc != NULL && rc->length() == fwd.length());
+                rc_ranks->resize(num_kmers);
+            }
+
+            if(num_kmers == 0) {
+                return;
+            }
+
+            const char* rc_str = rc_ranks != NULL ? rc->c_str() : NULL;
+            uint32_t* rc_out = rc_ranks != NULL ? rc_ranks->data() : NULL;
+            switch(size()) {
+                case 4:
+                    rolling_kmer_ranks<4>(get_rank_table(), 4, fwd.c_str(), rc_str, num_kmers, k, fwd_ranks.data(), rc_out);
+                    break;
+                case 5:
+                    rolling_kmer_ranks<5>(get_rank_table(), 5, fwd.c_str(), rc_str, num_kmers, k, fwd_ranks.data(), rc_out);
+                    break;
+                default:
+                    rolling_kmer_ranks<0>(get_rank_table(), size(), fwd.c_str(), rc_str, num_kmers, k, fwd_ranks.data(), rc_out);
+            }
+        }
+
+        // as above, for a single sequence
+        inline void kmer_ranks(const std::string& str, uint32_t k, std::vector<uint32_t>& ranks) const
+        {
+            kmer_ranks(str, NULL, k, ranks, NULL);
+        }
         
         // Increment the input string to be the next sequence in lexicographic order
         inline void lexicographic_next(std::string& str) const
@@ -101,6 +192,16 @@ class Alphabet
             } while(carry > 0 && i >= 0);
         }
 
+        // Write the kmer with rank r into str, the inverse of kmer_rank(str, str.size())
+        inline void unrank_kmer(uint32_t r, std::string& str) const
+        {
+            const uint32_t s = size();
+            for(size_t i = str.size(); i > 0; --i) {
+                str[i - 1] = base(r % s);
+                r /= s;
+            }
+        }
+
         // returns the number of unique strings of length l for this alphabet
         inline size_t get_num_strings(size_t l) const
         {
@@ -263,6 +364,7 @@ class Alphabet
 #define BASIC_ACCESSOR_BOILERPLATE \
     virtual const char* get_name() const { return _name; } \
     virtual uint8_t rank(char b) const { return _rank[(int)b]; }        \
+    virtual const uint8_t* get_rank_table() const { return _rank; } \
     virtual char base(uint8_t r) const { return _base[r]; } \
     virtual char complement(char b) const { return _complement[_rank[(int)b]]; } \
     virtual uint32_t size() const { return _size; } \
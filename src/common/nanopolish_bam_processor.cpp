@@ -8,9 +8,17 @@
 // on each aligned read in parallel
 //
 #include "nanopolish_bam_processor.h"
+#include "nanopolish_bam_utils.h"
 #include "nanopolish_common.h"
+#include "nanopolish_read_db.h"
+#include "nanopolish_reorder_buffer.h"
 #include <assert.h>
 #include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <vector>
 #include <hdf5.h>
 
@@ -25,8 +33,7 @@ BamProcessor::BamProcessor(const std::string& bam_file,
 
 {
     // load bam file
-    m_bam_fh = sam_open(m_bam_file.c_str(), "r");
-    assert(m_bam_fh != NULL);
+    m_bam_fh = open_bam_file(m_bam_file, "r");
 
     // load bam index file
     m_bam_idx = sam_index_load(m_bam_fh, bam_file.c_str());
@@ -46,6 +53,149 @@ BamProcessor::~BamProcessor()
     hts_idx_destroy(m_bam_idx);
 }
 
+std::vector<size_t> BamProcessor::get_processing_order(const std::vector<bam1_t*>& records, size_t num_records) const
+{
+    std::vector<size_t> order(num_records);
+    for(size_t i = 0; i < num_records; ++i) {
+        order[i] = i;
+    }
+
+    // the order of the output is already arbitrary with multiple threads so only then is it changed
+    if(m_read_db == NULL || m_num_threads == 1) {
+        return order;
+    }
+
+    // within a file the reads stay in alignment order
+    std::vector<std::string> paths(num_records);
+    for(size_t i = 0; i < num_records; ++i) {
+        paths[i] = m_read_db->get_signal_path(bam_get_qname(records[i]));
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return paths[a] < paths[b]; });
+    return order;
+}
+
+// A record read from the bam and the position it had in the file
+struct BamWorkItem
+{
+    bam1_t* record;
+    size_t read_idx;
+};
+
+// The records passed from the reading thread to the workers. The number of
+// records is fixed, the reader blocks when all of them are waiting or in use,
+// which bounds the memory used no matter how far the reader gets ahead.
+class BamWorkQueue
+{
+    public:
+        BamWorkQueue(size_t num_records)
+        {
+            for(size_t i = 0; i < num_records; ++i) {
+                m_free.push_back(bam_init1());
+            }
+            m_num_records = num_records;
+        }
+
+        ~BamWorkQueue()
+        {
+            assert(m_free.size() == m_num_records);
+            for(bam1_t* record : m_free) {
+                bam_destroy1(record);
+            }
+        }
+
+        // get an unused record to read into, blocks until one is available
+        bam1_t* get_free_record()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto start = std::chrono::steady_clock::now();
+            m_free_cv.wait(lock, [this] { return !m_free.empty(); });
+            m_stats.reader_wait_seconds += elapsed_seconds(start);
+
+            bam1_t* record = m_free.back();
+            m_free.pop_back();
+            return record;
+        }
+
+        // give back a record that was processed, or that was not used
+        void return_record(bam1_t* record)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(record);
+            m_free_cv.notify_one();
+        }
+
+        //
+        void push(const std::vector<BamWorkItem>& items)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_work.insert(m_work.end(), items.begin(), items.end());
+            m_stats.num_pushes += 1;
+            m_stats.sum_queue_depth += m_work.size();
+            m_stats.max_queue_depth = std::max(m_stats.max_queue_depth, m_work.size());
+            m_work_cv.notify_all();
+        }
+
+        // get the next record to process, returns false once the queue is closed and empty
+        bool pop(BamWorkItem& item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto start = std::chrono::steady_clock::now();
+            m_work_cv.wait(lock, [this] { return !m_work.empty() || m_closed; });
+            m_stats.worker_idle_seconds += elapsed_seconds(start);
+
+            if(m_work.empty()) {
+                return false;
+            }
+            item = m_work.front();
+            m_work.pop_front();
+            return true;
+        }
+
+        // non-blocking version of pop
+        bool try_pop(BamWorkItem& item)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_work.empty()) {
+                return false;
+            }
+            item = m_work.front();
+            m_work.pop_front();
+            return true;
+        }
+
+        // signal that no more records will be pushed
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_work_cv.notify_all();
+        }
+
+        bool has_free_record()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return !m_free.empty();
+        }
+
+        const BamProcessorStats& get_stats() const { return m_stats; }
+
+    private:
+
+        static double elapsed_seconds(const std::chrono::steady_clock::time_point& start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_free_cv;
+        std::condition_variable m_work_cv;
+        std::vector<bam1_t*> m_free;
+        std::deque<BamWorkItem> m_work;
+        size_t m_num_records;
+        bool m_closed = false;
+        BamProcessorStats m_stats;
+};
+
 void BamProcessor::parallel_run( std::function<void(const bam_hdr_t* hdr, 
                                            const bam1_t* record,
                                            size_t read_idx,
@@ -81,48 +231,101 @@ void BamProcessor::parallel_run( std::function<void(const bam_hdr_t* hdr,
     int prev_num_threads = omp_get_num_threads();
     omp_set_num_threads(m_num_threads);
 
-    // Initialize iteration
-    std::vector<bam1_t*> records(m_batch_size, NULL);
-    for(size_t i = 0; i < records.size(); ++i) {
-        records[i] = bam_init1();
-    }
+    // One thread reads the bam and the others process the records as they arrive, so
+    // reading overlaps with the work and a slow read only holds up the thread running it.
+    // The reader works through the bam m_batch_size records at a time, which is the
+    // window the records are reordered in for fast5 locality. There are enough records for
+    // the workers to process one window while the next is read.
+    BamWorkQueue queue(2 * m_batch_size + m_num_threads);
+
+    auto process = [&](const BamWorkItem& item) {
+        bam1_t* record = item.record;
+        if( (record->core.flag & BAM_FUNMAP) == 0 && record->core.qual >= m_min_mapping_quality) {
+            func(m_hdr, record, item.read_idx, clip_start, clip_end);
+        }
+        queue.return_record(record);
+
+        if(m_reorder_buffer != NULL) {
+            m_reorder_buffer->complete(item.read_idx);
+        }
+    };
+
+    #pragma omp parallel num_threads(m_num_threads + 1)
+    {
+        if(omp_get_thread_num() == 0) {
+            // with no worker threads available, the reader processes records itself when it runs out
+            bool reader_works = omp_get_num_threads() == 1;
+
+            std::vector<bam1_t*> window;
+            std::vector<BamWorkItem> items;
+            size_t num_reads_read = 0;
+            int result = 0;
+
+            while(result >= 0) {
+                BamWorkItem item;
 
-    int result;
-    size_t num_reads_realigned = 0;
-    size_t num_records_buffered = 0;
-
-    do {
-        assert(num_records_buffered < records.size());
-
-        // read a record into the next slot in the buffer
-        result = sam_itr_next(m_bam_fh, itr, records[num_records_buffered]);
-        num_records_buffered += result >= 0;
-
-        // realign if we've hit the max buffer size or reached the end of file
-        if(num_records_buffered == records.size() || result < 0 || (num_records_buffered + num_reads_realigned == m_max_reads)) {
-            #pragma omp parallel for schedule(dynamic)
-            for(size_t i = 0; i < num_records_buffered; ++i) {
-                bam1_t* record = records[i];
-                size_t read_idx = num_reads_realigned + i;
-                if( (record->core.flag & BAM_FUNMAP) == 0 && record->core.qual >= m_min_mapping_quality) {
-                    func(m_hdr, record, read_idx, clip_start, clip_end);
+                // do not start a window until the output of the reads before it fits in the buffer
+                if(m_reorder_buffer != NULL && window.empty()) {
+                    size_t window_end = num_reads_read + m_batch_size;
+                    while(reader_works && !m_reorder_buffer->has_space(num_reads_read, window_end) && queue.try_pop(item)) {
+                        process(item);
+                    }
+                    m_reorder_buffer->wait_for_space(num_reads_read, window_end);
+                }
+
+                while(reader_works && !queue.has_free_record() && queue.try_pop(item)) {
+                    process(item);
+                }
+
+                bam1_t* record = queue.get_free_record();
+                result = num_reads_read < m_max_reads ? sam_itr_next(m_bam_fh, itr, record) : -1;
+                if(result >= 0) {
+                    window.push_back(record);
+                    num_reads_read += 1;
+                } else {
+                    queue.return_record(record);
+                }
+
+                // hand the window to the workers once it is full or the input is exhausted
+                if(!window.empty() && (window.size() == (size_t)m_batch_size || result < 0)) {
+                    size_t window_start = num_reads_read - window.size();
+                    std::vector<size_t> order = get_processing_order(window, window.size());
+                    items.clear();
+                    for(size_t i : order) {
+                        items.push_back({ window[i], window_start + i });
+                    }
+                    queue.push(items);
+                    window.clear();
                 }
             }
+            queue.close();
 
-            num_reads_realigned += num_records_buffered;
-            num_records_buffered = 0;
+            BamWorkItem item;
+            while(reader_works && queue.pop(item)) {
+                process(item);
+            }
+        } else {
+            BamWorkItem item;
+            while(queue.pop(item)) {
+                process(item);
+            }
         }
-    } while(result >= 0 && num_reads_realigned < m_max_reads);
-
-    assert(num_records_buffered == 0);
+    }
+    m_stats = queue.get_stats();
 
     // restore number of threads
     omp_set_num_threads(prev_num_threads);
  
     // cleanup   
-    for(size_t i = 0; i < records.size(); ++i) {
-        bam_destroy1(records[i]);
-    }
-
     sam_itr_destroy(itr);
 }
+
+//
+void BamProcessor::print_stats() const
+{
+    fprintf(stderr, "[bam process] mean queue depth: %.1lf max queue depth: %zu worker idle time: %.1lfs reader wait time: %.1lfs\n",
+        m_stats.num_pushes > 0 ? (double)m_stats.sum_queue_depth / m_stats.num_pushes : 0.0,
+        m_stats.max_queue_depth,
+        m_stats.worker_idle_seconds,
+        m_stats.reader_wait_seconds);
+}
@@ -12,9 +12,26 @@
 
 #include <functional>
 #include <string>
+#include <vector>
 #include "htslib/hts.h"
 #include "htslib/sam.h"
 
+class ReadDB;
+class ReorderBuffer;
+
+// statistics about the pipeline between the bam reader and the worker threads
+struct BamProcessorStats
+{
+    // the number of records waiting to be processed, sampled each time the reader adds a batch
+    size_t num_pushes = 0;
+    size_t sum_queue_depth = 0;
+    size_t max_queue_depth = 0;
+
+    // the total time the workers waited for records, and the reader waited for free space
+    double worker_idle_seconds = 0.0;
+    double reader_wait_seconds = 0.0;
+};
+
 class BamProcessor
 {
 
@@ -34,14 +51,33 @@ class BamProcessor
         // place a limit on the minimum mapping quality
         void set_min_mapping_quality(size_t min_mapq) { m_min_mapping_quality = min_mapq; }
 
-        // process each record in parallel, using the input function
+        // when running on multiple threads, process the records of each batch grouped
+        // by the fast5 file holding their signal, rather than in alignment order, so reads
+        // from the same file are loaded together. The read_idx passed to the function is unchanged
+        void set_fast5_locality(const ReadDB* read_db) { m_read_db = read_db; }
+
+        // mark each read complete in the buffer once the function has run on it, or it was
+        // skipped, so the output the function adds to the buffer is written in bam order.
+        // Reading stops while the buffer is full
+        void set_reorder_buffer(ReorderBuffer* buffer) { m_reorder_buffer = buffer; }
+
+        // process each record in parallel, using the input function.
+        // The bam is read on its own thread while num_threads workers process the records
         void parallel_run( std::function<void(const bam_hdr_t* hdr, 
                                      const bam1_t* record,
                                      size_t read_idx,
                                      int region_start,
                                      int region_end)> func);
 
+        // print the queue and idle time statistics of the last parallel_run
+        void print_stats() const;
+        const BamProcessorStats& get_stats() const { return m_stats; }
+
     private:
+
+        // the order to process the first num_records records in
+        std::vector<size_t> get_processing_order(const std::vector<bam1_t*>& records, size_t num_records) const;
+
         std::string m_bam_file;
         std::string m_region;
     
@@ -53,6 +89,9 @@ class BamProcessor
         int m_num_threads = 1;
         size_t m_max_reads = -1;
         int m_min_mapping_quality = 0;
+        const ReadDB* m_read_db = NULL;
+        ReorderBuffer* m_reorder_buffer = NULL;
+        BamProcessorStats m_stats;
 };
 
 #endif
@@ -8,9 +8,33 @@
 // on each aligned read in parallel
 //
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "htslib/thread_pool.h"
 #include "nanopolish_bam_utils.h"
 
+// The thread pool shared by all open bam files. It is destroyed at exit,
+// after every file using it has been closed
+struct BamIOThreadPool
+{
+    BamIOThreadPool() { pool.pool = NULL; pool.qsize = 0; }
+    ~BamIOThreadPool() { destroy(); }
+
+    void destroy()
+    {
+        if(pool.pool != NULL) {
+            hts_tpool_destroy(pool.pool);
+            pool.pool = NULL;
+        }
+    }
+
+    htsThreadPool pool;
+};
+
+static BamIOThreadPool g_bam_io_pool;
+static std::string g_cram_reference;
+
 void write_bam_vardata(bam1_t* record,
                       const std::string& qname,
                       const std::vector<uint32_t> cigar,
@@ -79,3 +103,61 @@ void write_bam_vardata(bam1_t* record,
     }
     assert(record->l_data <= record->m_data);
 }
+
+void set_bam_io_threads(int io_threads, int num_threads)
+{
+    if(io_threads < 0) {
+        io_threads = num_threads;
+    }
+
+    g_bam_io_pool.destroy();
+    if(io_threads <= 0) {
+        return;
+    }
+
+    g_bam_io_pool.pool.pool = hts_tpool_init(io_threads);
+    if(g_bam_io_pool.pool.pool == NULL) {
+        fprintf(stderr, "error: could not create a pool of %d bam io threads\n", io_threads);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void set_cram_reference(const std::string& fasta_filename)
+{
+    g_cram_reference = fasta_filename;
+}
+
+htsFile* open_bam_file(const std::string& filename, const char* mode)
+{
+    htsFile* fp = hts_open(filename.c_str(), mode);
+    if(fp == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    // cram records are stored as differences to the reference
+    if(!g_cram_reference.empty() && hts_set_fai_filename(fp, g_cram_reference.c_str()) != 0) {
+        fprintf(stderr, "error: could not use %s as the reference for %s\n", g_cram_reference.c_str(), filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if(g_bam_io_pool.pool.pool != NULL) {
+        hts_set_opt(fp, HTS_OPT_THREAD_POOL, &g_bam_io_pool.pool);
+    }
+    return fp;
+}
+
+BGZF* open_bgzf_file(const std::string& filename, const char* mode)
+{
+    BGZF* fp = bgzf_open(filename.c_str(), mode);
+    if(fp == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if(g_bam_io_pool.pool.pool != NULL && bgzf_thread_pool(fp, g_bam_io_pool.pool.pool, g_bam_io_pool.pool.qsize) != 0) {
+        fprintf(stderr, "error: could not use the io thread pool for %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    return fp;
+}
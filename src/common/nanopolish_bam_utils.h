@@ -13,6 +13,7 @@
 #include <string>
 #include <vector>
 #include "htslib/hts.h"
+#include "htslib/bgzf.h"
 #include "htslib/sam.h"
 
 // Allocate space for the variable-length fields
@@ -26,4 +27,25 @@ void write_bam_vardata(bam1_t* record,
                        const std::string& qual,
                        size_t aux_reserve = 0);
 
+// Use a pool of io_threads threads, shared by every file opened
+// with open_bam_file, to compress and decompress bam and cram data.
+// Must be called before any file is opened. 0 disables the pool and
+// a negative value, the --io-threads default, uses num_threads.
+void set_bam_io_threads(int io_threads, int num_threads = 0);
+
+// Usage line for the --io-threads option of subprograms that call set_bam_io_threads
+#define BAM_IO_THREADS_USAGE_MESSAGE \
+"      --io-threads=NUM                 use NUM threads to decompress and compress bam/cram data (default: same as -t)\n"
+
+// Set the reference fasta used to decode cram files opened with open_bam_file
+void set_cram_reference(const std::string& fasta_filename);
+
+// Open a sam/bam/cram file with the shared thread pool and cram reference
+// attached. Exits with an error if the file cannot be opened.
+htsFile* open_bam_file(const std::string& filename, const char* mode);
+
+// Open a bgzip compressed file with the shared thread pool attached.
+// Exits with an error if the file cannot be opened.
+BGZF* open_bgzf_file(const std::string& filename, const char* mode);
+
 #endif
@@ -0,0 +1,122 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_fast5_cache -- keeps recently used fast5 files
+// open so that reads from the same multi-fast5 file do not
+// each pay for H5Fopen. Each thread has its own cache.
+//
+#include <stdio.h>
+#include <atomic>
+#include <list>
+#include "nanopolish_fast5_cache.h"
+
+static std::atomic<size_t> g_cache_size(FAST5_CACHE_DEFAULT_SIZE);
+static std::atomic<size_t> g_cache_hits(0);
+static std::atomic<size_t> g_cache_misses(0);
+
+//
+struct Fast5CacheEntry
+{
+    std::string filename;
+    fast5_file fh;
+
+    // the number of handles given out and not yet released, entries in use are never evicted
+    int num_users;
+};
+
+// The open files of one thread, most recently used first. The caches are small so
+// lookups scan the list rather than maintaining an index
+class Fast5ThreadCache
+{
+    public:
+        ~Fast5ThreadCache()
+        {
+            for(auto& entry : m_entries) {
+                fast5_close(entry.fh);
+            }
+        }
+
+        fast5_file open(const std::string& filename)
+        {
+            for(auto iter = m_entries.begin(); iter != m_entries.end(); ++iter) {
+                if(iter->filename == filename) {
+                    g_cache_hits += 1;
+                    iter->num_users += 1;
+                    m_entries.splice(m_entries.begin(), m_entries, iter);
+                    return iter->fh;
+                }
+            }
+
+            g_cache_misses += 1;
+            fast5_file fh = fast5_open(filename);
+            if(fast5_is_open(fh) && g_cache_size > 0) {
+                m_entries.push_front({ filename, fh, 1 });
+                evict();
+            }
+            return fh;
+        }
+
+        void release(fast5_file& fh)
+        {
+            for(auto& entry : m_entries) {
+                if(entry.fh.hdf5_file == fh.hdf5_file) {
+                    entry.num_users -= 1;
+                    evict();
+                    return;
+                }
+            }
+
+            // not cached
+            if(fast5_is_open(fh)) {
+                fast5_close(fh);
+            }
+        }
+
+    private:
+
+        // close the least recently used files that are not in use until the cache fits
+        void evict()
+        {
+            auto iter = m_entries.end();
+            while(m_entries.size() > g_cache_size && iter != m_entries.begin()) {
+                --iter;
+                if(iter->num_users == 0) {
+                    fast5_close(iter->fh);
+                    iter = m_entries.erase(iter);
+                }
+            }
+        }
+
+        std::list<Fast5CacheEntry> m_entries;
+};
+
+static thread_local Fast5ThreadCache t_cache;
+
+//
+fast5_file fast5_cache_open(const std::string& filename)
+{
+    return t_cache.open(filename);
+}
+
+//
+void fast5_cache_release(fast5_file& fh)
+{
+    t_cache.release(fh);
+}
+
+//
+void fast5_cache_set_size(size_t size)
+{
+    g_cache_size = size;
+}
+
+//
+void fast5_cache_print_stats()
+{
+    size_t hits = g_cache_hits;
+    size_t total = hits + g_cache_misses;
+    fprintf(stderr, "[fast5 cache] %zu of %zu file opens reused an open handle (%.1lf%%)\n",
+        hits, total, total > 0 ? 100.0 * hits / total : 0.0);
+}
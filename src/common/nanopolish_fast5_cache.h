@@ -0,0 +1,32 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_fast5_cache -- keeps recently used fast5 files
+// open so that reads from the same multi-fast5 file do not
+// each pay for H5Fopen. Each thread has its own cache.
+//
+#ifndef NANOPOLISH_FAST5_CACHE_H
+#define NANOPOLISH_FAST5_CACHE_H
+
+#include <string>
+#include "nanopolish_fast5_io.h"
+
+// the default number of files each thread keeps open
+#define FAST5_CACHE_DEFAULT_SIZE 4
+
+// open a fast5 file, reusing the handle if the calling thread has it cached.
+// The handle must be given back with fast5_cache_release
+fast5_file fast5_cache_open(const std::string& filename);
+
+// give back a handle from fast5_cache_open. The file is only closed if it is not cached
+void fast5_cache_release(fast5_file& fh);
+
+// set the maximum number of files each thread keeps open, 0 disables the cache
+void fast5_cache_set_size(size_t size);
+
+// print the number of hits and misses over all threads
+void fast5_cache_print_stats();
+
+#endif
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <algorithm>
 #include "nanopolish_fast5_io.h"
 
 //#define DEBUG_FAST5_IO 1
@@ -110,18 +111,20 @@ std::string fast5_get_read_id_single_fast5(fast5_file& fh)
 }
 
 //
-raw_table fast5_get_raw_samples(fast5_file& fh, const std::string& read_id, fast5_raw_scaling scaling)
+std::vector<int16_t> fast5_get_raw_int_samples(fast5_file& fh, const std::string& read_id)
 {
-    float* rawptr = NULL;
+    return fast5_get_raw_int_samples_from_group(fh, fast5_get_raw_read_group(fh, read_id));
+}
+
+//
+std::vector<int16_t> fast5_get_raw_int_samples_from_group(fast5_file& fh, const std::string& raw_read_group)
+{
+    std::vector<int16_t> samples;
     hid_t space;
     hsize_t nsample;
     herr_t status;
-    float raw_unit;
-    raw_table rawtbl = { 0, 0, 0, NULL };
 
     // mostly from scrappie
-    std::string raw_read_group = fast5_get_raw_read_group(fh, read_id);
-
     // Create data set name
     std::string signal_path = raw_read_group + "/Signal";
 
@@ -140,29 +143,121 @@ raw_table fast5_get_raw_samples(fast5_file& fh, const std::string& read_id, fast
     }
 
     H5Sget_simple_extent_dims(space, &nsample, NULL);
-    rawptr = (float*)calloc(nsample, sizeof(float));
-    status = H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, rawptr);
+    samples.resize(nsample);
+    status = H5Dread(dset, H5T_NATIVE_INT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, samples.data());
 
     if (status < 0) {
-        free(rawptr);
+        samples.clear();
 #ifdef DEBUG_FAST5_IO
         fprintf(stderr, "Failed to read raw data from dataset %s.\n", signal_path.c_str());
 #endif
         goto cleanup4;
     }
 
-    // convert to pA
-    rawtbl = (raw_table) { nsample, 0, nsample, rawptr };
-    raw_unit = scaling.range / scaling.digitisation;
-    for (size_t i = 0; i < nsample; i++) {
-        rawptr[i] = (rawptr[i] + scaling.offset) * raw_unit;
-    }
-
  cleanup4:
     H5Sclose(space);
  cleanup3:
     H5Dclose(dset);
  cleanup2:
+    return samples;
+}
+
+//
+size_t fast5_stream_raw_int_samples(fast5_file& fh,
+                                    const std::string& read_id,
+                                    size_t chunk_size,
+                                    const std::function<void(const int16_t*, size_t)>& callback)
+{
+    return fast5_stream_raw_int_samples_from_group(fh, fast5_get_raw_read_group(fh, read_id), chunk_size, callback);
+}
+
+//
+size_t fast5_stream_raw_int_samples_from_group(fast5_file& fh,
+                                               const std::string& raw_read_group,
+                                               size_t chunk_size,
+                                               const std::function<void(const int16_t*, size_t)>& callback)
+{
+    return fast5_stream_raw_int_samples_range_from_group(fh, raw_read_group, 0, SIZE_MAX, chunk_size, callback);
+}
+
+//
+size_t fast5_stream_raw_int_samples_range_from_group(fast5_file& fh,
+                                                     const std::string& raw_read_group,
+                                                     size_t sample_start,
+                                                     size_t sample_end,
+                                                     size_t chunk_size,
+                                                     const std::function<void(const int16_t*, size_t)>& callback)
+{
+    size_t total_read = 0;
+    hid_t space;
+    hsize_t nsample;
+    std::vector<int16_t> buffer;
+
+    std::string signal_path = raw_read_group + "/Signal";
+
+    hid_t dset = H5Dopen(fh.hdf5_file, signal_path.c_str(), H5P_DEFAULT);
+    if (dset < 0) {
+#ifdef DEBUG_FAST5_IO
+        fprintf(stderr, "Failed to open dataset '%s' to read raw signal from.\n", signal_path.c_str());
+#endif
+        return 0;
+    }
+
+    space = H5Dget_space(dset);
+    if (space < 0) {
+        fprintf(stderr, "Failed to create copy of dataspace for raw signal %s.\n", signal_path.c_str());
+        H5Dclose(dset);
+        return 0;
+    }
+
+    H5Sget_simple_extent_dims(space, &nsample, NULL);
+    nsample = std::min(nsample, (hsize_t)sample_end);
+    buffer.resize(std::min((hsize_t)chunk_size, nsample));
+
+    // read the signal one hyperslab at a time
+    for(hsize_t start = sample_start; start < nsample; start += chunk_size) {
+        hsize_t count = std::min((hsize_t)chunk_size, nsample - start);
+        hid_t memspace = H5Screate_simple(1, &count, NULL);
+        herr_t status = H5Sselect_hyperslab(space, H5S_SELECT_SET, &start, NULL, &count, NULL);
+        if(status >= 0) {
+            status = H5Dread(dset, H5T_NATIVE_INT16, memspace, space, H5P_DEFAULT, buffer.data());
+        }
+        H5Sclose(memspace);
+
+        if(status < 0) {
+#ifdef DEBUG_FAST5_IO
+            fprintf(stderr, "Failed to read raw data from dataset %s.\n", signal_path.c_str());
+#endif
+            break;
+        }
+
+        callback(buffer.data(), count);
+        total_read += count;
+    }
+
+    H5Sclose(space);
+    H5Dclose(dset);
+    return total_read;
+}
+
+//
+raw_table fast5_get_raw_samples(fast5_file& fh, const std::string& read_id, fast5_raw_scaling scaling)
+{
+    raw_table rawtbl = { 0, 0, 0, NULL };
+    std::vector<int16_t> int_samples = fast5_get_raw_int_samples(fh, read_id);
+    if(int_samples.empty()) {
+        return rawtbl;
+    }
+
+    // convert to pA
+    size_t nsample = int_samples.size();
+    float* rawptr = (float*)calloc(nsample, sizeof(float));
+    float raw_unit = scaling.range / scaling.digitisation;
+    for (size_t i = 0; i < nsample; i++) {
+        rawptr[i] = fast5_raw_to_pA(int_samples[i], scaling.offset, raw_unit);
+    }
+
+    rawtbl = (raw_table) { nsample, 0, nsample, rawptr };
     return rawtbl;
 }
 
@@ -238,6 +333,17 @@ fast5_raw_scaling fast5_get_channel_params(fast5_file& fh, const std::string& re
     return scaling;
 }
 
+//
+fast5_read_info fast5_get_read_info(fast5_file& fh, const std::string& read_id)
+{
+    fast5_read_info info;
+    info.raw_read_group = fast5_get_raw_read_group(fh, read_id);
+    info.sequencing_kit = fast5_get_sequencing_kit(fh, read_id);
+    info.experiment_type = fast5_get_experiment_type(fh, read_id);
+    info.channel_params = fast5_get_channel_params(fh, read_id);
+    return info;
+}
+
 //
 // Internal functions
 //
@@ -386,3 +492,87 @@ close_group:
 
     return out;
 }
+
+// read a scalar integer attribute, returns -1 if it is not present
+static int64_t fast5_get_int_attribute(fast5_file& fh, const std::string& group_name, const char* attribute_name)
+{
+    int64_t val = -1;
+
+    // check each level of the path exists, H5Lexists fails if an intermediate group is missing
+    for(size_t pos = group_name.find('/', 1); ; pos = group_name.find('/', pos + 1)) {
+        std::string prefix = group_name.substr(0, pos);
+        if(H5Lexists(fh.hdf5_file, prefix.c_str(), H5P_DEFAULT) <= 0) {
+            return val;
+        }
+        if(pos == std::string::npos) {
+            break;
+        }
+    }
+
+    hid_t group = H5Gopen(fh.hdf5_file, group_name.c_str(), H5P_DEFAULT);
+    if(group < 0) {
+        return val;
+    }
+
+    if(H5Aexists(group, attribute_name) > 0) {
+        hid_t attr = H5Aopen(group, attribute_name, H5P_DEFAULT);
+        if(attr >= 0) {
+            if(H5Aread(attr, H5T_NATIVE_INT64, &val) < 0) {
+                val = -1;
+            }
+            H5Aclose(attr);
+        }
+    }
+    H5Gclose(group);
+    return val;
+}
+
+//
+fast5_basecall_moves fast5_get_basecall_moves(fast5_file& fh, const std::string& raw_read_group)
+{
+    fast5_basecall_moves out = { 0, 0, std::vector<uint8_t>() };
+
+    // the analyses are in the read's group of a multi-fast5 file, and at the root of a single read file
+    std::string read_root;
+    if(fh.is_multi_fast5) {
+        size_t pos = raw_read_group.rfind("/Raw");
+        if(pos == std::string::npos) {
+            return out;
+        }
+        read_root = raw_read_group.substr(0, pos);
+    }
+
+    std::string basecall_group = read_root + "/Analyses/Basecall_1D_000";
+    int64_t first_sample = fast5_get_int_attribute(fh, read_root + "/Analyses/Segmentation_000/Summary/segmentation", "first_sample_template");
+    int64_t stride = fast5_get_int_attribute(fh, basecall_group + "/Summary/basecall_1d_template", "block_stride");
+    if(first_sample < 0 || stride <= 0) {
+        return out;
+    }
+
+    std::string move_path = basecall_group + "/BaseCalled_template/Move";
+    if(H5Lexists(fh.hdf5_file, (basecall_group + "/BaseCalled_template").c_str(), H5P_DEFAULT) <= 0 ||
+       H5Lexists(fh.hdf5_file, move_path.c_str(), H5P_DEFAULT) <= 0) {
+        return out;
+    }
+
+    hid_t dset = H5Dopen(fh.hdf5_file, move_path.c_str(), H5P_DEFAULT);
+    if(dset < 0) {
+        return out;
+    }
+
+    hid_t space = H5Dget_space(dset);
+    if(space >= 0) {
+        hsize_t n;
+        H5Sget_simple_extent_dims(space, &n, NULL);
+        out.moves.resize(n);
+        if(H5Dread(dset, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.moves.data()) < 0) {
+            out.moves.clear();
+        }
+        H5Sclose(space);
+    }
+    H5Dclose(dset);
+
+    out.first_sample = first_sample;
+    out.stride = stride;
+    return out;
+}
@@ -10,8 +10,10 @@
 #ifndef NANOPOLISH_FAST5_IO_H
 #define NANOPOLISH_FAST5_IO_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
+#include <functional>
 #include <hdf5.h>
 
 extern "C" {
@@ -28,6 +30,12 @@ typedef struct {
     float sample_rate;
 } fast5_raw_scaling;
 
+// convert a raw ADC value to pA, raw_unit is range / digitisation
+inline float fast5_raw_to_pA(int16_t raw, float offset, float raw_unit)
+{
+    return (raw + offset) * raw_unit;
+}
+
 //
 struct fast5_file
 {
@@ -35,6 +43,25 @@ struct fast5_file
     bool is_multi_fast5;
 };
 
+// The move table of a basecall. Block i of the basecaller starts at sample first_sample + i * stride
+// and a move of 1 means a new base starts in that block
+struct fast5_basecall_moves
+{
+    uint64_t first_sample;
+    uint32_t stride;
+    std::vector<uint8_t> moves;
+};
+
+// Where the signal of a read is in its file and the metadata needed to interpret it.
+// nanopolish index records this so reads can be loaded without group or attribute lookups
+struct fast5_read_info
+{
+    std::string raw_read_group;
+    std::string sequencing_kit;
+    std::string experiment_type;
+    fast5_raw_scaling channel_params;
+};
+
 //
 // External API
 //
@@ -66,7 +93,39 @@ std::vector<std::string> fast5_get_multi_read_groups(fast5_file& fh);
 // Functions to get the samples or metadata
 //
 
-// get the raw samples from this file
+// get the raw samples from this file, as unconverted ADC values. Returns an empty vector on failure
+std::vector<int16_t> fast5_get_raw_int_samples(fast5_file& fh, const std::string& read_id);
+
+// as above, for the read whose raw read group is already known
+std::vector<int16_t> fast5_get_raw_int_samples_from_group(fast5_file& fh, const std::string& raw_read_group);
+
+// read the raw samples from this file in chunks of at most chunk_size ADC values,
+// passing each to callback in order so the whole signal never has to be in memory.
+// Returns the number of samples read
+size_t fast5_stream_raw_int_samples(fast5_file& fh,
+                                    const std::string& read_id,
+                                    size_t chunk_size,
+                                    const std::function<void(const int16_t*, size_t)>& callback);
+
+// as above, for the read whose raw read group is already known
+size_t fast5_stream_raw_int_samples_from_group(fast5_file& fh,
+                                               const std::string& raw_read_group,
+                                               size_t chunk_size,
+                                               const std::function<void(const int16_t*, size_t)>& callback);
+
+// as above, for only the samples in [sample_start, sample_end)
+size_t fast5_stream_raw_int_samples_range_from_group(fast5_file& fh,
+                                                     const std::string& raw_read_group,
+                                                     size_t sample_start,
+                                                     size_t sample_end,
+                                                     size_t chunk_size,
+                                                     const std::function<void(const int16_t*, size_t)>& callback);
+
+// get the move table of the template basecall in the Basecall_1D_000 analysis of the read.
+// The moves are empty if the file does not have them
+fast5_basecall_moves fast5_get_basecall_moves(fast5_file& fh, const std::string& raw_read_group);
+
+// get the raw samples from this file, converted to pA
 raw_table fast5_get_raw_samples(fast5_file& fh, const std::string& read_id, fast5_raw_scaling scaling);
 
 // Get the sequencing kit
@@ -78,6 +137,9 @@ std::string fast5_get_experiment_type(fast5_file& fh, const std::string& read_id
 // Get sample rate, and ADC-to-pA scalings
 fast5_raw_scaling fast5_get_channel_params(fast5_file& fh, const std::string& read_id);
 
+// Get the raw read group, sequencing kit, experiment type and channel parameters of a read
+fast5_read_info fast5_get_read_info(fast5_file& fh, const std::string& read_id);
+
 //
 // Internal utility functions
 //
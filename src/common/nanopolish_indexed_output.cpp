@@ -0,0 +1,318 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_indexed_output -- bgzip compressed text output
+// with an index of the reference span of each read's rows,
+// so the rows of the reads in a region can be read without
+// decompressing the whole file
+//
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "nanopolish_bam_utils.h"
+#include "nanopolish_indexed_output.h"
+
+static const char INDEXED_OUTPUT_MAGIC[8] = { 'N', 'P', 'I', 'D', 'X', '0', '0', '2' };
+
+//
+IndexedOutputWriter::IndexedOutputWriter(const std::string& filename) : m_filename(filename),
+                                                                        m_offset(0),
+                                                                        m_header_length(0),
+                                                                        m_index_started(false)
+{
+    m_bgzf = open_bgzf_file(filename, "w");
+
+    // the .gzi index maps offsets in the text to offsets in the compressed file
+    if(bgzf_index_build_init(m_bgzf) != 0) {
+        fprintf(stderr, "error: could not start the bgzip index for %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+IndexedOutputWriter::~IndexedOutputWriter()
+{
+    if(m_bgzf != NULL) {
+        close();
+    }
+}
+
+//
+void IndexedOutputWriter::write_header(const std::string& text)
+{
+    // the header must come before the first read
+    assert(!m_index_started);
+    write_bytes(text);
+}
+
+//
+void IndexedOutputWriter::write(const std::string& text, const std::string& contig, int start, int end)
+{
+    if(text.empty()) {
+        return;
+    }
+
+    // everything before the first read is the header
+    if(!m_index_started) {
+        m_header_length = m_offset;
+        m_index_started = true;
+    }
+
+    auto iter = m_contig_indices.find(contig);
+    if(iter == m_contig_indices.end()) {
+        iter = m_contig_indices.insert(std::make_pair(contig, (uint32_t)m_contig_names.size())).first;
+        m_contig_names.push_back(contig);
+    }
+
+    PendingEntry entry = { iter->second, start, end, m_offset, text.size() };
+    m_entries.push_back(entry);
+    write_bytes(text);
+}
+
+//
+void IndexedOutputWriter::close()
+{
+    assert(m_bgzf != NULL);
+    if(bgzf_index_dump(m_bgzf, m_filename.c_str(), ".gzi") != 0 || bgzf_close(m_bgzf) != 0) {
+        fprintf(stderr, "error: could not write %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    m_bgzf = NULL;
+
+    if(!m_index_started) {
+        m_header_length = m_offset;
+    }
+    write_index();
+}
+
+//
+void IndexedOutputWriter::write_index()
+{
+    std::sort(m_entries.begin(), m_entries.end(), [](const PendingEntry& a, const PendingEntry& b) {
+        if(a.contig_idx != b.contig_idx) {
+            return a.contig_idx < b.contig_idx;
+        }
+        return a.start != b.start ? a.start < b.start : a.offset < b.offset;
+    });
+
+    std::vector<IndexedOutputContig> contigs(m_contig_names.size());
+    std::string names;
+    for(size_t i = 0; i < m_contig_names.size(); ++i) {
+        contigs[i].name_offset = names.size();
+        contigs[i].name_length = m_contig_names[i].size();
+        contigs[i].first_read = 0;
+        contigs[i].num_reads = 0;
+        contigs[i].max_span = 0;
+        names.append(m_contig_names[i]);
+    }
+
+    std::vector<IndexedOutputRead> reads(m_entries.size());
+    for(size_t i = 0; i < m_entries.size(); ++i) {
+        const PendingEntry& entry = m_entries[i];
+        IndexedOutputContig& contig = contigs[entry.contig_idx];
+        if(contig.num_reads == 0) {
+            contig.first_read = i;
+        }
+        contig.num_reads += 1;
+        contig.max_span = std::max(contig.max_span, (int64_t)entry.end - entry.start);
+
+        reads[i].start = entry.start;
+        reads[i].end = entry.end;
+        reads[i].offset = entry.offset;
+        reads[i].length = entry.length;
+    }
+
+    IndexedOutputHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEXED_OUTPUT_MAGIC, sizeof(INDEXED_OUTPUT_MAGIC));
+    header.header_length = m_header_length;
+    header.num_contigs = contigs.size();
+    header.num_reads = reads.size();
+    header.contigs_offset = sizeof(header);
+    header.reads_offset = header.contigs_offset + contigs.size() * sizeof(IndexedOutputContig);
+    header.names_offset = header.reads_offset + reads.size() * sizeof(IndexedOutputRead);
+    header.names_size = names.size();
+
+    std::string index_filename = m_filename + INDEXED_OUTPUT_SUFFIX;
+    FILE* fp = fopen(index_filename.c_str(), "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "error: could not open %s for write\n", index_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(contigs.data(), sizeof(IndexedOutputContig), contigs.size(), fp) == contigs.size() &&
+                   fwrite(reads.data(), sizeof(IndexedOutputRead), reads.size(), fp) == reads.size() &&
+                   fwrite(names.data(), 1, names.size(), fp) == names.size();
+    if(fclose(fp) != 0 || !success) {
+        fprintf(stderr, "error: could not write %s\n", index_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    m_entries.clear();
+}
+
+//
+void IndexedOutputWriter::write_bytes(const std::string& text)
+{
+    if(bgzf_write(m_bgzf, text.data(), text.size()) != (ssize_t)text.size()) {
+        fprintf(stderr, "error: could not write %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    m_offset += text.size();
+}
+
+//
+IndexedOutputReader::IndexedOutputReader(const std::string& filename) : m_filename(filename)
+{
+    m_bgzf = open_bgzf_file(filename, "r");
+    if(bgzf_index_load(m_bgzf, filename.c_str(), ".gzi") != 0) {
+        fprintf(stderr, "error: could not load the bgzip index %s.gzi\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::string index_filename = filename + INDEXED_OUTPUT_SUFFIX;
+    int fd = open(index_filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "error: could not open the read index %s\n", index_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat file_stat;
+    void* data = MAP_FAILED;
+    if(fstat(fd, &file_stat) == 0 && file_stat.st_size >= (off_t)sizeof(IndexedOutputHeader)) {
+        data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    // check that the tables are within the file
+    size_t size = data != MAP_FAILED ? file_stat.st_size : 0;
+    const IndexedOutputHeader* header = (const IndexedOutputHeader*)data;
+    bool valid = data != MAP_FAILED &&
+                 memcmp(header->magic, INDEXED_OUTPUT_MAGIC, sizeof(INDEXED_OUTPUT_MAGIC)) == 0 &&
+                 header->contigs_offset + header->num_contigs * sizeof(IndexedOutputContig) <= size &&
+                 header->reads_offset + header->num_reads * sizeof(IndexedOutputRead) <= size &&
+                 header->names_offset + header->names_size <= size;
+    if(!valid) {
+        fprintf(stderr, "error: %s is not a read index for this version of nanopolish\n", index_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    m_mapped_data = (const char*)data;
+    m_mapped_size = size;
+    m_header = header;
+    m_contigs = (const IndexedOutputContig*)(m_mapped_data + header->contigs_offset);
+    m_reads = (const IndexedOutputRead*)(m_mapped_data + header->reads_offset);
+
+    const char* names = m_mapped_data + header->names_offset;
+    for(uint64_t i = 0; i < header->num_contigs; ++i) {
+        const IndexedOutputContig& contig = m_contigs[i];
+        if(contig.name_offset + contig.name_length > header->names_size ||
+           contig.first_read + contig.num_reads > header->num_reads) {
+            fprintf(stderr, "error: malformed read index %s\n", index_filename.c_str());
+            exit(EXIT_FAILURE);
+        }
+        m_contig_indices[std::string(names + contig.name_offset, contig.name_length)] = i;
+    }
+}
+
+//
+IndexedOutputReader::~IndexedOutputReader()
+{
+    munmap((void*)m_mapped_data, m_mapped_size);
+    bgzf_close(m_bgzf);
+}
+
+//
+void IndexedOutputReader::write_header(FILE* fp)
+{
+    copy_range(fp, 0, m_header->header_length);
+}
+
+//
+void IndexedOutputReader::find_region(const std::string& contig, int start, int end, std::vector<const IndexedOutputRead*>& out) const
+{
+    auto iter = m_contig_indices.find(contig);
+    if(iter == m_contig_indices.end()) {
+        return;
+    }
+
+    // the reads are sorted by start, so the reads that overlap the region start
+    // in [start - max_span, end]
+    const IndexedOutputContig& c = m_contigs[iter->second];
+    const IndexedOutputRead* first = m_reads + c.first_read;
+    const IndexedOutputRead* last = first + c.num_reads;
+    int64_t min_start = (int64_t)start - c.max_span;
+
+    const IndexedOutputRead* lower = std::lower_bound(first, last, min_start,
+        [](const IndexedOutputRead& r, int64_t s) { return r.start < s; });
+    const IndexedOutputRead* upper = std::upper_bound(lower, last, (int64_t)end,
+        [](int64_t e, const IndexedOutputRead& r) { return e < r.start; });
+
+    for(const IndexedOutputRead* r = lower; r != upper; ++r) {
+        if(r->end >= start) {
+            out.push_back(r);
+        }
+    }
+}
+
+//
+void IndexedOutputReader::write_region(FILE* fp, const std::string& contig, int start, int end)
+{
+    std::vector<const IndexedOutputRead*> reads;
+    find_region(contig, start, end, reads);
+    write_reads(fp, reads);
+}
+
+//
+void IndexedOutputReader::write_regions(FILE* fp, const std::vector<std::string>& contigs,
+                                                  const std::vector<int>& starts,
+                                                  const std::vector<int>& ends)
+{
+    assert(contigs.size() == starts.size() && contigs.size() == ends.size());
+    std::vector<const IndexedOutputRead*> reads;
+    for(size_t i = 0; i < contigs.size(); ++i) {
+        find_region(contigs[i], starts[i], ends[i], reads);
+    }
+    write_reads(fp, reads);
+}
+
+//
+void IndexedOutputReader::write_reads(FILE* fp, std::vector<const IndexedOutputRead*>& reads)
+{
+    std::sort(reads.begin(), reads.end(), [](const IndexedOutputRead* a, const IndexedOutputRead* b) {
+        return a->offset < b->offset;
+    });
+    reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+
+    for(const IndexedOutputRead* r : reads) {
+        copy_range(fp, r->offset, r->length);
+    }
+}
+
+//
+void IndexedOutputReader::copy_range(FILE* fp, uint64_t offset, uint64_t length)
+{
+    if(length == 0) {
+        return;
+    }
+
+    if(bgzf_useek(m_bgzf, offset, SEEK_SET) != 0) {
+        fprintf(stderr, "error: could not seek in %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::string buffer(length, '\0');
+    if(bgzf_read(m_bgzf, &buffer[0], length) != (ssize_t)length) {
+        fprintf(stderr, "error: could not read %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fwrite(buffer.data(), 1, length, fp);
+}
@@ -0,0 +1,150 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_indexed_output -- bgzip compressed text output
+// with an index of the reference span of each read's rows,
+// so the rows of the reads in a region can be read without
+// decompressing the whole file
+//
+// FILE is the bgzip compressed text, FILE.gzi is the bgzip
+// index and FILE.idx is a binary table of the reads, sorted
+// by contig and start so a region can be binary searched
+//
+#ifndef NANOPOLISH_INDEXED_OUTPUT_H
+#define NANOPOLISH_INDEXED_OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "htslib/bgzf.h"
+
+// the suffix of the read index written next to the output
+#define INDEXED_OUTPUT_SUFFIX ".idx"
+
+class IndexedOutputWriter
+{
+    public:
+        // compression uses the bam io thread pool, so set_bam_io_threads must be called first
+        IndexedOutputWriter(const std::string& filename);
+        ~IndexedOutputWriter();
+
+        // write text that is not part of any read, like the header line
+        void write_header(const std::string& text);
+
+        // write the rows of one read, which cover [start, end] on contig. Only one thread can write at a time
+        void write(const std::string& text, const std::string& contig, int start, int end);
+
+        // write the indices and close the file
+        void close();
+
+    private:
+
+        // a read of the index before it is sorted
+        struct PendingEntry
+        {
+            uint32_t contig_idx;
+            int start;
+            int end;
+            uint64_t offset;
+            uint64_t length;
+        };
+
+        void write_bytes(const std::string& text);
+
+        // sort the reads and write the read index
+        void write_index();
+
+        std::string m_filename;
+        BGZF* m_bgzf;
+        uint64_t m_offset;
+        uint64_t m_header_length;
+        bool m_index_started;
+
+        // contigs are numbered in the order they are first written
+        std::map<std::string, uint32_t> m_contig_indices;
+        std::vector<std::string> m_contig_names;
+        std::vector<PendingEntry> m_entries;
+};
+
+// Layout of FILE.idx. The header is followed by the contig table, the read
+// table and the characters of the contig names. The reads of each contig are
+// contiguous in the read table and sorted by start, then by offset in the text.
+// Offsets into the names are relative to their start, the other offsets are
+// relative to the start of the file.
+struct IndexedOutputHeader
+{
+    char magic[8];
+    uint64_t header_length;
+    uint64_t num_contigs;
+    uint64_t num_reads;
+    uint64_t contigs_offset;
+    uint64_t reads_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+};
+
+struct IndexedOutputContig
+{
+    uint64_t name_offset;
+    uint64_t name_length;
+    uint64_t first_read;
+    uint64_t num_reads;
+
+    // the longest span of a read on this contig, bounds how far before
+    // the start of a region an overlapping read can start
+    int64_t max_span;
+};
+
+struct IndexedOutputRead
+{
+    int32_t start;
+    int32_t end;
+    uint64_t offset;
+    uint64_t length;
+};
+
+class IndexedOutputReader
+{
+    public:
+        IndexedOutputReader(const std::string& filename);
+        ~IndexedOutputReader();
+
+        // write the header text to fp
+        void write_header(FILE* fp);
+
+        // append the reads that overlap [start, end] on contig to out
+        void find_region(const std::string& contig, int start, int end, std::vector<const IndexedOutputRead*>& out) const;
+
+        // write the rows of every read that overlaps the region to fp, in the order of the file
+        void write_region(FILE* fp, const std::string& contig, int start, int end);
+
+        // write the rows of every read that overlaps any of the regions to fp, in the order
+        // of the file. Reads that overlap more than one region are written once
+        void write_regions(FILE* fp, const std::vector<std::string>& contigs,
+                                     const std::vector<int>& starts,
+                                     const std::vector<int>& ends);
+
+    private:
+
+        // write the rows of the reads to fp, sorted by offset and without duplicates
+        void write_reads(FILE* fp, std::vector<const IndexedOutputRead*>& reads);
+
+        void copy_range(FILE* fp, uint64_t offset, uint64_t length);
+
+        std::string m_filename;
+        BGZF* m_bgzf;
+
+        // the mapped read index
+        const char* m_mapped_data;
+        size_t m_mapped_size;
+        const IndexedOutputHeader* m_header;
+        const IndexedOutputContig* m_contigs;
+        const IndexedOutputRead* m_reads;
+        std::map<std::string, uint64_t> m_contig_indices;
+};
+
+#endif
@@ -0,0 +1,229 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_reference_db -- in-memory copy of a reference
+// genome, stored as 2-bit packed bases so that it can be
+// queried by many threads without locking. Contigs are
+// packed the first time they are used
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include "nanopolish_reference_db.h"
+
+// number of bases to pull out of the faidx at once while loading
+#define LOAD_CHUNK_SIZE (1 << 20)
+
+static const char PACKED_TO_BASE[4] = { 'A', 'C', 'G', 'T' };
+
+// returns the 2-bit code of an upper case base, or -1 if it is not ACGT
+static inline int base_to_packed(char b)
+{
+    switch(b) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+// set a single (upper case) base of the contig, bases must be set in order
+static inline void set_base(ReferenceContig& contig, uint32_t position, char b)
+{
+    int code = base_to_packed(b);
+    if(code >= 0) {
+        contig.packed[position >> 5] |= (uint64_t)code << ((position & 31) << 1);
+        return;
+    }
+
+    // non-ACGT, extend the previous run if possible
+    if(!contig.exceptions.empty()) {
+        ReferenceExceptionRun& last = contig.exceptions.back();
+        if(last.base == b && last.start + last.length == position) {
+            last.length += 1;
+            return;
+        }
+    }
+    contig.exceptions.push_back({ position, 1, b });
+}
+
+//
+ReferenceDB::~ReferenceDB()
+{
+    if(m_fai != NULL) {
+        fai_destroy(m_fai);
+    }
+}
+
+//
+void ReferenceDB::load(const std::string& fasta_filename)
+{
+    m_fai = fai_load(fasta_filename.c_str());
+    if(m_fai == NULL) {
+        fprintf(stderr, "Error: could not open genome file: %s\n", fasta_filename.c_str());
+        fprintf(stderr, "Please check the path is correct\n");
+        exit(EXIT_FAILURE);
+    }
+    m_fasta_filename = fasta_filename;
+
+    // only the names and lengths are read here
+    int num_contigs = faidx_nseq(m_fai);
+    m_contigs.reserve(num_contigs);
+
+    for(int i = 0; i < num_contigs; ++i) {
+        const char* name = faidx_iseq(m_fai, i);
+        int contig_length = faidx_seq_len(m_fai, name);
+        if(contig_length < 0) {
+            fprintf(stderr, "Error: could not retrieve length of contig %s from the faidx.\n", name);
+            exit(EXIT_FAILURE);
+        }
+
+        m_contig_ids[name] = m_contigs.size();
+        m_contigs.emplace_back();
+        ReferenceContig& contig = m_contigs.back();
+        contig.name = name;
+        contig.length = contig_length;
+        contig.packed_once.reset(new std::once_flag);
+    }
+}
+
+//
+void ReferenceDB::pack_contig(ReferenceContig& contig) const
+{
+    contig.packed.assign((contig.length + 31) / 32, 0);
+
+    // faidx reads share one file handle. Read the contig in chunks to avoid
+    // holding a second full copy of large chromosomes
+    const char* name = contig.name.c_str();
+    int contig_length = contig.length;
+    #pragma omp critical(reference_db_load)
+    for(int chunk_start = 0; chunk_start < contig_length; chunk_start += LOAD_CHUNK_SIZE) {
+        int chunk_end = std::min(chunk_start + LOAD_CHUNK_SIZE, contig_length) - 1;
+        int fetched_len = 0;
+        char* seq = faidx_fetch_seq(m_fai, name, chunk_start, chunk_end, &fetched_len);
+        if(seq == NULL || fetched_len != chunk_end - chunk_start + 1) {
+            fprintf(stderr, "Error: could not load %s:%d-%d from %s\n", name, chunk_start, chunk_end, m_fasta_filename.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        for(int j = 0; j < fetched_len; ++j) {
+            set_base(contig, chunk_start + j, toupper(seq[j]));
+        }
+        free(seq);
+    }
+    contig.exceptions.shrink_to_fit();
+}
+
+//
+const ReferenceContig& ReferenceDB::get_packed_contig(int contig_id) const
+{
+    ReferenceContig& contig = m_contigs[contig_id];
+    std::call_once(*contig.packed_once, [this, &contig]() { pack_contig(contig); });
+    return contig;
+}
+
+//
+void ReferenceDB::add_contig(const std::string& name, const std::string& sequence)
+{
+    m_contig_ids[name] = m_contigs.size();
+    m_contigs.emplace_back();
+    ReferenceContig& contig = m_contigs.back();
+    contig.name = name;
+    contig.length = sequence.length();
+    contig.packed.assign((sequence.length() + 31) / 32, 0);
+
+    for(size_t i = 0; i < sequence.length(); ++i) {
+        set_base(contig, i, toupper(sequence[i]));
+    }
+
+    // the sequence is already packed
+    contig.packed_once.reset(new std::once_flag);
+    std::call_once(*contig.packed_once, []() {});
+}
+
+//
+int ReferenceDB::get_contig_id(const std::string& name) const
+{
+    auto iter = m_contig_ids.find(name);
+    return iter != m_contig_ids.end() ? iter->second : -1;
+}
+
+//
+std::string ReferenceDB::get_subsequence(const std::string& contig, int start, int end, int* fetched_len) const
+{
+    int contig_id = get_contig_id(contig);
+    if(contig_id == -1) {
+        fprintf(stderr, "Error: contig %s is not in the reference genome\n", contig.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    // clamp coordinates to the contig, as faidx_fetch_seq does
+    int contig_length = m_contigs[contig_id].length;
+    end = std::min(end, contig_length - 1);
+    start = std::max(start, 0);
+
+    std::string out;
+    if(start <= end) {
+        out.resize(end - start + 1);
+        get_subsequence(contig_id, start, end, &out[0]);
+    }
+
+    *fetched_len = out.length();
+    return out;
+}
+
+//
+int ReferenceDB::get_subsequence(int contig_id, int start, int end, char* out) const
+{
+    const ReferenceContig& contig = get_packed_contig(contig_id);
+    assert(start >= 0);
+    assert(end < (int)contig.length);
+    if(start > end) {
+        return 0;
+    }
+
+    for(int i = start; i <= end; ++i) {
+        out[i - start] = PACKED_TO_BASE[get_code(contig, i)];
+    }
+
+    // overwrite the bases that could not be packed
+    auto iter = std::upper_bound(contig.exceptions.begin(), contig.exceptions.end(), (uint32_t)start,
+                                 [](uint32_t p, const ReferenceExceptionRun& run) { return p < run.start + run.length; });
+
+    for(; iter != contig.exceptions.end() && (int)iter->start <= end; ++iter) {
+        int run_start = std::max((int)iter->start, start);
+        int run_end = std::min((int)(iter->start + iter->length) - 1, end);
+        for(int i = run_start; i <= run_end; ++i) {
+            out[i - start] = iter->base;
+        }
+    }
+
+    return end - start + 1;
+}
+
+//
+bool ReferenceDB::get_kmer_rank(int contig_id, int position, uint32_t k, uint32_t& rank) const
+{
+    const ReferenceContig& contig = get_packed_contig(contig_id);
+    if(position < 0 || position + k > contig.length) {
+        return false;
+    }
+
+    // reject k-mers overlapping a non-ACGT run
+    auto iter = std::upper_bound(contig.exceptions.begin(), contig.exceptions.end(), (uint32_t)position,
+                                 [](uint32_t p, const ReferenceExceptionRun& run) { return p < run.start + run.length; });
+    if(iter != contig.exceptions.end() && iter->start < position + k) {
+        return false;
+    }
+
+    rank = 0;
+    for(uint32_t i = 0; i < k; ++i) {
+        rank = (rank << 2) | get_code(contig, position + i);
+    }
+    return true;
+}
@@ -0,0 +1,112 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_reference_db -- in-memory copy of a reference
+// genome, stored as 2-bit packed bases so that it can be
+// queried by many threads without locking. Contigs are
+// packed the first time they are used
+//
+#ifndef NANOPOLISH_REFERENCE_DB
+#define NANOPOLISH_REFERENCE_DB
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "htslib/faidx.h"
+
+// A run of identical bases that cannot be represented in 2 bits,
+// typically N but any other IUPAC symbol is kept as-is
+struct ReferenceExceptionRun
+{
+    uint32_t start;
+    uint32_t length;
+    char base;
+};
+
+struct ReferenceContig
+{
+    std::string name;
+    uint32_t length;
+
+    // 32 bases per word, base i is stored in bits [2*(i%32), 2*(i%32)+1] of word i/32
+    // using the DNA alphabet ordering (A=0, C=1, G=2, T=3)
+    std::vector<uint64_t> packed;
+
+    // non-ACGT runs, sorted by start position
+    std::vector<ReferenceExceptionRun> exceptions;
+
+    // set once packed and exceptions are filled in
+    std::unique_ptr<std::once_flag> packed_once;
+};
+
+class ReferenceDB
+{
+    public:
+        ReferenceDB() : m_fai(NULL) {}
+        ~ReferenceDB();
+
+        //
+        // I/O
+        //
+
+        // open an (faidx-indexed) fasta file, each sequence is read into memory on first use
+        void load(const std::string& fasta_filename);
+
+        // add a single sequence to the database
+        void add_contig(const std::string& name, const std::string& sequence);
+
+        //
+        // Data Access
+        //
+        // All of these functions are const and safe to call concurrently
+        // once loading has finished. The first access to a contig reads it
+        // from the fasta file, later accesses do not lock.
+
+        size_t get_num_contigs() const { return m_contigs.size(); }
+
+        // returns the internal ID of the contig, or -1 if it is not in the database
+        int get_contig_id(const std::string& name) const;
+
+        const std::string& get_contig_name(int contig_id) const { return m_contigs[contig_id].name; }
+        int get_contig_length(int contig_id) const { return m_contigs[contig_id].length; }
+
+        // Return the upper-case sequence of [start, end] (0-based, inclusive) of a contig.
+        // Coordinates are clamped to the contig like faidx_fetch_seq and the number
+        // of bases returned is written to fetched_len
+        std::string get_subsequence(const std::string& contig, int start, int end, int* fetched_len) const;
+
+        // As above, but decode directly into out, which must have room for end - start + 1 bases.
+        // Returns the number of bases written.
+        int get_subsequence(int contig_id, int start, int end, char* out) const;
+
+        // Calculate the rank of the k-mer starting at position in the DNA alphabet (see Alphabet::kmer_rank).
+        // Returns false if the k-mer runs off the end of the contig or contains a non-ACGT base.
+        bool get_kmer_rank(int contig_id, int position, uint32_t k, uint32_t& rank) const;
+
+    private:
+
+        inline uint32_t get_code(const ReferenceContig& contig, uint32_t position) const
+        {
+            return (contig.packed[position >> 5] >> ((position & 31) << 1)) & 3;
+        }
+
+        // the contig, after packing it if this is its first use
+        const ReferenceContig& get_packed_contig(int contig_id) const;
+
+        // read a contig from the fasta file and pack it
+        void pack_contig(ReferenceContig& contig) const;
+
+        // the sequences are packed on first use, under the once flag of each contig
+        mutable std::vector<ReferenceContig> m_contigs;
+        std::unordered_map<std::string, int> m_contig_ids;
+
+        std::string m_fasta_filename;
+        faidx_t* m_fai;
+};
+
+#endif
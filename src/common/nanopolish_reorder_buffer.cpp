@@ -0,0 +1,155 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_reorder_buffer -- collects the output of reads
+// processed in parallel and writes it in input order, so the
+// output does not depend on the number of threads
+//
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "nanopolish_reorder_buffer.h"
+
+//
+ReorderBuffer::~ReorderBuffer()
+{
+    assert(m_pending.empty());
+}
+
+//
+void ReorderBuffer::add(size_t read_idx, FILE* fp, std::string&& text)
+{
+    if(text.empty()) {
+        return;
+    }
+
+    ReorderBufferChunk chunk;
+    chunk.fp = fp;
+    chunk.text = std::move(text);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(read_idx >= m_next_idx);
+    m_pending[read_idx].chunks.push_back(std::move(chunk));
+}
+
+//
+void ReorderBuffer::add(size_t read_idx, const std::function<void()>& write)
+{
+    ReorderBufferChunk chunk;
+    chunk.fp = NULL;
+    chunk.write = write;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(read_idx >= m_next_idx);
+    m_pending[read_idx].chunks.push_back(std::move(chunk));
+}
+
+//
+void ReorderBuffer::complete(size_t read_idx)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(read_idx >= m_next_idx);
+        m_pending[read_idx].complete = true;
+        m_max_pending = std::max(m_max_pending, m_pending.size());
+
+        // only one thread writes at a time, which keeps the order
+        if(m_writing) {
+            return;
+        }
+        m_writing = true;
+    }
+
+    std::vector<PendingRead> ready;
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ready.clear();
+            auto iter = m_pending.begin();
+            while(iter != m_pending.end() && iter->first == m_next_idx && iter->second.complete) {
+                ready.push_back(std::move(iter->second));
+                iter = m_pending.erase(iter);
+                m_next_idx += 1;
+            }
+
+            if(ready.empty()) {
+                m_writing = false;
+                return;
+            }
+            m_space_cv.notify_all();
+        }
+
+        // write outside of the lock so other threads can keep adding output
+        for(PendingRead& read : ready) {
+            for(ReorderBufferChunk& chunk : read.chunks) {
+                write_chunk(chunk);
+            }
+        }
+    }
+}
+
+//
+bool ReorderBuffer::has_space_locked(size_t start_idx, size_t end_idx) const
+{
+    // with nothing before start_idx left to write the reads can always be started,
+    // even if the window is smaller than the range
+    return m_next_idx == start_idx || end_idx <= m_next_idx + m_window;
+}
+
+//
+bool ReorderBuffer::has_space(size_t start_idx, size_t end_idx)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return has_space_locked(start_idx, end_idx);
+}
+
+//
+void ReorderBuffer::wait_for_space(size_t start_idx, size_t end_idx)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space_cv.wait(lock, [&] { return has_space_locked(start_idx, end_idx); });
+}
+
+//
+void ReorderBuffer::write_chunk(ReorderBufferChunk& chunk)
+{
+    if(chunk.write) {
+        chunk.write();
+        return;
+    }
+
+    if(fwrite(chunk.text.data(), 1, chunk.text.size(), chunk.fp) != chunk.text.size()) {
+        fprintf(stderr, "error: could not write output\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+ReadOutputStream::ReadOutputStream() : m_data(NULL), m_size(0)
+{
+    m_fp = open_memstream(&m_data, &m_size);
+    if(m_fp == NULL) {
+        fprintf(stderr, "error: could not allocate an output buffer\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+ReadOutputStream::~ReadOutputStream()
+{
+    if(m_fp != NULL) {
+        fclose(m_fp);
+    }
+    free(m_data);
+}
+
+//
+std::string ReadOutputStream::release()
+{
+    assert(m_fp != NULL);
+    fclose(m_fp);
+    m_fp = NULL;
+    return std::string(m_data, m_size);
+}
@@ -0,0 +1,101 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_reorder_buffer -- collects the output of reads
+// processed in parallel and writes it in input order, so the
+// output does not depend on the number of threads
+//
+#ifndef NANOPOLISH_REORDER_BUFFER_H
+#define NANOPOLISH_REORDER_BUFFER_H
+
+#include <stdio.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the default number of reads whose output can be held while waiting for an earlier read
+#define REORDER_BUFFER_DEFAULT_WINDOW 1024
+
+// One piece of the output of a read: text for a file, or a function that writes output
+// that is not text, like sam records
+struct ReorderBufferChunk
+{
+    FILE* fp;
+    std::string text;
+    std::function<void()> write;
+};
+
+class ReorderBuffer
+{
+    public:
+        ReorderBuffer(size_t window = REORDER_BUFFER_DEFAULT_WINDOW) : m_window(window) {}
+        ~ReorderBuffer();
+
+        // queue text to be written to fp after the output of every read before read_idx
+        void add(size_t read_idx, FILE* fp, std::string&& text);
+
+        // queue a function to be called after the output of every read before read_idx is written
+        void add(size_t read_idx, const std::function<void()>& write);
+
+        // all output for read_idx has been added, including none if the read was skipped.
+        // Writes out the reads that are now in order. This never waits for other threads to
+        // finish their reads, if another thread is already writing it picks up this read too
+        void complete(size_t read_idx);
+
+        // true if the reads [start_idx, end_idx) can be started without holding more than the window
+        bool has_space(size_t start_idx, size_t end_idx);
+
+        // block until has_space(start_idx, end_idx) is true. Used by the thread reading the input to
+        // bound memory when a slow read holds up the output
+        void wait_for_space(size_t start_idx, size_t end_idx);
+
+        // the most reads that were held at once
+        size_t get_max_pending() const { return m_max_pending; }
+
+    private:
+
+        struct PendingRead
+        {
+            std::vector<ReorderBufferChunk> chunks;
+            bool complete = false;
+        };
+
+        // must be called with m_mutex held
+        bool has_space_locked(size_t start_idx, size_t end_idx) const;
+
+        static void write_chunk(ReorderBufferChunk& chunk);
+
+        std::mutex m_mutex;
+        std::condition_variable m_space_cv;
+        std::map<size_t, PendingRead> m_pending;
+        size_t m_next_idx = 0;
+        size_t m_window;
+        size_t m_max_pending = 0;
+        bool m_writing = false;
+};
+
+// Collects text written with fprintf in memory, so the output of a read
+// can be formatted by the worker thread and handed to a ReorderBuffer
+class ReadOutputStream
+{
+    public:
+        ReadOutputStream();
+        ~ReadOutputStream();
+
+        FILE* fp() const { return m_fp; }
+
+        // close the stream and return everything written to it
+        std::string release();
+
+    private:
+        FILE* m_fp;
+        char* m_data;
+        size_t m_size;
+};
+
+#endif
@@ -0,0 +1,66 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_text_format -- append numbers to a string
+// without the format string parsing of printf, for writing
+// large tables. The text matches what printf would write.
+//
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include "nanopolish_text_format.h"
+
+static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+//
+static void append_fixed_printf(std::string& out, double v, int precision)
+{
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf), "%.*f", precision, v);
+    assert(n > 0 && n < (int)sizeof(buf));
+    out.append(buf, n);
+}
+
+//
+void append_fixed(std::string& out, double v, int precision)
+{
+    assert(precision >= 0 && precision <= 9);
+    double scaled = fabs(v) * powers_of_ten[precision];
+
+    // keep the rounding error of the multiplication well below the tie check below
+    if(!(scaled < 1e9)) {
+        append_fixed_printf(out, v, precision);
+        return;
+    }
+
+    // printf rounds the exact binary value, the multiplication above can be off by a
+    // few ulps so values this near a tie could round either way
+    double lower = floor(scaled);
+    double fraction = scaled - lower;
+    if(fabs(fraction - 0.5) < 1e-6) {
+        append_fixed_printf(out, v, precision);
+        return;
+    }
+
+    uint64_t digits = (uint64_t)(fraction > 0.5 ? lower + 1 : lower);
+    uint64_t divisor = (uint64_t)powers_of_ten[precision];
+
+    // printf keeps the sign of negative values that round to zero
+    if(signbit(v)) {
+        out.push_back('-');
+    }
+    append_uint(out, digits / divisor);
+
+    if(precision > 0) {
+        out.push_back('.');
+        uint64_t fraction_digits = digits % divisor;
+        char buf[9];
+        for(int i = precision - 1; i >= 0; --i) {
+            buf[i] = '0' + (fraction_digits % 10);
+            fraction_digits /= 10;
+        }
+        out.append(buf, precision);
+    }
+}
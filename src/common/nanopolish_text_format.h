@@ -0,0 +1,44 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_text_format -- append numbers to a string
+// without the format string parsing of printf, for writing
+// large tables. The text matches what printf would write.
+//
+#ifndef NANOPOLISH_TEXT_FORMAT_H
+#define NANOPOLISH_TEXT_FORMAT_H
+
+#include <stdint.h>
+#include <string>
+
+// append v, like printf("%llu")
+inline void append_uint(std::string& out, uint64_t v)
+{
+    char buf[20];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = '0' + (v % 10);
+        v /= 10;
+    } while(v != 0);
+    out.append(p, buf + sizeof(buf) - p);
+}
+
+// append v, like printf("%lld")
+inline void append_int(std::string& out, int64_t v)
+{
+    if(v < 0) {
+        out.push_back('-');
+        append_uint(out, -(uint64_t)v);
+    } else {
+        append_uint(out, v);
+    }
+}
+
+// append v with precision digits after the decimal point, like printf("%.*f", precision, v).
+// Values that are not finite, very large, or too close to halfway between two outputs to
+// round reliably here are passed to snprintf
+void append_fixed(std::string& out, double v, int precision);
+
+#endif
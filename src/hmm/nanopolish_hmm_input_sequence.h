@@ -10,6 +10,7 @@
 #define NANOPOLISH_HMM_INPUT_SEQUENCE
 
 #include <string>
+#include <vector>
 #include "nanopolish_common.h"
 #include "nanopolish_alphabet.h"
 
@@ -24,15 +25,17 @@ class HMMInputSequence
         // constructors
         HMMInputSequence(const std::string& seq) : 
                              m_alphabet(&gDNAAlphabet),
-                             m_seq(seq)
+                             m_seq(seq),
+                             m_ranked_k(0)
         {
             m_rc_seq = m_alphabet->reverse_complement(seq);
         }
         
         HMMInputSequence(const std::string& fwd,
                          const Alphabet* alphabet) : 
+                             m_alphabet(alphabet),
                              m_seq(fwd),
-                             m_alphabet(alphabet)
+                             m_ranked_k(0)
         {
             m_rc_seq = m_alphabet->reverse_complement(m_seq);
         }
@@ -42,7 +45,8 @@ class HMMInputSequence
                          const Alphabet* alphabet) : 
                              m_alphabet(alphabet),
                              m_seq(fwd),
-                             m_rc_seq(rc)
+                             m_rc_seq(rc),
+                             m_ranked_k(0)
         {
 
         }
@@ -57,7 +61,24 @@ class HMMInputSequence
         size_t length() const { return m_seq.length(); }
 
         // swap sequence and its reverse complement
-        void swap() { m_seq.swap(m_rc_seq); }
+        void swap()
+        {
+            m_seq.swap(m_rc_seq);
+            if(m_ranked_k > 0) {
+                precompute_kmer_ranks(m_ranked_k);
+            }
+        }
+
+        // compute and cache the ranks of every k-mer of the sequence and its
+        // reverse complement so get_kmer_rank becomes a table lookup for this k
+        void precompute_kmer_ranks(uint32_t k)
+        {
+            m_alphabet->kmer_ranks(m_seq, &m_rc_seq, k, m_kmer_ranks, &m_rc_kmer_ranks);
+            m_ranked_k = k;
+        }
+
+        // returns true if the k-mer ranks have been cached for this k
+        bool has_kmer_ranks(uint32_t k) const { return m_ranked_k == k; }
 
         // returns the i-th kmer of the sequence
         inline std::string get_kmer(uint32_t i, uint32_t k, bool do_rc) const
@@ -75,6 +96,9 @@ class HMMInputSequence
         // NOT the ki-th kmer of the reverse-complemented sequence
         inline uint32_t get_kmer_rank(uint32_t i, uint32_t k, bool do_rc) const
         {
+            if(k == m_ranked_k) {
+                return ! do_rc ? m_kmer_ranks[i] : m_rc_kmer_ranks[i];
+            }
             return ! do_rc ? _kmer_rank(i, k) : _rc_kmer_rank(i, k);
         }
 
@@ -95,6 +119,11 @@ class HMMInputSequence
 
         std::string m_seq;
         std::string m_rc_seq;
+
+        // cached k-mer ranks, valid when m_ranked_k is non-zero
+        uint32_t m_ranked_k;
+        std::vector<uint32_t> m_kmer_ranks;
+        std::vector<uint32_t> m_rc_kmer_ranks;
 };
 
 #endif
@@ -44,7 +44,7 @@ float profile_hmm_score_set(const std::vector<HMMInputSequence>& sequences, cons
 
     // Score the remainder using the alternative alphabets/pore models
     for(size_t seq_idx = 1; seq_idx < sequences.size(); ++seq_idx) {
-        alt_data.pore_model = alt_data.read->get_model(alt_data.strand, sequences[seq_idx].get_alphabet()->get_name());
+        alt_data.pore_model = alt_data.read->get_model(alt_data.strand, sequences[seq_idx].get_alphabet());
         assert(alt_data.pore_model != NULL);
 
         // Score the methylated sequence
@@ -63,3 +63,15 @@ std::vector<HMMAlignmentState> profile_hmm_align(const HMMInputSequence& sequenc
         return profile_hmm_align_r7(sequence, data, flags);
     }
 }
+
+std::vector<HMMAlignmentState> profile_hmm_align_banded(const HMMInputSequence& sequence,
+                                                        const HMMInputData& data,
+                                                        const std::vector<int>& kmer_seed_rows,
+                                                        const uint32_t flags)
+{
+    if(data.read->pore_type == PT_R9) {
+        return profile_hmm_align_banded_r9(sequence, data, kmer_seed_rows, flags);
+    } else {
+        return std::vector<HMMAlignmentState>();
+    }
+}
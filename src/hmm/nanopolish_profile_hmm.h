@@ -30,6 +30,16 @@ float profile_hmm_score_set(const std::vector<HMMInputSequence>& sequence, const
 // Run viterbi to align events to kmers
 std::vector<HMMAlignmentState> profile_hmm_align(const HMMInputSequence& sequence, const HMMInputData& data, const uint32_t flags = 0);
 
+// Run viterbi to align events to kmers, only filling an adaptive band of the matrix so
+// long inputs can be aligned in memory linear in their length. The band starts at the first
+// event and kmer and is kept near the seed path, kmer_seed_rows[i] is the expected offset from
+// event_start_idx of the first event of the i-th kmer. Returns an empty alignment if the best
+// path leaves the band, or for R7 data which is not supported
+std::vector<HMMAlignmentState> profile_hmm_align_banded(const HMMInputSequence& sequence,
+                                                        const HMMInputData& data,
+                                                        const std::vector<int>& kmer_seed_rows,
+                                                        const uint32_t flags = 0);
+
 // Flags to modify the behaviour of the HMM
 enum HMMAlignmentFlags
 {
@@ -303,7 +303,11 @@ inline float profile_hmm_fill_generic_r7(const HMMInputSequence& _sequence,
     const uint32_t k = data.pore_model->k;
 
     // Make sure the HMMInputSequence's alphabet matches the state space of the read
-    assert( data.pore_model->states.size() == sequence.get_num_kmer_ranks(k) );
+    assert( data.pore_model->get_num_states() == sequence.get_num_kmer_ranks(k) );
+
+    if(!sequence.has_kmer_ranks(k)) {
+        sequence.precompute_kmer_ranks(k);
+    }
 
     std::vector<uint32_t> kmer_ranks(num_kmers);
     for(size_t ki = 0; ki < num_kmers; ++ki)
@@ -195,3 +195,262 @@ std::vector<HMMAlignmentState> profile_hmm_align_r9(const HMMInputSequence& sequ
 
     return alignment;
 }
+
+//
+// Banded viterbi
+//
+
+// The band of cells (event e, kmer k) with e + k constant, from the
+// cell with the largest event index at offset 0
+#define PSR9_BANDWIDTH 100
+
+// The movements into the three states of a cell are packed into one byte of the traceback.
+// The match state uses the low 3 bits, the bad event state the next bit and the skip state the top two
+static inline uint8_t pack_banded_trace(uint8_t from_m, uint8_t from_b, uint8_t from_k)
+{
+    uint8_t b = from_b == HMT_FROM_SAME_B;
+    uint8_t k = from_k == HMT_FROM_PREV_M ? 0 : (from_k == HMT_FROM_PREV_B ? 1 : 2);
+    return from_m | (b << 3) | (k << 4);
+}
+
+static inline HMMMovementType unpack_banded_trace(uint8_t trace, ProfileStateR9 ps)
+{
+    static const HMMMovementType from_b[] = { HMT_FROM_SAME_M, HMT_FROM_SAME_B };
+    static const HMMMovementType from_k[] = { HMT_FROM_PREV_M, HMT_FROM_PREV_B, HMT_FROM_PREV_K };
+    switch(ps) {
+        case PSR9_MATCH: return (HMMMovementType)(trace & 7);
+        case PSR9_BAD_EVENT: return from_b[(trace >> 3) & 1];
+        default: return from_k[(trace >> 4) & 3];
+    }
+}
+
+// the same choice as ProfileHMMViterbiOutputR9::update_cell
+static inline float viterbi_max(const HMMUpdateScores& scores, uint8_t& from)
+{
+    float max = scores.x[0];
+    from = 0;
+    for(auto i = 1; i < HMT_NUM_MOVEMENT_TYPES; ++i) {
+        max = scores.x[i] > max ? scores.x[i] : max;
+        from = max == scores.x[i] ? i : from;
+    }
+    return max;
+}
+
+std::vector<HMMAlignmentState> profile_hmm_align_banded_r9(const HMMInputSequence& sequence,
+                                                           const HMMInputData& data,
+                                                           const std::vector<int>& kmer_seed_rows,
+                                                           const uint32_t flags)
+{
+    std::vector<HMMAlignmentState> alignment;
+    assert( (data.rc && data.event_stride == -1) || (!data.rc && data.event_stride == 1));
+
+    const uint32_t k = data.pore_model->k;
+    assert( data.pore_model->get_num_states() == sequence.get_num_kmer_ranks(k) );
+
+    int n_kmers = sequence.length() - k + 1;
+    int n_events = abs((int)data.event_stop_idx - (int)data.event_start_idx) + 1;
+    assert(n_events >= 2);
+    assert((int)kmer_seed_rows.size() == n_kmers);
+
+    uint32_t e_start = data.event_start_idx;
+
+    std::vector<BlockTransitions> transitions = calculate_transitions(n_kmers, sequence, data);
+    std::vector<float> pre_flank = make_pre_flanking(data, e_start, n_events);
+
+    std::vector<uint32_t> kmer_ranks(n_kmers);
+    for(int ki = 0; ki < n_kmers; ++ki) {
+        kmer_ranks[ki] = sequence.get_kmer_rank(ki, k, data.rc);
+    }
+
+    // The scores are only kept for the last three bands, the traceback for every cell
+    const int bandwidth = PSR9_BANDWIDTH;
+    const int half_bandwidth = bandwidth / 2;
+    const int max_seed_distance = half_bandwidth / 2;
+    size_t n_bands = n_events + n_kmers + 1;
+
+    std::vector<float> scores(3 * bandwidth * PSR9_NUM_STATES, -INFINITY);
+    std::vector<uint8_t> trace(n_bands * bandwidth, 0);
+
+    struct EventKmerPair
+    {
+        int event_idx;
+        int kmer_idx;
+    };
+    std::vector<EventKmerPair> band_lower_left(n_bands);
+
+#define BANDED_SCORE(bi, offset, state) scores[(((bi) % 3) * bandwidth + (offset)) * PSR9_NUM_STATES + (state)]
+#define BANDED_GET(bi, offset, state) ((offset) >= 0 && (offset) < bandwidth ? BANDED_SCORE(bi, offset, state) : -INFINITY)
+
+    // the first two bands are centered on the start cell (-1, -1) and have no states to fill
+    band_lower_left[0] = { half_bandwidth - 1, -1 - half_bandwidth };
+    band_lower_left[1] = { band_lower_left[0].event_idx + 1, band_lower_left[0].kmer_idx };
+
+    int seed_kmer = 0;
+    for(size_t band_idx = 2; band_idx < n_bands; ++band_idx) {
+
+        // Place the band using Suzuki's rule, unless that would move it too far from the seed path
+        const EventKmerPair& prev_ll = band_lower_left[band_idx - 1];
+        float ll = -INFINITY;
+        float ur = -INFINITY;
+        for(int s = 0; s < PSR9_NUM_STATES; ++s) {
+            ll = std::max(ll, BANDED_SCORE(band_idx - 1, 0, s));
+            ur = std::max(ur, BANDED_SCORE(band_idx - 1, bandwidth - 1, s));
+        }
+
+        bool right = false;
+        if(ll == -INFINITY && ur == -INFINITY) {
+            right = band_idx % 2 == 1;
+        } else {
+            right = ll < ur;
+        }
+
+        // the seed path moves down the events of kmer_seed_rows[ki] then to the next kmer
+        int diagonal = band_idx - 2;
+        while(seed_kmer + 1 < n_kmers && kmer_seed_rows[seed_kmer + 1] + seed_kmer + 1 <= diagonal) {
+            seed_kmer += 1;
+        }
+        int seed_event = diagonal - seed_kmer;
+        int center_event = prev_ll.event_idx - half_bandwidth;
+        if(seed_event - center_event > max_seed_distance) {
+            right = false;
+        } else if(center_event + 1 - seed_event > max_seed_distance) {
+            right = true;
+        }
+
+        if(right) {
+            band_lower_left[band_idx] = { prev_ll.event_idx, prev_ll.kmer_idx + 1 };
+        } else {
+            band_lower_left[band_idx] = { prev_ll.event_idx + 1, prev_ll.kmer_idx };
+        }
+        const EventKmerPair& curr_ll = band_lower_left[band_idx];
+
+        for(int offset = 0; offset < bandwidth; ++offset) {
+            for(int s = 0; s < PSR9_NUM_STATES; ++s) {
+                BANDED_SCORE(band_idx, offset, s) = -INFINITY;
+            }
+        }
+
+        // restrict the offsets to the cells of the matrix
+        int min_offset = std::max(0, std::max(curr_ll.event_idx - (n_events - 1), -curr_ll.kmer_idx));
+        int max_offset = std::min(bandwidth - 1, std::min(curr_ll.event_idx, n_kmers - 1 - curr_ll.kmer_idx));
+
+        for(int offset = min_offset; offset <= max_offset; ++offset) {
+            int event_offset = curr_ll.event_idx - offset;
+            int kmer_idx = curr_ll.kmer_idx + offset;
+            uint32_t event_idx = e_start + event_offset * data.event_stride;
+            const BlockTransitions& bt = transitions[kmer_idx];
+
+            // (event - 1, kmer) and (event, kmer - 1) are in the previous band, (event - 1, kmer - 1) the one before
+            int offset_up = prev_ll.event_idx - (event_offset - 1);
+            int offset_left = prev_ll.event_idx - event_offset;
+            int offset_diag = band_lower_left[band_idx - 2].event_idx - (event_offset - 1);
+
+            float lp_emission_m = log_probability_match_r9(*data.read, *data.pore_model, kmer_ranks[kmer_idx], event_idx, data.strand);
+            HMMUpdateScores s;
+            uint8_t from_m, from_b, from_k;
+
+            // state PSR9_MATCH
+            s.x[HMT_FROM_SAME_M] = bt.lp_mm_self + BANDED_GET(band_idx - 1, offset_up, PSR9_MATCH);
+            s.x[HMT_FROM_PREV_M] = bt.lp_mm_next + BANDED_GET(band_idx - 2, offset_diag, PSR9_MATCH);
+            s.x[HMT_FROM_SAME_B] = bt.lp_bm_self + BANDED_GET(band_idx - 1, offset_up, PSR9_BAD_EVENT);
+            s.x[HMT_FROM_PREV_B] = bt.lp_bm_next + BANDED_GET(band_idx - 2, offset_diag, PSR9_BAD_EVENT);
+            s.x[HMT_FROM_PREV_K] = bt.lp_km + BANDED_GET(band_idx - 2, offset_diag, PSR9_KMER_SKIP);
+            s.x[HMT_FROM_SOFT] = (kmer_idx == 0 && (event_offset == 0 || (flags & HAF_ALLOW_PRE_CLIP))) ? pre_flank[event_offset] : -INFINITY;
+            float lp_m = viterbi_max(s, from_m) + lp_emission_m;
+
+            // state PSR9_BAD_EVENT
+            s.x[HMT_FROM_SAME_M] = bt.lp_mb + BANDED_GET(band_idx - 1, offset_up, PSR9_MATCH);
+            s.x[HMT_FROM_PREV_M] = -INFINITY;
+            s.x[HMT_FROM_SAME_B] = bt.lp_bb + BANDED_GET(band_idx - 1, offset_up, PSR9_BAD_EVENT);
+            s.x[HMT_FROM_PREV_B] = -INFINITY;
+            s.x[HMT_FROM_PREV_K] = -INFINITY;
+            s.x[HMT_FROM_SOFT] = -INFINITY;
+            float lp_b = viterbi_max(s, from_b);
+
+            // state PSR9_KMER_SKIP
+            s.x[HMT_FROM_SAME_M] = -INFINITY;
+            s.x[HMT_FROM_PREV_M] = bt.lp_mk + BANDED_GET(band_idx - 1, offset_left, PSR9_MATCH);
+            s.x[HMT_FROM_SAME_B] = -INFINITY;
+            s.x[HMT_FROM_PREV_B] = bt.lp_bk + BANDED_GET(band_idx - 1, offset_left, PSR9_BAD_EVENT);
+            s.x[HMT_FROM_PREV_K] = bt.lp_kk + BANDED_GET(band_idx - 1, offset_left, PSR9_KMER_SKIP);
+            float lp_k = viterbi_max(s, from_k);
+
+            BANDED_SCORE(band_idx, offset, PSR9_MATCH) = lp_m;
+            BANDED_SCORE(band_idx, offset, PSR9_BAD_EVENT) = lp_b;
+            BANDED_SCORE(band_idx, offset, PSR9_KMER_SKIP) = lp_k;
+            trace[band_idx * bandwidth + offset] = pack_banded_trace(from_m, from_b, from_k);
+        }
+    }
+
+    // start from the last event matched to the last kmer, like profile_hmm_align_r9,
+    // which is on the last band
+    int event_offset = n_events - 1;
+    int kmer_idx = n_kmers - 1;
+    ProfileStateR9 curr_ps = PSR9_MATCH;
+
+    int end_offset = band_lower_left[n_bands - 1].event_idx - event_offset;
+    float lp_end = BANDED_GET(n_bands - 1, end_offset, PSR9_MATCH);
+
+#undef BANDED_GET
+#undef BANDED_SCORE
+
+    // the alignment left the band
+    if(lp_end == -INFINITY) {
+        return alignment;
+    }
+
+    while(true) {
+        size_t band_idx = event_offset + kmer_idx + 2;
+        int offset = band_lower_left[band_idx].event_idx - event_offset;
+        assert(offset >= 0 && offset < bandwidth);
+
+        HMMAlignmentState as;
+        as.event_idx = e_start + event_offset * data.event_stride;
+        as.kmer_idx = kmer_idx;
+        as.l_posterior = -INFINITY; // not computed
+        as.l_fm = alignment.empty() ? lp_end : -INFINITY; // only kept for the last state
+        as.log_transition_probability = -INFINITY; // not computed
+        as.state = ps2char(curr_ps);
+        alignment.push_back(as);
+
+        HMMMovementType movement = unpack_banded_trace(trace[band_idx * bandwidth + offset], curr_ps);
+        if(movement == HMT_FROM_SOFT) {
+            break;
+        }
+
+        ProfileStateR9 next_ps = PSR9_MATCH;
+        switch(movement) {
+            case HMT_FROM_SAME_M:
+                next_ps = PSR9_MATCH;
+                break;
+            case HMT_FROM_PREV_M:
+                kmer_idx -= 1;
+                next_ps = PSR9_MATCH;
+                break;
+            case HMT_FROM_SAME_B:
+                next_ps = PSR9_BAD_EVENT;
+                break;
+            case HMT_FROM_PREV_B:
+                kmer_idx -= 1;
+                next_ps = PSR9_BAD_EVENT;
+                break;
+            case HMT_FROM_PREV_K:
+                kmer_idx -= 1;
+                next_ps = PSR9_KMER_SKIP;
+                break;
+            default:
+                assert(false);
+                break;
+        }
+
+        // kmer skips are silent
+        if(curr_ps != PSR9_KMER_SKIP) {
+            event_offset -= 1;
+        }
+        curr_ps = next_ps;
+        assert(event_offset >= 0 && kmer_idx >= 0);
+    }
+
+    std::reverse(alignment.begin(), alignment.end());
+    return alignment;
+}
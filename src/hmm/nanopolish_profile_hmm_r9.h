@@ -31,6 +31,12 @@ float profile_hmm_score_r9(const HMMInputSequence& sequence, const HMMInputData&
 // Run viterbi to align events to kmers
 std::vector<HMMAlignmentState> profile_hmm_align_r9(const HMMInputSequence& sequence, const HMMInputData& data, const uint32_t flags = 0);
 
+// Run viterbi in an adaptive band, see profile_hmm_align_banded
+std::vector<HMMAlignmentState> profile_hmm_align_banded_r9(const HMMInputSequence& sequence,
+                                                           const HMMInputData& data,
+                                                           const std::vector<int>& kmer_seed_rows,
+                                                           const uint32_t flags = 0);
+
 //
 // Forward algorithm
 //
@@ -13,12 +13,14 @@
 #include "nanopolish_extract.h"
 #include "nanopolish_call_variants.h"
 #include "nanopolish_eventalign.h"
+#include "nanopolish_eventalign_view.h"
 #include "nanopolish_getmodel.h"
 #include "nanopolish_methyltrain.h"
 #include "nanopolish_call_methylation.h"
 #include "nanopolish_scorereads.h"
 #include "nanopolish_phase_reads.h"
 #include "nanopolish_vcf2fasta.h"
+#include "nanopolish_view_region.h"
 #include "nanopolish_polya_estimator.h"
 #include "nanopolish_train_poremodel_from_basecalls.h"
 
@@ -32,12 +34,14 @@ static std::map< std::string, std::function<int(int, char**)> > programs = {
     {"index",       index_main},
     {"extract",     extract_main},
     {"eventalign",  eventalign_main},
+    {"eventalign-view",  eventalign_view_main},
     {"getmodel",    getmodel_main},
     {"variants",    call_variants_main},
     {"methyltrain", methyltrain_main},
     {"scorereads",  scorereads_main} ,
     {"phase-reads", phase_reads_main} ,
     {"vcf2fasta",   vcf2fasta_main} ,
+    {"view-region",  view_region_main} ,
     {"polya",  polya_main} ,
     {"call-methylation",  call_methylation_main}
 };
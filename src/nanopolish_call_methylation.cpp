@@ -20,6 +20,7 @@
 #include <set>
 #include <omp.h>
 #include <getopt.h>
+#include <memory>
 #include "htslib/faidx.h"
 #include "nanopolish_eventalign.h"
 #include "nanopolish_iupac.h"
@@ -31,11 +32,15 @@
 #include "nanopolish_methyltrain.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_bam_processor.h"
+#include "nanopolish_bam_utils.h"
+#include "nanopolish_reorder_buffer.h"
 #include "nanopolish_alignment_db.h"
 #include "nanopolish_read_db.h"
 #include "H5pubconf.h"
 #include "profiler.h"
 #include "progress.h"
+#include "nanopolish_fast5_cache.h"
+#include "nanopolish_indexed_output.h"
 
 using namespace std::placeholders;
 
@@ -45,6 +50,12 @@ using namespace std::placeholders;
 struct OutputHandles
 {
     FILE* site_writer;
+
+    // keeps the output in bam order
+    ReorderBuffer* output;
+
+    // the output, when it is written to a compressed file with a read index instead of site_writer
+    IndexedOutputWriter* indexed_writer;
 };
 
 struct ScoredSite
@@ -96,12 +107,17 @@ static const char *CALL_METHYLATION_USAGE_MESSAGE =
 "      --version                        display version\n"
 "      --help                           display this help and exit\n"
 "  -r, --reads=FILE                     the ONT reads are in fasta/fastq FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the genome we are calling methylation for is in fasta FILE\n"
 "  -q, --methylation=STRING             the type of methylation (cpg,gpc,dam,dcm)\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
 "      --progress                       print out a progress message\n"
+"      --signal-cache                   load the events of each read from the cache built by nanopolish index --precompute-events\n"
+"      --fast5-cache-size=NUM           keep up to NUM fast5 files open per thread (default: 4)\n"
 "  -K  --batchsize=NUM                  the batch size (default: 512)\n"
+"      --indexed-output=FILE            write the output bgzip compressed to FILE, with an index of the\n"
+"                                       reads for nanopolish view-region, instead of stdout\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 namespace opt
@@ -114,8 +130,12 @@ namespace opt
     static std::string models_fofn;
     static std::string region;
     static std::string motif_methylation_model_type = "reftrained";
+    static std::string indexed_output_file;
     static int progress = 0;
+    static int signal_cache = 0;
+    static int fast5_cache_size = FAST5_CACHE_DEFAULT_SIZE;
     static int num_threads = 1;
+    static int io_threads = -1;
     static int batch_size = 512;
     static int min_separation = 10;
     static int min_flank = 10;
@@ -123,7 +143,7 @@ namespace opt
 
 static const char* shortopts = "r:b:g:t:w:m:K:q:vn";
 
-enum { OPT_HELP = 1, OPT_VERSION, OPT_PROGRESS, OPT_MIN_SEPARATION };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_PROGRESS, OPT_MIN_SEPARATION, OPT_SIGNAL_CACHE, OPT_FAST5_CACHE_SIZE, OPT_IO_THREADS, OPT_INDEXED_OUTPUT };
 
 static const struct option longopts[] = {
     { "verbose",          no_argument,       NULL, 'v' },
@@ -136,6 +156,10 @@ static const struct option longopts[] = {
     { "models-fofn",      required_argument, NULL, 'm' },
     { "min-separation",   required_argument, NULL, OPT_MIN_SEPARATION },
     { "progress",         no_argument,       NULL, OPT_PROGRESS },
+    { "signal-cache",     no_argument,       NULL, OPT_SIGNAL_CACHE },
+    { "fast5-cache-size", required_argument, NULL, OPT_FAST5_CACHE_SIZE },
+    { "io-threads",       required_argument, NULL, OPT_IO_THREADS },
+    { "indexed-output",   required_argument, NULL, OPT_INDEXED_OUTPUT },
     { "help",             no_argument,       NULL, OPT_HELP },
     { "version",          no_argument,       NULL, OPT_VERSION },
     { "batchsize",        no_argument,       NULL, 'K' },
@@ -145,7 +169,7 @@ static const struct option longopts[] = {
 // Test motif sites in this read for methylation
 void calculate_methylation_for_read(const OutputHandles& handles,
                                     const ReadDB& read_db,
-                                    const faidx_t* fai,
+                                    const ReferenceDB& ref_db,
                                     const bam_hdr_t* hdr,
                                     const bam1_t* record,
                                     size_t read_idx,
@@ -155,7 +179,7 @@ void calculate_methylation_for_read(const OutputHandles& handles,
     // Load a squiggle read for the mapped read
     std::string read_name = bam_get_qname(record);
     std::string read_orientation = bam_is_rev(record) ? "-" : "+";
-    SquiggleRead sr(read_name, read_db);
+    SquiggleRead sr(read_name, read_db, 0, get_read_range_for_ref_region(record, region_start, region_end));
 
     // An output map from reference positions to scored motif sites
     std::map<int, ScoredSite> site_score_map;
@@ -193,8 +217,7 @@ void calculate_methylation_for_read(const OutputHandles& handles,
         // Extract the reference sequence for this region
         int fetched_len = 0;
         assert(ref_end_pos >= ref_start_pos);
-        std::string ref_seq = get_reference_region_ts(fai, contig.c_str(), ref_start_pos,
-                                                      ref_end_pos, &fetched_len);
+        std::string ref_seq = ref_db.get_subsequence(contig, ref_start_pos, ref_end_pos, &fetched_len);
 
         // Remove non-ACGT bases from this reference segment
         ref_seq = gDNAAlphabet.disambiguate(ref_seq);
@@ -245,6 +268,11 @@ void calculate_methylation_for_read(const OutputHandles& handles,
             int calling_start = sub_start_pos + ref_start_pos;
             int calling_end = sub_end_pos + ref_start_pos;
 
+            // skip groups outside of the region, only the signal near it has been loaded
+            if(region_start != -1 && (calling_end < region_start || calling_start >= region_end)) {
+                continue;
+            }
+
             // using the reference-to-event map, look up the event indices for this segment
             int e1,e2;
             bool bounded = AlignmentDB::_find_by_ref_bounds(event_align_record.aligned_events,
@@ -313,27 +341,45 @@ void calculate_methylation_for_read(const OutputHandles& handles,
         } // for group
     } // for strands
 
-    #pragma omp critical(call_methylation_write)
-    {
-        // write all sites for this read
-        for(auto iter = site_score_map.begin(); iter != site_score_map.end(); ++iter) {
+    // format all sites for this read, they are written once the reads before it are done
+    ReadOutputStream out;
+    std::string out_contig;
+    int out_start = -1;
+    int out_end = -1;
+    for(auto iter = site_score_map.begin(); iter != site_score_map.end(); ++iter) {
+
+        const ScoredSite& ss = iter->second;
+        double sum_ll_m = ss.ll_methylated[0] + ss.ll_methylated[1];
+        double sum_ll_u = ss.ll_unmethylated[0] + ss.ll_unmethylated[1];
+        double diff = sum_ll_m - sum_ll_u;
+
+        // do not output if outside the window boundaries
+        if((region_start != -1 && ss.start_position < region_start) ||
+           (region_end != -1 && ss.end_position >= region_end)) {
+            continue;
+        }
 
-            const ScoredSite& ss = iter->second;
-            double sum_ll_m = ss.ll_methylated[0] + ss.ll_methylated[1];
-            double sum_ll_u = ss.ll_unmethylated[0] + ss.ll_unmethylated[1];
-            double diff = sum_ll_m - sum_ll_u;
+        fprintf(out.fp(), "%s\t%s\t%d\t%d\t", ss.chromosome.c_str(), read_orientation.c_str(), ss.start_position, ss.end_position);
+        fprintf(out.fp(), "%s\t%.2lf\t", sr.read_name.c_str(), diff);
+        fprintf(out.fp(), "%.2lf\t%.2lf\t", sum_ll_m, sum_ll_u);
+        fprintf(out.fp(), "%d\t%d\t%s\n", ss.strands_scored, ss.n_motif, ss.sequence.c_str());
 
-            // do not output if outside the window boundaries
-            if((region_start != -1 && ss.start_position < region_start) ||
-               (region_end != -1 && ss.end_position >= region_end)) {
-                continue;
-            }
+        // the span of the written sites, for the read index
+        out_contig = ss.chromosome;
+        out_start = out_start == -1 ? ss.start_position : out_start;
+        out_end = std::max(out_end, ss.end_position);
+    }
 
-            fprintf(handles.site_writer, "%s\t%s\t%d\t%d\t", ss.chromosome.c_str(), read_orientation.c_str(), ss.start_position, ss.end_position);
-            fprintf(handles.site_writer, "%s\t%.2lf\t", sr.read_name.c_str(), diff);
-            fprintf(handles.site_writer, "%.2lf\t%.2lf\t", sum_ll_m, sum_ll_u);
-            fprintf(handles.site_writer, "%d\t%d\t%s\n", ss.strands_scored, ss.n_motif, ss.sequence.c_str());
+    if(handles.indexed_writer != NULL) {
+        if(out_start != -1) {
+            std::shared_ptr<std::string> data = std::make_shared<std::string>(out.release());
+            IndexedOutputWriter* indexed_writer = handles.indexed_writer;
+            handles.output->add(read_idx, [indexed_writer, data, out_contig, out_start, out_end]() {
+                indexed_writer->write(*data, out_contig, out_start, out_end);
+            });
         }
+    } else {
+        handles.output->add(read_idx, handles.site_writer, out.release());
     }
 }
 
@@ -355,6 +401,10 @@ void parse_call_methylation_options(int argc, char** argv)
             case 'K': arg >> opt::batch_size; break;
             case OPT_MIN_SEPARATION: arg >> opt::min_separation; break;
             case OPT_PROGRESS: opt::progress = true; break;
+            case OPT_SIGNAL_CACHE: opt::signal_cache = true; break;
+            case OPT_FAST5_CACHE_SIZE: arg >> opt::fast5_cache_size; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
+            case OPT_INDEXED_OUTPUT: arg >> opt::indexed_output_file; break;
             case OPT_HELP:
                 std::cout << CALL_METHYLATION_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -378,6 +428,11 @@ void parse_call_methylation_options(int argc, char** argv)
         die = true;
     }
 
+    if(opt::fast5_cache_size < 0) {
+        std::cerr << SUBPROGRAM ": invalid fast5 cache size: " << opt::fast5_cache_size << "\n";
+        die = true;
+    }
+
     if(opt::reads_file.empty()) {
         std::cerr << SUBPROGRAM ": a --reads file must be provided\n";
         die = true;
@@ -416,17 +471,20 @@ void parse_call_methylation_options(int argc, char** argv)
 int call_methylation_main(int argc, char** argv)
 {
     parse_call_methylation_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
+    fast5_cache_set_size(opt::fast5_cache_size);
+
     ReadDB read_db;
     read_db.load(opt::reads_file);
-
-    // load reference fai file
-    faidx_t *fai = fai_load(opt::genome_file.c_str());
-    if(fai == NULL) {
-        fprintf(stderr, "Error: could not open genome file: %s\n", opt::genome_file.c_str());
-        fprintf(stderr, "Please check the path is correct\n");
-        exit(1);
+    if(opt::signal_cache) {
+        read_db.open_signal_cache();
     }
 
+    // load the reference genome into memory
+    ReferenceDB ref_db;
+    ref_db.load(opt::genome_file);
+
 #ifndef H5_HAVE_THREADSAFE
     if(opt::num_threads > 1) {
         fprintf(stderr, "You enabled multi-threading but you do not have a threadsafe HDF5\n");
@@ -436,28 +494,49 @@ int call_methylation_main(int argc, char** argv)
 #endif
 
     // Initialize writers
+    ReorderBuffer output(2 * opt::batch_size);
     OutputHandles handles;
     handles.site_writer = stdout;
+    handles.output = &output;
+    handles.indexed_writer = NULL;
 
     // Write header
-    fprintf(handles.site_writer, "chromosome\tstrand\tstart\tend\tread_name\t"
-                                 "log_lik_ratio\tlog_lik_methylated\tlog_lik_unmethylated\t"
-                                 "num_calling_strands\tnum_motifs\tsequence\n");
+    ReadOutputStream header;
+    fprintf(header.fp(), "chromosome\tstrand\tstart\tend\tread_name\t"
+                         "log_lik_ratio\tlog_lik_methylated\tlog_lik_unmethylated\t"
+                         "num_calling_strands\tnum_motifs\tsequence\n");
+    if(!opt::indexed_output_file.empty()) {
+        handles.indexed_writer = new IndexedOutputWriter(opt::indexed_output_file);
+        handles.indexed_writer->write_header(header.release());
+    } else {
+        std::string header_text = header.release();
+        fwrite(header_text.data(), 1, header_text.size(), handles.site_writer);
+    }
 
     // the BamProcessor framework calls the input function with the 
     // bam record, read index, etc passed as parameters
     // bind the other parameters the worker function needs here
-    auto f = std::bind(calculate_methylation_for_read, std::ref(handles), std::ref(read_db), fai, _1, _2, _3, _4, _5);
+    auto f = std::bind(calculate_methylation_for_read, std::ref(handles), std::ref(read_db), std::ref(ref_db), _1, _2, _3, _4, _5);
     BamProcessor processor(opt::bam_file, opt::region, opt::num_threads, opt::batch_size);
+    processor.set_fast5_locality(&read_db);
+    processor.set_reorder_buffer(&output);
     processor.parallel_run(f);
 
+    if(opt::verbose > 0) {
+        fast5_cache_print_stats();
+        processor.print_stats();
+    }
+
     // cleanup
+    if(handles.indexed_writer != NULL) {
+        handles.indexed_writer->close();
+        delete handles.indexed_writer;
+    }
+
     if(handles.site_writer != stdout) {
         fclose(handles.site_writer);
     }
 
-    fai_destroy(fai);
-
     return EXIT_SUCCESS;
 }
 
@@ -29,6 +29,7 @@
 #include "nanopolish_klcs.h"
 #include "nanopolish_profile_hmm.h"
 #include "nanopolish_alignment_db.h"
+#include "nanopolish_bam_utils.h"
 #include "nanopolish_anchor.h"
 #include "nanopolish_variant.h"
 #include "nanopolish_haplotype.h"
@@ -80,14 +81,15 @@ static const char *CONSENSUS_USAGE_MESSAGE =
 "      --faster                         minimize compute time while slightly reducing consensus accuracy\n"
 "  -w, --window=STR                     find variants in window STR (format: <chromsome_name>:<start>-<end>)\n"
 "  -r, --reads=FILE                     the ONT reads are in fasta FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the reference genome are in bam FILE\n"
-"  -e, --event-bam=FILE                 the events aligned to the reference genome are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the reference genome are in bam/cram FILE\n"
+"  -e, --event-bam=FILE                 the events aligned to the reference genome are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the reference genome is in FILE\n"
 "  -p, --ploidy=NUM                     the ploidy level of the sequenced genome\n"
 "  -q  --methylation-aware=STR          turn on methylation aware polishing and test motifs given in STR (example: -q dcm,dam)\n"
 "      --genotype=FILE                  call genotypes for the variants in the vcf FILE\n"
 "  -o, --outfile=FILE                   write result to FILE [default: stdout]\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
 "  -m, --min-candidate-frequency=F      extract candidate variants from the aligned reads when the variant frequency is at least F (default 0.2)\n"
 "  -d, --min-candidate-depth=D          extract candidate variants from the aligned reads when the depth is at least D (default: 20)\n"
 "  -x, --max-haplotypes=N               consider at most N haplotype combinations (default: 1000)\n"
@@ -120,6 +122,7 @@ namespace opt
     static int snps_only = 0;
     static int show_progress = 0;
     static int num_threads = 1;
+    static int io_threads = -1;
     static int consensus_mode = 0;
     static int fix_homopolymers = 0;
     static int genotype_only = 0;
@@ -153,7 +156,8 @@ enum { OPT_HELP = 1,
        OPT_P_SKIP_SELF,
        OPT_P_BAD,
        OPT_P_BAD_SELF,
-       OPT_MIN_FLANKING_SEQUENCE };
+       OPT_MIN_FLANKING_SEQUENCE,
+       OPT_IO_THREADS };
 
 static const struct option longopts[] = {
     { "verbose",                   no_argument,       NULL, 'v' },
@@ -186,6 +190,7 @@ static const struct option longopts[] = {
     { "calculate-all-support",     no_argument,       NULL, OPT_CALC_ALL_SUPPORT },
     { "snps",                      no_argument,       NULL, OPT_SNPS_ONLY },
     { "progress",                  no_argument,       NULL, OPT_PROGRESS },
+    { "io-threads",                required_argument, NULL, OPT_IO_THREADS },
     { "help",                      no_argument,       NULL, OPT_HELP },
     { "version",                   no_argument,       NULL, OPT_VERSION },
     { NULL, 0, NULL, 0 }
@@ -501,8 +506,8 @@ void print_debug_stats(const std::string& contig,
                 called_kmer = gDNAAlphabet.reverse_complement(called_kmer);
             }
 
-            PoreModelStateParams base_model = pm.states[pm.pmalphabet->kmer_rank(base_kmer.c_str(), k)];
-            PoreModelStateParams called_model = pm.states[pm.pmalphabet->kmer_rank(called_kmer.c_str(), k)];
+            PoreModelStateParams base_model = pm.get_parameters(pm.pmalphabet->kmer_rank(base_kmer.c_str(), k));
+            PoreModelStateParams called_model = pm.get_parameters(pm.pmalphabet->kmer_rank(called_kmer.c_str(), k));
 
             float base_standard_level = (event_mean - base_model.level_mean) / (sqrt(scalings.var) * base_model.level_stdv);
             float called_standard_level = (event_mean - called_model.level_mean) / (sqrt(scalings.var) * called_model.level_stdv);
@@ -1034,6 +1039,7 @@ void parse_call_variants_options(int argc, char** argv)
             case OPT_P_BAD: arg >> g_p_bad; break;
             case OPT_P_BAD_SELF: arg >> g_p_bad_self; break;
             case OPT_MIN_FLANKING_SEQUENCE: arg >> opt::min_flanking_sequence; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
             case OPT_HELP:
                 std::cout << CONSENSUS_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -1107,6 +1113,8 @@ void print_invalid_window_error(int start_base, int end_base)
 int call_variants_main(int argc, char** argv)
 {
     parse_call_variants_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
     omp_set_num_threads(opt::num_threads);
 
     std::string contig;
@@ -0,0 +1,181 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_eventalign_view - convert the binary output
+// of eventalign to the tsv format
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <getopt.h>
+#include "nanopolish_common.h"
+#include "nanopolish_alphabet.h"
+#include "nanopolish_eventalign.h"
+#include "nanopolish_eventalign_binary.h"
+#include "nanopolish_text_format.h"
+
+//
+// Getopt
+//
+#define SUBPROGRAM "eventalign-view"
+
+static const char *EVENTALIGN_VIEW_VERSION_MESSAGE =
+SUBPROGRAM " Version " PACKAGE_VERSION "\n"
+"Written by agent.\n"
+"\n"
+"Copyright 2026 agent\n";
+
+static const char *EVENTALIGN_VIEW_USAGE_MESSAGE =
+"Usage: " PACKAGE_NAME " " SUBPROGRAM " [OPTIONS] eventalign.bin\n"
+"Write the output of eventalign --format=binary as the tsv table\n"
+"\n"
+"  -v, --verbose                        display verbose output\n"
+"      --version                        display version\n"
+"      --help                           display this help and exit\n"
+"  -w, --window=STR                     only write the events aligned to the region STR (format: ctg:start-end)\n"
+"                                       using the index of the file, the file can not be read from stdin\n"
+"  -n, --print-read-names               print read names instead of indexes\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+namespace opt
+{
+    static unsigned int verbose;
+    static std::string input_file;
+    static std::string region;
+    static bool print_read_names = false;
+}
+
+static const char* shortopts = "w:nv";
+
+enum { OPT_HELP = 1, OPT_VERSION };
+
+static const struct option longopts[] = {
+    { "verbose",          no_argument,       NULL, 'v' },
+    { "window",           required_argument, NULL, 'w' },
+    { "print-read-names", no_argument,       NULL, 'n' },
+    { "help",             no_argument,       NULL, OPT_HELP },
+    { "version",          no_argument,       NULL, OPT_VERSION },
+    { NULL, 0, NULL, 0 }
+};
+
+void parse_eventalign_view_options(int argc, char** argv)
+{
+    bool die = false;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        std::istringstream arg(optarg != NULL ? optarg : "");
+        switch (c) {
+            case '?': die = true; break;
+            case 'v': opt::verbose++; break;
+            case 'w': arg >> opt::region; break;
+            case 'n': opt::print_read_names = true; break;
+            case OPT_HELP:
+                std::cout << EVENTALIGN_VIEW_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+            case OPT_VERSION:
+                std::cout << EVENTALIGN_VIEW_VERSION_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (argc - optind < 1) {
+        std::cerr << SUBPROGRAM ": not enough arguments\n";
+        die = true;
+    }
+
+    if (argc - optind > 1) {
+        std::cerr << SUBPROGRAM ": too many arguments\n";
+        die = true;
+    }
+
+    if (die)
+    {
+        std::cout << "\n" << EVENTALIGN_VIEW_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+
+    opt::input_file = argv[optind++];
+
+    if(!opt::region.empty() && opt::input_file == "-") {
+        std::cerr << SUBPROGRAM ": the --window option needs the index at the end of the file, it can not be used with stdin\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+// append the tsv rows of block to out, skipping events outside of [start, end] when start >= 0
+static void format_block_tsv(std::string& out,
+                             const EventalignBinaryReader& reader,
+                             const EventalignBinaryBlock& block,
+                             bool write_signal_index,
+                             int start,
+                             int end)
+{
+    const Alphabet* alphabet = get_alphabet_by_name(block.alphabet_name);
+
+    std::string read_id;
+    if (not opt::print_read_names) {
+        append_uint(read_id, block.read_idx);
+    } else {
+        read_id = block.read_name;
+    }
+
+    std::string ref_kmer;
+    std::string model_kmer;
+    for(size_t i = 0; i < block.records.size(); ++i) {
+        const EventalignBinaryRecord& record = block.records[i];
+        if(start >= 0 && (record.ref_position < start || record.ref_position > end)) {
+            continue;
+        }
+
+        block.decode_kmer(alphabet, record.ref_kmer, ref_kmer);
+        block.decode_kmer(alphabet, record.model_kmer, model_kmer);
+
+        EventAlignmentValues values = reader.get_values(block, record);
+
+        append_event_alignment_tsv_row(out, block.contig, record.ref_position, ref_kmer, read_id,
+                                       block.strand_idx, record.event_idx, model_kmer, values);
+
+        if(write_signal_index) {
+            out.push_back('\t');
+            append_uint(out, block.signal_idx[2 * i]);
+            out.push_back('\t');
+            append_uint(out, block.signal_idx[2 * i + 1]);
+        }
+        out.push_back('\n');
+    }
+}
+
+int eventalign_view_main(int argc, char** argv)
+{
+    parse_eventalign_view_options(argc, argv);
+
+    EventalignBinaryReader reader(opt::input_file);
+
+    std::string contig;
+    int start = -1;
+    int end = -1;
+    if(!opt::region.empty()) {
+        parse_region_string(opt::region, contig, start, end);
+        reader.set_region(contig, start, end);
+    }
+
+    bool write_signal_index = reader.get_flags() & EVENTALIGN_BINARY_FLAG_SIGNAL_INDEX;
+    emit_tsv_header(stdout, opt::print_read_names, write_signal_index, false);
+
+    EventalignBinaryBlock block;
+    std::string out;
+    while(reader.read_block(block)) {
+        if(write_signal_index && block.signal_idx.size() != 2 * block.records.size()) {
+            fprintf(stderr, "error: the eventalign block for read %s has no signal index\n", block.read_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        out.clear();
+        format_block_tsv(out, reader, block, write_signal_index, start, end);
+        fwrite(out.data(), 1, out.size(), stdout);
+    }
+    return 0;
+}
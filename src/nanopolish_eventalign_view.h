@@ -0,0 +1,14 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_eventalign_view - convert the binary output
+// of eventalign to the tsv format
+//
+#ifndef NANOPOLISH_EVENTALIGN_VIEW_H
+#define NANOPOLISH_EVENTALIGN_VIEW_H
+
+int eventalign_view_main(int argc, char** argv);
+
+#endif
@@ -13,19 +13,31 @@
 //
 #define SUBPROGRAM "index"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <getopt.h>
+#include <omp.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <fast5.hpp>
 #include "nanopolish_index.h"
 #include "nanopolish_common.h"
 #include "nanopolish_read_db.h"
+#include "nanopolish_squiggle_read.h"
+#include "nanopolish_signal_cache.h"
 #include "fs_support.hpp"
 #include "logger.hpp"
 #include "profiler.h"
+#include "progress.h"
 #include "nanopolish_fast5_io.h"
+#include "nanopolish_fast5_cache.h"
 
 static const char *INDEX_VERSION_MESSAGE =
 SUBPROGRAM " Version " PACKAGE_VERSION "\n"
@@ -43,6 +55,9 @@ static const char *INDEX_USAGE_MESSAGE =
 "  -d, --directory                      path to the directory containing the raw ONT signal files. This option can be given multiple times.\n"
 "  -s, --sequencing-summary             the sequencing summary file from albacore, providing this option will make indexing much faster\n"
 "  -f, --summary-fofn                   file containing the paths to the sequencing summary files (one per line)\n"
+"      --precompute-events              detect and calibrate the events of every read and store them in a cache\n"
+"                                       that other subprograms can read with --signal-cache\n"
+"  -t, --threads=NUM                    use NUM processes to scan fast5 files and threads to precompute events (default: 1)\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 namespace opt
@@ -52,6 +67,8 @@ namespace opt
     static std::string reads_file;
     static std::vector<std::string> sequencing_summary_files;
     static std::string sequencing_summary_fofn;
+    static int precompute_events = 0;
+    static int num_threads = 1;
 }
 static std::ostream* os_p;
 
@@ -72,16 +89,26 @@ void index_file_from_map(ReadDB& read_db, const std::string& fn, const std::mult
     }
 }
 
-//
-void index_file_from_fast5(ReadDB& read_db, const std::string& fn)
+// a read found in a fast5 file and where its signal is
+struct Fast5ReadEntry
 {
-    PROFILE_FUNC("index_file_from_fast5")
+    std::string read_id;
+    fast5_read_info info;
+};
 
+// open a fast5 file and list the reads it contains
+std::vector<Fast5ReadEntry> get_reads_from_fast5(const std::string& fn)
+{
+    PROFILE_FUNC("get_reads_from_fast5")
+
+    std::vector<Fast5ReadEntry> out;
     fast5_file f5_file = fast5_open(fn);
     if(!fast5_is_open(f5_file)) {
         fprintf(stderr, "could not open fast5 file: %s\n", fn.c_str());
+        return out;
     }
 
+    // the location and metadata of each read are recorded so SquiggleRead does not have to look them up
     if(f5_file.is_multi_fast5) {
         std::vector<std::string> read_groups = fast5_get_multi_read_groups(f5_file);
         std::string prefix = "read_";
@@ -89,44 +116,255 @@ void index_file_from_fast5(ReadDB& read_db, const std::string& fn)
             std::string group_name = read_groups[group_idx];
             if(group_name.find(prefix) == 0) {
                 std::string read_id = group_name.substr(prefix.size());
-                read_db.add_signal_path(read_id, fn);
+                out.push_back({ read_id, fast5_get_read_info(f5_file, read_id) });
             }
         }
     } else {
         std::string read_id = fast5_get_read_id_single_fast5(f5_file);
         if(read_id != "") {
-            read_db.add_signal_path(read_id, fn);
+            out.push_back({ read_id, fast5_get_read_info(f5_file, read_id) });
         }
     }
     fast5_close(f5_file);
+    return out;
 }
 
 //
-void index_path(ReadDB& read_db, const std::string& path, const std::multimap<std::string, std::string>& fast5_to_read_name_map)
+// The fast5 files are scanned by a pool of worker processes, rather than threads, as
+// HDF5 is often built without thread safety and otherwise serializes every call.
+// Each worker sends the reads of its files to the parent over a pipe as a sequence of
+// messages: the file index, the size of the rest of the message, and the reads
+//
+static void append_scan_string(std::string& out, const std::string& s)
 {
-    fprintf(stderr, "[readdb] indexing %s\n", path.c_str());
-    if (is_directory(path)) {
-        auto dir_list = list_directory(path);
-        for (const auto& fn : dir_list) {
-            if(fn == "." or fn == "..") {
+    uint32_t length = s.length();
+    out.append((const char*)&length, sizeof(length));
+    out.append(s);
+}
+
+static std::string read_scan_string(const char*& p)
+{
+    uint32_t length;
+    memcpy(&length, p, sizeof(length));
+    p += sizeof(length);
+    std::string out(p, length);
+    p += length;
+    return out;
+}
+
+static void append_scan_message(std::string& out, uint32_t file_idx, const std::vector<Fast5ReadEntry>& reads)
+{
+    std::string payload;
+    uint32_t num_reads = reads.size();
+    payload.append((const char*)&num_reads, sizeof(num_reads));
+    for(const auto& entry : reads) {
+        append_scan_string(payload, entry.read_id);
+        append_scan_string(payload, entry.info.raw_read_group);
+        append_scan_string(payload, entry.info.sequencing_kit);
+        append_scan_string(payload, entry.info.experiment_type);
+        payload.append((const char*)&entry.info.channel_params, sizeof(entry.info.channel_params));
+    }
+
+    uint32_t payload_size = payload.size();
+    out.append((const char*)&file_idx, sizeof(file_idx));
+    out.append((const char*)&payload_size, sizeof(payload_size));
+    out.append(payload);
+}
+
+static std::vector<Fast5ReadEntry> parse_scan_payload(const char* p)
+{
+    uint32_t num_reads;
+    memcpy(&num_reads, p, sizeof(num_reads));
+    p += sizeof(num_reads);
+
+    std::vector<Fast5ReadEntry> reads(num_reads);
+    for(auto& entry : reads) {
+        entry.read_id = read_scan_string(p);
+        entry.info.raw_read_group = read_scan_string(p);
+        entry.info.sequencing_kit = read_scan_string(p);
+        entry.info.experiment_type = read_scan_string(p);
+        memcpy(&entry.info.channel_params, p, sizeof(entry.info.channel_params));
+        p += sizeof(entry.info.channel_params);
+    }
+    return reads;
+}
+
+// scan every num_workers'th file starting at worker_idx and write the results to fd
+static void run_scan_worker(const std::vector<std::string>& files, size_t worker_idx, size_t num_workers, int fd)
+{
+    for(size_t i = worker_idx; i < files.size(); i += num_workers) {
+        std::string message;
+        append_scan_message(message, i, get_reads_from_fast5(files[i]));
+
+        const char* p = message.data();
+        size_t remaining = message.size();
+        while(remaining > 0) {
+            ssize_t n = write(fd, p, remaining);
+            if(n < 0 && errno == EINTR) {
                 continue;
             }
+            if(n <= 0) {
+                fprintf(stderr, "[readdb] error: could not send scan results: %s\n", strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+            p += n;
+            remaining -= n;
+        }
+    }
+    close(fd);
+    _exit(EXIT_SUCCESS);
+}
+
+// open the fast5 files that are not in the sequencing summary to find their reads.
+// The reads are added to the database in the order of files, so the index does not
+// depend on the number of workers
+void index_files_from_fast5(ReadDB& read_db, const std::vector<std::string>& files)
+{
+    if(files.empty()) {
+        return;
+    }
+
+    Progress progress("[readdb] scanning fast5 files");
+    std::vector<std::vector<Fast5ReadEntry>> file_reads(files.size());
+    size_t num_scanned = 0;
+    unsigned last_percent = 0;
+    auto file_done = [&]() {
+        num_scanned += 1;
+        unsigned percent = 100 * num_scanned / files.size();
+        if(percent != last_percent) {
+            progress.print((float)num_scanned / files.size());
+            last_percent = percent;
+        }
+    };
+
+    size_t num_workers = std::min((size_t)opt::num_threads, files.size());
+    if(num_workers <= 1) {
+        for(size_t i = 0; i < files.size(); ++i) {
+            file_reads[i] = get_reads_from_fast5(files[i]);
+            file_done();
+        }
+    } else {
+        // the children inherit the unwritten output of the parent, which would be printed twice
+        fflush(stdout);
+        fflush(stderr);
+
+        std::vector<pid_t> pids(num_workers);
+        std::vector<struct pollfd> fds(num_workers);
+        for(size_t worker_idx = 0; worker_idx < num_workers; ++worker_idx) {
+            int pipe_fds[2];
+            if(pipe(pipe_fds) != 0) {
+                fprintf(stderr, "[readdb] error: could not create pipe: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            pid_t pid = fork();
+            if(pid < 0) {
+                fprintf(stderr, "[readdb] error: could not start a scanning process: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            } else if(pid == 0) {
+                // the child only needs the write end of its own pipe
+                close(pipe_fds[0]);
+                for(size_t j = 0; j < worker_idx; ++j) {
+                    close(fds[j].fd);
+                }
+                run_scan_worker(files, worker_idx, num_workers, pipe_fds[1]);
+            }
+
+            close(pipe_fds[1]);
+            pids[worker_idx] = pid;
+            fds[worker_idx].fd = pipe_fds[0];
+            fds[worker_idx].events = POLLIN;
+        }
+
+        // read from every worker as its results arrive, so none of them blocks on a full pipe
+        std::vector<std::string> buffers(num_workers);
+        size_t num_open = num_workers;
+        char chunk[65536];
+        while(num_open > 0) {
+            if(poll(fds.data(), fds.size(), -1) < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "[readdb] error: poll failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            for(size_t worker_idx = 0; worker_idx < num_workers; ++worker_idx) {
+                struct pollfd& pfd = fds[worker_idx];
+                if(pfd.fd < 0 || pfd.revents == 0) {
+                    continue;
+                }
 
-            std::string full_fn = path + "/" + fn;
-            bool is_fast5 = full_fn.find(".fast5") != -1;
-            bool in_map = fast5_to_read_name_map.find(fn) != fast5_to_read_name_map.end();
-
-            // JTS 04/19: is_directory is painfully slow so we first check if the file is in the name map
-            // if it is, it is definitely not a directory so we can skip the system call
-            if(!in_map && is_directory(full_fn)) {
-                // recurse
-                index_path(read_db, full_fn, fast5_to_read_name_map);
-            } else if (is_fast5) {
-                if(in_map) {
-                    index_file_from_map(read_db, full_fn, fast5_to_read_name_map);
-                } else {
-                    index_file_from_fast5(read_db, full_fn);
+                ssize_t n = read(pfd.fd, chunk, sizeof(chunk));
+                if(n < 0 && errno == EINTR) {
+                    continue;
                 }
+                if(n <= 0) {
+                    close(pfd.fd);
+                    pfd.fd = -1;
+                    num_open -= 1;
+                    continue;
+                }
+
+                // parse the complete messages
+                std::string& buffer = buffers[worker_idx];
+                buffer.append(chunk, n);
+                size_t offset = 0;
+                const size_t header_size = 2 * sizeof(uint32_t);
+                while(buffer.size() - offset >= header_size) {
+                    uint32_t file_idx, payload_size;
+                    memcpy(&file_idx, buffer.data() + offset, sizeof(file_idx));
+                    memcpy(&payload_size, buffer.data() + offset + sizeof(file_idx), sizeof(payload_size));
+                    if(buffer.size() - offset - header_size < payload_size) {
+                        break;
+                    }
+                    assert(file_idx < files.size());
+                    file_reads[file_idx] = parse_scan_payload(buffer.data() + offset + header_size);
+                    offset += header_size + payload_size;
+                    file_done();
+                }
+                buffer.erase(0, offset);
+            }
+        }
+
+        for(size_t worker_idx = 0; worker_idx < num_workers; ++worker_idx) {
+            int status = 0;
+            if(waitpid(pids[worker_idx], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+               !buffers[worker_idx].empty()) {
+                fprintf(stderr, "[readdb] error: a fast5 scanning process failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    progress.end();
+
+    for(size_t i = 0; i < files.size(); ++i) {
+        for(const auto& entry : file_reads[i]) {
+            read_db.add_signal_path(entry.read_id, files[i]);
+            read_db.add_read_info(entry.read_id, entry.info);
+        }
+    }
+}
+
+// walk the directory tree under path. fast5 files named in the sequencing summary are indexed
+// immediately, the others are appended to files_to_scan to be opened by index_files_from_fast5
+void index_path(ReadDB& read_db,
+                const std::string& path,
+                const std::multimap<std::string, std::string>& fast5_to_read_name_map,
+                std::vector<std::string>& files_to_scan)
+{
+    fprintf(stderr, "[readdb] indexing %s\n", path.c_str());
+    for (const auto& entry : list_directory_entries(path)) {
+        const std::string& fn = entry.name;
+        std::string full_fn = path + "/" + fn;
+        if(entry.is_directory) {
+            // recurse
+            index_path(read_db, full_fn, fast5_to_read_name_map, files_to_scan);
+        } else if(full_fn.find(".fast5") != std::string::npos) {
+            if(fast5_to_read_name_map.find(fn) != fast5_to_read_name_map.end()) {
+                index_file_from_map(read_db, full_fn, fast5_to_read_name_map);
+            } else {
+                files_to_scan.push_back(full_fn);
             }
         }
     }
@@ -208,12 +446,13 @@ void parse_sequencing_summary(const std::string& filename, std::multimap<std::st
     }
 }
 
-static const char* shortopts = "vd:f:s:";
+static const char* shortopts = "vd:f:s:t:";
 
 enum {
     OPT_HELP = 1,
     OPT_VERSION,
     OPT_LOG_LEVEL,
+    OPT_PRECOMPUTE_EVENTS
 };
 
 static const struct option longopts[] = {
@@ -224,6 +463,8 @@ static const struct option longopts[] = {
     { "directory",                 required_argument, NULL, 'd' },
     { "sequencing-summary-file",   required_argument, NULL, 's' },
     { "summary-fofn",              required_argument, NULL, 'f' },
+    { "threads",                   required_argument, NULL, 't' },
+    { "precompute-events",         no_argument,       NULL, OPT_PRECOMPUTE_EVENTS },
     { NULL, 0, NULL, 0 }
 };
 
@@ -247,6 +488,8 @@ void parse_index_options(int argc, char** argv)
             case 's': opt::sequencing_summary_files.push_back(arg.str()); break;
             case 'd': opt::raw_file_directories.push_back(arg.str()); break;
             case 'f': arg >> opt::sequencing_summary_fofn; break;
+            case 't': arg >> opt::num_threads; break;
+            case OPT_PRECOMPUTE_EVENTS: opt::precompute_events = 1; break;
         }
     }
 
@@ -265,6 +508,11 @@ void parse_index_options(int argc, char** argv)
         die = true;
     }
 
+    if(opt::num_threads <= 0) {
+        std::cerr << SUBPROGRAM ": invalid number of threads: " << opt::num_threads << "\n";
+        die = true;
+    }
+
     if (die)
     {
         std::cout << "\n" << INDEX_USAGE_MESSAGE;
@@ -300,10 +548,52 @@ void clean_fast5_map(std::multimap<std::string, std::string>& mmap)
     }
 }
 
+// load every read of the saved index and write its events to the signal cache
+void precompute_events()
+{
+    ReadDB read_db;
+    read_db.load(opt::reads_file);
+    std::vector<std::string> read_names = read_db.get_read_names();
+
+    // visit the reads of each fast5 file together so that its handle stays in the fast5 cache
+    std::vector<std::pair<std::string, std::string>> path_and_name(read_names.size());
+    for(size_t i = 0; i < read_names.size(); ++i) {
+        path_and_name[i] = std::make_pair(read_db.get_signal_path(read_names[i]), read_names[i]);
+    }
+    std::sort(path_and_name.begin(), path_and_name.end());
+    for(size_t i = 0; i < read_names.size(); ++i) {
+        read_names[i] = path_and_name[i].second;
+    }
+
+    SignalCacheWriter writer(read_db.get_signal_cache_filename());
+
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t i = 0; i < read_names.size(); ++i) {
+        SquiggleRead sr(read_names[i], read_db);
+        writer.add(sr);
+    }
+
+    fprintf(stderr, "[readdb] cached the events of %zu of %zu reads in %s\n",
+        writer.get_num_reads(), read_names.size(), read_db.get_signal_cache_filename().c_str());
+    if(opt::verbose > 0) {
+        fast5_cache_print_stats();
+    }
+}
+
 int index_main(int argc, char** argv)
 {
     parse_index_options(argc, argv);
 
+#ifndef H5_HAVE_THREADSAFE
+    // the fast5 files are scanned by separate processes, only precomputing events uses threads
+    if(opt::num_threads > 1 && opt::precompute_events) {
+        fprintf(stderr, "You enabled multi-threading but you do not have a threadsafe HDF5\n");
+        fprintf(stderr, "Please recompile nanopolish's built-in libhdf5 or run with -t 1\n");
+        exit(1);
+    }
+#endif
+    omp_set_num_threads(opt::num_threads);
+
     // Read a map from fast5 files to read name from the sequencing summary files (if any)
     process_summary_fofn();
     std::multimap<std::string, std::string> fast5_to_read_name_map;
@@ -330,9 +620,11 @@ int index_main(int argc, char** argv)
     // use the fofn/directory provided to augment the index
     if(!all_reads_have_paths) {
 
+        std::vector<std::string> files_to_scan;
         for(const auto& dir_name : opt::raw_file_directories) {
-            index_path(read_db, dir_name, fast5_to_read_name_map);
+            index_path(read_db, dir_name, fast5_to_read_name_map, files_to_scan);
         }
+        index_files_from_fast5(read_db, files_to_scan);
     }
 
     size_t num_with_path = read_db.get_num_reads_with_path();
@@ -343,5 +635,9 @@ int index_main(int argc, char** argv)
         read_db.print_stats();
         read_db.save();
     }
+
+    if(opt::precompute_events) {
+        precompute_events();
+    }
     return 0;
 }
@@ -38,6 +38,7 @@
 #include "nanopolish_model_names.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_read_db.h"
+#include "nanopolish_bam_utils.h"
 #include "training_core.hpp"
 #include "H5pubconf.h"
 #include "profiler.h"
@@ -105,9 +106,10 @@ static const char *METHYLTRAIN_USAGE_MESSAGE =
 "      --no-update-models               do not write out trained models\n"
 "      --output-scores                  optionally output read scores during training\n"
 "  -r, --reads=FILE                     the ONT reads are in fasta FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the reference genome is in FILE\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
 "      --filter-policy=STR              filter reads for [R7] or [R9] project\n"
 "  -s, --out-suffix=STR                 name output files like <strand>.out_suffix\n"
 "      --out-fofn=FILE                  write the names of the output models into FILE\n"
@@ -137,6 +139,7 @@ namespace opt
     static bool output_scores = false;
     static unsigned progress = 0;
     static unsigned num_threads = 1;
+    static int io_threads = -1;
     static unsigned batch_size = 128;
     static unsigned max_reads = -1;
 
@@ -166,7 +169,8 @@ enum { OPT_HELP = 1,
        OPT_P_BAD,
        OPT_P_BAD_SELF,
        OPT_MAX_READS,
-       OPT_MAX_EVENTS
+       OPT_MAX_EVENTS,
+       OPT_IO_THREADS
      };
 
 static const struct option longopts[] = {
@@ -188,6 +192,7 @@ static const struct option longopts[] = {
     { "output-scores",      no_argument,       NULL, OPT_OUTPUT_SCORES },
     { "no-update-models",   no_argument,       NULL, OPT_NO_UPDATE_MODELS },
     { "progress",           no_argument,       NULL, OPT_PROGRESS },
+    { "io-threads",         required_argument, NULL, OPT_IO_THREADS },
     { "help",               no_argument,       NULL, OPT_HELP },
     { "version",            no_argument,       NULL, OPT_VERSION },
     { "log-level",          required_argument, NULL, OPT_LOG_LEVEL },
@@ -198,6 +203,83 @@ static const struct option longopts[] = {
     { NULL, 0, NULL, 0 }
 };
 
+// fits with fewer events than this are not attempted
+#define MIN_EVENTS_TO_RESCALE 200
+
+ScalingsFitter::ScalingsFitter(bool scale_drift) : m_scale_drift(scale_drift), m_num_events(0), m_sum_e2(0.0)
+{
+    for(int i = 0; i < 3; ++i) {
+        m_b[i] = 0.0;
+        for(int j = 0; j < 3; ++j) {
+            m_A[i][j] = 0.0;
+        }
+    }
+}
+
+void ScalingsFitter::add(double level, double time, const PoreModelStateParams& state)
+{
+    // Assemble linear system corresponding to weighted least squares problem
+    // Can just directly call a weighted least squares solver, but there's enough
+    // structure in our problem it's a little faster just to build the normal eqn
+    // matrices ourselves
+    double inv_var = 1./(state.level_stdv*state.level_stdv);
+    double mu = state.level_mean;
+    double e  = level;
+
+    m_A[0][0] += inv_var;  m_A[0][1] += mu*inv_var;
+                           m_A[1][1] += mu*mu*inv_var;
+
+    m_b[0] += e*inv_var;
+    m_b[1] += mu*e*inv_var;
+
+    if (m_scale_drift) {
+        double t  = time;
+        m_A[0][2] += t*inv_var;
+        m_A[1][2] += mu*t*inv_var;
+        m_A[2][2] += t*t*inv_var;
+        m_b[2] += t*e*inv_var;
+    }
+
+    m_sum_e2 += e*e*inv_var;
+    m_num_events += 1;
+}
+
+bool ScalingsFitter::solve(bool scale_var, SquiggleScalings& scalings) const
+{
+    if (m_num_events < MIN_EVENTS_TO_RESCALE) {
+        return false;
+    }
+
+    const uint32_t num_equations = m_scale_drift ? 3 : 2;
+    Eigen::MatrixXd A(num_equations, num_equations);
+    Eigen::VectorXd b(num_equations);
+    for (int i=0; i<num_equations; i++) {
+        b(i) = m_b[i];
+        for (int j=i; j<num_equations; j++) {
+            A(i,j) = m_A[i][j];
+            A(j,i) = m_A[i][j];
+        }
+    }
+
+    // perform the linear solve
+    Eigen::VectorXd x = A.fullPivLu().solve(b);
+
+    double shift = x(0);
+    double scale = x(1);
+    double drift = m_scale_drift ? x(2) : 0.;
+    double var = 1.0;
+
+    if (scale_var) {
+        // the weighted sum of squared residuals, sum (e - x.phi)^2 / sd^2, expanded
+        // in terms of the accumulated sums as e.e - 2 x.b + x.A.x
+        double ss = m_sum_e2 - 2. * x.dot(b) + x.dot(A * x);
+        var = sqrt(std::max(ss, 0.) / m_num_events);
+    }
+
+    scalings.set4(shift, scale, drift, var);
+    return true;
+}
+
 // recalculate shift, scale, drift, scale_sd from an alignment and the read
 // returns true if the recalibration was performed
 // in either case, sets residual to the L1 norm of the residual
@@ -208,102 +290,59 @@ bool recalibrate_model(SquiggleRead &sr,
                        const bool scale_var,
                        const bool scale_drift)
 {
-    std::vector<double> raw_events, times, level_means, level_stdvs;
-    uint32_t k = pore_model.k;
-    const uint32_t num_equations = scale_drift ? 3 : 2;
-
-    //std::cout << "Previous pore model parameters: " << sr.pore_model[strand_idx].shift << ", "
-    //                                                << sr.pore_model[strand_idx].scale << ", "
-    //                                                << sr.pore_model[strand_idx].drift << ", "
-    //                                                << sr.pore_model[strand_idx].var   << std::endl;
-
-    // extract necessary vectors from the read and the pore model; note do not want scaled values
+    ScalingsFitter fitter(scale_drift);
     for(size_t ei = 0; ei < alignment_output.size(); ++ei) {
         const auto& ea = alignment_output[ei];
         if(ea.hmm_state == 'M') {
-            std::string model_kmer = ea.rc ? pore_model.pmalphabet->reverse_complement(ea.ref_kmer) : ea.ref_kmer;
-            uint32_t rank = pore_model.pmalphabet->kmer_rank(model_kmer.c_str(), k);
-
-            raw_events.push_back ( sr.get_unscaled_level(ea.event_idx, strand_idx) );
-            level_means.push_back( pore_model.states[rank].level_mean );
-            level_stdvs.push_back( pore_model.states[rank].level_stdv );
-            if (scale_drift)
-                times.push_back  ( sr.get_time(ea.event_idx, strand_idx) );
-
-            /*
-            fprintf(stdout, "recalibrate ei: %zu level: %.2lf kmer: %s model: %.2lf\n", 
-                    ei, sr.get_uncorrected_level(ea.event_idx, strand_idx), model_kmer.c_str(), 
-                    sr.pore_model[strand_idx].states[rank].level_mean);
-            */
+            // for matches the model kmer is the reference kmer on the sequenced strand
+            uint32_t rank = ea.get_model_kmer_rank(pore_model.pmalphabet);
+            fitter.add(sr.get_unscaled_level(ea.event_idx, strand_idx),
+                       scale_drift ? sr.get_time(ea.event_idx, strand_idx) : 0.0,
+                       pore_model.get_parameters(rank));
         }
     }
+    return fitter.solve(scale_var, sr.scalings[strand_idx]);
+}
 
-    const int minNumEventsToRescale = 200;
-    bool recalibrated = false; 
-    if (raw_events.size() >= minNumEventsToRescale) {
-        // Assemble linear system corresponding to weighted least squares problem
-        // Can just directly call a weighted least squares solver, but there's enough
-        // structure in our problem it's a little faster just to build the normal eqn
-        // matrices ourselves
-        Eigen::MatrixXd A(num_equations, num_equations);
-        Eigen::VectorXd b(num_equations);
-
-        for (int i=0; i<num_equations; i++) {
-            b(i) = 0.;
-            for (int j=0; j<num_equations; j++)
-                A(i,j) = 0.;
+//
+bool recalibrate_model(SquiggleRead &sr,
+                       const PoreModel& pore_model,
+                       const int strand_idx,
+                       const std::vector<AlignedPair>& event_alignment,
+                       const std::vector<uint32_t>& kmer_ranks,
+                       bool scale_var,
+                       bool scale_drift,
+                       size_t max_events)
+{
+    // there are no more candidate events than aligned pairs, so this uses at most max_events
+    size_t stride = max_events > 0 ? std::max((event_alignment.size() + max_events - 1) / max_events, (size_t)1) : 1;
+
+    // Events aligned to more than one k-mer are used for the first of them and
+    // repeated k-mers are used once, to match get_eventalignment_for_1d_basecalls
+    ScalingsFitter fitter(scale_drift);
+    int prev_event_idx = -1;
+    uint32_t prev_kmer_rank = -1;
+    size_t n_candidates = 0;
+    for(size_t i = 0; i < event_alignment.size(); ++i) {
+        int event_idx = event_alignment[i].read_pos;
+        if(event_idx == prev_event_idx) {
+            continue;
         }
+        prev_event_idx = event_idx;
 
-        for (size_t i=0; i<raw_events.size(); i++) {
-            double inv_var = 1./(level_stdvs[i]*level_stdvs[i]);
-            double mu = level_means[i];
-            double e  = raw_events[i];
-
-            A(0,0) += inv_var;  A(0,1) += mu*inv_var;
-                                A(1,1) += mu*mu*inv_var;
-
-            b(0) += e*inv_var;
-            b(1) += mu*e*inv_var;
-
-            if (scale_drift) {
-                double t  = times[i];
-                A(0,2) += t*inv_var;
-                A(1,2) += mu*t*inv_var;
-                A(2,2) += t*t*inv_var;
-                b(2) += t*e*inv_var;
-            }
-        }
-        A(1,0) = A(0,1);
-        if (scale_drift) {
-            A(2,0) = A(0,2);
-            A(2,1) = A(1,2);
+        uint32_t rank = kmer_ranks[event_alignment[i].ref_pos];
+        if(rank == prev_kmer_rank) {
+            continue;
         }
+        prev_kmer_rank = rank;
 
-        // perform the linear solve
-        Eigen::VectorXd x = A.fullPivLu().solve(b);
-
-        double shift = x(0);
-        double scale = x(1);
-        double drift = scale_drift ? x(2) : 0.;
-        double var = 1.0;
-
-        if (scale_var) {
-            var = 0.;
-            for (size_t i=0; i<raw_events.size(); i++) {
-                double yi = (raw_events[i] - shift - scale*level_means[i]);
-                if (scale_drift)
-                    yi -= drift*times[i];
-                var+= yi*yi/(level_stdvs[i]*level_stdvs[i]);
-            }
-            var /= raw_events.size();
-            var = sqrt(var);
+        if(n_candidates++ % stride == 0) {
+            fitter.add(sr.get_unscaled_level(event_idx, strand_idx),
+                       scale_drift ? sr.get_time(event_idx, strand_idx) : 0.0,
+                       pore_model.get_parameters(rank));
         }
-
-        sr.scalings[strand_idx].set4(shift, scale, drift, var);
-        recalibrated = true;
     }
-
-    return recalibrated;
+    return fitter.solve(scale_var, sr.scalings[strand_idx]);
 }
 
 // Use reservoir sampling to limit the amount of events for each kmer
@@ -327,7 +366,7 @@ void add_event(StateSummary& kmer_summary, StateTrainingData std, int event_coun
 
 // Update the training data with aligned events from a read
 void add_aligned_events(const ReadDB& read_db,
-                        const faidx_t* fai,
+                        const ReferenceDB& ref_db,
                         const bam_hdr_t* hdr,
                         const bam1_t* record,
                         size_t read_idx,
@@ -355,13 +394,10 @@ void add_aligned_events(const ReadDB& read_db,
         assert(training_kit == sr.get_model_kit_name(strand_idx));
         assert(training_k == sr.get_model_k(strand_idx));
 
-        // set k
-        uint32_t k = sr.get_model_k(strand_idx);
-
         // Align to the new model
         EventAlignmentParameters params;
         params.sr = &sr;
-        params.fai = fai;
+        params.ref_db = &ref_db;
         params.hdr = hdr;
         params.record = record;
         params.strand_idx = strand_idx;
@@ -376,14 +412,14 @@ void add_aligned_events(const ReadDB& read_db,
             return;
 
         // Update pore model based on alignment
-        std::string model_key = PoreModelSet::get_model_key(*sr.get_model(strand_idx, mtrain_alphabet->get_name()));
+        std::string model_key = PoreModelSet::get_model_key(*sr.get_model(strand_idx, mtrain_alphabet));
 
         //
         // Optional recalibration of shift/scale/drift and output of sequence likelihood
         //
         double orig_score = -INFINITY;
         if (opt::output_scores) {
-            orig_score = model_score(sr, strand_idx, fai, alignment_output, 500, NULL);
+            orig_score = model_score(sr, strand_idx, ref_db, alignment_output, 500, NULL);
 
             #pragma omp critical(print)
             std::cout << round << " " << model_key << " " << read_idx << " " << strand_idx << " Original " << orig_score << std::endl;
@@ -391,10 +427,10 @@ void add_aligned_events(const ReadDB& read_db,
 
         if ( opt::calibrate ) {
             double resid = 0.;
-            recalibrate_model(sr, *sr.get_model(strand_idx, mtrain_alphabet->get_name()), strand_idx, alignment_output, resid, true);
+            recalibrate_model(sr, *sr.get_model(strand_idx, mtrain_alphabet), strand_idx, alignment_output, resid, true);
 
             if (opt::output_scores) {
-                double rescaled_score = model_score(sr, strand_idx, fai, alignment_output, 500, NULL);
+                double rescaled_score = model_score(sr, strand_idx, ref_db, alignment_output, 500, NULL);
                 #pragma omp critical(print)
                 {
                     std::cout << round << " " << model_key << " " << read_idx << " " << strand_idx << " Rescaled " << rescaled_score << std::endl;
@@ -412,7 +448,6 @@ void add_aligned_events(const ReadDB& read_db,
 
         for(size_t i = 0; i < alignment_output.size(); ++i) {
             const EventAlignment& ea = alignment_output[i];
-            std::string model_kmer = ea.model_kmer;
 
             // Grab the previous/next model kmer from the alignment_output table.
             // If the read is from the same strand as the reference
@@ -431,16 +466,16 @@ void add_aligned_events(const ReadDB& read_db,
 
                 // only set the previous/next when there was exactly one base of movement along the referenc
                 if( std::abs(alignment_output[i + next_stride].ref_position - ea.ref_position) == 1) {
-                    next_kmer = alignment_output[i + next_stride].model_kmer;
+                    next_kmer = alignment_output[i + next_stride].get_model_kmer();
                 }
 
                 if( std::abs(alignment_output[i - next_stride].ref_position - ea.ref_position) == 1) {
-                    prev_kmer = alignment_output[i - next_stride].model_kmer;
+                    prev_kmer = alignment_output[i - next_stride].get_model_kmer();
                 }
             }
 
             // Get the rank of the kmer that we aligned to (on the sequencing strand, = model_kmer)
-            uint32_t rank = mtrain_alphabet->kmer_rank(model_kmer.c_str(), k);
+            uint32_t rank = ea.get_model_kmer_rank(mtrain_alphabet);
             assert(rank < emission_map.size());
             auto& kmer_summary = emission_map[rank];
 
@@ -504,6 +539,7 @@ void parse_methyltrain_options(int argc, char** argv)
             case OPT_P_BAD_SELF: arg >> g_p_bad_self; break;
             case OPT_MAX_READS: arg >> opt::max_reads; break;
             case OPT_MAX_EVENTS: arg >> opt::max_events; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
             case OPT_HELP:
                 std::cout << METHYLTRAIN_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -671,7 +707,7 @@ TrainingResult retrain_model_from_events(const PoreModel& current_model,
             }
 
             #pragma omp critical
-            result.trained_model.states[ki] = trained_mixture.params[0];
+            result.trained_model.set_parameters(ki, trained_mixture.params[0]);
 
 #if 0
             if (false && model_stdv()) {
@@ -698,7 +734,7 @@ TrainingResult retrain_model_from_events(const PoreModel& current_model,
                 // update state
                 #pragma omp critical
                 {
-                    result.trained_model.states[ki] = trained_ig_mixture.params[0];
+                    result.trained_model.set_parameters(ki, trained_ig_mixture.params[0]);
                 }
             }
 #endif 
@@ -711,7 +747,7 @@ TrainingResult retrain_model_from_events(const PoreModel& current_model,
             fprintf(summary_fp, "%s\t%s\t%d\t%d\t%d\t%zu\t%d\t%.2lf\t%.2lf\n",
                                     model_short_name.c_str(), kmer.c_str(),
                                     summaries[ki].num_matches, summaries[ki].num_skips, summaries[ki].num_stays,
-                                    summaries[ki].events.size(), trained, result.trained_model.states[ki].level_mean, result.trained_model.states[ki].level_stdv);
+                                    summaries[ki].events.size(), trained, result.trained_model.get_parameters(ki).level_mean, result.trained_model.get_parameters(ki).level_stdv);
         }
     }
 
@@ -719,6 +755,7 @@ TrainingResult retrain_model_from_events(const PoreModel& current_model,
 }
 
 void train_one_round(const ReadDB& read_db,
+                     const ReferenceDB& ref_db,
                      const std::string& kit_name,
                      const std::string& alphabet,
                      size_t k,
@@ -739,20 +776,17 @@ void train_one_round(const ReadDB& read_db,
     // Open the BAM and iterate over reads
 
     // load bam file
-    htsFile* bam_fh = sam_open(opt::bam_file.c_str(), "r");
-    assert(bam_fh != NULL);
+    htsFile* bam_fh = open_bam_file(opt::bam_file, "r");
 
-    // load bam index file
-    std::string index_filename = opt::bam_file + ".bai";
-    hts_idx_t* bam_idx = bam_index_load(index_filename.c_str());
-    assert(bam_idx != NULL);
+    // load bam index file, .bai for bam or .crai for cram
+    hts_idx_t* bam_idx = sam_index_load(bam_fh, opt::bam_file.c_str());
+    if(bam_idx == NULL) {
+        bam_index_error_exit(opt::bam_file);
+    }
 
     // read the bam header
     bam_hdr_t* hdr = sam_hdr_read(bam_fh);
 
-    // load reference fai file
-    faidx_t *fai = fai_load(opt::genome_file.c_str());
-
     hts_itr_t* itr;
 
     // If processing a region of the genome, only emit events aligned to this window
@@ -802,7 +836,7 @@ void train_one_round(const ReadDB& read_db,
                 bam1_t* record = records[i];
                 size_t read_idx = num_reads_realigned + i;
                 if( (record->core.flag & BAM_FUNMAP) == 0) {
-                    add_aligned_events(read_db, fai, hdr, record, read_idx,
+                    add_aligned_events(read_db, ref_db, hdr, record, read_idx,
                                        clip_start, clip_end,
                                        kit_name, alphabet, k,
                                        round, model_training_data, event_count);
@@ -866,7 +900,6 @@ void train_one_round(const ReadDB& read_db,
     // cleanup
     sam_itr_destroy(itr);
     bam_hdr_destroy(hdr);
-    fai_destroy(fai);
     sam_close(bam_fh);
     hts_idx_destroy(bam_idx);
     fclose(summary_fp);
@@ -892,11 +925,17 @@ void write_models(const std::map<std::string, PoreModel>& models, int round)
 int methyltrain_main(int argc, char** argv)
 {
     parse_methyltrain_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
     omp_set_num_threads(opt::num_threads);
 
     ReadDB read_db;
     read_db.load(opt::reads_file);
 
+    // load the reference genome once, it is shared by all training rounds
+    ReferenceDB ref_db;
+    ref_db.load(opt::genome_file);
+
     // Import the models to train into the pore model set
     assert(!opt::models_fofn.empty());
     std::vector<const PoreModel*> imported_models = PoreModelSet::initialize(opt::models_fofn);
@@ -912,7 +951,7 @@ int methyltrain_main(int argc, char** argv)
 
     for(size_t round = 0; round < opt::num_training_rounds; round++) {
         fprintf(stderr, "Starting round %zu\n", round);
-        train_one_round(read_db, training_kit, mtrain_alphabet->get_name(), training_k, round);
+        train_one_round(read_db, ref_db, training_kit, mtrain_alphabet->get_name(), training_k, round);
         /*
         if(opt::write_models) {
             write_models(training_kit, mtrain_alphabet->get_name(), training_k, round);
@@ -14,6 +14,33 @@
 #include <vector>
 #include "nanopolish_eventalign.h"
 #include "nanopolish_squiggle_read.h"
+#include "nanopolish_anchor.h"
+
+// Accumulates the normal equations of the weighted least squares fit of shift, scale
+// and optionally drift one event at a time, so the events do not need to be stored
+class ScalingsFitter
+{
+    public:
+        ScalingsFitter(bool scale_drift);
+
+        // add an event with the unscaled level, observed at time, that is aligned to state
+        void add(double level, double time, const PoreModelStateParams& state);
+
+        size_t get_num_events() const { return m_num_events; }
+
+        // solve for the scalings, var is the weighted residual of the fit if scale_var is true.
+        // Returns false and leaves scalings unchanged if there are too few events
+        bool solve(bool scale_var, SquiggleScalings& scalings) const;
+
+    private:
+        bool m_scale_drift;
+        size_t m_num_events;
+        double m_A[3][3];
+        double m_b[3];
+
+        // the weighted sum of the squared levels, to calculate the residual without the events
+        double m_sum_e2;
+};
 
 // recalculate shift, scale, drift, scale_sd from an alignment and the read
 // returns true if the recalibration was performed
@@ -25,6 +52,20 @@ bool recalibrate_model(SquiggleRead &sr,
                        bool scale_var=true,
                        bool scale_drift=true);
 
+// recalibrate from the alignment of events to the k-mers of a basecalled sequence, as
+// made by adaptive_banded_simple_event_align, with kmer_ranks the ranks of the k-mers in
+// the alphabet of pore_model. Like get_eventalignment_for_1d_basecalls only the first event
+// of each k-mer is used. If max_events is not zero at most that many of them are used,
+// evenly spaced along the read
+bool recalibrate_model(SquiggleRead &sr,
+                       const PoreModel& pore_model,
+                       const int strand_idx,
+                       const std::vector<AlignedPair>& event_alignment,
+                       const std::vector<uint32_t>& kmer_ranks,
+                       bool scale_var,
+                       bool scale_drift,
+                       size_t max_events = 0);
+
 int methyltrain_main(int argc, char** argv);
 
 #endif
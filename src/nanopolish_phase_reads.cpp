@@ -67,11 +67,13 @@ static const char *PHASE_READS_USAGE_MESSAGE =
 "      --version                        display version\n"
 "      --help                           display this help and exit\n"
 "  -r, --reads=FILE                     the ONT reads are in fasta FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the reference genome is in FILE\n"
 "  -w, --window=STR                     only phase reads in the window STR (format: ctg:start-end)\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
 "      --progress                       print out a progress message\n"
+"      --signal-cache                   load the events of each read from the cache built by nanopolish index --precompute-events\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 namespace opt
@@ -84,7 +86,9 @@ namespace opt
     static std::string region;
 
     static unsigned progress = 0;
+    static unsigned signal_cache = 0;
     static unsigned num_threads = 1;
+    static int io_threads = -1;
     static unsigned batch_size = 128;
     static int min_flanking_sequence = 30;
 }
@@ -94,7 +98,9 @@ static const char* shortopts = "r:b:g:t:w:v";
 enum { OPT_HELP = 1,
        OPT_VERSION,
        OPT_PROGRESS,
-       OPT_LOG_LEVEL
+       OPT_LOG_LEVEL,
+       OPT_SIGNAL_CACHE,
+       OPT_IO_THREADS
      };
 
 static const struct option longopts[] = {
@@ -105,6 +111,8 @@ static const struct option longopts[] = {
     { "threads",            required_argument, NULL, 't' },
     { "window",             required_argument, NULL, 'w' },
     { "progress",           no_argument,       NULL, OPT_PROGRESS },
+    { "signal-cache",       no_argument,       NULL, OPT_SIGNAL_CACHE },
+    { "io-threads",         required_argument, NULL, OPT_IO_THREADS },
     { "help",               no_argument,       NULL, OPT_HELP },
     { "version",            no_argument,       NULL, OPT_VERSION },
     { "log-level",          required_argument, NULL, OPT_LOG_LEVEL },
@@ -125,6 +133,8 @@ void parse_phase_reads_options(int argc, char** argv)
             case 't': arg >> opt::num_threads; break;
             case 'v': opt::verbose++; break;
             case OPT_PROGRESS: opt::progress = true; break;
+            case OPT_SIGNAL_CACHE: opt::signal_cache = true; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
             case OPT_HELP:
                 std::cout << PHASE_READS_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -176,7 +186,7 @@ void parse_phase_reads_options(int argc, char** argv)
 }
 
 void phase_single_read(const ReadDB& read_db,
-                       const faidx_t* fai,
+                       const ReferenceDB& ref_db,
                        const std::vector<Variant>& variants,
                        samFile* sam_fp,
                        const bam_hdr_t* hdr,
@@ -193,8 +203,15 @@ void phase_single_read(const ReadDB& read_db,
     // Load a squiggle read for the mapped read
     std::string read_name = bam_get_qname(record);
 
-    // load read
-    SquiggleRead sr(read_name, read_db);
+    // only the signal for the bases around the variants of the region is needed,
+    // including the flanking sequence each variant is scored with
+    SquiggleReadRange read_range;
+    if(region_start != -1 && region_end != -1) {
+        read_range = get_read_range_for_ref_region(record,
+                                                   region_start - opt::min_flanking_sequence,
+                                                   region_end + opt::min_flanking_sequence);
+    }
+    SquiggleRead sr(read_name, read_db, 0, read_range);
 
     std::string ref_name = hdr->target_name[record->core.tid];
     int alignment_start_pos = record->core.pos;
@@ -221,14 +238,11 @@ void phase_single_read(const ReadDB& read_db,
     }
 
     int fetched_len;
-    std::string reference_seq = get_reference_region_ts(fai,
-                                                        ref_name.c_str(),
-                                                        alignment_start_pos,
-                                                        alignment_end_pos,
-                                                        &fetched_len);
-
-    // convert to upper case to avoid calling c>C as variants
-    std::transform(reference_seq.begin(), reference_seq.end(), reference_seq.begin(), ::toupper);
+    // the reference store returns upper case bases so c>C is not called as a variant
+    std::string reference_seq = ref_db.get_subsequence(ref_name,
+                                                       alignment_start_pos,
+                                                       alignment_end_pos,
+                                                       &fetched_len);
 
     std::string read_outseq = reference_seq;
     std::string read_outqual(reference_seq.length(), MAX_Q_SCORE + BAM_Q_OFFSET);
@@ -349,17 +363,20 @@ void phase_single_read(const ReadDB& read_db,
 int phase_reads_main(int argc, char** argv)
 {
     parse_phase_reads_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
     omp_set_num_threads(opt::num_threads);
 
     ReadDB read_db;
     read_db.load(opt::reads_file);
-
-    // load reference fai file
-    faidx_t *fai = fai_load(opt::genome_file.c_str());
-    if(fai == NULL) {
-        exit(EXIT_FAILURE);
+    if(opt::signal_cache) {
+        read_db.open_signal_cache();
     }
 
+    // load the reference genome into memory
+    ReferenceDB ref_db;
+    ref_db.load(opt::genome_file);
+
     std::vector<Variant> variants;
     if(!opt::region.empty()) {
         std::string contig;
@@ -380,13 +397,14 @@ int phase_reads_main(int argc, char** argv)
     auto new_end = std::remove_if(variants.begin(), variants.end(), [](Variant v) { return v.genotype == "0/0"; });
     variants.erase( new_end, variants.end());
 
-    samFile* sam_out = sam_open("-", "w");
+    samFile* sam_out = open_bam_file("-", "w");
 
     // the BamProcessor framework calls the input function with the
     // bam record, read index, etc passed as parameters
     // bind the other parameters the worker function needs here
-    auto f = std::bind(phase_single_read, std::ref(read_db), std::ref(fai), std::ref(variants), sam_out, _1, _2, _3, _4, _5);
+    auto f = std::bind(phase_single_read, std::ref(read_db), std::ref(ref_db), std::ref(variants), sam_out, _1, _2, _3, _4, _5);
     BamProcessor processor(opt::bam_file, opt::region, opt::num_threads);
+    processor.set_fast5_locality(&read_db);
 
     // Copy the bam header to std
     int ret = sam_hdr_write(sam_out, processor.get_bam_header());
@@ -395,7 +413,6 @@ int phase_reads_main(int argc, char** argv)
     }
     processor.parallel_run(f);
 
-    fai_destroy(fai);
     sam_close(sam_out);
 
     return EXIT_SUCCESS;
@@ -34,7 +34,10 @@
 #include "nanopolish_hmm_input_sequence.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_bam_processor.h"
+#include "nanopolish_bam_utils.h"
+#include "nanopolish_reorder_buffer.h"
 #include "nanopolish_polya_estimator.h"
+#include "nanopolish_fast5_cache.h"
 #include "nanopolish_raw_loader.h"
 #include "nanopolish_emissions.h"
 #include "H5pubconf.h"
@@ -63,9 +66,11 @@ static const char *POLYA_USAGE_MESSAGE =
 "      --help                           display this help and exit\n"
 "  -w, --window=STR                     only compute the poly-A lengths for reads in window STR (format: ctg:start_id-end_id)\n"
 "  -r, --reads=FILE                     the 1D ONT direct RNA reads are in fasta FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the reference genome assembly for the reads is in FILE\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
+"      --fast5-cache-size=NUM           keep up to NUM fast5 files open per thread (default: 4)\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 namespace opt
@@ -77,12 +82,14 @@ namespace opt
     static std::string region;
     static int progress = 0;
     static int num_threads = 1;
+    static int io_threads = -1;
     static int batch_size = 128;
+    static int fast5_cache_size = FAST5_CACHE_DEFAULT_SIZE;
 }
 
 static const char* shortopts = "r:b:g:t:w:v";
 
-enum { OPT_HELP = 1, OPT_VERSION };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_FAST5_CACHE_SIZE, OPT_IO_THREADS };
 
 static const struct option longopts[] = {
     { "verbose",          no_argument,       NULL, 'v' },
@@ -91,6 +98,8 @@ static const struct option longopts[] = {
     { "genome",           required_argument, NULL, 'g' },
     { "window",           required_argument, NULL, 'w' },
     { "threads",          required_argument, NULL, 't' },
+    { "fast5-cache-size", required_argument, NULL, OPT_FAST5_CACHE_SIZE },
+    { "io-threads",       required_argument, NULL, OPT_IO_THREADS },
     { "help",             no_argument,       NULL, OPT_HELP },
     { "version",          no_argument,       NULL, OPT_VERSION },
     { NULL, 0, NULL, 0 }
@@ -109,6 +118,8 @@ void parse_polya_options(int argc, char** argv)
             case 't': arg >> opt::num_threads; break;
             case 'v': opt::verbose++; break;
             case 'w': arg >> opt::region; break;
+            case OPT_FAST5_CACHE_SIZE: arg >> opt::fast5_cache_size; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
             case OPT_HELP:
                 std::cout << POLYA_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -132,6 +143,11 @@ void parse_polya_options(int argc, char** argv)
         die = true;
     }
 
+    if(opt::fast5_cache_size < 0) {
+        std::cerr << SUBPROGRAM ": invalid fast5 cache size: " << opt::fast5_cache_size << "\n";
+        die = true;
+    }
+
     if(opt::reads_file.empty()) {
         std::cerr << SUBPROGRAM ": a --reads file must be provided\n";
         die = true;
@@ -372,7 +388,7 @@ public:
     ViterbiOutputs viterbi(const SquiggleRead& sr) const
     {
         // count of raw samples:
-        size_t num_samples = sr.samples.size();
+        size_t num_samples = sr.get_num_samples();
 
         // create/initialize viterbi scores and backpointers:
         std::vector<float> init_scores(HMM_NUM_STATES, -std::numeric_limits<float>::infinity()); // log(0.0) == -INFTY
@@ -382,8 +398,9 @@ public:
 
         // forward viterbi pass; fill up backpointers:
         // weight initially distributed between START and LEADER:
-        viterbi_scores[0][HMM_START] = this->log_start_probs[HMM_START] + this->emit_log_proba(sr.samples[num_samples-1], HMM_START);
-        viterbi_scores[0][HMM_LEADER] = this->log_start_probs[HMM_LEADER] + this->emit_log_proba(sr.samples[num_samples-1], HMM_LEADER);
+        float x0 = sr.get_sample(num_samples-1);
+        viterbi_scores[0][HMM_START] = this->log_start_probs[HMM_START] + this->emit_log_proba(x0, HMM_START);
+        viterbi_scores[0][HMM_LEADER] = this->log_start_probs[HMM_LEADER] + this->emit_log_proba(x0, HMM_LEADER);
         for (size_t i = 1; i < num_samples; ++i) {
             // get individual incoming state scores:
             float s_to_s = viterbi_scores.at(i-1)[HMM_START] + this->log_state_transitions[HMM_START][HMM_START];
@@ -400,12 +417,13 @@ public:
             float t_to_t = viterbi_scores.at(i-1)[HMM_TRANSCRIPT] + this->log_state_transitions[HMM_TRANSCRIPT][HMM_TRANSCRIPT];
 
             // update the viterbi scores for each state at this timestep:
-            viterbi_scores.at(i)[HMM_START] = s_to_s + this->emit_log_proba(sr.samples[i], HMM_START);
-            viterbi_scores.at(i)[HMM_LEADER] = std::max(l_to_l, s_to_l) + this->emit_log_proba(sr.samples[i], HMM_LEADER);
-            viterbi_scores.at(i)[HMM_ADAPTER] = std::max(a_to_a, l_to_a) + this->emit_log_proba(sr.samples[i], HMM_ADAPTER);
-            viterbi_scores.at(i)[HMM_POLYA] = std::max(p_to_p, std::max(a_to_p, c_to_p)) + this->emit_log_proba(sr.samples[i], HMM_POLYA);
-            viterbi_scores.at(i)[HMM_CLIFF] = std::max(c_to_c, p_to_c) + this->emit_log_proba(sr.samples[i], HMM_CLIFF);
-            viterbi_scores.at(i)[HMM_TRANSCRIPT] = std::max(p_to_t, t_to_t) + this->emit_log_proba(sr.samples[i], HMM_TRANSCRIPT);
+            float x = sr.get_sample(i);
+            viterbi_scores.at(i)[HMM_START] = s_to_s + this->emit_log_proba(x, HMM_START);
+            viterbi_scores.at(i)[HMM_LEADER] = std::max(l_to_l, s_to_l) + this->emit_log_proba(x, HMM_LEADER);
+            viterbi_scores.at(i)[HMM_ADAPTER] = std::max(a_to_a, l_to_a) + this->emit_log_proba(x, HMM_ADAPTER);
+            viterbi_scores.at(i)[HMM_POLYA] = std::max(p_to_p, std::max(a_to_p, c_to_p)) + this->emit_log_proba(x, HMM_POLYA);
+            viterbi_scores.at(i)[HMM_CLIFF] = std::max(c_to_c, p_to_c) + this->emit_log_proba(x, HMM_CLIFF);
+            viterbi_scores.at(i)[HMM_TRANSCRIPT] = std::max(p_to_t, t_to_t) + this->emit_log_proba(x, HMM_TRANSCRIPT);
 
             // backpointers:
             // START: S can only come from S
@@ -520,14 +538,14 @@ public:
 // (N.B.: deprecated; using non-eventaligned durations seems to work just as well
 // while being faster to run.)
 double estimate_eventalign_duration_profile(SquiggleRead& sr,
-                                            const faidx_t* fai,
+                                            const ReferenceDB& ref_db,
                                             const bam_hdr_t* hdr,
                                             const bam1_t* record,
                                             const size_t read_idx)
 {
     EventAlignmentParameters params;
     params.sr = &sr;
-    params.fai = fai;
+    params.ref_db = &ref_db;
     params.hdr = hdr;
     params.record = record;
     params.strand_idx = 0;
@@ -562,7 +580,7 @@ double estimate_eventalign_duration_profile(SquiggleRead& sr,
 
 // compute a read-rate based on kmer-to-event mapping, collapsed by consecutive 5mer identity:
 double estimate_unaligned_duration_profile(const SquiggleRead& sr,
-                                           const faidx_t* fai,
+                                           const ReferenceDB& ref_db,
                                            const bam_hdr_t* hdr,
                                            const bam1_t* record,
                                            const size_t read_idx,
@@ -600,7 +618,7 @@ double estimate_unaligned_duration_profile(const SquiggleRead& sr,
 
 // fetch the raw event durations for a given read:
 std::vector<double> fetch_event_durations(const SquiggleRead& sr,
-                                          const faidx_t* fai,
+                                          const ReferenceDB& ref_db,
                                           const bam_hdr_t* hdr,
                                           const bam1_t* record,
                                           const size_t read_idx,
@@ -640,7 +658,7 @@ double estimate_polya_length(const SquiggleRead& sr, const Segmentation& region_
     // start and end times (sample indices) of the poly(A) tail, in original 3'->5' time-direction:
     // (n.b.: everything in 5'->3' order due to inversion in SquiggleRead constructor, but our
     // `region_indices` struct has everything in 3'->5' order)
-    double num_samples = sr.samples.size();
+    double num_samples = sr.get_num_samples();
     double polya_sample_start = region_indices.adapter + 1;
     double polya_sample_end = region_indices.polya;
     double adapter_sample_start = region_indices.leader;
@@ -731,8 +749,9 @@ std::string post_estimation_qc(const Segmentation& region_indices, const Squiggl
 // ================================================================================
 // Write Poly(A) region segmentation and tail length estimation data to TSV
 void estimate_polya_for_single_read(const ReadDB& read_db,
-                                    const faidx_t* fai,
+                                    const ReferenceDB& ref_db,
                                     FILE* out_fp,
+                                    ReorderBuffer& output,
                                     const bam_hdr_t* hdr,
                                     const bam1_t* record,
                                     size_t read_idx,
@@ -760,19 +779,18 @@ void estimate_polya_for_single_read(const ReadDB& read_db,
     //----- construct SquiggleRead; if there are load issues, print -1's and skip compute:
     SquiggleRead sr(read_name, read_db, SRF_LOAD_RAW_SAMPLES);
     if (sr.fast5_path == "" || sr.events[0].empty()) {
-        #pragma omp critical
-	{
-            fprintf(out_fp, "%s\t%s\t%zu\t-1.0\t-1.0\t-1.0\t-1.0\t-1.00\t-1.00\tREAD_FAILED_LOAD\n",
-                read_name.c_str(), ref_name.c_str(), record->core.pos);
-            if (opt::verbose == 1) {
-                fprintf(out_fp,
-                    "polya-samples\t%s\t%s\t-1\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\tREAD_FAILED_LOAD\n",
-                    read_name.substr(0,6).c_str(), ref_name.c_str());
-            }
-            if (opt::verbose == 2) {
-                fprintf(out_fp, "polya-durations\t%s\t-1\t-1.0\tREAD_FAILED_LOAD\n", read_name.substr(0,6).c_str());
-            }
+        ReadOutputStream out;
+        fprintf(out.fp(), "%s\t%s\t%zu\t-1.0\t-1.0\t-1.0\t-1.0\t-1.00\t-1.00\tREAD_FAILED_LOAD\n",
+            read_name.c_str(), ref_name.c_str(), record->core.pos);
+        if (opt::verbose == 1) {
+            fprintf(out.fp(),
+                "polya-samples\t%s\t%s\t-1\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\t-1.0\tREAD_FAILED_LOAD\n",
+                read_name.substr(0,6).c_str(), ref_name.c_str());
+        }
+        if (opt::verbose == 2) {
+            fprintf(out.fp(), "polya-durations\t%s\t-1\t-1.0\tREAD_FAILED_LOAD\n", read_name.substr(0,6).c_str());
         }
+        output.add(read_idx, out_fp, out.release());
         return;
     }
 
@@ -794,7 +812,7 @@ void estimate_polya_for_single_read(const ReadDB& read_db,
     std::string post_segmentation_qc_flag = post_segmentation_qc(region_indices, sr);
 
     //----- compute duration profile for the read:
-    double read_rate = estimate_unaligned_duration_profile(sr, fai, hdr, record, read_idx, strand_idx);
+    double read_rate = estimate_unaligned_duration_profile(sr, ref_db, hdr, record, read_idx, strand_idx);
 
     //----- estimate number of nucleotides in poly-A tail & post-estimation QC:
     double polya_length = estimate_polya_length(sr, region_indices, read_rate);
@@ -818,60 +836,63 @@ void estimate_polya_for_single_read(const ReadDB& read_db,
     double polya_sample_start = region_indices.adapter+1;
     double polya_sample_end = region_indices.polya;
     double transcr_sample_start = region_indices.polya+1;
-    #pragma omp critical
-    {
-        fprintf(out_fp, "%s\t%s\t%zu\t%.1lf\t%.1lf\t%.1lf\t%.1lf\t%.2lf\t%.2lf\t%s\n",
-                read_name.c_str(), ref_name.c_str(), record->core.pos,
-                leader_sample_start, adapter_sample_start, polya_sample_start,
-                transcr_sample_start, read_rate, polya_length, qc_tag.c_str());
-        // if `verbose == 1`, print the samples (picoAmps) of the read,
-        // up to the first 1000 samples of transcript region:
-        if (opt::verbose == 1) {
-            for (size_t i = 0; i < std::min(static_cast<size_t>(polya_sample_end)+1000, sr.samples.size()); ++i) {
-                std::string tag;
-                if (i < leader_sample_start) {
-                    tag = "START";
-                } else if (i < adapter_sample_start) {
-                    tag = "LEADER";
-                } else if (i < polya_sample_start) {
-                    tag =  "ADAPTER";
-                } else if (i < polya_sample_end) {
-                    tag = "POLYA";
-                } else {
-                    tag = "TRANSCRIPT";
-                }
-                float s = sr.samples[i];
-                float scaled_s = (s - sr.scalings[0].shift) / sr.scalings[0].scale;
-                std::vector<float> s_probas = hmm.log_probas(s);
-                fprintf(out_fp, "polya-samples\t%s\t%s\t%zu\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%s\n",
-                        read_name.substr(0,6).c_str(), ref_name.c_str(), i, s, scaled_s,
-                        s_probas.at(0), s_probas.at(1), s_probas.at(2), s_probas.at(3), s_probas.at(4), s_probas.at(5),
-                        tag.c_str());
+    ReadOutputStream out;
+    fprintf(out.fp(), "%s\t%s\t%zu\t%.1lf\t%.1lf\t%.1lf\t%.1lf\t%.2lf\t%.2lf\t%s\n",
+            read_name.c_str(), ref_name.c_str(), record->core.pos,
+            leader_sample_start, adapter_sample_start, polya_sample_start,
+            transcr_sample_start, read_rate, polya_length, qc_tag.c_str());
+    // if `verbose == 1`, print the samples (picoAmps) of the read,
+    // up to the first 1000 samples of transcript region:
+    if (opt::verbose == 1) {
+        for (size_t i = 0; i < std::min(static_cast<size_t>(polya_sample_end)+1000, sr.get_num_samples()); ++i) {
+            std::string tag;
+            if (i < leader_sample_start) {
+                tag = "START";
+            } else if (i < adapter_sample_start) {
+                tag = "LEADER";
+            } else if (i < polya_sample_start) {
+                tag =  "ADAPTER";
+            } else if (i < polya_sample_end) {
+                tag = "POLYA";
+            } else {
+                tag = "TRANSCRIPT";
             }
+            float s = sr.get_sample(i);
+            float scaled_s = (s - sr.scalings[0].shift) / sr.scalings[0].scale;
+            std::vector<float> s_probas = hmm.log_probas(s);
+            fprintf(out.fp(), "polya-samples\t%s\t%s\t%zu\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%s\n",
+                    read_name.substr(0,6).c_str(), ref_name.c_str(), i, s, scaled_s,
+                    s_probas.at(0), s_probas.at(1), s_probas.at(2), s_probas.at(3), s_probas.at(4), s_probas.at(5),
+                    tag.c_str());
         }
-        // if `verbose == 2`, print the raw event durations of the read:
-        if (opt::verbose == 2) {
-            std::vector<double> raw_durations = fetch_event_durations(sr, fai, hdr, record, read_idx, strand_idx);
-            for (size_t i = 0; i < raw_durations.size(); ++i) {
-                double dura = raw_durations[i];
-                fprintf(out_fp, "polya-durations\t%s\t%zu\t%f\t%s\n",
-                    read_name.substr(0,6).c_str(), i, dura, qc_tag.c_str());
-            }
+    }
+    // if `verbose == 2`, print the raw event durations of the read:
+    if (opt::verbose == 2) {
+        std::vector<double> raw_durations = fetch_event_durations(sr, ref_db, hdr, record, read_idx, strand_idx);
+        for (size_t i = 0; i < raw_durations.size(); ++i) {
+            double dura = raw_durations[i];
+            fprintf(out.fp(), "polya-durations\t%s\t%zu\t%f\t%s\n",
+                read_name.substr(0,6).c_str(), i, dura, qc_tag.c_str());
         }
     }
+    output.add(read_idx, out_fp, out.release());
 }
 
 // Wrap poly-A estimation code for parallelism
 int polya_main(int argc, char** argv)
 {
     parse_polya_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
     omp_set_num_threads(opt::num_threads);
+    fast5_cache_set_size(opt::fast5_cache_size);
 
     ReadDB read_db;
     read_db.load(opt::reads_file);
 
-    // load reference fai file
-    faidx_t *fai = fai_load(opt::genome_file.c_str());
+    // load the reference sequences into memory
+    ReferenceDB ref_db;
+    ref_db.load(opt::genome_file);
 
     // print header line:
     fprintf(stdout, "readname\tcontig\tposition\tleader_start\tadapter_start\tpolya_start\ttranscript_start\tread_rate\tpolya_length\tqc_tag\n");
@@ -879,12 +900,17 @@ int polya_main(int argc, char** argv)
     // the BamProcessor framework calls the input function with the
     // bam record, read index, etc passed as parameters
     // bind the other parameters the worker function needs here
-    auto f = std::bind(estimate_polya_for_single_read, std::ref(read_db), std::ref(fai), stdout, _1, _2, _3, _4, _5);
+    ReorderBuffer output;
+    auto f = std::bind(estimate_polya_for_single_read, std::ref(read_db), std::ref(ref_db), stdout, std::ref(output), _1, _2, _3, _4, _5);
     BamProcessor processor(opt::bam_file, opt::region, opt::num_threads);
+    processor.set_fast5_locality(&read_db);
+    processor.set_reorder_buffer(&output);
     processor.parallel_run(f);
 
-    // free allocated values:
-    fai_destroy(fai);
+    if(opt::verbose > 0) {
+        fast5_cache_print_stats();
+        processor.print_stats();
+    }
 
     return EXIT_SUCCESS;
 }
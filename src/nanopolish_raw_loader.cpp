@@ -30,11 +30,13 @@ SquiggleScalings estimate_scalings_using_mom(const std::string& sequence,
         event_level_sum += et.event[i].mean;
     }
 
+    std::vector<uint32_t> kmer_ranks;
+    alphabet->kmer_ranks(sequence, k, kmer_ranks);
+
     double kmer_level_sum = 0.0f;
     double kmer_level_sq_sum = 0.0f;
     for(size_t i = 0; i < n_kmers; ++i) {
-        size_t kmer_rank = alphabet->kmer_rank(sequence.substr(i, k).c_str(), k);
-        double l = pore_model.get_parameters(kmer_rank).level_mean;
+        double l = pore_model.level_mean[kmer_ranks[i]];
         kmer_level_sum += l;
         kmer_level_sq_sum += pow(l, 2.0f);
     }
@@ -71,8 +73,26 @@ SquiggleScalings estimate_scalings_using_mom(const std::string& sequence,
 
 #define ALN_BANDWIDTH 100
 
-#define BAND_ARRAY(r, c) ( bands[((r)*(ALN_BANDWIDTH)+(c))] )
-#define TRACE_ARRAY(r, c) ( trace[((r)*(ALN_BANDWIDTH)+(c))] )
+// Only the scores of the last three bands are kept, in rows that are reused. Each row has an
+// extra -INFINITY cell on both ends so that reading one offset past the band needs no check
+#define ALN_BAND_ROWS 3
+#define ALN_ROW_SIZE (ALN_BANDWIDTH + 2)
+#define BAND_ARRAY(r, c) ( bands[((r) % ALN_BAND_ROWS) * ALN_ROW_SIZE + (c) + 1] )
+
+// The backtrack markers take 2 bits, four cells are packed into each byte
+#define ALN_TRACE_BYTES ((ALN_BANDWIDTH + 3) / 4)
+
+inline void set_trace(uint8_t* trace, size_t band_idx, int offset, uint8_t from)
+{
+    uint8_t& b = trace[band_idx * ALN_TRACE_BYTES + offset / 4];
+    int shift = (offset % 4) * 2;
+    b = (b & ~(3 << shift)) | (from << shift);
+}
+
+inline uint8_t get_trace(const uint8_t* trace, size_t band_idx, int offset)
+{
+    return (trace[band_idx * ALN_TRACE_BYTES + offset / 4] >> ((offset % 4) * 2)) & 3;
+}
 
 std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read, const PoreModel& pore_model, const std::string& sequence)
 {
@@ -115,27 +135,29 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
     // Initialize
 
     // Precompute k-mer ranks to avoid doing this in the inner loop
-    std::vector<size_t> kmer_ranks(n_kmers);
-    for(size_t i = 0; i < n_kmers; ++i) {
-        kmer_ranks[i] = alphabet->kmer_rank(sequence.substr(i, k).c_str(), k);
+    std::vector<uint32_t> kmer_ranks;
+    alphabet->kmer_ranks(sequence, k, kmer_ranks);
+
+    // Precompute the scaled event levels and k-mer gaussians so the inner loop
+    // is arithmetic on arrays, which the compiler can vectorize
+    std::vector<float> event_levels(n_events);
+    for(size_t i = 0; i < n_events; ++i) {
+        event_levels[i] = read.get_drift_scaled_level(i, strand_idx);
     }
 
-    float* bands = (float*)malloc(sizeof(float) * n_bands * bandwidth);
-    if(bands==NULL){
-        fprintf(stderr,"Memory allocation failed at %s\n",__func__);
-        exit(1);
+    std::vector<GaussianParameters> kmer_gaussians(n_kmers);
+    for(size_t i = 0; i < n_kmers; ++i) {
+        kmer_gaussians[i] = read.get_scaled_gaussian_from_pore_model_state(pore_model, strand_idx, kmer_ranks[i]);
     }
-    uint8_t* trace = (uint8_t*)malloc(sizeof(uint8_t) * n_bands * bandwidth);
+
+    std::vector<float> bands(ALN_BAND_ROWS * ALN_ROW_SIZE, -INFINITY);
+
+    // calloc'd so the pages of the trace are only touched as the bands are filled
+    uint8_t* trace = (uint8_t*)calloc(n_bands * ALN_TRACE_BYTES, sizeof(uint8_t));
     if(trace==NULL){
         fprintf(stderr,"Memory allocation failed at %s\n",__func__);
         exit(1);
     }
-    for (size_t i = 0; i < n_bands; i++) {
-        for (int j = 0; j < bandwidth; j++) {
-            BAND_ARRAY(i,j) = -INFINITY;
-            TRACE_ARRAY(i,j) = 0;
-        }
-    }
 
     // Keep track of the event/kmer index for the lower left corner of the band
     // these indices are updated at every iteration to perform the adaptive banding
@@ -164,14 +186,22 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
     assert(kmer_at_offset(1, first_trim_offset) == -1);
     assert(is_offset_valid(first_trim_offset));
     BAND_ARRAY(1,first_trim_offset) = lp_trim;
-    TRACE_ARRAY(1,first_trim_offset) = FROM_U;
+    set_trace(trace, 1, first_trim_offset, FROM_U);
 
     int fills = 0;
 #ifdef DEBUG_ADAPTIVE
     fprintf(stderr, "[trim] bi: %d o: %d e: %d k: %d s: %.2lf\n", 1, first_trim_offset, 0, -1, BAND_ARRAY(1,first_trim_offset));
 #endif
 
+    // The best score between an event and the last k-mer, after trimming the remaining events.
+    // The bands are not kept so this is tracked as they are filled
+    float best_end_score = -INFINITY;
+    int curr_event_idx = 0;
+    int curr_kmer_idx = n_kmers -1;
+
     // fill in remaining bands
+    float band_scores[ALN_BANDWIDTH];
+    uint8_t band_from[ALN_BANDWIDTH];
     for(int band_idx = 2; band_idx < n_bands; ++band_idx) {
         // Determine placement of this band according to Suzuki's adaptive algorithm
         // When both ll and ur are out-of-band (ob) we alternate movements
@@ -194,33 +224,17 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
             band_lower_left[band_idx] = move_down(band_lower_left[band_idx - 1]);
         }
 
-/*
-        float max_score = -INFINITY;
-        int tmp_max_offset = 0;
-        for(int tmp = 0; tmp < bandwidth; ++tmp) {
-            float s = bands[band_idx - 1][tmp];
-            if(s > max_score) {
-                max_score = s;
-                tmp_max_offset = tmp;
-            }
-        }
-        fprintf(stderr, "bi: %d ll: %.2f up: %.2f [%d %d] [%d %d] max: %.2f [%d %d] move: %s\n", 
-            band_idx, bands[band_idx - 1][0], bands[band_idx - 1][bandwidth - 1], 
-            band_lower_left[band_idx - 1].event_idx, band_lower_left[band_idx - 1].kmer_idx,
-            event_at_offset(band_idx - 1, bandwidth - 1), kmer_at_offset(band_idx - 1, bandwidth - 1),
-            max_score, event_at_offset(band_idx - 1, tmp_max_offset), kmer_at_offset(band_idx - 1, tmp_max_offset),
-            (right ? "RIGHT" : "DOWN"));
-*/
+        // this band reuses the row of band_idx - 3
+        float* curr = &BAND_ARRAY(band_idx,0);
+        std::fill(curr, curr + bandwidth, -INFINITY);
 
         // If the trim state is within the band, fill it in here
         int trim_offset = band_kmer_to_offset(band_idx, -1);
         if(is_offset_valid(trim_offset)) {
             int event_idx = event_at_offset(band_idx, trim_offset);
             if(event_idx >= 0 && event_idx < n_events) {
-                BAND_ARRAY(band_idx,trim_offset) = lp_trim * (event_idx + 1);
-                TRACE_ARRAY(band_idx,trim_offset) = FROM_U;
-            } else {
-                BAND_ARRAY(band_idx,trim_offset) = -INFINITY;
+                curr[trim_offset] = lp_trim * (event_idx + 1);
+                set_trace(trace, band_idx, trim_offset, FROM_U);
             }
         }
 
@@ -237,30 +251,29 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
         int max_offset = std::min(kmer_max_offset, event_max_offset);
         max_offset = std::min(max_offset, bandwidth);
 
-        for(int offset = min_offset; offset < max_offset; ++offset) {
-            int event_idx = event_at_offset(band_idx, offset);
-            int kmer_idx = kmer_at_offset(band_idx, offset);
-
-            size_t kmer_rank = kmer_ranks[kmer_idx];
-
-            int offset_up   = band_event_to_offset(band_idx - 1, event_idx - 1);
-            int offset_left = band_kmer_to_offset(band_idx - 1, kmer_idx - 1);
-            int offset_diag = band_kmer_to_offset(band_idx - 2, kmer_idx - 1);
+        // The cells above, to the left and diagonal of the cell at an offset are at a fixed
+        // distance from the offset in the previous bands, at most one cell outside of the band
+        int band_event_idx = band_lower_left[band_idx].event_idx;
+        int band_kmer_idx = band_lower_left[band_idx].kmer_idx;
+        int up_delta = band_event_to_offset(band_idx - 1, band_event_idx - 1);
+        int diag_delta = band_kmer_to_offset(band_idx - 2, band_kmer_idx - 1);
+        const float* prev = &BAND_ARRAY(band_idx - 1,0);
+        const float* prev_diag = &BAND_ARRAY(band_idx - 2,0);
 
 #ifdef DEBUG_ADAPTIVE
-            // verify loop conditions
-            assert(kmer_idx >= 0 && kmer_idx < n_kmers);
-            assert(event_idx >= 0 && event_idx < n_events);
-            assert(offset_diag == band_event_to_offset(band_idx - 2, event_idx - 1));
-            assert(offset_up - offset_left == 1);
-            assert(offset >= 0 && offset < bandwidth);
+        assert(up_delta >= 0 && up_delta <= 1);
+        assert(diag_delta >= -1 && diag_delta <= 1);
 #endif
 
-            float up   = is_offset_valid(offset_up)   ? BAND_ARRAY(band_idx - 1,offset_up)   : -INFINITY;
-            float left = is_offset_valid(offset_left) ? BAND_ARRAY(band_idx - 1,offset_left) : -INFINITY;
-            float diag = is_offset_valid(offset_diag) ? BAND_ARRAY(band_idx - 2,offset_diag) : -INFINITY;
+        for(int offset = min_offset; offset < max_offset; ++offset) {
+            int event_idx = band_event_idx - offset;
+            int kmer_idx = band_kmer_idx + offset;
+
+            float up   = prev[offset + up_delta];
+            float left = prev[offset + up_delta - 1];
+            float diag = prev_diag[offset + diag_delta];
 
-            float lp_emission = log_probability_match_r9(read, pore_model, kmer_rank, event_idx, strand_idx);
+            float lp_emission = log_normal_pdf(event_levels[event_idx], kmer_gaussians[kmer_idx]);
             float score_d = diag + lp_step + lp_emission;
             float score_u = up + lp_stay + lp_emission;
             float score_l = left + lp_skip;
@@ -273,31 +286,30 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
             max_score = score_l > max_score ? score_l : max_score;
             from = max_score == score_l ? FROM_L : from;
 
+            band_scores[offset] = max_score;
+            band_from[offset] = from;
+        }
+
+        for(int offset = min_offset; offset < max_offset; ++offset) {
+            curr[offset] = band_scores[offset];
+            set_trace(trace, band_idx, offset, band_from[offset]);
 #ifdef DEBUG_ADAPTIVE
-            fprintf(stderr, "[adafill] offset-up: %d offset-diag: %d offset-left: %d\n", offset_up, offset_diag, offset_left);
-            fprintf(stderr, "[adafill] up: %.2lf diag: %.2lf left: %.2lf\n", up, diag, left);
-            fprintf(stderr, "[adafill] bi: %d o: %d e: %d k: %d s: %.2lf f: %d emit: %.2lf\n", band_idx, offset, event_idx, kmer_idx, max_score, from, lp_emission);
+            fprintf(stderr, "[adafill] bi: %d o: %d e: %d k: %d s: %.2lf f: %d\n", band_idx, offset,
+                event_at_offset(band_idx, offset), kmer_at_offset(band_idx, offset), band_scores[offset], band_from[offset]);
 #endif
-            BAND_ARRAY(band_idx,offset) = max_score;
-            TRACE_ARRAY(band_idx,offset) = from;
-            fills += 1;
         }
-    }
-
-    /*
-    // Debug, print some of the score matrix
-    for(int col = 0; col <= 10; ++col) {
-        for(int row = 0; row < 100; ++row) {
-            int kmer_idx = col - 1;
-            int event_idx = row - 1;
-            int band_idx = event_kmer_to_band(event_idx, kmer_idx);
-            int offset = band_kmer_to_offset(band_idx, kmer_idx);
-            assert(offset == band_event_to_offset(band_idx, event_idx));
-            assert(event_idx == event_at_offset(band_idx, offset));
-            fprintf(stdout, "ei: %d ki: %d bi: %d o: %d s: %.2f\n", event_idx, kmer_idx, band_idx, offset, bands[band_idx][offset]);
+        fills += std::max(max_offset - min_offset, 0);
+
+        int last_kmer_offset = band_kmer_to_offset(band_idx, curr_kmer_idx);
+        if(last_kmer_offset >= min_offset && last_kmer_offset < max_offset) {
+            int event_idx = event_at_offset(band_idx, last_kmer_offset);
+            float s = curr[last_kmer_offset] + (n_events - event_idx) * lp_trim;
+            if(s > best_end_score) {
+                best_end_score = s;
+                curr_event_idx = event_idx;
+            }
         }
     }
-    */
 
     //
     // Backtrack to compute alignment
@@ -306,25 +318,8 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
     double n_aligned_events = 0;
     std::vector<AlignedPair> out;
 
-    float max_score = -INFINITY;
-    int curr_event_idx = 0;
-    int curr_kmer_idx = n_kmers -1;
-
-    // Find best score between an event and the last k-mer. after trimming the remaining evnets
-    for(int event_idx = 0; event_idx < n_events; ++event_idx) {
-        size_t band_idx = event_kmer_to_band(event_idx, curr_kmer_idx);
-        size_t offset = band_event_to_offset(band_idx, event_idx);
-        if(is_offset_valid(offset)) {
-            float s = BAND_ARRAY(band_idx,offset)  + (n_events - event_idx) * lp_trim;
-            if(s > max_score) {
-                max_score = s;
-                curr_event_idx = event_idx;
-            }
-        }
-    }
-
 #ifdef DEBUG_ADAPTIVE
-    fprintf(stderr, "[adaback] ei: %d ki: %d s: %.2f\n", curr_event_idx, curr_kmer_idx, max_score);
+    fprintf(stderr, "[adaback] ei: %d ki: %d s: %.2f\n", curr_event_idx, curr_kmer_idx, best_end_score);
 #endif
 
     int curr_gap = 0;
@@ -337,15 +332,14 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
         fprintf(stderr, "[adaback] ei: %d ki: %d\n", curr_event_idx, curr_kmer_idx);
 #endif
         // qc stats
-        size_t kmer_rank = alphabet->kmer_rank(sequence.substr(curr_kmer_idx, k).c_str(), k);
-        sum_emission += log_probability_match_r9(read, pore_model, kmer_rank, curr_event_idx, strand_idx);
+        sum_emission += log_normal_pdf(event_levels[curr_event_idx], kmer_gaussians[curr_kmer_idx]);
         n_aligned_events += 1;
 
         size_t band_idx = event_kmer_to_band(curr_event_idx, curr_kmer_idx);
         size_t offset = band_event_to_offset(band_idx, curr_event_idx);
         assert(band_kmer_to_offset(band_idx, curr_kmer_idx) == offset);
 
-        uint8_t from = TRACE_ARRAY(band_idx,offset);
+        uint8_t from = get_trace(trace, band_idx, offset);
         if(from == FROM_D) {
             curr_kmer_idx -= 1;
             curr_event_idx -= 1;
@@ -371,7 +365,6 @@ std::vector<AlignedPair> adaptive_banded_simple_event_align(SquiggleRead& read,
         out.clear();
     }
 
-    free(bands);
     free(trace);
 
     //fprintf(stderr, "ada\t%s\t%s\t%.2lf\t%zu\t%.2lf\t%d\t%d\t%d\n", read.read_name.substr(0, 6).c_str(), failed ? "FAILED" : "OK", events_per_kmer, sequence.size(), avg_log_emission, curr_event_idx, max_gap, fills);
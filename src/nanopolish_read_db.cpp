@@ -7,23 +7,86 @@
 // associated signal data
 //
 #include <zlib.h>
+#include <algorithm>
 #include <fstream>
 #include <ostream>
 #include <iostream>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include "nanopolish_common.h"
 #include "htslib/kseq.h"
 #include "htslib/bgzf.h"
 #include "nanopolish_read_db.h"
+#include "nanopolish_signal_cache.h"
 
 #define READ_DB_SUFFIX ".readdb"
+#define READ_DB_BINARY_SUFFIX ".readdb.bin"
+#define SIGNAL_CACHE_SUFFIX ".sigcache"
 #define GZIPPED_READS_SUFFIX ".index"
 
 // Tell KSEQ what functions to use to open/read files
 KSEQ_INIT(gzFile, gzread)
 
+// Layout of the binary database. The header is followed by the read table,
+// sorted by read name, the table of distinct fast5 paths, the table of distinct
+// (sequencing kit, experiment type) pairs and finally the characters of all strings.
+// Offsets into the string data are relative to its start, the other offsets are
+// relative to the start of the file.
+static const char READ_DB_BINARY_MAGIC[8] = { 'N', 'P', 'R', 'D', 'B', '0', '0', '2' };
+static const uint32_t READ_DB_NO_PATH = UINT32_MAX;
+static const uint32_t READ_DB_NO_READ_INFO = UINT32_MAX;
+
+struct ReadDBBinaryHeader
+{
+    char magic[8];
+    uint64_t num_reads;
+    uint64_t num_paths;
+    uint64_t num_contexts;
+    uint64_t reads_offset;
+    uint64_t paths_offset;
+    uint64_t contexts_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct ReadDBBinaryString
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct ReadDBBinaryContext
+{
+    ReadDBBinaryString sequencing_kit;
+    ReadDBBinaryString experiment_type;
+};
+
+struct ReadDBBinaryRead
+{
+    uint64_t name_offset;
+    uint32_t name_length;
+    uint32_t path_idx;
+
+    // fast5_read_info, context_idx is READ_DB_NO_READ_INFO if it was not recorded
+    uint64_t raw_read_group_offset;
+    uint32_t raw_read_group_length;
+    uint32_t context_idx;
+    float digitisation;
+    float offset;
+    float range;
+    float sample_rate;
+};
+
 //
-ReadDB::ReadDB() : m_fai(NULL)
+ReadDB::ReadDB() : m_mapped_data(NULL),
+                   m_mapped_size(0),
+                   m_mapped_num_reads(0),
+                   m_fai(NULL),
+                   m_signal_cache(NULL)
 {
 
 }
@@ -48,37 +111,37 @@ void ReadDB::build(const std::string& input_reads_filename)
     m_fai = NULL;
 }
 
+// returns true if both files exist and a was modified after b
+static bool is_file_newer(const std::string& a, const std::string& b)
+{
+    struct stat a_stat;
+    struct stat b_stat;
+    return stat(a.c_str(), &a_stat) == 0 && stat(b.c_str(), &b_stat) == 0 && a_stat.st_mtime > b_stat.st_mtime;
+}
+
 //
 void ReadDB::load(const std::string& input_reads_filename)
 {
     // generate input filenames
     m_indexed_reads_filename = input_reads_filename + GZIPPED_READS_SUFFIX;
     std::string in_filename = m_indexed_reads_filename + READ_DB_SUFFIX;
-    
-    //
-    std::ifstream in_file(in_filename.c_str());
+
+    // prefer the binary database, indices built by older versions only have the text file.
+    // A text file written after the binary one was edited or rebuilt by another version
+    std::string bin_filename = m_indexed_reads_filename + READ_DB_BINARY_SUFFIX;
     bool success = false;
-    if(in_file.good()) {
-        // read the database
-        std::string line;
-        while(getline(in_file, line)) {
-            std::vector<std::string> fields = split(line, '\t');
-
-            std::string name = "";
-            std::string path = "";
-            if(fields.size() == 2) {
-                name = fields[0];
-                path = fields[1];
-                m_data[name].signal_data_path = path;
-            }
-        }
+    if(is_file_newer(in_filename, bin_filename)) {
+        fprintf(stderr, "warning: %s is older than %s and will not be used, re-run nanopolish index to update it\n",
+                bin_filename.c_str(), in_filename.c_str());
+        success = load_text(in_filename);
+    } else {
+        success = load_binary(bin_filename) || load_text(in_filename);
+    }
 
-        // load faidx
-        m_fai = fai_load3(m_indexed_reads_filename.c_str(), NULL, NULL, 0);
-        if(m_fai != NULL) {
-            success = true;
-        }
-    } 
+    // the faidx is loaded on the first sequence lookup, many subprograms never need it
+    if(success) {
+        success = access((m_indexed_reads_filename + ".fai").c_str(), R_OK) == 0;
+    }
 
     if(!success) {
         fprintf(stderr, "error: could not load the index files for input file %s\n", input_reads_filename.c_str());
@@ -87,11 +150,94 @@ void ReadDB::load(const std::string& input_reads_filename)
     }
 }
 
+//
+bool ReadDB::load_text(const std::string& filename)
+{
+    std::ifstream in_file(filename.c_str());
+    if(!in_file.good()) {
+        return false;
+    }
+
+    // read the database
+    std::string line;
+    while(getline(in_file, line)) {
+        std::vector<std::string> fields = split(line, '\t');
+
+        std::string name = "";
+        std::string path = "";
+        if(fields.size() == 2) {
+            name = fields[0];
+            path = fields[1];
+            m_data[name].signal_data_path = path;
+        }
+    }
+    return true;
+}
+
+//
+bool ReadDB::load_binary(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    void* data = MAP_FAILED;
+    if(fstat(fd, &file_stat) == 0 && file_stat.st_size >= (off_t)sizeof(ReadDBBinaryHeader)) {
+        data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if(data == MAP_FAILED) {
+        fprintf(stderr, "error: could not map the read database %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    // check that the tables are within the file
+    size_t size = file_stat.st_size;
+    const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)data;
+    bool valid = memcmp(header->magic, READ_DB_BINARY_MAGIC, sizeof(READ_DB_BINARY_MAGIC)) == 0 &&
+                 header->reads_offset + header->num_reads * sizeof(ReadDBBinaryRead) <= size &&
+                 header->paths_offset + header->num_paths * sizeof(ReadDBBinaryString) <= size &&
+                 header->contexts_offset + header->num_contexts * sizeof(ReadDBBinaryContext) <= size &&
+                 header->strings_offset + header->strings_size <= size;
+    if(!valid) {
+        fprintf(stderr, "error: %s is not a read database for this version of nanopolish\n", filename.c_str());
+        fprintf(stderr, "Please re-run nanopolish index on your reads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    m_mapped_data = (const char*)data;
+    m_mapped_size = size;
+    m_mapped_num_reads = header->num_reads;
+    return true;
+}
+
 ReadDB::~ReadDB()
 {
     if(m_fai != NULL) {
         fai_destroy(m_fai);
     }
+    delete m_signal_cache;
+
+    if(m_mapped_data != NULL) {
+        munmap((void*)m_mapped_data, m_mapped_size);
+    }
+}
+
+//
+std::string ReadDB::get_signal_cache_filename() const
+{
+    return m_indexed_reads_filename + SIGNAL_CACHE_SUFFIX;
+}
+
+//
+void ReadDB::open_signal_cache()
+{
+    assert(m_signal_cache == NULL);
+    m_signal_cache = new SignalCache;
+    m_signal_cache->open(get_signal_cache_filename());
 }
 
 //
@@ -147,8 +293,7 @@ void ReadDB::import_reads(const std::string& input_filename, const std::string&
         // sanity check that the read does not exist in the database
         // JTS 04/2019: changed error to warning to account for duplicate reads coming out of
         // some versions of guppy.
-        auto iter = m_data.find(seq->name.s);
-        if(iter != m_data.end()) {
+        if(has_read(seq->name.s)) {
             fprintf(stderr, "Warning: duplicate read name %s found in fasta file\n", seq->name.s);
             continue;
         }
@@ -189,11 +334,18 @@ void ReadDB::import_reads(const std::string& input_filename, const std::string&
 //
 void ReadDB::add_signal_path(const std::string& read_id, const std::string& path)
 {
+    if(m_mapped_data != NULL) {
+        unmap_binary();
+    }
     m_data[read_id].signal_data_path = path;
 }
 
 bool ReadDB::has_read(const std::string& read_id) const
 {
+    if(m_mapped_data != NULL) {
+        return find_mapped_read(read_id) != -1;
+    }
+
     const auto& iter = m_data.find(read_id);
     return iter != m_data.end();
 }
@@ -201,6 +353,11 @@ bool ReadDB::has_read(const std::string& read_id) const
 //
 std::string ReadDB::get_signal_path(const std::string& read_id) const
 {
+    if(m_mapped_data != NULL) {
+        int64_t idx = find_mapped_read(read_id);
+        return idx != -1 ? get_mapped_signal_path(idx) : "";
+    }
+
     const auto& iter = m_data.find(read_id);
     if(iter == m_data.end()) {
         return "";
@@ -209,17 +366,146 @@ std::string ReadDB::get_signal_path(const std::string& read_id) const
     }
 }
 
+//
+void ReadDB::add_read_info(const std::string& read_id, const fast5_read_info& info)
+{
+    if(m_mapped_data != NULL) {
+        unmap_binary();
+    }
+
+    ReadDBData& entry = m_data[read_id];
+    entry.has_read_info = true;
+    entry.read_info = info;
+}
+
+//
+bool ReadDB::get_read_info(const std::string& read_id, fast5_read_info& info) const
+{
+    if(m_mapped_data != NULL) {
+        int64_t idx = find_mapped_read(read_id);
+        return idx != -1 && get_mapped_read_info(idx, info);
+    }
+
+    const auto& iter = m_data.find(read_id);
+    if(iter == m_data.end() || !iter->second.has_read_info) {
+        return false;
+    }
+    info = iter->second.read_info;
+    return true;
+}
+
+//
+int64_t ReadDB::find_mapped_read(const std::string& read_id) const
+{
+    const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)m_mapped_data;
+    const ReadDBBinaryRead* reads = (const ReadDBBinaryRead*)(m_mapped_data + header->reads_offset);
+    const char* strings = m_mapped_data + header->strings_offset;
+
+    // binary search, the names are in the same order as in std::map<std::string, ...>
+    size_t lo = 0;
+    size_t hi = header->num_reads;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const ReadDBBinaryRead& r = reads[mid];
+        int cmp = memcmp(strings + r.name_offset, read_id.data(), std::min((size_t)r.name_length, read_id.length()));
+        if(cmp == 0) {
+            cmp = r.name_length < read_id.length() ? -1 : (r.name_length > read_id.length() ? 1 : 0);
+        }
+
+        if(cmp == 0) {
+            return mid;
+        } else if(cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+//
+std::string ReadDB::get_mapped_read_name(size_t idx) const
+{
+    const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)m_mapped_data;
+    const ReadDBBinaryRead& r = ((const ReadDBBinaryRead*)(m_mapped_data + header->reads_offset))[idx];
+    return get_mapped_string(r.name_offset, r.name_length);
+}
+
+//
+std::string ReadDB::get_mapped_signal_path(size_t idx) const
+{
+    const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)m_mapped_data;
+    const ReadDBBinaryRead& r = ((const ReadDBBinaryRead*)(m_mapped_data + header->reads_offset))[idx];
+    if(r.path_idx == READ_DB_NO_PATH) {
+        return "";
+    }
+
+    const ReadDBBinaryString& p = ((const ReadDBBinaryString*)(m_mapped_data + header->paths_offset))[r.path_idx];
+    return get_mapped_string(p.offset, p.length);
+}
+
+//
+bool ReadDB::get_mapped_read_info(size_t idx, fast5_read_info& info) const
+{
+    const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)m_mapped_data;
+    const ReadDBBinaryRead& r = ((const ReadDBBinaryRead*)(m_mapped_data + header->reads_offset))[idx];
+    if(r.context_idx == READ_DB_NO_READ_INFO) {
+        return false;
+    }
+
+    const ReadDBBinaryContext& c = ((const ReadDBBinaryContext*)(m_mapped_data + header->contexts_offset))[r.context_idx];
+    info.raw_read_group = get_mapped_string(r.raw_read_group_offset, r.raw_read_group_length);
+    info.sequencing_kit = get_mapped_string(c.sequencing_kit.offset, c.sequencing_kit.length);
+    info.experiment_type = get_mapped_string(c.experiment_type.offset, c.experiment_type.length);
+    info.channel_params.digitisation = r.digitisation;
+    info.channel_params.offset = r.offset;
+    info.channel_params.range = r.range;
+    info.channel_params.sample_rate = r.sample_rate;
+    return true;
+}
+
+//
+std::string ReadDB::get_mapped_string(uint64_t offset, uint64_t length) const
+{
+    const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)m_mapped_data;
+    return std::string(m_mapped_data + header->strings_offset + offset, length);
+}
+
+//
+void ReadDB::unmap_binary()
+{
+    for(size_t i = 0; i < m_mapped_num_reads; ++i) {
+        ReadDBData& entry = m_data[get_mapped_read_name(i)];
+        entry.signal_data_path = get_mapped_signal_path(i);
+        entry.has_read_info = get_mapped_read_info(i, entry.read_info);
+    }
+
+    munmap((void*)m_mapped_data, m_mapped_size);
+    m_mapped_data = NULL;
+    m_mapped_size = 0;
+    m_mapped_num_reads = 0;
+}
+
 //
 std::string ReadDB::get_read_sequence(const std::string& read_id) const
 {
-    assert(m_fai != NULL);
+    assert(!m_indexed_reads_filename.empty());
     
     int length;
     char* seq;
 
-    // this call is not threadsafe
+    // these calls are not threadsafe
     #pragma omp critical
-    seq = fai_fetch(m_fai, read_id.c_str(), &length);
+    {
+        if(m_fai == NULL) {
+            m_fai = fai_load3(m_indexed_reads_filename.c_str(), NULL, NULL, 0);
+            if(m_fai == NULL) {
+                fprintf(stderr, "error: could not load the faidx of %s\n", m_indexed_reads_filename.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        seq = fai_fetch(m_fai, read_id.c_str(), &length);
+    }
 
     if(seq == NULL) {
         return "";
@@ -233,22 +519,150 @@ std::string ReadDB::get_read_sequence(const std::string& read_id) const
 //
 void ReadDB::save() const
 {
+    assert(m_mapped_data == NULL);
     std::string out_filename = m_indexed_reads_filename + READ_DB_SUFFIX;
 
+    // the text file is still written for older versions and external tools
     std::ofstream out_file(out_filename.c_str());
 
     for(const auto& iter : m_data) {
         const ReadDBData& entry = iter.second;
         out_file << iter.first << "\t" << entry.signal_data_path << "\n";
     }
+
+    save_binary(m_indexed_reads_filename + READ_DB_BINARY_SUFFIX);
+}
+
+// add str to the string data, once
+static ReadDBBinaryString add_binary_string(const std::string& str,
+                                            std::string& strings,
+                                            std::unordered_map<std::string, ReadDBBinaryString>& added)
+{
+    auto iter = added.find(str);
+    if(iter == added.end()) {
+        ReadDBBinaryString s = { strings.size(), str.length() };
+        strings.append(str);
+        iter = added.insert(std::make_pair(str, s)).first;
+    }
+    return iter->second;
 }
 
+//
+void ReadDB::save_binary(const std::string& filename) const
+{
+    // m_data is sorted by name so the read table can be written in order.
+    // Each distinct path and context is stored once.
+    std::vector<ReadDBBinaryRead> reads;
+    std::vector<ReadDBBinaryString> paths;
+    std::vector<ReadDBBinaryContext> contexts;
+    std::unordered_map<std::string, uint32_t> path_indices;
+    std::map<std::pair<std::string, std::string>, uint32_t> context_indices;
+    std::unordered_map<std::string, ReadDBBinaryString> context_strings;
+    std::string strings;
+
+    reads.reserve(m_data.size());
+    for(const auto& iter : m_data) {
+        ReadDBBinaryRead r;
+        memset(&r, 0, sizeof(r));
+        r.name_offset = strings.size();
+        r.name_length = iter.first.length();
+        r.path_idx = READ_DB_NO_PATH;
+        r.context_idx = READ_DB_NO_READ_INFO;
+        strings.append(iter.first);
 
+        const ReadDBData& entry = iter.second;
+        const std::string& path = entry.signal_data_path;
+        if(!path.empty()) {
+            auto path_iter = path_indices.find(path);
+            if(path_iter == path_indices.end()) {
+                ReadDBBinaryString p = { strings.size(), path.length() };
+                strings.append(path);
+                path_iter = path_indices.insert(std::make_pair(path, (uint32_t)paths.size())).first;
+                paths.push_back(p);
+            }
+            r.path_idx = path_iter->second;
+        }
+
+        if(entry.has_read_info) {
+            const fast5_read_info& info = entry.read_info;
+            auto context_key = std::make_pair(info.sequencing_kit, info.experiment_type);
+            auto context_iter = context_indices.find(context_key);
+            if(context_iter == context_indices.end()) {
+                ReadDBBinaryContext c;
+                c.sequencing_kit = add_binary_string(info.sequencing_kit, strings, context_strings);
+                c.experiment_type = add_binary_string(info.experiment_type, strings, context_strings);
+                context_iter = context_indices.insert(std::make_pair(context_key, (uint32_t)contexts.size())).first;
+                contexts.push_back(c);
+            }
+
+            r.context_idx = context_iter->second;
+            r.raw_read_group_offset = strings.size();
+            r.raw_read_group_length = info.raw_read_group.length();
+            strings.append(info.raw_read_group);
+            r.digitisation = info.channel_params.digitisation;
+            r.offset = info.channel_params.offset;
+            r.range = info.channel_params.range;
+            r.sample_rate = info.channel_params.sample_rate;
+        }
+        reads.push_back(r);
+    }
+
+    ReadDBBinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, READ_DB_BINARY_MAGIC, sizeof(READ_DB_BINARY_MAGIC));
+    header.num_reads = reads.size();
+    header.num_paths = paths.size();
+    header.num_contexts = contexts.size();
+    header.reads_offset = sizeof(header);
+    header.paths_offset = header.reads_offset + reads.size() * sizeof(ReadDBBinaryRead);
+    header.contexts_offset = header.paths_offset + paths.size() * sizeof(ReadDBBinaryString);
+    header.strings_offset = header.contexts_offset + contexts.size() * sizeof(ReadDBBinaryContext);
+    header.strings_size = strings.size();
+
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "error: could not open %s for write\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(reads.data(), sizeof(ReadDBBinaryRead), reads.size(), fp) == reads.size() &&
+                   fwrite(paths.data(), sizeof(ReadDBBinaryString), paths.size(), fp) == paths.size() &&
+                   fwrite(contexts.data(), sizeof(ReadDBBinaryContext), contexts.size(), fp) == contexts.size() &&
+                   fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+    if(fclose(fp) != 0 || !success) {
+        fprintf(stderr, "error: could not write %s\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+std::vector<std::string> ReadDB::get_read_names() const
+{
+    std::vector<std::string> names;
+    names.reserve(get_num_reads());
+    for(size_t i = 0; i < m_mapped_num_reads; ++i) {
+        names.push_back(get_mapped_read_name(i));
+    }
+
+    for(const auto& iter : m_data) {
+        names.push_back(iter.first);
+    }
+    return names;
+}
 
 //
 size_t ReadDB::get_num_reads_with_path() const
 {
     size_t num_reads_with_path = 0;
+    if(m_mapped_data != NULL) {
+        const ReadDBBinaryHeader* header = (const ReadDBBinaryHeader*)m_mapped_data;
+        const ReadDBBinaryRead* reads = (const ReadDBBinaryRead*)(m_mapped_data + header->reads_offset);
+        for(size_t i = 0; i < m_mapped_num_reads; ++i) {
+            num_reads_with_path += reads[i].path_idx != READ_DB_NO_PATH;
+        }
+    }
+
     for(const auto& iter : m_data) {
         if(iter.second.signal_data_path != "") {
             num_reads_with_path += 1;
@@ -260,15 +674,12 @@ size_t ReadDB::get_num_reads_with_path() const
 bool ReadDB::check_signal_paths() const
 {
     size_t num_reads_with_path = get_num_reads_with_path();
-    return num_reads_with_path == m_data.size();
+    return num_reads_with_path == get_num_reads();
 }
 
 //
 void ReadDB::print_stats() const
 {
-    size_t num_reads_with_path = 0;
-    for(const auto& iter : m_data) {
-        num_reads_with_path += iter.second.signal_data_path != "";
-    }
-    fprintf(stderr, "[readdb] num reads: %zu, num reads with path to fast5: %zu\n", m_data.size(), num_reads_with_path);
+    size_t num_reads_with_path = get_num_reads_with_path();
+    fprintf(stderr, "[readdb] num reads: %zu, num reads with path to fast5: %zu\n", get_num_reads(), num_reads_with_path);
 }
@@ -9,13 +9,23 @@
 #ifndef NANOPOLISH_READ_DB
 #define NANOPOLISH_READ_DB
 
+#include <stdint.h>
 #include <map>
+#include <string>
+#include <vector>
 #include "htslib/faidx.h"
+#include "nanopolish_fast5_io.h"
+
+class SignalCache;
 
 struct ReadDBData
 {
     // path to the signal-level data for this read
     std::string signal_data_path;
+
+    // location of the signal within the fast5 file, if it was recorded
+    bool has_read_info = false;
+    fast5_read_info read_info;
 };
 
 class ReadDB
@@ -46,6 +56,12 @@ class ReadDB
         
         // returns the path to the signal data for the given read
         std::string get_signal_path(const std::string& read_id) const;
+
+        // record where the signal of the read is in its fast5 file
+        void add_read_info(const std::string& read_id, const fast5_read_info& info);
+
+        // get the location of the signal of the read, returns false if it was not recorded
+        bool get_read_info(const std::string& read_id, fast5_read_info& info) const;
         
         // returns true if a read with this ID is in the DB
         bool has_read(const std::string& read_id) const;
@@ -54,7 +70,23 @@ class ReadDB
         std::string get_read_sequence(const std::string& read_id) const;
 
         // returns the number of reads in the database
-        size_t get_num_reads() const { return m_data.size(); }
+        size_t get_num_reads() const { return m_mapped_data != NULL ? m_mapped_num_reads : m_data.size(); }
+
+        // returns the names of all reads in the database
+        std::vector<std::string> get_read_names() const;
+
+        //
+        // Signal cache
+        //
+
+        // the file holding the precomputed events of the reads (nanopolish index --precompute-events)
+        std::string get_signal_cache_filename() const;
+
+        // load the signal cache, SquiggleReads will then be read from it instead of the fast5 files
+        void open_signal_cache();
+
+        // returns NULL if the signal cache has not been opened
+        const SignalCache* get_signal_cache() const { return m_signal_cache; }
  
         //
         // Summaries and sanity checks
@@ -74,14 +106,44 @@ class ReadDB
         //
         void import_reads(const std::string& input_filename, const std::string& output_fasta_filename);
 
+        // read the name -> path table from the tab-separated .readdb file
+        bool load_text(const std::string& filename);
+
+        // memory-map the binary .readdb.bin file
+        bool load_binary(const std::string& filename);
+
+        // write the binary version of the name -> path table
+        void save_binary(const std::string& filename) const;
+
+        // copy the memory-mapped table into m_data so it can be modified
+        void unmap_binary();
+
+        // returns the index of the read in the memory-mapped table, or -1 if it is not present
+        int64_t find_mapped_read(const std::string& read_id) const;
+
+        // accessors into the memory-mapped table
+        std::string get_mapped_read_name(size_t idx) const;
+        std::string get_mapped_signal_path(size_t idx) const;
+        bool get_mapped_read_info(size_t idx, fast5_read_info& info) const;
+        std::string get_mapped_string(uint64_t offset, uint64_t length) const;
+
         // the filename of the indexed data, after converting to fasta
         std::string m_indexed_reads_filename;
 
-        //
+        // the reads of a database being built, or loaded from the text format
         std::map<std::string, ReadDBData> m_data;
 
+        // the reads of a database loaded from the binary format. Only the pages
+        // that are looked up are read from disk, so this is used in place of m_data
+        const char* m_mapped_data;
+        size_t m_mapped_size;
+        size_t m_mapped_num_reads;
+
+        // loaded on the first call to get_read_sequence
+        mutable faidx_t* m_fai;
+
         //
-        faidx_t* m_fai;
+        SignalCache* m_signal_cache;
 };
 
 #endif
@@ -33,6 +33,7 @@
 #include "nanopolish_profile_hmm.h"
 #include "nanopolish_anchor.h"
 #include "nanopolish_read_db.h"
+#include "nanopolish_bam_utils.h"
 #include "nanopolish_pore_model_set.h"
 #include "H5pubconf.h"
 
@@ -59,10 +60,11 @@ static const char *SCOREREADS_USAGE_MESSAGE =
 "  -z  --zero-drift                     if recalibrating, keep drift at 0\n"
 "  -i  --individual-reads=READ,READ     optional comma-delimited list of readnames to score\n"
 "  -r, --reads=FILE                     the ONT reads are in fasta FILE\n"
-"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam FILE\n"
+"  -b, --bam=FILE                       the reads aligned to the genome assembly are in bam/cram FILE\n"
 "  -g, --genome=FILE                    the genome we are computing a consensus for is in FILE\n"
 "  -w, --window=STR                     score reads in the window STR (format: ctg:start-end)\n"
 "  -t, --threads=NUM                    use NUM threads (default: 1)\n"
+BAM_IO_THREADS_USAGE_MESSAGE
 "      --train-transitions              train new transition parameters from the input reads\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
@@ -78,6 +80,7 @@ namespace opt
     static std::vector<std::string> readnames;
     static int train_transitions = 0;
     static int num_threads = 1;
+    static int io_threads = -1;
     static int batch_size = 128;
 
     // Offset calculating parameters
@@ -94,7 +97,7 @@ namespace opt
 
 static const char* shortopts = "i:r:b:g:t:m:w:vcz";
 
-enum { OPT_HELP = 1, OPT_VERSION, OPT_TRAIN_TRANSITIONS };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_TRAIN_TRANSITIONS, OPT_IO_THREADS };
 
 static const struct option longopts[] = {
     { "verbose",            no_argument,       NULL, 'v' },
@@ -108,6 +111,7 @@ static const struct option longopts[] = {
     { "individual-reads",   required_argument, NULL, 'i' },
     { "window",             required_argument, NULL, 'w' },
     { "train-transitions",  no_argument,       NULL, OPT_TRAIN_TRANSITIONS },
+    { "io-threads",         required_argument, NULL, OPT_IO_THREADS },
     { "help",               no_argument,       NULL, OPT_HELP },
     { "version",            no_argument,       NULL, OPT_VERSION },
     { NULL, 0, NULL, 0 }
@@ -115,7 +119,7 @@ static const struct option longopts[] = {
 
 double model_score(SquiggleRead &sr,
                    const size_t strand_idx,
-                   const faidx_t *fai, 
+                   const ReferenceDB& ref_db,
                    const std::vector<EventAlignment> &alignment_output,
                    const size_t events_per_segment,
                    TransitionParameters* transition_training)
@@ -129,7 +133,7 @@ double model_score(SquiggleRead &sr,
 
         const EventAlignment& align_start = alignment_output[align_start_idx];
         const EventAlignment& align_end = alignment_output[align_start_idx + events_per_segment];
-        std::string contig = alignment_output.front().ref_name.c_str();
+        const std::string& contig = alignment_output.front().get_ref_name();
 
         // Set up event data
         HMMInputData data;
@@ -149,8 +153,7 @@ double model_score(SquiggleRead &sr,
         assert(ref_end_pos >= ref_start_pos);
 
         // Extract the reference sequence for this region
-        std::string ref_seq = get_reference_region_ts(fai, contig.c_str(), ref_start_pos, 
-                                                      ref_end_pos, &fetched_len);
+        std::string ref_seq = ref_db.get_subsequence(contig, ref_start_pos, ref_end_pos, &fetched_len);
 
         if (fetched_len <= (int)sr.get_model_k(strand_idx))
             continue;
@@ -205,7 +208,7 @@ double model_score(SquiggleRead &sr,
 std::vector<EventAlignment> alignment_from_read(SquiggleRead& sr,
                                                 const size_t strand_idx,
                                                 const size_t read_idx,
-                                                const faidx_t* fai,
+                                                const ReferenceDB& ref_db,
                                                 const bam_hdr_t* hdr,
                                                 const bam1_t* record,
                                                 int region_start,
@@ -214,7 +217,7 @@ std::vector<EventAlignment> alignment_from_read(SquiggleRead& sr,
     // Align to the new model
     EventAlignmentParameters params;
     params.sr = &sr;
-    params.fai = fai;
+    params.ref_db = &ref_db;
     params.hdr = hdr;
     params.record = record;
     params.strand_idx = strand_idx;
@@ -244,6 +247,7 @@ void parse_scorereads_options(int argc, char** argv)
             case 'z': opt::scale_drift = false; break;
             case '?': die = true; break;
             case OPT_TRAIN_TRANSITIONS: opt::train_transitions = 1; break;
+            case OPT_IO_THREADS: arg >> opt::io_threads; break;
             case OPT_HELP:
                 std::cout << SCOREREADS_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
@@ -307,6 +311,8 @@ void parse_scorereads_options(int argc, char** argv)
 int scorereads_main(int argc, char** argv)
 {
     parse_scorereads_options(argc, argv);
+    set_bam_io_threads(opt::io_threads, opt::num_threads);
+    set_cram_reference(opt::genome_file);
     omp_set_num_threads(opt::num_threads);
 
     std::string alphabet_name = "nucleotide";
@@ -316,19 +322,20 @@ int scorereads_main(int argc, char** argv)
     // Open the BAM and iterate over reads
 
     // load bam file
-    htsFile* bam_fh = sam_open(opt::bam_file.c_str(), "r");
-    assert(bam_fh != NULL);
+    htsFile* bam_fh = open_bam_file(opt::bam_file, "r");
 
-    // load bam index file
-    std::string index_filename = opt::bam_file + ".bai";
-    hts_idx_t* bam_idx = bam_index_load(index_filename.c_str());
-    assert(bam_idx != NULL);
+    // load bam index file, .bai for bam or .crai for cram
+    hts_idx_t* bam_idx = sam_index_load(bam_fh, opt::bam_file.c_str());
+    if(bam_idx == NULL) {
+        bam_index_error_exit(opt::bam_file);
+    }
 
     // read the bam header
     bam_hdr_t* hdr = sam_hdr_read(bam_fh);
 
-    // load reference fai file
-    faidx_t *fai = fai_load(opt::genome_file.c_str());
+    // load the reference genome into memory
+    ReferenceDB ref_db;
+    ref_db.load(opt::genome_file);
 
     hts_itr_t* itr;
 
@@ -407,7 +414,7 @@ int scorereads_main(int argc, char** argv)
                         }
 
                         std::vector<EventAlignment> ao = alignment_from_read(sr, strand_idx, read_idx,
-                                                                             fai, hdr,
+                                                                             ref_db, hdr,
                                                                              record, clip_start, clip_end);
                         if (ao.size() == 0)
                             continue;
@@ -417,7 +424,7 @@ int scorereads_main(int argc, char** argv)
                             recalibrate_model(sr, *sr.get_model(strand_idx, alphabet_name), strand_idx, ao, true, opt::scale_drift);
                         }
 
-                        double score = model_score(sr, strand_idx, fai, ao, 500, transition_training[strand_idx]);
+                        double score = model_score(sr, strand_idx, ref_db, ao, 500, transition_training[strand_idx]);
                         if(score > 0)
                             continue;
 
@@ -454,7 +461,6 @@ int scorereads_main(int argc, char** argv)
     // cleanup
     sam_itr_destroy(itr);
     bam_hdr_destroy(hdr);
-    fai_destroy(fai);
     sam_close(bam_fh);
     hts_idx_destroy(bam_idx);
     return 0;
@@ -14,7 +14,7 @@ std::vector<EventAlignment> alignment_from_read(SquiggleRead& sr,
                                                 const size_t strand_idx,
                                                 const size_t read_idx,
                                                 const std::string& alternative_model_type,
-                                                const faidx_t* fai,
+                                                const ReferenceDB& ref_db,
                                                 const bam_hdr_t* hdr,
                                                 const bam1_t* record,
                                                 int region_start,
@@ -22,7 +22,7 @@ std::vector<EventAlignment> alignment_from_read(SquiggleRead& sr,
 
 double model_score(SquiggleRead &sr,
                    const size_t strand_idx,
-                   const faidx_t *fai, 
+                   const ReferenceDB& ref_db,
                    const std::vector<EventAlignment> &alignment_output,
                    const size_t events_per_segment,
                    TransitionParameters* transition_training);
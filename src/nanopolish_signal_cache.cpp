@@ -0,0 +1,256 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_signal_cache -- on-disk cache of the events and
+// calibration computed from the raw signal of each read, so
+// that repeated runs over the same reads skip the fast5 files
+//
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fstream>
+#include "nanopolish_common.h"
+#include "nanopolish_squiggle_read.h"
+#include "nanopolish_signal_cache.h"
+
+// the first bytes of the file, the digits are the format version
+static const char SIGNAL_CACHE_MAGIC[8] = { 'N', 'P', 'S', 'I', 'G', '0', '0', '1' };
+
+#define SIGNAL_CACHE_INDEX_SUFFIX ".idx"
+
+// the number of bytes a part of a record takes, with padding to keep the next part aligned
+static inline size_t padded_size(size_t bytes)
+{
+    return (bytes + 7) & ~(size_t)7;
+}
+
+// append the bytes of an array to buf, with padding
+template<typename T>
+static void append_column(std::string& buf, const T* data, size_t n)
+{
+    size_t bytes = n * sizeof(T);
+    if(bytes > 0) {
+        buf.append((const char*)data, bytes);
+    }
+    buf.append(padded_size(bytes) - bytes, '\0');
+}
+
+// return a pointer to the array at p and move p past it
+template<typename T>
+static const T* next_column(const char*& p, size_t n)
+{
+    const T* column = (const T*)p;
+    p += padded_size(n * sizeof(T));
+    return column;
+}
+
+// the number of bytes of a record, including its columns
+static uint64_t get_record_size(const SignalCacheRecord& record)
+{
+    uint64_t size = sizeof(SignalCacheRecord);
+    for(size_t si = 0; si < 2; ++si) {
+        size += 2 * padded_size((uint64_t)record.num_events[si] * sizeof(float));
+        size += 2 * padded_size((uint64_t)record.num_events[si] * sizeof(uint32_t));
+    }
+    size += padded_size((uint64_t)record.num_kmers * sizeof(EventRangeForBase));
+    size += padded_size(record.sequence_length);
+    return size;
+}
+
+//
+SignalCache::SignalCache() : m_data(NULL), m_data_size(0)
+{
+
+}
+
+//
+SignalCache::~SignalCache()
+{
+    if(m_data != NULL) {
+        munmap((void*)m_data, m_data_size);
+    }
+}
+
+//
+void SignalCache::open(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if(fd < 0 || fstat(fd, &file_stat) != 0) {
+        fprintf(stderr, "error: could not open the signal cache %s\n", filename.c_str());
+        fprintf(stderr, "Please run nanopolish index with --precompute-events to build it\n");
+        exit(EXIT_FAILURE);
+    }
+
+    m_data_size = file_stat.st_size;
+    void* data = m_data_size > 0 ? mmap(NULL, m_data_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if(data == MAP_FAILED || m_data_size < sizeof(SIGNAL_CACHE_MAGIC) ||
+       memcmp(data, SIGNAL_CACHE_MAGIC, sizeof(SIGNAL_CACHE_MAGIC)) != 0) {
+        fprintf(stderr, "error: %s is not a signal cache for this version of nanopolish\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    m_data = (const char*)data;
+
+    // load the offset of each read
+    std::string index_filename = filename + SIGNAL_CACHE_INDEX_SUFFIX;
+    std::ifstream index_file(index_filename.c_str());
+    if(!index_file.good()) {
+        fprintf(stderr, "error: could not open the signal cache index %s\n", index_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::string line;
+    while(getline(index_file, line)) {
+        std::vector<std::string> fields = split(line, '\t');
+        uint64_t offset = fields.size() == 2 ? strtoull(fields[1].c_str(), NULL, 10) : 0;
+        if(offset < sizeof(SIGNAL_CACHE_MAGIC) || offset + sizeof(SignalCacheRecord) > m_data_size) {
+            fprintf(stderr, "error: malformed signal cache index line: %s\n", line.c_str());
+            exit(EXIT_FAILURE);
+        }
+        m_offsets[fields[0]] = offset;
+    }
+}
+
+//
+bool SignalCache::has_read(const std::string& read_name) const
+{
+    return m_offsets.find(read_name) != m_offsets.end();
+}
+
+//
+bool SignalCache::load(const std::string& read_name, SquiggleRead& sr) const
+{
+    const auto& iter = m_offsets.find(read_name);
+    if(iter == m_offsets.end()) {
+        return false;
+    }
+
+    const char* p = m_data + iter->second;
+    const SignalCacheRecord* record = (const SignalCacheRecord*)p;
+
+    // a truncated or stale cache can have records that run past the end of the file
+    if(get_record_size(*record) > m_data_size - iter->second) {
+        fprintf(stderr, "error: malformed signal cache record for read %s\n", read_name.c_str());
+        fprintf(stderr, "Please run nanopolish index with --precompute-events to rebuild it\n");
+        exit(EXIT_FAILURE);
+    }
+    p += sizeof(SignalCacheRecord);
+
+    sr.nucleotide_type = (SquiggleReadNucleotideType)record->nucleotide_type;
+    sr.read_type = (SquiggleReadType)record->read_type;
+    sr.pore_type = (PoreType)record->pore_type;
+    sr.sample_rate = record->sample_rate;
+    sr.m_events_from_raw = true;
+
+    // the events are used in-place
+    for(size_t si = 0; si < 2; ++si) {
+        size_t n = record->num_events[si];
+        const float* mean = next_column<float>(p, n);
+        const float* stdv = next_column<float>(p, n);
+        const uint32_t* start = next_column<uint32_t>(p, n);
+        const uint32_t* length = next_column<uint32_t>(p, n);
+
+        sr.events[si].clear();
+        sr.events[si].set_sample_rate(record->sample_rate);
+        sr.events[si].set_external(mean, stdv, start, length, n, record->sample_offset[si]);
+
+        const double* sc = record->scalings[si];
+        sr.scalings[si].set6(sc[0], sc[1], sc[2], sc[3], sc[4], sc[5]);
+        sr.events_per_base[si] = record->events_per_base[si];
+    }
+    sr.base_model[0] = SquiggleRead::get_raw_read_model(sr.nucleotide_type);
+    sr.base_model[1] = NULL;
+
+    const EventRangeForBase* event_map = next_column<EventRangeForBase>(p, record->num_kmers);
+    sr.base_to_event_map.assign(event_map, event_map + record->num_kmers);
+
+    sr.read_sequence.assign(p, record->sequence_length);
+    return true;
+}
+
+//
+SignalCacheWriter::SignalCacheWriter(const std::string& filename) : m_filename(filename),
+                                                                    m_offset(0),
+                                                                    m_num_reads(0)
+{
+    m_data_fp = fopen(filename.c_str(), "wb");
+    std::string index_filename = filename + SIGNAL_CACHE_INDEX_SUFFIX;
+    m_index_fp = fopen(index_filename.c_str(), "w");
+    if(m_data_fp == NULL || m_index_fp == NULL) {
+        fprintf(stderr, "error: could not open %s for writing\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(SIGNAL_CACHE_MAGIC, sizeof(SIGNAL_CACHE_MAGIC), 1, m_data_fp);
+    m_offset = sizeof(SIGNAL_CACHE_MAGIC);
+}
+
+//
+SignalCacheWriter::~SignalCacheWriter()
+{
+    if(fclose(m_data_fp) != 0 || fclose(m_index_fp) != 0) {
+        fprintf(stderr, "error: could not write the signal cache %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+bool SignalCacheWriter::add(const SquiggleRead& sr)
+{
+    if(!sr.has_events_from_raw() || sr.base_model[0] == NULL) {
+        return false;
+    }
+
+    SignalCacheRecord record;
+    memset(&record, 0, sizeof(record));
+    record.num_kmers = sr.base_to_event_map.size();
+    record.sequence_length = sr.read_sequence.length();
+    record.nucleotide_type = sr.nucleotide_type;
+    record.read_type = sr.read_type;
+    record.pore_type = sr.pore_type;
+    record.sample_rate = sr.sample_rate;
+
+    for(size_t si = 0; si < 2; ++si) {
+        const SquiggleScalings& scalings = sr.scalings[si];
+        record.num_events[si] = sr.events[si].size();
+        record.sample_offset[si] = sr.events[si].get_sample_offset();
+        record.events_per_base[si] = sr.events_per_base[si];
+        double sc[6] = { scalings.shift, scalings.scale, scalings.drift, scalings.var, scalings.scale_sd, scalings.var_sd };
+        memcpy(record.scalings[si], sc, sizeof(sc));
+    }
+
+    // serialize outside of the critical section
+    std::string buf;
+    buf.append((const char*)&record, sizeof(record));
+    for(size_t si = 0; si < 2; ++si) {
+        const SquiggleEventTable& events = sr.events[si];
+        append_column(buf, events.get_mean_data(), events.size());
+        append_column(buf, events.get_stdv_data(), events.size());
+        append_column(buf, events.get_start_data(), events.size());
+        append_column(buf, events.get_length_data(), events.size());
+    }
+    append_column(buf, sr.base_to_event_map.data(), sr.base_to_event_map.size());
+    append_column(buf, sr.read_sequence.data(), sr.read_sequence.length());
+
+    bool write_failed = false;
+    #pragma omp critical(signal_cache_writer)
+    {
+        write_failed = fwrite(buf.data(), 1, buf.size(), m_data_fp) != buf.size() ||
+                       fprintf(m_index_fp, "%s\t%llu\n", sr.read_name.c_str(), (unsigned long long)m_offset) < 0;
+        m_offset += buf.size();
+        m_num_reads += 1;
+    }
+
+    if(write_failed) {
+        fprintf(stderr, "error: could not write the signal cache %s\n", m_filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
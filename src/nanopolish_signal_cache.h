@@ -0,0 +1,94 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_signal_cache -- on-disk cache of the events and
+// calibration computed from the raw signal of each read, so
+// that repeated runs over the same reads skip the fast5 files
+//
+#ifndef NANOPOLISH_SIGNAL_CACHE_H
+#define NANOPOLISH_SIGNAL_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+class SquiggleRead;
+
+// The fixed-size part of a cached read. In the file it is followed by, for each
+// strand, the mean, stdv, start and length columns of its events, then the
+// base-to-event map and finally the read sequence. Every part starts on an 8 byte boundary.
+struct SignalCacheRecord
+{
+    uint32_t num_events[2];
+    uint32_t num_kmers; // length of the base-to-event map
+    uint32_t sequence_length;
+    uint8_t nucleotide_type;
+    uint8_t read_type;
+    uint8_t pore_type;
+    uint8_t padding[5];
+    double sample_rate;
+    int64_t sample_offset[2];
+    double events_per_base[2];
+
+    // shift, scale, drift, var, scale_sd, var_sd
+    double scalings[2][6];
+};
+
+// Read-only access to a cache file. The file is memory-mapped and the event
+// columns of the loaded reads point directly into the mapping, so the cache
+// must outlive every SquiggleRead loaded from it.
+class SignalCache
+{
+    public:
+        SignalCache();
+        ~SignalCache();
+
+        // map the cache into memory and load its index
+        void open(const std::string& filename);
+
+        // returns true if the read is in the cache
+        bool has_read(const std::string& read_name) const;
+
+        // set the events, calibration and sequence of sr from the cache.
+        // returns false if the read is not in the cache
+        bool load(const std::string& read_name, SquiggleRead& sr) const;
+
+        size_t get_num_reads() const { return m_offsets.size(); }
+
+    private:
+        SignalCache(const SignalCache&) = delete;
+        SignalCache& operator=(const SignalCache&) = delete;
+
+        const char* m_data;
+        size_t m_data_size;
+        std::unordered_map<std::string, uint64_t> m_offsets;
+};
+
+// Builds a cache file. Reads can be added from multiple threads.
+class SignalCacheWriter
+{
+    public:
+        SignalCacheWriter(const std::string& filename);
+        ~SignalCacheWriter();
+
+        // append a read to the cache. Reads whose events were not computed from
+        // the raw signal are skipped and false is returned
+        bool add(const SquiggleRead& sr);
+
+        size_t get_num_reads() const { return m_num_reads; }
+
+    private:
+        SignalCacheWriter(const SignalCacheWriter&) = delete;
+        SignalCacheWriter& operator=(const SignalCacheWriter&) = delete;
+
+        std::string m_filename;
+        FILE* m_data_fp;
+        FILE* m_index_fp;
+        uint64_t m_offset;
+        size_t m_num_reads;
+};
+
+#endif
@@ -9,11 +9,13 @@
 #include <algorithm>
 #include "nanopolish_common.h"
 #include "nanopolish_squiggle_read.h"
+#include "nanopolish_signal_cache.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_methyltrain.h"
 #include "nanopolish_extract.h"
 #include "nanopolish_raw_loader.h"
 #include "nanopolish_fast5_io.h"
+#include "nanopolish_fast5_cache.h"
 
 extern "C" {
 #include "event_detection.h"
@@ -25,6 +27,9 @@ extern "C" {
 //#define DEBUG_MODEL_SELECTION 1
 //#define DEBUG_RECONSTRUCTION 1
 
+// number of raw samples read from the fast5 file at once when they are only needed for event detection
+#define RAW_SIGNAL_CHUNK_SIZE 65536
+
 // Track the number of skipped reads to warn the use at the end of the run
 // Workaround for albacore issues.  Temporary, I hope
 int g_total_reads = 0;
@@ -36,6 +41,9 @@ int g_bad_fast5_file = 0;
 
 const double MIN_CALIBRATION_VAR = 2.5;
 
+// the per-read calibration of long reads is fit to an evenly spaced subsample of their events
+const size_t MAX_CALIBRATION_EVENTS = 20000;
+
 void SquiggleScalings::set4(double _shift,
                             double _scale,
                             double _drift,
@@ -66,7 +74,10 @@ void SquiggleScalings::set6(double _shift,
 }
 
 //
-SquiggleRead::SquiggleRead(const std::string& name, const ReadDB& read_db, const uint32_t flags) :
+SquiggleRead::SquiggleRead(const std::string& name,
+                           const ReadDB& read_db,
+                           const uint32_t flags,
+                           const SquiggleReadRange& range) :
     read_name(name),
     nucleotide_type(SRNT_DNA),
     pore_type(PT_UNKNOWN),
@@ -75,6 +86,10 @@ SquiggleRead::SquiggleRead(const std::string& name, const ReadDB& read_db, const
 
     this->events_per_base[0] = events_per_base[1] = 0.0f;
     this->base_model[0] = this->base_model[1] = NULL;
+    this->raw_offset = 0.0f;
+    this->raw_unit = 1.0f;
+    this->sample_start_time = 0;
+    this->raw_sample_offset = 0;
     this->fast5_path = read_db.get_signal_path(this->read_name);
     g_total_reads += 1;
     if(this->fast5_path == "") {
@@ -82,17 +97,27 @@ SquiggleRead::SquiggleRead(const std::string& name, const ReadDB& read_db, const
         return;
     }
 
-    // Get the read type from the fast5 file
-    fast5_file f5_file = fast5_open(fast5_path);
+    // Use the events precomputed by nanopolish index, if available, rather than the fast5 file
+    const SignalCache* signal_cache = read_db.get_signal_cache();
+    if(signal_cache != NULL && (flags & SRF_LOAD_RAW_SAMPLES) == 0 && signal_cache->load(this->read_name, *this)) {
+        return;
+    }
+
+    // Get the read type from the fast5 file, consecutive reads are often in the same file so the handle is cached
+    fast5_file f5_file = fast5_cache_open(fast5_path);
     if(fast5_is_open(f5_file)) {
 
-        std::string sequencing_kit = fast5_get_sequencing_kit(f5_file, this->read_name);
-        std::string experiment_type = fast5_get_experiment_type(f5_file, this->read_name);
+        // The location of the signal and the run metadata are recorded by nanopolish index,
+        // for indices that do not have them they are read from the file
+        fast5_read_info read_info;
+        if(!read_db.get_read_info(this->read_name, read_info)) {
+            read_info = fast5_get_read_info(f5_file, this->read_name);
+        }
 
         // Try to detect whether this read is DNA or RNA
         // Fix issue 531: experiment_type in fast5 is "rna" for cDNA kit dcs108
-        bool rna_experiment = experiment_type == "rna" || experiment_type == "internal_rna";
-        this->nucleotide_type = rna_experiment && sequencing_kit != "sqk-dcs108" ? SRNT_RNA : SRNT_DNA;
+        bool rna_experiment = read_info.experiment_type == "rna" || read_info.experiment_type == "internal_rna";
+        this->nucleotide_type = rna_experiment && read_info.sequencing_kit != "sqk-dcs108" ? SRNT_RNA : SRNT_DNA;
 
         // Did this read come from nanopolish extract?
         bool is_event_read = is_extract_read_name(this->read_name);
@@ -115,10 +140,10 @@ SquiggleRead::SquiggleRead(const std::string& name, const ReadDB& read_db, const
             this->f_p = nullptr;
         } else {
             this->read_sequence = read_db.get_read_sequence(read_name);
-            load_from_raw(f5_file, flags);
+            load_from_raw(f5_file, read_info, flags, range);
         }
 
-        fast5_close(f5_file);
+        fast5_cache_release(f5_file);
 
     } else {
         fprintf(stderr, "[warning] fast5 file is unreadable and will be skipped: %s\n", fast5_path.c_str());
@@ -175,6 +200,10 @@ void SquiggleRead::load_from_events(const uint32_t flags)
 
     read_sequence = f_p->get_basecall_seq(read_type, basecall_group);
 
+    // event times are stored as sample indices, so we need the sample rate up-front
+    auto channel_params = f_p->get_channel_id_params();
+    sample_rate = channel_params.sampling_rate;
+
     // Load PoreModel for both strands
     std::vector<EventRangeForBase> event_maps_1d[NUM_STRANDS];
     std::string read_sequences_1d[NUM_STRANDS];
@@ -190,18 +219,20 @@ void SquiggleRead::load_from_events(const uint32_t flags)
         auto f5_events = f_p->get_basecall_events(si, basecall_group);
 
         // copy events
-        events[si].resize(f5_events.size());
+        events[si].clear();
+        events[si].set_sample_rate(sample_rate);
+        events[si].reserve(f5_events.size());
         std::vector<double> p_model_states;
 
         for(size_t ei = 0; ei < f5_events.size(); ++ei) {
             auto const & f5_event = f5_events[ei];
 
-            events[si][ei] = { static_cast<float>(f5_event.mean),
-                               static_cast<float>(f5_event.stdv),
-                               f5_event.start,
-                               static_cast<float>(f5_event.length),
-                               static_cast<float>(log(f5_event.stdv))
-                             };
+            events[si].push_back({ static_cast<float>(f5_event.mean),
+                                   static_cast<float>(f5_event.stdv),
+                                   f5_event.start,
+                                   static_cast<float>(f5_event.length),
+                                   0.0f
+                                 });
             assert(f5_event.p_model_state >= 0.0 && f5_event.p_model_state <= 1.0);
             p_model_states.push_back(f5_event.p_model_state);
         }
@@ -254,12 +285,10 @@ void SquiggleRead::load_from_events(const uint32_t flags)
         // we assume the first raw sample read is the one we're after
         std::string sample_read_name = sample_read_names.front();
 
-        samples = f_p->get_raw_samples(sample_read_name);
+        raw_samples = f_p->get_raw_int_samples(sample_read_name);
+        raw_offset = channel_params.offset;
+        raw_unit = channel_params.range / channel_params.digitisation;
         sample_start_time = f_p->get_raw_samples_params(sample_read_name).start_time;
-
-        // retreive parameters
-        auto channel_params = f_p->get_channel_id_params();
-        sample_rate = channel_params.sampling_rate;
     }
 
     // Filter poor quality reads that have too many "stays"
@@ -271,26 +300,67 @@ void SquiggleRead::load_from_events(const uint32_t flags)
 }
 
 //
-void SquiggleRead::load_from_raw(fast5_file& f5_file, const uint32_t flags)
+const PoreModel* SquiggleRead::get_raw_read_model(SquiggleReadNucleotideType nucleotide_type)
+{
+    if(nucleotide_type == SRNT_RNA) {
+        return PoreModelSet::get_model("r9.4_70bps", "u_to_t_rna", "template", 5);
+    } else {
+        return PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    }
+}
+
+//
+bool get_sample_range_for_bases(const fast5_basecall_moves& bm,
+                                       size_t base_start,
+                                       size_t base_end,
+                                       size_t& sample_start,
+                                       size_t& sample_end)
+{
+    size_t first_block = bm.moves.size();
+    size_t end_block = bm.moves.size();
+    size_t base_idx = 0;
+    for(size_t i = 0; i < bm.moves.size(); ++i) {
+        if(bm.moves[i] == 0) {
+            continue;
+        }
+
+        if(base_idx == base_start) {
+            first_block = i;
+        } else if(base_idx == base_end) {
+            end_block = i;
+            break;
+        }
+        base_idx += 1;
+    }
+
+    if(first_block == bm.moves.size()) {
+        return false;
+    }
+
+    size_t padding = RANGE_MARGIN_BLOCKS * bm.stride;
+    sample_start = base_start == 0 ? 0 : bm.first_sample + first_block * bm.stride;
+    sample_start = sample_start > padding ? sample_start - padding : 0;
+    sample_end = end_block == bm.moves.size() ? SIZE_MAX : bm.first_sample + end_block * bm.stride + padding;
+    return true;
+}
+
+//
+void SquiggleRead::load_from_raw(fast5_file& f5_file,
+                                 const fast5_read_info& read_info,
+                                 const uint32_t flags,
+                                 const SquiggleReadRange& range)
 {
     // File not in db, can't load
     if(this->fast5_path == "" || this->read_sequence == "") {
         return;
     }
+    this->m_events_from_raw = true;
 
     // Hardcoded parameters, for now we can only do template with the main R9.4 model
     size_t strand_idx = 0;
-    std::string alphabet = "nucleotide";
-    std::string kit = "r9.4_450bps";
-    std::string strand_str = "template";
-    size_t k = 6;
-
     const detector_param* ed_params = &event_detection_defaults;
 
     if(this->nucleotide_type == SRNT_RNA) {
-        kit = "r9.4_70bps";
-        alphabet = "u_to_t_rna";
-        k = 5;
         ed_params = &event_detection_rna;
 
         std::replace(this->read_sequence.begin(), this->read_sequence.end(), 'U', 'T');
@@ -300,69 +370,106 @@ void SquiggleRead::load_from_raw(fast5_file& f5_file, const uint32_t flags)
     this->pore_type = PT_R9;
 
     // Set the base model for this read to either the nucleotide or U->T RNA model
-    this->base_model[strand_idx] = PoreModelSet::get_model(kit, alphabet, strand_str, k);
+    this->base_model[strand_idx] = get_raw_read_model(this->nucleotide_type);
     assert(this->base_model[strand_idx] != NULL);
 
     // Read the sample rate
-    auto channel_params = fast5_get_channel_params(f5_file, this->read_name);
+    const fast5_raw_scaling& channel_params = read_info.channel_params;
     this->sample_rate = channel_params.sample_rate;
 
-    // Read the actual samples
-    raw_table rt = fast5_get_raw_samples(f5_file, this->read_name, channel_params);
-
-    // trim using scrappie's internal method
-    // parameters taken directly from scrappie defaults
-    int trim_start = 200;
-    int trim_end = 10;
-    int varseg_chunk = 100;
-    float varseg_thresh = 0.0;
-    trim_and_segment_raw(rt, trim_start, trim_end, varseg_chunk, varseg_thresh);
-    event_table et = detect_events(rt, *ed_params);
-    assert(rt.n > 0);
+    // When only some bases of the read are needed, load the signal for them (and a margin
+    // around them so the ends align well) if the move table says where it is.
+    // The events are then aligned to the bases [base_start, base_end) of the read
+    size_t base_start = 0;
+    size_t base_end = this->read_sequence.length();
+    size_t range_sample_start = 0;
+    size_t range_sample_end = SIZE_MAX;
+    if(range.is_set() && this->nucleotide_type == SRNT_DNA) {
+        fast5_basecall_moves bm = fast5_get_basecall_moves(f5_file, read_info.raw_read_group);
+        size_t n_moves = std::count(bm.moves.begin(), bm.moves.end(), 1);
+
+        size_t start = std::max(range.start - RANGE_MARGIN_BASES, 0);
+        size_t end = std::min((size_t)range.end + RANGE_MARGIN_BASES, base_end);
+        if(n_moves == base_end && start + this->base_model[strand_idx]->k < end &&
+           get_sample_range_for_bases(bm, start, end, range_sample_start, range_sample_end)) {
+            base_start = start;
+            base_end = end;
+        }
+    }
+    std::string sequence = base_start == 0 && base_end == this->read_sequence.length() ?
+        this->read_sequence : this->read_sequence.substr(base_start, base_end - base_start);
+
+    // Read the actual samples, these stay as ADC values and are converted to pA during event detection
+    float raw_unit = channel_params.range / channel_params.digitisation;
+    event_detector* detector = event_detector_create(*ed_params);
+    size_t num_samples = 0;
+    if(flags & SRF_LOAD_RAW_SAMPLES) {
+        if(range_sample_start == 0 && range_sample_end == SIZE_MAX) {
+            this->raw_samples = fast5_get_raw_int_samples_from_group(f5_file, read_info.raw_read_group);
+        } else {
+            this->raw_samples.clear();
+            fast5_stream_raw_int_samples_range_from_group(f5_file, read_info.raw_read_group,
+                range_sample_start, range_sample_end, RAW_SIGNAL_CHUNK_SIZE,
+                [&](const int16_t* samples, size_t n) {
+                    this->raw_samples.insert(this->raw_samples.end(), samples, samples + n);
+                });
+        }
+        this->raw_offset = channel_params.offset;
+        this->raw_unit = raw_unit;
+        this->sample_start_time = 0;
+        this->raw_sample_offset = range_sample_start;
+        event_detector_add_raw_int16(detector, this->raw_samples.data(), this->raw_samples.size(), channel_params.offset, raw_unit);
+        num_samples = this->raw_samples.size();
+    } else {
+        // the samples are not needed after event detection so stream them through the
+        // detector, rather than holding the entire signal of long reads in memory
+        num_samples = fast5_stream_raw_int_samples_range_from_group(f5_file, read_info.raw_read_group,
+            range_sample_start, range_sample_end, RAW_SIGNAL_CHUNK_SIZE,
+            [&](const int16_t* samples, size_t n) {
+                event_detector_add_raw_int16(detector, samples, n, channel_params.offset, raw_unit);
+            });
+    }
+    event_table et = event_detector_finish(detector);
+    assert(num_samples > 0);
     assert(et.n > 0);
 
     //
-    this->scalings[strand_idx] = estimate_scalings_using_mom(this->read_sequence,
+    this->scalings[strand_idx] = estimate_scalings_using_mom(sequence,
                                                              *this->base_model[strand_idx],
                                                              et);
 
     // copy events into nanopolish's format
-    this->events[strand_idx].resize(et.n);
-    double start_time = 0;
+    // event positions are counted from the first sample of the signal
+    SquiggleEventTable& strand_events = this->events[strand_idx];
+    strand_events.clear();
+    strand_events.set_sample_rate(this->sample_rate);
+    strand_events.reserve(et.n);
+    int64_t sample_start = range_sample_start;
     for(size_t i = 0; i < et.n; ++i) {
-        float length_in_seconds = et.event[i].length / this->sample_rate;
-        this->events[strand_idx][i] = { et.event[i].mean, et.event[i].stdv, start_time, length_in_seconds, logf(et.event[i].stdv) };
-        start_time += length_in_seconds;
-    }
-
-    if(flags & SRF_LOAD_RAW_SAMPLES) {
-        this->sample_start_time = 0;
-        this->samples.resize(rt.n);
-        for(size_t i = 0; i < this->samples.size(); ++i) {
-            assert(rt.start + i < rt.n);
-            this->samples[i] = rt.raw[rt.start + i];
-        }
+        uint32_t sample_length = et.event[i].length;
+        strand_events.push_back(et.event[i].mean, et.event[i].stdv, sample_start, sample_length);
+        sample_start += sample_length;
     }
 
     // If sequencing RNA, reverse the events to be 5'->3'
     if(this->nucleotide_type == SRNT_RNA) {
-        std::reverse(this->events[strand_idx].begin(), this->events[strand_idx].end());
+        this->events[strand_idx].reverse();
     }
 
-    // clean up scrappie raw and event tables
-    assert(rt.raw != NULL);
+    // clean up scrappie event table
     assert(et.event != NULL);
-    free(rt.raw);
     free(et.event);
 
     // align events to the basecalled read
-    std::vector<AlignedPair> event_alignment = adaptive_banded_simple_event_align(*this, *this->base_model[strand_idx], read_sequence);
+    std::vector<AlignedPair> event_alignment = adaptive_banded_simple_event_align(*this, *this->base_model[strand_idx], sequence);
 
     // transform alignment into the base-to-event map
     if(event_alignment.size() > 0) {
 
         // create base-to-event map
+        // the map covers the whole read, kmers outside of the loaded bases have no events
         size_t n_kmers = read_sequence.size() - this->get_model_k(strand_idx) + 1;
+        size_t n_aligned_kmers = sequence.size() - this->get_model_k(strand_idx) + 1;
         this->base_to_event_map.clear();
         this->base_to_event_map.resize(n_kmers);
 
@@ -372,7 +479,7 @@ void SquiggleRead::load_from_raw(fast5_file& f5_file, const uint32_t flags)
         size_t prev_event_idx = -1;
         for(size_t i = 0; i < event_alignment.size(); ++i) {
 
-            size_t k_idx = event_alignment[i].ref_pos;
+            size_t k_idx = base_start + event_alignment[i].ref_pos;
             size_t event_idx = event_alignment[i].read_pos;
             IndexPair& elem = this->base_to_event_map[k_idx].indices[strand_idx];
             if(event_idx != prev_event_idx) {
@@ -387,16 +494,15 @@ void SquiggleRead::load_from_raw(fast5_file& f5_file, const uint32_t flags)
             prev_event_idx = event_idx;
         }
 
-        events_per_base[strand_idx] = (double)(max_event - min_event) / n_kmers;
-
-        // prepare data structures for the final calibration
-        std::vector<EventAlignment> alignment =
-            get_eventalignment_for_1d_basecalls(read_sequence, alphabet, this->base_to_event_map, this->base_model[strand_idx]->k, strand_idx, 0);
+        events_per_base[strand_idx] = (double)(max_event - min_event) / n_aligned_kmers;
 
         // run recalibration to get the best set of scaling parameters and the residual
-        // between the (scaled) event levels and the model.
+        // between the (scaled) event levels and the model, directly from the event alignment.
         // internally this function will set shift/scale/etc of the pore model
-        bool calibrated = recalibrate_model(*this, *this->base_model[strand_idx], strand_idx, alignment, true, false);
+        const PoreModel& model = *this->base_model[strand_idx];
+        std::vector<uint32_t> kmer_ranks;
+        model.pmalphabet->kmer_ranks(sequence, model.k, kmer_ranks);
+        bool calibrated = recalibrate_model(*this, model, strand_idx, event_alignment, kmer_ranks, true, false, MAX_CALIBRATION_EVENTS);
 
 #ifdef DEBUG_MODEL_SELECTION
         fprintf(stderr, "[calibration] read: %s events: %zu"
@@ -537,17 +643,25 @@ void SquiggleRead::_load_R9(uint32_t si,
     // This vector tracks the number of events observed (by the basecaller) for each kmer
     std::vector<size_t> event_counts;
     event_counts.reserve(read_sequence_1d.length());
-    std::string prev_kmer = "";
+    int64_t prev_kmer_rank = -1;
+
+    // the alignment only has kmers of calibration_k, so the blacklist can be compared by rank
+    int64_t blacklist_rank = -1;
+    int64_t rc_blacklist_rank = -1;
+    if(blacklist_kmer.size() == calibration_k) {
+        blacklist_rank = gDNAAlphabet.kmer_rank(blacklist_kmer.c_str(), calibration_k);
+        rc_blacklist_rank = gDNAAlphabet.kmer_rank(gDNAAlphabet.reverse_complement(blacklist_kmer).c_str(), calibration_k);
+    }
 
     for(const auto& ea : alignment) {
-        if((!ea.rc && ea.ref_kmer == blacklist_kmer) ||
-           (ea.rc && ea.ref_kmer == gDNAAlphabet.reverse_complement(blacklist_kmer)))
+        if((!ea.rc && ea.ref_kmer_rank == blacklist_rank) ||
+           (ea.rc && ea.ref_kmer_rank == rc_blacklist_rank))
         {
             continue;
         }
 
-        if(ea.ref_kmer != prev_kmer) {
-            prev_kmer = ea.ref_kmer;
+        if(ea.ref_kmer_rank != prev_kmer_rank) {
+            prev_kmer_rank = ea.ref_kmer_rank;
             event_counts.push_back(1);
         } else {
             assert(!event_counts.empty());
@@ -1039,6 +1153,7 @@ std::vector<EventAlignment> SquiggleRead::get_eventalignment_for_1d_basecalls(co
                                                                               const int shift_offset) const
 {
     std::vector<EventAlignment> alignment;
+    alignment.reserve(this->events[strand_idx].size());
 
     const Alphabet* alphabet = get_alphabet_by_name(alphabet_name);
     size_t n_kmers = read_sequence_1d.size() - k + 1;
@@ -1062,19 +1177,20 @@ std::vector<EventAlignment> SquiggleRead::get_eventalignment_for_1d_basecalls(co
             assert(event_idx < this->events[strand_idx].size());
 
             // since we use the 1D read seqence here we never have to reverse complement
-            std::string kmer = read_sequence_1d.substr(ki + shift_offset, k);
-            size_t kmer_rank = alphabet->kmer_rank(kmer.c_str(), k);
+            uint32_t kmer_rank = alphabet->kmer_rank(read_sequence_1d.c_str() + ki + shift_offset, k);
 
             EventAlignment ea;
             // ref data
-            //ea.ref_name = "read";
+            ea.ref_id = 0; // not needed
             ea.read_idx = -1; // not needed
-            ea.ref_kmer = kmer;
+            ea.alphabet = alphabet;
+            ea.k = k;
+            ea.ref_kmer_rank = kmer_rank;
             ea.ref_position = ki;
             ea.strand_idx = strand_idx;
             ea.event_idx = event_idx;
             ea.rc = false;
-            ea.model_kmer = kmer;
+            ea.model_kmer_rank = kmer_rank;
             ea.hmm_state = prev_kmer_rank != kmer_rank ? 'M' : 'E';
             alignment.push_back(ea);
             prev_kmer_rank = kmer_rank;
@@ -1095,10 +1211,11 @@ std::vector<float> SquiggleRead::get_scaled_samples_for_event(size_t strand_idx,
     std::pair<size_t, size_t> sample_range = get_event_sample_idx(strand_idx, event_idx);
 
     std::vector<float> out;
+    out.reserve(sample_range.second - sample_range.first);
     for(size_t i = sample_range.first; i < sample_range.second; ++i) {
         double curr_sample_time = (this->sample_start_time + i) / this->sample_rate;
         //fprintf(stderr, "event_start: %.5lf sample start: %.5lf curr: %.5lf rate: %.2lf\n", event_start_time, this->sample_start_time / this->sample_rate, curr_sample_time, this->sample_rate);
-        double s = this->samples[i];
+        double s = this->get_sample(i - this->raw_sample_offset);
         // apply scaling corrections
         double scaled_s = s - this->scalings[strand_idx].shift;
         assert(curr_sample_time >= (this->sample_start_time / this->sample_rate));
@@ -1112,11 +1229,11 @@ std::vector<float> SquiggleRead::get_scaled_samples_for_event(size_t strand_idx,
 // return a pair of value corresponding to the start and end index of a given index on the signal
 std::pair<size_t, size_t> SquiggleRead::get_event_sample_idx(size_t strand_idx, size_t event_idx) const
 {
-    double event_start_time = this->events[strand_idx][event_idx].start_time;
-    double event_duration = this->events[strand_idx][event_idx].duration;
+    int64_t event_sample_start = this->events[strand_idx].get_sample_start(event_idx);
+    uint32_t event_sample_length = this->events[strand_idx].get_sample_length(event_idx);
 
-    size_t start_idx = this->get_sample_index_at_time(event_start_time * this->sample_rate);
-    size_t end_idx = this->get_sample_index_at_time((event_start_time + event_duration) * this->sample_rate);
+    size_t start_idx = this->get_sample_index_at_time(event_sample_start);
+    size_t end_idx = this->get_sample_index_at_time(event_sample_start + event_sample_length);
 
     return std::make_pair(start_idx, end_idx);
 }
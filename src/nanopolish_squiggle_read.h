@@ -16,7 +16,11 @@
 #include "nanopolish_read_db.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_fast5_io.h"
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 
 enum PoreType
 {
@@ -48,14 +52,212 @@ enum SquiggleReadFlags
     SRF_LOAD_RAW_SAMPLES = 2
 };
 
+// The bases of the read sequence that will be used, [start, end). When this is set only the
+// signal of these bases is loaded if the basecaller's move table in the fast5 says where it is
+struct SquiggleReadRange
+{
+    SquiggleReadRange() : start(-1), end(-1) {}
+    SquiggleReadRange(int s, int e) : start(s), end(e) {}
+    bool is_set() const { return start >= 0 && end > start; }
+
+    int start;
+    int end;
+};
+
+// number of bases loaded on either side of a SquiggleReadRange, and basecaller blocks of
+// signal on either side of those, so the ends of the range align well
+#define RANGE_MARGIN_BASES 250
+#define RANGE_MARGIN_BLOCKS 4
+
+// Find the samples of bases [base_start, base_end) of the read from the basecaller's move table,
+// which has one entry per block of stride samples that is 1 when the block starts a new base.
+// The range is padded by RANGE_MARGIN_BLOCKS blocks, and sample_end is SIZE_MAX when the bases
+// run to the end of the read. Returns false if the read has fewer than base_start + 1 bases
+bool get_sample_range_for_bases(const fast5_basecall_moves& bm,
+                                size_t base_start,
+                                size_t base_end,
+                                size_t& sample_start,
+                                size_t& sample_end);
+
 // The raw event data for a read
+// This is a by-value view of a single event, see SquiggleEventTable
 struct SquiggleEvent
 {
     float mean;        // current level mean in picoamps
     float stdv;        // current level stdv
     double start_time; // start time of the event in seconds
     float duration;    // duration of the event in seconds
-    float log_stdv;    // precompute for efficiency
+    float log_stdv;    // log of stdv
+};
+
+// The events for one strand of a read, stored column-wise so that loops over
+// the event levels read contiguous memory. Event boundaries are stored as
+// sample indices; times in seconds are derived from the sample rate on demand.
+// The columns are either owned by the table or, for reads loaded from the
+// signal cache, point directly into memory owned by someone else.
+class SquiggleEventTable
+{
+    public:
+        SquiggleEventTable() : m_sample_rate(1.0), m_inv_sample_rate(1.0), m_sample_offset(0) { update_pointers(); }
+
+        SquiggleEventTable(const SquiggleEventTable&) = delete;
+        SquiggleEventTable& operator=(const SquiggleEventTable&) = delete;
+
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        void clear()
+        {
+            m_mean.clear();
+            m_stdv.clear();
+            m_start.clear();
+            m_length.clear();
+            update_pointers();
+        }
+
+        void reserve(size_t n)
+        {
+            take_ownership();
+            m_mean.reserve(n);
+            m_stdv.reserve(n);
+            m_start.reserve(n);
+            m_length.reserve(n);
+            update_pointers();
+        }
+
+        // the sample rate must be set before events are added
+        void set_sample_rate(double sample_rate)
+        {
+            assert(empty());
+            m_sample_rate = sample_rate;
+            m_inv_sample_rate = 1.0 / sample_rate;
+        }
+
+        double get_sample_rate() const { return m_sample_rate; }
+
+        // append an event starting at sample_start (in samples, absolute) and spanning sample_length samples
+        void push_back(float mean, float stdv, int64_t sample_start, uint32_t sample_length)
+        {
+            take_ownership();
+            if(empty()) {
+                m_sample_offset = sample_start;
+            }
+            assert(sample_start >= m_sample_offset && sample_start - m_sample_offset <= UINT32_MAX);
+            m_mean.push_back(mean);
+            m_stdv.push_back(stdv);
+            m_start.push_back(sample_start - m_sample_offset);
+            m_length.push_back(sample_length);
+            update_pointers();
+        }
+
+        // append an event with times given in seconds
+        void push_back(const SquiggleEvent& event)
+        {
+            push_back(event.mean,
+                      event.stdv,
+                      llround(event.start_time * m_sample_rate),
+                      lround(event.duration * m_sample_rate));
+        }
+
+        // reverse the order of the events, used for RNA which is sequenced 3'->5'
+        void reverse()
+        {
+            take_ownership();
+            std::reverse(m_mean.begin(), m_mean.end());
+            std::reverse(m_stdv.begin(), m_stdv.end());
+            std::reverse(m_start.begin(), m_start.end());
+            std::reverse(m_length.begin(), m_length.end());
+            update_pointers();
+        }
+
+        // use n events stored in external columns, which must outlive this table.
+        // start is relative to sample_offset, as returned by get_start_data()
+        void set_external(const float* mean,
+                          const float* stdv,
+                          const uint32_t* start,
+                          const uint32_t* length,
+                          size_t n,
+                          int64_t sample_offset)
+        {
+            clear();
+            m_mean_ptr = mean;
+            m_stdv_ptr = stdv;
+            m_start_ptr = start;
+            m_length_ptr = length;
+            m_size = n;
+            m_sample_offset = sample_offset;
+        }
+
+        inline float get_mean(size_t i) const { return m_mean_ptr[i]; }
+        inline float get_stdv(size_t i) const { return m_stdv_ptr[i]; }
+        inline float get_log_stdv(size_t i) const { return logf(m_stdv_ptr[i]); }
+
+        // first sample of the event and the number of samples it spans
+        inline int64_t get_sample_start(size_t i) const { return m_sample_offset + m_start_ptr[i]; }
+        inline uint32_t get_sample_length(size_t i) const { return m_length_ptr[i]; }
+
+        inline double get_start_time(size_t i) const { return get_sample_start(i) * m_inv_sample_rate; }
+        inline float get_duration(size_t i) const { return m_length_ptr[i] * m_inv_sample_rate; }
+
+        // time elapsed between the first event in the table and event i, in seconds
+        inline float get_time(size_t i) const
+        {
+            return ((int64_t)m_start_ptr[i] - (int64_t)m_start_ptr[0]) * m_inv_sample_rate;
+        }
+
+        // contiguous columns, for loops over all events and serialization
+        const float* get_mean_data() const { return m_mean_ptr; }
+        const float* get_stdv_data() const { return m_stdv_ptr; }
+        const uint32_t* get_start_data() const { return m_start_ptr; }
+        const uint32_t* get_length_data() const { return m_length_ptr; }
+        int64_t get_sample_offset() const { return m_sample_offset; }
+
+        // by-value view of a single event
+        SquiggleEvent operator[](size_t i) const
+        {
+            return { get_mean(i), get_stdv(i), get_start_time(i), get_duration(i), get_log_stdv(i) };
+        }
+
+    private:
+
+        inline bool is_external() const { return m_mean_ptr != m_mean.data(); }
+
+        // copy external columns into the owned vectors so they can be modified
+        void take_ownership()
+        {
+            if(is_external()) {
+                m_mean.assign(m_mean_ptr, m_mean_ptr + m_size);
+                m_stdv.assign(m_stdv_ptr, m_stdv_ptr + m_size);
+                m_start.assign(m_start_ptr, m_start_ptr + m_size);
+                m_length.assign(m_length_ptr, m_length_ptr + m_size);
+                update_pointers();
+            }
+        }
+
+        void update_pointers()
+        {
+            m_mean_ptr = m_mean.data();
+            m_stdv_ptr = m_stdv.data();
+            m_start_ptr = m_start.data();
+            m_length_ptr = m_length.data();
+            m_size = m_mean.size();
+        }
+
+        std::vector<float> m_mean;
+        std::vector<float> m_stdv;
+        std::vector<uint32_t> m_start; // relative to m_sample_offset
+        std::vector<uint32_t> m_length;
+
+        // the columns in use, pointing either at the vectors above or external memory
+        const float* m_mean_ptr;
+        const float* m_stdv_ptr;
+        const uint32_t* m_start_ptr;
+        const uint32_t* m_length_ptr;
+        size_t m_size;
+
+        double m_sample_rate;
+        double m_inv_sample_rate;
+        int64_t m_sample_offset;
 };
 
 // Scaling parameters to account for per-read variations from the model
@@ -111,9 +313,15 @@ class SquiggleRead
     public:
 
         SquiggleRead() {} // legacy TODO remove
-        SquiggleRead(const std::string& name, const ReadDB& read_db, const uint32_t flags = 0);
+        SquiggleRead(const std::string& name,
+                     const ReadDB& read_db,
+                     const uint32_t flags = 0,
+                     const SquiggleReadRange& range = SquiggleReadRange());
         ~SquiggleRead();
 
+        // the model used for reads that are loaded from raw samples (template only, R9.4)
+        static const PoreModel* get_raw_read_model(SquiggleReadNucleotideType nucleotide_type);
+
         //
         // I/O
         //
@@ -126,19 +334,19 @@ class SquiggleRead
         inline float get_duration(uint32_t event_idx, uint32_t strand) const
         {
             assert(event_idx < events[strand].size());
-            return events[strand][event_idx].duration;
+            return events[strand].get_duration(event_idx);
         }
 
         // Return the current stdv for the given event
         inline float get_stdv(uint32_t event_idx, uint32_t strand) const
         {
-            return events[strand][event_idx].stdv;
+            return events[strand].get_stdv(event_idx);
         }
 
         // Return log of the current stdv for the given event
         inline float get_log_stdv(uint32_t event_idx, uint32_t strand) const
         {
-            return events[strand][event_idx].log_stdv;
+            return events[strand].get_log_stdv(event_idx);
         }
 
         // Return the observed current level corrected for drift
@@ -158,18 +366,18 @@ class SquiggleRead
         // Return the observed current level stdv, after correcting for scale
         inline float get_scaled_stdv(uint32_t event_idx, uint32_t strand) const
         {
-            return events[strand][event_idx].stdv / scalings[strand].scale_sd;
+            return events[strand].get_stdv(event_idx) / scalings[strand].scale_sd;
         }
 
         inline float get_time(uint32_t event_idx, uint32_t strand) const
         {
-            return events[strand][event_idx].start_time - events[strand][0].start_time;
+            return events[strand].get_time(event_idx);
         }
 
         // Return the observed current level after correcting for drift
         inline float get_unscaled_level(uint32_t event_idx, uint32_t strand) const
         {
-            return events[strand][event_idx].mean;
+            return events[strand].get_mean(event_idx);
         }
 
         // Return k-mer sized used by the pore model for this read strand
@@ -200,9 +408,26 @@ class SquiggleRead
             return this->base_model[strand];
         }
 
-        // Get the pore model that should be used for this read, for a given alphabet
+        // Get the pore model that should be used for this read, for a given alphabet.
+        // This uses the handle of the base model so it does not look up a string key,
+        // unless the base model was not added to the PoreModelSet
+        const PoreModel* get_model(uint32_t strand, const Alphabet* alphabet) const
+        {
+            assert(this->base_model[strand] != NULL);
+            int handle = this->base_model[strand]->handle;
+            if(handle == -1) {
+                return get_model(strand, std::string(alphabet->get_name()));
+            }
+            return PoreModelSet::get_model(PoreModelSet::get_model_handle(handle, alphabet));
+        }
+
         const PoreModel* get_model(uint32_t strand, const std::string& alphabet) const
         {
+            assert(this->base_model[strand] != NULL);
+            int handle = this->base_model[strand]->handle;
+            if(handle != -1) {
+                return PoreModelSet::get_model(PoreModelSet::get_model_handle(handle, alphabet));
+            }
             return PoreModelSet::get_model(this->get_model_kit_name(strand),
                                            alphabet,
                                            this->get_model_strand_name(strand),
@@ -212,12 +437,12 @@ class SquiggleRead
         // Get the parameters to the gaussian PDF scaled to this read
         inline GaussianParameters get_scaled_gaussian_from_pore_model_state(const PoreModel& pore_model, size_t strand_idx, size_t rank) const
         {
+            assert(rank < pore_model.level_mean.size() && pore_model.level_mean.size() == pore_model.get_num_states());
             const SquiggleScalings& scalings = this->scalings[strand_idx];
-            const PoreModelStateParams& params = pore_model.states[rank];
             GaussianParameters gp;
-            gp.mean = scalings.scale * params.level_mean + scalings.shift;
-            gp.stdv = params.level_stdv * scalings.var;
-            gp.log_stdv = params.level_log_stdv + scalings.log_var;
+            gp.mean = scalings.scale * pore_model.level_mean[rank] + scalings.shift;
+            gp.stdv = pore_model.level_stdv[rank] * scalings.var;
+            gp.log_stdv = pore_model.level_log_stdv[rank] + scalings.log_var;
             return gp;
         }
 
@@ -234,6 +459,9 @@ class SquiggleRead
         // returns true if this read has events for this strand
         bool has_events_for_strand(size_t strand_idx) const { return !this->events[strand_idx].empty(); }
 
+        // returns true if the events were detected from the raw signal by nanopolish
+        bool has_events_from_raw() const { return m_events_from_raw; }
+
         // Create an eventalignment between the events of this read and its 1D basecalled sequence
         std::vector<EventAlignment> get_eventalignment_for_1d_basecalls(const std::string& read_sequence_1d,
                                                                         const std::string& alphabet_name,
@@ -242,7 +470,11 @@ class SquiggleRead
                                                                         const size_t strand_idx,
                                                                         const int label_shift) const;
 
-        // Sample-level access
+        // Sample-level access, i is an index into raw_samples, not the read's full signal
+        inline size_t get_num_samples() const { return raw_samples.size(); }
+        inline float get_sample(size_t i) const { return fast5_raw_to_pA(raw_samples[i], raw_offset, raw_unit); }
+
+        // these return indices into the read's full signal, even when only part of it is loaded
         size_t get_sample_index_at_time(size_t sample_time) const;
         std::vector<float> get_scaled_samples_for_event(size_t strand_idx, size_t event_idx) const;
         std::pair<size_t, size_t> get_event_sample_idx(size_t strand_idx, size_t event_idx) const;
@@ -270,7 +502,7 @@ class SquiggleRead
         std::string read_sequence;
 
         // one event sequence for each strand
-        std::vector<SquiggleEvent> events[2];
+        SquiggleEventTable events[2];
 
         // scaling parameters for each strand
         SquiggleScalings scalings[2];
@@ -279,11 +511,18 @@ class SquiggleRead
         const PoreModel* base_model[2];
 
         // optional fields holding the raw data
-        // this is not split into strands so there is only one vector, unlike events
-        std::vector<float> samples;
+        // this is not split into strands so there is only one vector, unlike events.
+        // The samples are kept as ADC values, use get_sample() for the current in pA
+        std::vector<int16_t> raw_samples;
+        float raw_offset;
+        float raw_unit;
         double sample_rate;
         int64_t sample_start_time;
 
+        // the index in the read's signal of raw_samples[0], which is not 0
+        // when only the signal for a range of the read was loaded
+        size_t raw_sample_offset;
+
         // summary stats
         double events_per_base[2];
 
@@ -294,17 +533,26 @@ class SquiggleRead
         TransitionParameters parameters[2];
 
     private:
+        friend class SignalCache;
+
         // private data
         fast5::File* f_p;
         std::string basecall_group;
 
+        // true if the events were detected from the raw signal, rather than
+        // loaded from the basecaller's events
+        bool m_events_from_raw = false;
+
         SquiggleRead(const SquiggleRead&) {}
 
         // Load all read data from events in a fast5 file
         void load_from_events(const uint32_t flags);
 
-        // Load all read data from raw samples
-        void load_from_raw(fast5_file& f5_file, const uint32_t flags);
+        // Load all read data from raw samples, or only the data for range if it is set
+        void load_from_raw(fast5_file& f5_file,
+                           const fast5_read_info& read_info,
+                           const uint32_t flags,
+                           const SquiggleReadRange& range);
 
         // Version-specific intialization functions
         void _load_R7(uint32_t si);
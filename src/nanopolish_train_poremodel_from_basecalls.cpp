@@ -132,7 +132,7 @@ PoreModel initialize_pore_model(const std::vector<KmerTrainingData>& read_traini
 
     // Set the initial pore model
     PoreModel pore_model(k);
-    pore_model.states.resize(num_kmers_in_alphabet);
+    std::vector<PoreModelStateParams> states(num_kmers_in_alphabet);
 
     auto& kmer_training_data_for_selected = read_training_data[max_events_index];
 
@@ -158,17 +158,18 @@ PoreModel initialize_pore_model(const std::vector<KmerTrainingData>& read_traini
                 median = values[n/2];
             }
 
-            pore_model.states[ki].level_mean = median;
-            pore_model.states[ki].level_stdv = 1.0;
-            pore_model.states[ki].sd_mean = 0.0;
-            pore_model.states[ki].sd_stdv = 0.0;
-            pore_model.states[ki].sd_lambda = 0.0;
-            pore_model.states[ki].update_logs();
+            states[ki].level_mean = median;
+            states[ki].level_stdv = 1.0;
+            states[ki].sd_mean = 0.0;
+            states[ki].sd_stdv = 0.0;
+            states[ki].sd_lambda = 0.0;
+            states[ki].update_logs();
 
             printf("k: %zu median: %.2lf values: %s\n", ki, median, ss.str().c_str());
         }
     }
 
+    pore_model.update_states(states);
     return pore_model;
 }
 
@@ -180,13 +181,13 @@ void alignment_to_training_data(const SquiggleRead* read,
                                 FILE* tsv_writer)
 {
     for(auto const& a : alignment) {
-        size_t kmer_rank = gDNAAlphabet.kmer_rank(a.model_kmer.c_str(), k);
+        size_t kmer_rank = a.get_model_kmer_rank(&gDNAAlphabet);
         assert(kmer_rank < out_data->size());
         assert(a.strand_idx == 0);
         assert(a.event_idx < read->events[a.strand_idx].size());
 
         double level = read->get_fully_scaled_level(a.event_idx, a.strand_idx);
-        double stdv = read->events[a.strand_idx][a.event_idx].stdv;
+        double stdv = read->get_stdv(a.event_idx, a.strand_idx);
 
         // If the scale/shift values are off, or the events are erroneous, the scaled events can have negative values
         // causing the training to implode. Filter these here.
@@ -196,7 +197,7 @@ void alignment_to_training_data(const SquiggleRead* read,
         }
 
         if(tsv_writer) {
-            fprintf(tsv_writer, "%zu\t%s\t%.2lf\t%.5lf\n", read_idx, a.model_kmer.c_str(), level, read->events[a.strand_idx][a.event_idx].duration);
+            fprintf(tsv_writer, "%zu\t%s\t%.2lf\t%.5lf\n", read_idx, a.get_model_kmer().c_str(), level, read->get_duration(a.event_idx, a.strand_idx));
         }
     }
 }
@@ -280,7 +281,7 @@ int train_poremodel_from_basecalls_main(int argc, char** argv)
         for(size_t kmer_idx = 0; kmer_idx < num_kmers_in_alphabet; ++kmer_idx) {
 
             // untrained kmers have a mean of 0.0
-            trained_kmers[kmer_idx] = current_pore_model.states[kmer_idx].level_mean > 1.0;
+            trained_kmers[kmer_idx] = current_pore_model.get_parameters(kmer_idx).level_mean > 1.0;
             num_trained += trained_kmers[kmer_idx];
         }
 
@@ -306,7 +307,7 @@ int train_poremodel_from_basecalls_main(int argc, char** argv)
             // filter the alignment to only contain k-mers that have a distribution
             std::vector<EventAlignment> filtered_alignment;
             for(size_t i = 0; i < alignment.size(); ++i) {
-                size_t kmer_rank = gDNAAlphabet.kmer_rank(alignment[i].model_kmer.c_str(), basecalled_k);
+                size_t kmer_rank = alignment[i].get_model_kmer_rank(&gDNAAlphabet);
                 if(trained_kmers[kmer_rank]) {
                     filtered_alignment.push_back(alignment[i]);
                 }
@@ -373,11 +374,11 @@ int train_poremodel_from_basecalls_main(int argc, char** argv)
             input_mixture.params.push_back(initial_params);
                
             ParamMixture trained_mixture = train_gaussian_mixture(kmer_training_data[kmer_idx], input_mixture);
-            new_pore_model.states[kmer_idx] = trained_mixture.params[0];
-            new_pore_model.states[kmer_idx].level_stdv = 1.5;
+            PoreModelStateParams trained_params = trained_mixture.params[0];
+            trained_params.level_stdv = 1.5;
+            new_pore_model.set_parameters(kmer_idx, trained_params);
             gDNAAlphabet.lexicographic_next(model_kmer);
         }
-        new_pore_model.bake_gaussian_parameters();
         current_pore_model = new_pore_model;
     }
     current_pore_model.write("r9.template.5mer.base.model", "r9.template.5mer.base.model");
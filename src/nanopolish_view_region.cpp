@@ -0,0 +1,126 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_view_region - write the rows of the reads
+// aligned to a region from output written with --indexed-output
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <getopt.h>
+#include "nanopolish_common.h"
+#include "nanopolish_bam_utils.h"
+#include "nanopolish_indexed_output.h"
+
+//
+// Getopt
+//
+#define SUBPROGRAM "view-region"
+
+static const char *VIEW_REGION_VERSION_MESSAGE =
+SUBPROGRAM " Version " PACKAGE_VERSION "\n"
+"Written by agent.\n"
+"\n"
+"Copyright 2026 agent\n";
+
+static const char *VIEW_REGION_USAGE_MESSAGE =
+"Usage: " PACKAGE_NAME " " SUBPROGRAM " [OPTIONS] output.tsv.gz ctg:start-end [ctg:start-end ...]\n"
+"Write the rows of every read that overlaps the regions, from the output of eventalign or\n"
+"call-methylation written with --indexed-output. Rows are written per read, so reads that\n"
+"overlap a region can have rows outside of it. Reads that overlap more than one region are\n"
+"written once, in the order of the file\n"
+"\n"
+"  -v, --verbose                        display verbose output\n"
+"      --version                        display version\n"
+"      --help                           display this help and exit\n"
+"  -t, --threads=NUM                    use NUM threads to decompress the output (default: 1)\n"
+"      --no-header                      do not write the header line\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+namespace opt
+{
+    static unsigned int verbose;
+    static std::string input_file;
+    static std::vector<std::string> regions;
+    static int num_threads = 1;
+    static bool write_header = true;
+}
+
+static const char* shortopts = "t:v";
+
+enum { OPT_HELP = 1, OPT_VERSION, OPT_NO_HEADER };
+
+static const struct option longopts[] = {
+    { "verbose",   no_argument,       NULL, 'v' },
+    { "threads",   required_argument, NULL, 't' },
+    { "no-header", no_argument,       NULL, OPT_NO_HEADER },
+    { "help",      no_argument,       NULL, OPT_HELP },
+    { "version",   no_argument,       NULL, OPT_VERSION },
+    { NULL, 0, NULL, 0 }
+};
+
+void parse_view_region_options(int argc, char** argv)
+{
+    bool die = false;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;) {
+        std::istringstream arg(optarg != NULL ? optarg : "");
+        switch (c) {
+            case '?': die = true; break;
+            case 'v': opt::verbose++; break;
+            case 't': arg >> opt::num_threads; break;
+            case OPT_NO_HEADER: opt::write_header = false; break;
+            case OPT_HELP:
+                std::cout << VIEW_REGION_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+            case OPT_VERSION:
+                std::cout << VIEW_REGION_VERSION_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (argc - optind < 2) {
+        std::cerr << SUBPROGRAM ": not enough arguments\n";
+        die = true;
+    }
+
+    if(opt::num_threads <= 0) {
+        std::cerr << SUBPROGRAM ": invalid number of threads: " << opt::num_threads << "\n";
+        die = true;
+    }
+
+    if (die)
+    {
+        std::cout << "\n" << VIEW_REGION_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+
+    opt::input_file = argv[optind++];
+    for(; optind < argc; ++optind) {
+        opt::regions.push_back(argv[optind]);
+    }
+}
+
+int view_region_main(int argc, char** argv)
+{
+    parse_view_region_options(argc, argv);
+    set_bam_io_threads(opt::num_threads > 1 ? opt::num_threads : 0);
+
+    IndexedOutputReader reader(opt::input_file);
+    if(opt::write_header) {
+        reader.write_header(stdout);
+    }
+
+    // reads that overlap more than one region are written once
+    std::vector<std::string> contigs(opt::regions.size());
+    std::vector<int> start_bases(opt::regions.size());
+    std::vector<int> end_bases(opt::regions.size());
+    for(size_t i = 0; i < opt::regions.size(); ++i) {
+        parse_region_string(opt::regions[i], contigs[i], start_bases[i], end_bases[i]);
+    }
+    reader.write_regions(stdout, contigs, start_bases, end_bases);
+    return 0;
+}
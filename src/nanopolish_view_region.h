@@ -0,0 +1,14 @@
+//---------------------------------------------------------
+// Copyright 2026 agent
+// Written by agent (agent@local)
+//---------------------------------------------------------
+//
+// nanopolish_view_region - write the rows of the reads
+// aligned to a region from output written with --indexed-output
+//
+#ifndef NANOPOLISH_VIEW_REGION_H
+#define NANOPOLISH_VIEW_REGION_H
+
+int view_region_main(int argc, char** argv);
+
+#endif
@@ -28,22 +28,33 @@
 #include "builtin_models/r9_4_450bps_dcm_6mer_template_model.inl"
 #include "builtin_models/r9_4_450bps_dam_6mer_template_model.inl"
 
+// A built-in model is only constructed by calling initialize when
+// it is first used, the other fields give its key without doing so
+struct BuiltinModel
+{
+    const char* kit_name;
+    const char* alphabet;
+    const char* strand;
+    size_t k;
+    PoreModel (*initialize)();
+};
+
 // Autogenerated from convert_all_models.py
-const static std::vector<PoreModel> builtin_models({
-	initialize_r9_250bps_cpg_6mer_template_model_builtin(),
-	initialize_r9_250bps_nucleotide_5mer_complement_pop1_model_builtin(),
-	initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin(),
-	initialize_r9_250bps_nucleotide_5mer_template_model_builtin(),
-	initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin(),
-	initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin(),
-	initialize_r9_250bps_nucleotide_6mer_template_model_builtin(),
-	initialize_r9_4_450bps_cpg_6mer_template_model_builtin(),
-	initialize_r9_4_450bps_gpc_6mer_template_model_builtin(),
-	initialize_r9_4_450bps_nucleotide_5mer_template_model_builtin(),
-	initialize_r9_4_450bps_nucleotide_6mer_template_model_builtin(),
-	initialize_r9_4_70bps_u_to_t_rna_5mer_template_model_builtin(),
-	initialize_r9_4_450bps_dcm_6mer_template_model_builtin(),
-	initialize_r9_4_450bps_dam_6mer_template_model_builtin()
-});
+const static BuiltinModel builtin_models[] = {
+	{ "r9_250bps", "cpg", "template", 6, initialize_r9_250bps_cpg_6mer_template_model_builtin },
+	{ "r9_250bps", "nucleotide", "complement.pop1", 5, initialize_r9_250bps_nucleotide_5mer_complement_pop1_model_builtin },
+	{ "r9_250bps", "nucleotide", "complement.pop2", 5, initialize_r9_250bps_nucleotide_5mer_complement_pop2_model_builtin },
+	{ "r9_250bps", "nucleotide", "template", 5, initialize_r9_250bps_nucleotide_5mer_template_model_builtin },
+	{ "r9_250bps", "nucleotide", "complement.pop1", 6, initialize_r9_250bps_nucleotide_6mer_complement_pop1_model_builtin },
+	{ "r9_250bps", "nucleotide", "complement.pop2", 6, initialize_r9_250bps_nucleotide_6mer_complement_pop2_model_builtin },
+	{ "r9_250bps", "nucleotide", "template", 6, initialize_r9_250bps_nucleotide_6mer_template_model_builtin },
+	{ "r9.4_450bps", "cpg", "template", 6, initialize_r9_4_450bps_cpg_6mer_template_model_builtin },
+	{ "r9.4_450bps", "gpc", "template", 6, initialize_r9_4_450bps_gpc_6mer_template_model_builtin },
+	{ "r9.4_450bps", "nucleotide", "template", 5, initialize_r9_4_450bps_nucleotide_5mer_template_model_builtin },
+	{ "r9.4_450bps", "nucleotide", "template", 6, initialize_r9_4_450bps_nucleotide_6mer_template_model_builtin },
+	{ "r9.4_70bps", "u_to_t_rna", "template", 5, initialize_r9_4_70bps_u_to_t_rna_5mer_template_model_builtin },
+	{ "r9.4_450bps", "dcm", "template", 6, initialize_r9_4_450bps_dcm_6mer_template_model_builtin },
+	{ "r9.4_450bps", "dam", "template", 6, initialize_r9_4_450bps_dam_6mer_template_model_builtin }
+};
 
 #endif
@@ -9,22 +9,29 @@
 //
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_builtin_models.h"
+#include <assert.h>
 
 //
 PoreModelSet::PoreModelSet()
 {
-    // Copy the built-in models into the map
-    for(auto p : builtin_models) {
-        register_model(p);
+    alphabets = get_alphabet_list();
+    entries.reserve(MAX_PORE_MODELS);
+    family_handles.reserve(MAX_PORE_MODELS * alphabets.size());
+
+    // Give the built-in models handles, they are constructed by get_model
+    // when first used as most runs only need one or two of them
+    for(const BuiltinModel& builtin : builtin_models) {
+        int handle = register_entry(builtin.kit_name, builtin.alphabet, builtin.strand, builtin.k);
+        entries[handle].initialize = builtin.initialize;
     }
 }
 
 //
 PoreModelSet::~PoreModelSet()
 {
-    for(auto& kv : model_map) {
-        delete kv.second;
-        kv.second = NULL;
+    for(auto& entry : entries) {
+        delete entry.model;
+        entry.model = NULL;
     }
 }
 
@@ -59,26 +66,98 @@ std::vector<const PoreModel*> PoreModelSet::initialize(const std::string& fofn_f
 PoreModel* PoreModelSet::register_model(const PoreModel& p)
 {
     PoreModel* out = NULL;
-    #pragma omp critical
+    #pragma omp critical(pore_model_set)
     {
-        // Check that this model doesn't exist already
-        std::string key = get_model_key(p);
-        auto iter = model_map.find(key);
-        if(iter != model_map.end()) {
+        int handle = register_entry(p.metadata.get_kit_name(),
+                                    p.pmalphabet->get_name(),
+                                    p.metadata.get_strand_model_name(),
+                                    p.k);
+        ModelEntry& entry = entries[handle];
+        if(entry.model != NULL) {
             // Overwrite model
-            *iter->second = p;
-            //fprintf(stderr, "overwrite model with key %s\n", key.c_str());
-            out = iter->second;
+            *entry.model = p;
+            //fprintf(stderr, "overwrite model with key %s\n", entry.key.c_str());
+            out = entry.model;
         } else {
-            PoreModel* incoming = new PoreModel(p);
-            model_map[key] = incoming;
-            //fprintf(stderr, "registered model with key %s\n", key.c_str());
-            out = incoming;
+            // a new model, or one replacing a built-in model that has not been constructed
+            out = new PoreModel(p);
+            //fprintf(stderr, "registered model with key %s\n", entry.key.c_str());
         }
+        out->handle = handle;
+
+        #pragma omp atomic write
+        entry.model = out;
     }
     return out;
 }
 
+int PoreModelSet::register_entry(const std::string& kit_name,
+                                 const std::string& alphabet,
+                                 const std::string& strand,
+                                 size_t k)
+{
+    std::string key = get_model_key(kit_name, alphabet, strand, k);
+    auto iter = handle_map.find(key);
+    if(iter != handle_map.end()) {
+        return iter->second;
+    }
+
+    if(entries.size() == MAX_PORE_MODELS) {
+        fprintf(stderr, "Error: too many pore models, at most %d can be loaded\n", MAX_PORE_MODELS);
+        exit(EXIT_FAILURE);
+    }
+
+    std::string family_key = kit_name + "." + std::to_string(k) + "mer." + strand;
+    auto family_iter = family_map.find(family_key);
+    int family = 0;
+    if(family_iter != family_map.end()) {
+        family = family_iter->second;
+    } else {
+        family = family_map.size();
+        family_map[family_key] = family;
+        family_handles.insert(family_handles.end(), alphabets.size(), -1);
+    }
+
+    ModelEntry entry;
+    entry.key = key;
+    entry.model = NULL;
+    entry.initialize = NULL;
+    entry.family = family;
+
+    int handle = entries.size();
+    entries.push_back(entry);
+    handle_map[key] = handle;
+
+    // other threads can read this without the lock
+    int alphabet_idx = get_alphabet_index(alphabet);
+    if(alphabet_idx >= 0) {
+        int& family_handle = family_handles[family * alphabets.size() + alphabet_idx];
+        #pragma omp atomic write
+        family_handle = handle;
+    }
+    return handle;
+}
+
+int PoreModelSet::get_alphabet_index(const Alphabet* alphabet) const
+{
+    for(size_t i = 0; i < alphabets.size(); ++i) {
+        if(alphabets[i] == alphabet) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int PoreModelSet::get_alphabet_index(const std::string& alphabet) const
+{
+    for(size_t i = 0; i < alphabets.size(); ++i) {
+        if(alphabet == alphabets[i]->get_name()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 const PoreModel* PoreModelSet::add_model(const PoreModel& p)
 {
     PoreModelSet& model_set = getInstance();
@@ -87,10 +166,10 @@ const PoreModel* PoreModelSet::add_model(const PoreModel& p)
 
 bool PoreModelSet::has_model(const PoreModel& p)
 {
-    PoreModelSet& model_set = getInstance();
-    std::string model_key = model_set.get_model_key(p);
-    auto iter = model_set.model_map.find(model_key);
-    return iter != model_set.model_map.end();
+    return get_model_handle(p.metadata.get_kit_name(),
+                            p.pmalphabet->get_name(),
+                            p.metadata.get_strand_model_name(),
+                            p.k) != -1;
 }
 
 //
@@ -99,10 +178,7 @@ bool PoreModelSet::has_model(const std::string& kit_name,
                              const std::string& strand,
                              size_t k)
 {
-    PoreModelSet& model_set = getInstance();
-    std::string model_key = model_set.get_model_key(kit_name, alphabet, strand, k);
-    auto iter = model_set.model_map.find(model_key);
-    return iter != model_set.model_map.end();
+    return get_model_handle(kit_name, alphabet, strand, k) != -1;
 }
 
 //
@@ -111,19 +187,111 @@ const PoreModel* PoreModelSet::get_model(const std::string& kit_name,
                                          const std::string& strand,
                                          size_t k)
 {
-    std::string key = PoreModelSet::get_model_key(kit_name, alphabet, strand, k);
-    return get_model_by_key(key);
+    return get_model(get_model_handle(kit_name, alphabet, strand, k));
 }
 
 const PoreModel* PoreModelSet::get_model_by_key(const std::string& key)
 {
     PoreModelSet& model_set = getInstance();
-    auto iter = model_set.model_map.find(key);
-    if(iter == model_set.model_map.end()) {
+    int handle = -1;
+    #pragma omp critical(pore_model_set)
+    {
+        auto iter = model_set.handle_map.find(key);
+        if(iter != model_set.handle_map.end()) {
+            handle = iter->second;
+        }
+    }
+    return get_model(handle);
+}
+
+//
+int PoreModelSet::get_model_handle(const std::string& kit_name,
+                                   const std::string& alphabet,
+                                   const std::string& strand,
+                                   size_t k)
+{
+    PoreModelSet& model_set = getInstance();
+    std::string key = get_model_key(kit_name, alphabet, strand, k);
+    int handle = -1;
+    #pragma omp critical(pore_model_set)
+    {
+        auto iter = model_set.handle_map.find(key);
+        if(iter != model_set.handle_map.end()) {
+            handle = iter->second;
+        }
+    }
+    return handle;
+}
+
+//
+int PoreModelSet::get_model_handle(int handle, const Alphabet* alphabet)
+{
+    if(handle < 0) {
+        return -1;
+    }
+
+    PoreModelSet& model_set = getInstance();
+    int alphabet_idx = model_set.get_alphabet_index(alphabet);
+    if(alphabet_idx < 0) {
+        return -1;
+    }
+    const int& family_handle = model_set.family_handles[model_set.entries[handle].family * model_set.alphabets.size() + alphabet_idx];
+    int out;
+    #pragma omp atomic read
+    out = family_handle;
+    return out;
+}
+
+//
+int PoreModelSet::get_model_handle(int handle, const std::string& alphabet)
+{
+    if(handle < 0) {
+        return -1;
+    }
+
+    PoreModelSet& model_set = getInstance();
+    int alphabet_idx = model_set.get_alphabet_index(alphabet);
+    if(alphabet_idx < 0) {
+        return -1;
+    }
+    const int& family_handle = model_set.family_handles[model_set.entries[handle].family * model_set.alphabets.size() + alphabet_idx];
+    int out;
+    #pragma omp atomic read
+    out = family_handle;
+    return out;
+}
+
+//
+const PoreModel* PoreModelSet::get_model(int handle)
+{
+    if(handle < 0) {
         return NULL;
-    } else {
-        return iter->second;
     }
+
+    PoreModelSet& model_set = getInstance();
+    ModelEntry& entry = model_set.entries[handle];
+
+    PoreModel* model = NULL;
+    #pragma omp atomic read
+    model = entry.model;
+
+    if(model == NULL) {
+        #pragma omp critical(pore_model_set)
+        {
+            // another thread may have constructed it while this one waited
+            if(entry.model == NULL) {
+                assert(entry.initialize != NULL);
+                PoreModel* incoming = new PoreModel(entry.initialize());
+                assert(get_model_key(*incoming) == entry.key);
+                incoming->handle = handle;
+
+                #pragma omp atomic write
+                entry.model = incoming;
+            }
+            model = entry.model;
+        }
+    }
+    return model;
 }
 
 //
@@ -133,14 +301,22 @@ std::map<std::string, PoreModel> PoreModelSet::copy_strand_models(const std::str
 {
     std::map<std::string, PoreModel> out;
     PoreModelSet& model_set = getInstance();
-    for(const auto& kv : model_set.model_map) {
-        const PoreModel* model = kv.second;
-        if(model->metadata.get_kit_name() == kit_name &&
-           model->pmalphabet->get_name() == alphabet &&
-           model->k == k) {
-            out.insert(std::make_pair(kv.first, *kv.second));
+
+    // keys start with the kit, alphabet and k so only the matching built-in models are constructed
+    std::string prefix = kit_name + "." + alphabet + "." + std::to_string(k) + "mer.";
+    std::vector<int> handles;
+    #pragma omp critical(pore_model_set)
+    {
+        for(size_t handle = 0; handle < model_set.entries.size(); ++handle) {
+            if(model_set.entries[handle].key.compare(0, prefix.size(), prefix) == 0) {
+                handles.push_back(handle);
+            }
         }
     }
+
+    for(int handle : handles) {
+        out.insert(std::make_pair(model_set.entries[handle].key, *get_model(handle)));
+    }
     return out;
 }
 
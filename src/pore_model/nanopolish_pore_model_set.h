@@ -15,6 +15,10 @@
 
 #define DEFAULT_MODEL_TYPE "ONT"
 
+// the storage for the models is allocated up front so it never moves, which
+// lets get_model(handle) be called while another thread adds a model
+#define MAX_PORE_MODELS 1024
+
 class PoreModelSet
 {
     public:
@@ -55,6 +59,29 @@ class PoreModelSet
 
         static const PoreModel* get_model_by_key(const std::string& key);
 
+        //
+        // get the handle of a model, which get_model(handle) can use to find
+        // it without building its key. Returns -1 if the model does not exist.
+        // The handle of a model never changes
+        //
+        static int get_model_handle(const std::string& kit_name,
+                                    const std::string& alphabet,
+                                    const std::string& strand,
+                                    size_t k);
+
+        //
+        // get the handle of the model with the same kit, strand and k as the
+        // model for handle, but for another alphabet. Returns -1 if it does not exist
+        //
+        static int get_model_handle(int handle, const Alphabet* alphabet);
+        static int get_model_handle(int handle, const std::string& alphabet);
+
+        //
+        // get a model by its handle, NULL if the handle is -1. The built-in
+        // models are only constructed the first time they are requested
+        //
+        static const PoreModel* get_model(int handle);
+
         //
         // get all the models for the combination of parameters
         //
@@ -80,10 +107,36 @@ class PoreModelSet
             return instance;
         }
 
+        // A model in the set, the index of the entry is the model's handle
+        struct ModelEntry
+        {
+            std::string key;
+
+            // NULL for a built-in model that has not been used yet
+            PoreModel* model;
+
+            // constructs a built-in model, NULL for other models
+            PoreModel (*initialize)();
+
+            // the family of the model, see family_handles
+            int family;
+        };
+
         // Internal function for adding this model into the collection
         // Returns a reference to the model in the map
         PoreModel* register_model(const PoreModel& p);
 
+        // Returns the handle of the entry for the model, adding an empty
+        // entry if it does not exist. Must be called in the critical section
+        int register_entry(const std::string& kit_name,
+                           const std::string& alphabet,
+                           const std::string& strand,
+                           size_t k);
+
+        // index of the alphabet in alphabets, -1 if it is not there
+        int get_alphabet_index(const Alphabet* alphabet) const;
+        int get_alphabet_index(const std::string& alphabet) const;
+
         // Build a unique identify string
         static std::string get_model_key(const std::string& kit_name,
                                          const std::string& alphabet,
@@ -96,8 +149,18 @@ class PoreModelSet
         PoreModelSet(PoreModelSet const&) = delete;
         void operator=(PoreModelSet const&) = delete;
 
-        // map from a string key to a pointer to the actual model
-        std::map<std::string, PoreModel*> model_map;
+        // the models, indexed by handle. This has a capacity of MAX_PORE_MODELS
+        std::vector<ModelEntry> entries;
+
+        // map from a string key to the handle of the model
+        std::map<std::string, int> handle_map;
+
+        // models that only differ by alphabet are in the same family,
+        // family_handles[family * alphabets.size() + alphabet index] is the
+        // handle of the model for the alphabet, or -1. Its capacity is also fixed
+        std::map<std::string, int> family_map;
+        std::vector<int> family_handles;
+        std::vector<const Alphabet*> alphabets;
 };
 
 #endif
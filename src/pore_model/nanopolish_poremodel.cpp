@@ -24,7 +24,7 @@ void add_found_bases(char *known, const char *kmer) {
     return;
 }
 
-PoreModel::PoreModel(const std::string filename, const Alphabet *alphabet) : pmalphabet(alphabet)
+PoreModel::PoreModel(const std::string filename, const Alphabet *alphabet) : pmalphabet(alphabet), handle(-1)
 {
     model_filename = filename;
     std::ifstream model_reader(filename);
@@ -118,9 +118,10 @@ PoreModel::PoreModel(const std::string filename, const Alphabet *alphabet) : pma
         states[ pmalphabet->kmer_rank(iter.first.c_str(), k) ] = iter.second;
     }
     assert( ninserted == states.size() );
+    bake_gaussian_parameters();
 }
 
-PoreModel::PoreModel(fast5::File *f_p, const size_t strand, const std::string& bc_gr, const Alphabet *alphabet) : pmalphabet(alphabet)
+PoreModel::PoreModel(fast5::File *f_p, const size_t strand, const std::string& bc_gr, const Alphabet *alphabet) : pmalphabet(alphabet), handle(-1)
 {
     const size_t maxNucleotides=50;
     char bases[maxNucleotides+1]="";
@@ -151,6 +152,7 @@ PoreModel::PoreModel(fast5::File *f_p, const size_t strand, const std::string& b
     for (const auto &iter : kmers ) {
         states[ pmalphabet->kmer_rank(iter.first.c_str(), k) ] = iter.second;
     }
+    bake_gaussian_parameters();
 
     // Read and shorten the model name
     std::string temp_name = f_p->get_basecall_model_file(strand, bc_gr);
@@ -200,6 +202,31 @@ void PoreModel::update_states( const PoreModel &other )
 void PoreModel::update_states( const std::vector<PoreModelStateParams> &otherstates )
 {
     states = otherstates;
+    bake_gaussian_parameters();
+}
+
+void PoreModel::set_parameters(const uint32_t kmer_rank, const PoreModelStateParams& params)
+{
+    assert(kmer_rank < states.size() && level_mean.size() == states.size());
+    states[kmer_rank] = params;
+    level_mean[kmer_rank] = params.level_mean;
+    level_stdv[kmer_rank] = params.level_stdv;
+    level_log_stdv[kmer_rank] = params.level_log_stdv;
+}
+
+void PoreModel::bake_gaussian_parameters()
+{
+    size_t n = states.size();
+    level_mean.resize(n);
+    level_stdv.resize(n);
+    level_log_stdv.resize(n);
+
+    for(size_t i = 0; i < n; ++i) {
+        const PoreModelStateParams& s = states[i];
+        level_mean[i] = s.level_mean;
+        level_stdv[i] = s.level_stdv;
+        level_log_stdv[i] = s.level_log_stdv;
+    }
 }
 
 void PoreModel::set_metadata(const std::string& kit, const std::string& strand)
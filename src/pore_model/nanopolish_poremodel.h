@@ -82,7 +82,7 @@ struct PoreModelStateParams
 class PoreModel
 {
     public:
-        PoreModel(uint32_t _k=5) : k(_k), pmalphabet(&gDNAAlphabet) {}
+        PoreModel(uint32_t _k=5) : k(_k), pmalphabet(&gDNAAlphabet), handle(-1) {}
 
         // These constructors and the output routine take an alphabet 
         // so that kmers are inserted/written in order
@@ -95,13 +95,16 @@ class PoreModel
 
         void write(const std::string filename, const std::string modelname="") const;
 
-        inline PoreModelStateParams get_parameters(const uint32_t kmer_rank) const
+        inline const PoreModelStateParams& get_parameters(const uint32_t kmer_rank) const
         {
             return states[kmer_rank];
         }
         
         inline size_t get_num_states() const { return states.size(); }
 
+        // set the parameters of one k-mer, which must already have a state
+        void set_parameters(const uint32_t kmer_rank, const PoreModelStateParams& params);
+
         // update states with those given, or from another model
         void update_states( const PoreModel &other );
         void update_states( const std::vector<PoreModelStateParams> &otherstates );
@@ -121,6 +124,20 @@ class PoreModel
         uint32_t k;
         const Alphabet *pmalphabet; 
 
+        // the handle of this model in the PoreModelSet, -1 if it was not added to it
+        int handle;
+
+        // the level parameters of the states as contiguous float arrays indexed by k-mer
+        // rank, for the inner loops of the HMMs. They are kept in sync by the setters above
+        std::vector<float> level_mean;
+        std::vector<float> level_stdv;
+        std::vector<float> level_log_stdv;
+
+    private:
+
+        // Copy states into the float arrays above
+        void bake_gaussian_parameters();
+
         // model parameters, one per k-mer
         std::vector<PoreModelStateParams> states;
 };
@@ -7,10 +7,14 @@
 //
 #define CATCH_CONFIG_MAIN
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <string>
 #include <array>
 #include <vector>
 #include <random>
+#include <sstream>
+#include <algorithm>
 
 #include "logsum.h"
 #include "catch.hpp"
@@ -18,8 +22,20 @@
 #include "nanopolish_alphabet.h"
 #include "nanopolish_emissions.h"
 #include "nanopolish_profile_hmm.h"
+#include "nanopolish_hmm_input_sequence.h"
 #include "nanopolish_pore_model_set.h"
 #include "nanopolish_variant_db.h"
+#include "nanopolish_reference_db.h"
+#include "nanopolish_reorder_buffer.h"
+#include "nanopolish_text_format.h"
+#include "nanopolish_eventalign.h"
+#include "nanopolish_eventalign_binary.h"
+#include "nanopolish_indexed_output.h"
+#include "nanopolish_fast5_io.h"
+#include "nanopolish_anchor.h"
+#include "nanopolish_squiggle_read.h"
+#include "nanopolish_methyltrain.h"
+#include "nanopolish_raw_loader.h"
 #include "training_core.hpp"
 #include "invgauss.hpp"
 #include "logger.hpp"
@@ -233,7 +249,35 @@ TEST_CASE( "alphabet", "[alphabet]" ) {
     REQUIRE( dcm_alphabet.reverse_complement("CCTGG") == "CCAGG");
     REQUIRE( dcm_alphabet.reverse_complement("CMAGG") == "CMTGG");
     REQUIRE( dcm_alphabet.reverse_complement("CMTGG") == "CMAGG");
-    
+
+    // rolling k-mer ranks must match the ranks calculated one k-mer at a time
+    std::vector<std::pair<const Alphabet*, std::string>> rank_tests = {
+        { &dna_alphabet, "GATTACAGGCATTACGTACGATCGATTTTAAGCGCGCTAGT" },
+        { &mc_alphabet, mc_alphabet.methylate("GATTACAGGCATTACGTACGATCGATTTTAAGCGCGCTAGT") }
+    };
+
+    for(const auto& rank_test : rank_tests) {
+        const Alphabet* alphabet = rank_test.first;
+        const std::string& fwd = rank_test.second;
+        std::string rc = alphabet->reverse_complement(fwd);
+
+        for(uint32_t rk = 1; rk <= 6; ++rk) {
+            HMMInputSequence sequence(fwd, rc, alphabet);
+            HMMInputSequence cached_sequence(fwd, rc, alphabet);
+            cached_sequence.precompute_kmer_ranks(rk);
+            REQUIRE( cached_sequence.has_kmer_ranks(rk) );
+
+            std::vector<uint32_t> ranks;
+            alphabet->kmer_ranks(fwd, rk, ranks);
+            REQUIRE( ranks.size() == fwd.length() - rk + 1 );
+
+            for(size_t i = 0; i < ranks.size(); ++i) {
+                REQUIRE( ranks[i] == alphabet->kmer_rank(fwd.c_str() + i, rk) );
+                REQUIRE( cached_sequence.get_kmer_rank(i, rk, false) == sequence.get_kmer_rank(i, rk, false) );
+                REQUIRE( cached_sequence.get_kmer_rank(i, rk, true) == sequence.get_kmer_rank(i, rk, true) );
+            }
+        }
+    }
 }
 
 TEST_CASE( "string functions", "[string_functions]" ) {
@@ -264,6 +308,592 @@ TEST_CASE( "string functions", "[string_functions]" ) {
     REQUIRE( ends_with("abcd", "") );
 }
 
+TEST_CASE( "reference db", "[reference_db]" ) {
+    DNAAlphabet dna_alphabet;
+
+    // exercise word boundaries, runs of N, other ambiguity codes and lower case bases
+    std::string contig_seq = "ACGTACGTTTGACCAGTGACGTAGCATGCAGTNNNNNNNGATGAcgtaRYACGTTGCAGGCATTAGCGATN";
+    std::string expected = contig_seq;
+    std::transform(expected.begin(), expected.end(), expected.begin(), ::toupper);
+
+    ReferenceDB ref_db;
+    ref_db.add_contig("chr1", contig_seq);
+    ref_db.add_contig("chr2", "GATGA");
+
+    REQUIRE( ref_db.get_num_contigs() == 2 );
+    REQUIRE( ref_db.get_contig_id("chr2") == 1 );
+    REQUIRE( ref_db.get_contig_id("chr3") == -1 );
+    REQUIRE( ref_db.get_contig_length(0) == (int)contig_seq.length() );
+
+    int fetched_len = 0;
+    for(size_t start = 0; start < expected.length(); start += 3) {
+        for(size_t end = start; end < expected.length(); end += 5) {
+            std::string sub = ref_db.get_subsequence("chr1", start, end, &fetched_len);
+            REQUIRE( sub == expected.substr(start, end - start + 1) );
+            REQUIRE( fetched_len == (int)sub.length() );
+        }
+    }
+
+    // out-of-range end coordinates are clamped
+    REQUIRE( ref_db.get_subsequence("chr2", 2, 100, &fetched_len) == "TGA" );
+    REQUIRE( fetched_len == 3 );
+
+    // k-mer ranks match the alphabet and are rejected over non-ACGT bases
+    uint32_t rank = 0;
+    REQUIRE( ref_db.get_kmer_rank(1, 0, 5, rank) );
+    REQUIRE( rank == dna_alphabet.kmer_rank("GATGA", 5) );
+    REQUIRE( ref_db.get_kmer_rank(0, 4, 6, rank) );
+    REQUIRE( rank == dna_alphabet.kmer_rank(expected.c_str() + 4, 6) );
+    REQUIRE( ! ref_db.get_kmer_rank(0, 30, 5, rank) );
+    REQUIRE( ! ref_db.get_kmer_rank(0, 45, 6, rank) );
+    REQUIRE( ! ref_db.get_kmer_rank(1, 1, 5, rank) );
+
+    // contigs loaded from a fasta file are packed on first use, from any thread
+    char filename[] = "/tmp/nanopolish_test_XXXXXX";
+    int fd = mkstemp(filename);
+    REQUIRE( fd >= 0 );
+    std::string fasta = ">chr1\n" + contig_seq.substr(0, 40) + "\n" + contig_seq.substr(40) + "\n>chr2\nGATGA\n";
+    REQUIRE( write(fd, fasta.data(), fasta.size()) == (ssize_t)fasta.size() );
+    close(fd);
+
+    ReferenceDB fasta_db;
+    fasta_db.load(filename);
+    REQUIRE( fasta_db.get_num_contigs() == 2 );
+    REQUIRE( fasta_db.get_contig_length(0) == (int)contig_seq.length() );
+
+    std::vector<std::string> subsequences(8);
+    #pragma omp parallel for
+    for(size_t i = 0; i < subsequences.size(); ++i) {
+        int len = 0;
+        subsequences[i] = fasta_db.get_subsequence("chr1", i, expected.length() - 1, &len);
+    }
+    for(size_t i = 0; i < subsequences.size(); ++i) {
+        REQUIRE( subsequences[i] == expected.substr(i) );
+    }
+    REQUIRE( fasta_db.get_kmer_rank(1, 0, 5, rank) );
+    REQUIRE( rank == dna_alphabet.kmer_rank("GATGA", 5) );
+
+    remove(filename);
+    remove((std::string(filename) + ".fai").c_str());
+}
+
+TEST_CASE( "text format", "[text_format]" ) {
+    std::string out;
+    append_int(out, -42);
+    append_uint(out, 0);
+    REQUIRE( out == "-420" );
+
+    // the fast path and the printf fallback agree with printf
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> dist(-200.0, 200.0);
+    std::vector<double> values = { 0.0, -0.0, -0.001, 0.125, 2.675, 1e12, 1.0 / 0.0 };
+    for(size_t i = 0; i < 10000; ++i) {
+        values.push_back(dist(rng));
+    }
+
+    char expected[64];
+    for(double v : values) {
+        for(int precision = 0; precision <= 5; ++precision) {
+            out.clear();
+            append_fixed(out, v, precision);
+            snprintf(expected, sizeof(expected), "%.*f", precision, v);
+            REQUIRE( out == expected );
+        }
+    }
+}
+
+TEST_CASE( "reorder buffer", "[reorder_buffer]" ) {
+    FILE* fp = tmpfile();
+    REQUIRE( fp != NULL );
+    std::string calls;
+    {
+        ReorderBuffer buffer(2);
+
+        // reads finish out of order, read 2 is skipped and adds no output
+        buffer.add(1, fp, "b");
+        buffer.complete(1);
+        buffer.add(3, [&calls]() { calls += "d"; });
+        buffer.complete(3);
+        buffer.complete(2);
+        REQUIRE( calls.empty() );
+
+        // the window is full until read 0 is done, unless nothing before the range is pending
+        REQUIRE( ! buffer.has_space(4, 5) );
+        REQUIRE( buffer.has_space(0, 10) );
+
+        ReadOutputStream out;
+        fprintf(out.fp(), "%s", "a");
+        buffer.add(0, fp, out.release());
+        buffer.add(0, fp, "A");
+        buffer.complete(0);
+        REQUIRE( calls == "d" );
+        REQUIRE( buffer.has_space(4, 5) );
+        REQUIRE( buffer.get_max_pending() == 4 );
+    }
+
+    rewind(fp);
+    char text[16] = { 0 };
+    REQUIRE( fread(text, 1, sizeof(text) - 1, fp) == 3 );
+    REQUIRE( std::string(text) == "aAb" );
+    fclose(fp);
+}
+
+// read everything written to a temporary file
+static std::string read_tmpfile(FILE* fp)
+{
+    std::string text;
+    rewind(fp);
+    char buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        text.append(buffer, n);
+    }
+    return text;
+}
+
+TEST_CASE( "indexed output", "[indexed_output]" ) {
+    char filename[] = "/tmp/nanopolish_test_XXXXXX";
+    int fd = mkstemp(filename);
+    REQUIRE( fd >= 0 );
+    close(fd);
+
+    // reads are written in the order they finish, not by start
+    {
+        IndexedOutputWriter writer(filename);
+        writer.write_header("header\n");
+        writer.write("r0\n", "chr1", 100, 200);
+        writer.write("r1\n", "chr2", 0, 50);
+        writer.write("r2\n", "chr1", 10, 1000);
+        writer.write("", "chr1", 10, 20);
+        writer.write("r3\n", "chr1", 300, 400);
+        writer.write("r4\n", "chr1", 150, 160);
+        writer.close();
+    }
+
+    IndexedOutputReader reader(filename);
+    auto query = [&reader](const std::vector<std::string>& contigs, const std::vector<int>& starts, const std::vector<int>& ends) {
+        FILE* fp = tmpfile();
+        reader.write_regions(fp, contigs, starts, ends);
+        std::string text = read_tmpfile(fp);
+        fclose(fp);
+        return text;
+    };
+
+    FILE* fp = tmpfile();
+    reader.write_header(fp);
+    reader.write_region(fp, "chr1", 210, 250);
+    REQUIRE( read_tmpfile(fp) == "header\nr2\n" );
+    fclose(fp);
+
+    // the long read r2 starts well before the region, the bounds are inclusive
+    REQUIRE( query({ "chr1" }, { 200 }, { 300 }) == "r0\nr2\nr3\n" );
+    REQUIRE( query({ "chr1" }, { 1001 }, { 2000 }) == "" );
+    REQUIRE( query({ "chr3" }, { 0 }, { 100 }) == "" );
+
+    // reads that overlap several regions are written once, in file order
+    REQUIRE( query({ "chr1", "chr2", "chr1" }, { 155, 40, 100 }, { 155, 60, 120 }) == "r0\nr1\nr2\nr4\n" );
+
+    remove(filename);
+    remove((std::string(filename) + ".gzi").c_str());
+    remove((std::string(filename) + INDEXED_OUTPUT_SUFFIX).c_str());
+}
+
+TEST_CASE( "eventalign binary", "[eventalign_binary]" ) {
+    EventalignBinaryBlock block;
+    block.k = 6;
+
+    // kmers with bases outside the alphabet are stored once as strings
+    uint32_t c0 = block.encode_kmer(&gDNAAlphabet, "ACGTAC");
+    uint32_t c1 = block.encode_kmer(&gDNAAlphabet, "NNNNNN");
+    uint32_t c2 = block.encode_kmer(&gDNAAlphabet, "NNNNNN");
+    REQUIRE( c0 == gDNAAlphabet.kmer_rank("ACGTAC", 6) );
+    REQUIRE( c1 == c2 );
+    REQUIRE( block.strings.size() == 1 );
+
+    std::string kmer;
+    block.decode_kmer(&gDNAAlphabet, c0, kmer);
+    REQUIRE( kmer == "ACGTAC" );
+    block.decode_kmer(&gDNAAlphabet, c1, kmer);
+    REQUIRE( kmer == "NNNNNN" );
+
+    block.records.resize(3);
+    block.records[0].ref_position = 12;
+    block.records[1].ref_position = 10;
+    block.records[2].ref_position = 15;
+    int32_t start, end;
+    block.get_reference_span(start, end);
+    REQUIRE( start == 10 );
+    REQUIRE( end == 15 );
+}
+
+// a block of one record for each reference position
+static EventalignBinaryBlock make_binary_block(uint64_t read_idx, const std::string& contig, int start, int n)
+{
+    EventalignBinaryBlock block;
+    block.read_idx = read_idx;
+    block.k = 6;
+    block.read_name = "read" + std::to_string(read_idx);
+    block.contig = contig;
+    block.alphabet_name = gDNAAlphabet.get_name();
+    block.shift = 10.0;
+    block.scale = 2.0;
+    block.var = 1.5;
+    block.records.resize(n);
+    for(int i = 0; i < n; ++i) {
+        EventalignBinaryRecord& record = block.records[i];
+        record.ref_position = start + i;
+        record.event_idx = i;
+        record.ref_kmer = i;
+        record.model_kmer = i;
+        record.event_level_mean = 100.0f + i;
+        record.event_stdv = 1.0f;
+        record.event_length = 0.002f;
+        block.signal_idx.push_back(10 * i);
+        block.signal_idx.push_back(10 * i + 10);
+    }
+    return block;
+}
+
+TEST_CASE( "eventalign binary round trip", "[eventalign_binary]" ) {
+    const PoreModel* pore_model = PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    REQUIRE( pore_model != NULL );
+
+    char filename[] = "/tmp/nanopolish_test_XXXXXX";
+    int fd = mkstemp(filename);
+    REQUIRE( fd >= 0 );
+    close(fd);
+
+    // the last record of the first block is a background event, which has no model level
+    std::vector<EventalignBinaryBlock> blocks = { make_binary_block(0, "chr1", 100, 5),
+                                                  make_binary_block(1, "chr2", 50, 3),
+                                                  make_binary_block(2, "chr1", 200, 4) };
+    blocks[0].model_id = pore_model->handle;
+    blocks[0].records[4].model_kmer = blocks[0].encode_string_kmer("ACGTAC");
+    blocks[1].model_id = pore_model->handle;
+    blocks[2].model_id = pore_model->handle;
+    {
+        FILE* fp = fopen(filename, "wb");
+        REQUIRE( fp != NULL );
+        EventalignBinaryWriter writer(fp, EVENTALIGN_BINARY_FLAG_SIGNAL_INDEX);
+        for(const EventalignBinaryBlock& block : blocks) {
+            std::string data;
+            EventalignBinaryWriter::serialize(block, data);
+            int32_t ref_start, ref_end;
+            block.get_reference_span(ref_start, ref_end);
+            writer.write(data, pore_model, block.read_idx, block.contig, ref_start, ref_end);
+        }
+        writer.finish();
+        fclose(fp);
+    }
+
+    // every block comes back in order, with the model values derived from the scalings
+    {
+        EventalignBinaryReader reader(filename);
+        REQUIRE( reader.get_flags() == EVENTALIGN_BINARY_FLAG_SIGNAL_INDEX );
+
+        EventalignBinaryBlock block;
+        for(const EventalignBinaryBlock& expected : blocks) {
+            REQUIRE( reader.read_block(block) );
+            REQUIRE( block.read_idx == expected.read_idx );
+            REQUIRE( block.read_name == expected.read_name );
+            REQUIRE( block.contig == expected.contig );
+            REQUIRE( block.model_id == expected.model_id );
+            REQUIRE( block.scale == expected.scale );
+            REQUIRE( block.strings == expected.strings );
+            REQUIRE( block.signal_idx == expected.signal_idx );
+            REQUIRE( block.records.size() == expected.records.size() );
+            REQUIRE( memcmp(block.records.data(), expected.records.data(), block.records.size() * sizeof(EventalignBinaryRecord)) == 0 );
+        }
+        REQUIRE( ! reader.read_block(block) );
+
+        EventAlignmentValues values = reader.get_values(blocks[0], blocks[0].records[1]);
+        float model_mean = 2.0 * pore_model->level_mean[1] + 10.0;
+        float model_stdv = pore_model->level_stdv[1] * 1.5;
+        REQUIRE( values.event_level_mean == 101.0f );
+        REQUIRE( values.model_mean == model_mean );
+        REQUIRE( values.model_stdv == model_stdv );
+        REQUIRE( values.standardized_level == (float)((101.0f - model_mean) / (sqrt(1.5) * model_stdv)) );
+
+        values = reader.get_values(blocks[0], blocks[0].records[4]);
+        REQUIRE( values.model_mean == 0.0f );
+        REQUIRE( values.model_stdv == 0.0f );
+    }
+
+    // the footer index finds the blocks that overlap a region, and loads the models
+    {
+        EventalignBinaryReader reader(filename);
+        EventalignBinaryBlock block;
+        reader.set_region("chr1", 104, 200);
+        REQUIRE( reader.read_block(block) );
+        REQUIRE( block.read_idx == 0 );
+        REQUIRE( reader.read_block(block) );
+        REQUIRE( block.read_idx == 2 );
+        REQUIRE( reader.get_values(block, block.records[0]).model_mean == (float)(2.0 * pore_model->level_mean[0] + 10.0) );
+        REQUIRE( ! reader.read_block(block) );
+
+        reader.set_region("chr2", 53, 60);
+        REQUIRE( ! reader.read_block(block) );
+        reader.set_region("chr3", 0, 1000);
+        REQUIRE( ! reader.read_block(block) );
+        reader.set_region("chr2", 0, 50);
+        REQUIRE( reader.read_block(block) );
+        REQUIRE( block.read_idx == 1 );
+    }
+    remove(filename);
+}
+
+// split the lines of tab-separated text into fields
+static std::vector<std::vector<std::string>> split_tsv(const std::string& text)
+{
+    std::vector<std::vector<std::string>> rows;
+    std::istringstream lines(text);
+    std::string line;
+    while(std::getline(lines, line)) {
+        rows.push_back(split(line, '\t'));
+    }
+    return rows;
+}
+
+TEST_CASE( "eventalign collapse and pileup", "[eventalign]" ) {
+
+    SquiggleRead sr;
+    sr.base_model[0] = PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    sr.scalings[0].set4(0.0, 1.0, 0.0, 1.0);
+    sr.events[0].set_sample_rate(4000.0);
+    sr.events[0].push_back(80.0, 1.0, 0, 4);
+    sr.events[0].push_back(90.0, 1.0, 4, 4);
+    sr.events[0].push_back(70.0, 1.0, 8, 8);
+
+    EventAlignmentParameters params;
+    params.sr = &sr;
+    params.strand_idx = 0;
+
+    // the first two events are aligned to position 10, the last to 11
+    std::vector<EventAlignment> alignments(3);
+    const char* kmers[] = { "AACGTA", "AACGTA", "ACGTAC" };
+    for(size_t i = 0; i < alignments.size(); ++i) {
+        EventAlignment& ea = alignments[i];
+        ea.read_idx = 7;
+        ea.alphabet = &gDNAAlphabet;
+        ea.ref_position = i == 0 ? 10 : 9 + i;
+        ea.ref_id = intern_ref_name("ctgA");
+        ea.ref_kmer_rank = gDNAAlphabet.kmer_rank(kmers[i], 6);
+        ea.model_kmer_rank = ea.ref_kmer_rank;
+        ea.event_idx = i;
+        ea.strand_idx = 0;
+        ea.k = 6;
+        ea.rc = false;
+        ea.hmm_state = i == 1 ? 'E' : 'M';
+    }
+
+    // the run of events at position 10 is merged into one row, weighted by duration
+    std::string out;
+    format_collapsed_event_alignment_tsv(out, sr, 0, params, alignments);
+    std::vector<std::vector<std::string>> rows = split_tsv(out);
+    REQUIRE( rows.size() == 2 );
+    REQUIRE( rows[0][0] == "ctgA" );
+    REQUIRE( rows[0][1] == "10" );
+    REQUIRE( rows[0][2] == "AACGTA" );
+    REQUIRE( rows[0][3] == "7" );
+    REQUIRE( rows[0][5] == "0" );
+    REQUIRE( rows[0][6] == "85.00" );
+    REQUIRE( rows[0][7] == "5.099" );
+    REQUIRE( rows[0][8] == "0.00200" );
+    REQUIRE( rows[0].back() == "2" );
+    REQUIRE( rows[1][1] == "11" );
+    REQUIRE( rows[1][5] == "2" );
+    REQUIRE( rows[1][6] == "70.00" );
+    REQUIRE( rows[1].back() == "1" );
+
+    // a background event at position 11 has no model level and stays out of the pileup
+    sr.events[0].push_back(120.0, 1.0, 16, 4);
+    alignments.push_back(alignments.back());
+    alignments.back().event_idx = 3;
+    alignments.back().hmm_state = 'B';
+
+    std::map<int, EventalignPileupColumn> columns;
+    add_event_alignment_to_pileup(columns, sr, 0, params, alignments);
+    REQUIRE( columns.size() == 2 );
+    REQUIRE( columns[10].num_reads == 1 );
+    REQUIRE( columns[10].num_events == 2 );
+    REQUIRE( columns[10].ref_kmer == "AACGTA" );
+    REQUIRE( columns[11].num_events == 1 );
+    REQUIRE( columns[11].sum_level == Approx(70.0) );
+    REQUIRE( std::isfinite(columns[11].sum_standardized_level) );
+
+    // positions are written once a read starting after them is added
+    EventalignPileup pileup;
+    out.clear();
+    pileup.add("ctgA", 10, columns, out);
+    pileup.add("ctgA", 10, columns, out);
+    REQUIRE( out.empty() );
+    REQUIRE( pileup.size() == 2 );
+
+    pileup.add("ctgA", 11, std::map<int, EventalignPileupColumn>(), out);
+    rows = split_tsv(out);
+    REQUIRE( rows.size() == 1 );
+    REQUIRE( rows[0][0] == "ctgA" );
+    REQUIRE( rows[0][1] == "10" );
+    REQUIRE( rows[0][2] == "AACGTA" );
+    REQUIRE( rows[0][3] == "2" );
+    REQUIRE( rows[0][4] == "4" );
+    REQUIRE( rows[0][5] == "85.00" );
+    REQUIRE( rows[0][6] == "5.000" );
+    REQUIRE( rows[0][7] == "0.00200" );
+    REQUIRE( pileup.size() == 1 );
+
+    // a new contig completes the previous one
+    out.clear();
+    pileup.add("ctgB", 0, columns, out);
+    rows = split_tsv(out);
+    REQUIRE( rows.size() == 1 );
+    REQUIRE( rows[0][0] == "ctgA" );
+    REQUIRE( rows[0][1] == "11" );
+    REQUIRE( rows[0][3] == "2" );
+    REQUIRE( rows[0][5] == "70.00" );
+    REQUIRE( rows[0][8] != "inf" );
+
+    out.clear();
+    pileup.flush(out);
+    rows = split_tsv(out);
+    REQUIRE( rows.size() == 2 );
+    REQUIRE( rows[0][0] == "ctgB" );
+    REQUIRE( rows[1][1] == "11" );
+    REQUIRE( pileup.size() == 0 );
+}
+
+TEST_CASE( "event detection", "[event_detection]" ) {
+
+    // a noisy step signal in ADC units
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 6.0f);
+    std::vector<int16_t> int_samples;
+    for(size_t i = 0; i < 20000; ++i) {
+        int level = 400 + 80 * ((i / 37) % 5);
+        int_samples.push_back(level + (int)noise(rng));
+    }
+
+    float offset = 4.0f;
+    float raw_unit = 1400.0f / 8192.0f;
+    std::vector<float> pa_samples(int_samples.size());
+    for(size_t i = 0; i < int_samples.size(); ++i) {
+        pa_samples[i] = fast5_raw_to_pA(int_samples[i], offset, raw_unit);
+    }
+
+    // detecting on the ADC values must give exactly the same events as on pA
+    raw_table rt = { pa_samples.size(), 0, pa_samples.size(), pa_samples.data() };
+    event_table et_float = detect_events(rt, event_detection_defaults);
+    event_table et_int16 = detect_events_int16(int_samples.data(), int_samples.size(), offset, raw_unit, event_detection_defaults);
+
+    REQUIRE( et_float.n > 100 );
+    REQUIRE( et_int16.n == et_float.n );
+    for(size_t i = 0; i < et_float.n; ++i) {
+        REQUIRE( et_int16.event[i].start == et_float.event[i].start );
+        REQUIRE( et_int16.event[i].length == et_float.event[i].length );
+        REQUIRE( et_int16.event[i].mean == et_float.event[i].mean );
+        REQUIRE( et_int16.event[i].stdv == et_float.event[i].stdv );
+    }
+
+    // streaming the signal in uneven chunks must not change the events either
+    event_detector* detector = event_detector_create(event_detection_defaults);
+    for(size_t start = 0, chunk = 1; start < int_samples.size(); start += chunk, chunk = chunk * 3 + 1) {
+        chunk = std::min(chunk, int_samples.size() - start);
+        event_detector_add_raw_int16(detector, int_samples.data() + start, chunk, offset, raw_unit);
+    }
+    event_table et_streamed = event_detector_finish(detector);
+
+    REQUIRE( et_streamed.n == et_float.n );
+    for(size_t i = 0; i < et_float.n; ++i) {
+        REQUIRE( et_streamed.event[i].start == et_float.event[i].start );
+        REQUIRE( et_streamed.event[i].length == et_float.event[i].length );
+        REQUIRE( et_streamed.event[i].mean == et_float.event[i].mean );
+        REQUIRE( et_streamed.event[i].stdv == et_float.event[i].stdv );
+    }
+    free(et_float.event);
+    free(et_int16.event);
+    free(et_streamed.event);
+}
+
+TEST_CASE( "read ranges", "[read_range]" ) {
+
+    // 5 bases starting at blocks 0, 2, 3, 6 and 8
+    fast5_basecall_moves bm;
+    bm.first_sample = 100;
+    bm.stride = 5;
+    bm.moves = { 1, 0, 1, 1, 0, 0, 1, 0, 1, 0 };
+    size_t padding = RANGE_MARGIN_BLOCKS * bm.stride;
+    size_t sample_start, sample_end;
+
+    // the first bases start at the beginning of the signal
+    REQUIRE( get_sample_range_for_bases(bm, 0, 2, sample_start, sample_end) );
+    REQUIRE( sample_start == 0 );
+    REQUIRE( sample_end == 100 + 3 * 5 + padding );
+
+    REQUIRE( get_sample_range_for_bases(bm, 2, 4, sample_start, sample_end) );
+    REQUIRE( sample_start == 100 + 3 * 5 - padding );
+    REQUIRE( sample_end == 100 + 8 * 5 + padding );
+
+    // the last bases run to the end of the signal
+    REQUIRE( get_sample_range_for_bases(bm, 3, 5, sample_start, sample_end) );
+    REQUIRE( sample_start == 100 + 6 * 5 - padding );
+    REQUIRE( sample_end == SIZE_MAX );
+
+    REQUIRE( !get_sample_range_for_bases(bm, 5, 6, sample_start, sample_end) );
+
+    // the padding stops at the first sample
+    bm.first_sample = 0;
+    REQUIRE( get_sample_range_for_bases(bm, 1, 2, sample_start, sample_end) );
+    REQUIRE( sample_start == 0 );
+
+    // a record with clipped and inserted bases, only the fields used by the cigar functions are set
+    std::vector<uint32_t> cigar = { 10 << BAM_CIGAR_SHIFT | BAM_CHARD_CLIP,
+                                    5 << BAM_CIGAR_SHIFT | BAM_CSOFT_CLIP,
+                                    20 << BAM_CIGAR_SHIFT | BAM_CMATCH,
+                                    2 << BAM_CIGAR_SHIFT | BAM_CINS,
+                                    10 << BAM_CIGAR_SHIFT | BAM_CMATCH,
+                                    3 << BAM_CIGAR_SHIFT | BAM_CHARD_CLIP };
+    bam1_t record;
+    memset(&record, 0, sizeof(record));
+    record.core.pos = 100;
+    record.core.n_cigar = cigar.size();
+    record.data = (uint8_t*)cigar.data();
+    record.l_data = cigar.size() * sizeof(uint32_t);
+
+    // record positions 15-24 and 27-28 are aligned to the region
+    SquiggleReadRange forward = get_read_range_for_ref_region(&record, 110, 121);
+    REQUIRE( forward.start == 15 );
+    REQUIRE( forward.end == 29 );
+
+    // the read has 50 bases, flip the range to the strand that was sequenced
+    record.core.flag = BAM_FREVERSE;
+    SquiggleReadRange reverse = get_read_range_for_ref_region(&record, 110, 121);
+    REQUIRE( reverse.start == 21 );
+    REQUIRE( reverse.end == 35 );
+
+    // a partial load covers every base the event aligner looks up for the region, on both strands
+    const int read_length = 50;
+    for(int rc = 0; rc < 2; ++rc) {
+        record.core.flag = rc ? BAM_FREVERSE : 0;
+        SquiggleReadRange range = get_read_range_for_ref_region(&record, 110, 121);
+        size_t n_pairs = 0;
+        for(const AlignedSegment& segment : get_aligned_segments(&record)) {
+            for(const AlignedPair& ap : segment) {
+                if(ap.ref_pos < 110 || ap.ref_pos > 121) {
+                    continue;
+                }
+                int read_pos = rc ? read_length - ap.read_pos - 1 : ap.read_pos;
+                REQUIRE( read_pos >= range.start );
+                REQUIRE( read_pos < range.end );
+                n_pairs += 1;
+            }
+        }
+        REQUIRE( n_pairs == 12 );
+    }
+
+    REQUIRE( !get_read_range_for_ref_region(&record, 200, 300).is_set() );
+    REQUIRE( !get_read_range_for_ref_region(&record, -1, -1).is_set() );
+}
+
 TEST_CASE( "math", "[math]") {
     GaussianParameters params;
     params.mean = 4;
@@ -274,6 +904,34 @@ TEST_CASE( "math", "[math]") {
     REQUIRE( log_normal_pdf(2.25, params) == Approx(log(normal_pdf(2.25, params))) );
 }
 
+TEST_CASE( "pore model set", "[pore_model]") {
+
+    int handle = PoreModelSet::get_model_handle("r9.4_450bps", "nucleotide", "template", 6);
+    REQUIRE( handle != -1 );
+    REQUIRE( PoreModelSet::get_model_handle("r9.4_450bps", "nucleotide", "template", 7) == -1 );
+    REQUIRE( PoreModelSet::get_model(-1) == NULL );
+
+    // the handle and string lookups give the same model, which knows its handle
+    const PoreModel* pore_model = PoreModelSet::get_model(handle);
+    REQUIRE( pore_model != NULL );
+    REQUIRE( pore_model == PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6) );
+    REQUIRE( pore_model->handle == handle );
+    REQUIRE( PoreModelSet::get_model_key(*pore_model) == "r9.4_450bps.nucleotide.6mer.template" );
+
+    // switching alphabets keeps the kit, strand and k
+    int cpg_handle = PoreModelSet::get_model_handle(handle, &gMCpGAlphabet);
+    REQUIRE( cpg_handle == PoreModelSet::get_model_handle("r9.4_450bps", "cpg", "template", 6) );
+    REQUIRE( cpg_handle == PoreModelSet::get_model_handle(handle, "cpg") );
+    REQUIRE( PoreModelSet::get_model_handle(cpg_handle, &gDNAAlphabet) == handle );
+    REQUIRE( PoreModelSet::get_model_handle(handle, &gUtoTRNAAlphabet) == -1 );
+    REQUIRE( PoreModelSet::get_model(cpg_handle)->pmalphabet == &gMCpGAlphabet );
+
+    SquiggleRead sr;
+    sr.base_model[0] = pore_model;
+    REQUIRE( sr.get_model(0, &gMCpGAlphabet) == PoreModelSet::get_model(cpg_handle) );
+    REQUIRE( sr.get_model(0, "cpg") == PoreModelSet::get_model(cpg_handle) );
+}
+
 TEST_CASE( "scalings", "[scalings]") {
 
     SquiggleRead test_read;
@@ -293,10 +951,11 @@ TEST_CASE( "scalings", "[scalings]") {
 
     std::vector<float> lp_truth;
     std::vector<float> z_truth;
+    test_read.events[0].set_sample_rate(4000.0);
 
     for(size_t i = 0; i < n_events; ++i) {
 
-        PoreModelStateParams params = pore_model->states[rank];
+        PoreModelStateParams params = pore_model->get_parameters(rank);
         SquiggleEvent event;
         event.stdv = 1.0f; //unused
         event.start_time = (i * duration);
@@ -324,6 +983,53 @@ TEST_CASE( "scalings", "[scalings]") {
     }
 }
 
+TEST_CASE( "scalings fit", "[scalings]") {
+
+    const PoreModel* pore_model = PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    SquiggleScalings truth;
+    truth.set4(10.0, 1.2, 0.5, 1.3);
+
+    // Generate events for random k-mers and fit the scalings back from them
+    std::default_random_engine generator;
+    std::uniform_int_distribution<uint32_t> rank_distribution(0, pore_model->get_num_states() - 1);
+    ScalingsFitter fitter(true);
+    ScalingsFitter no_drift_fitter(false);
+    double sum_sq_z = 0.0;
+    size_t n_events = 10000;
+    for(size_t i = 0; i < n_events; ++i) {
+        const PoreModelStateParams& params = pore_model->get_parameters(rank_distribution(generator));
+        double time = i * 10.0 / 4000.0;
+        double g_mean = truth.shift + truth.scale * params.level_mean + time * truth.drift;
+        double g_stdv = truth.var * params.level_stdv;
+        std::normal_distribution<double> distribution(g_mean, g_stdv);
+        double level = distribution(generator);
+        sum_sq_z += pow((level - g_mean) / params.level_stdv, 2.0);
+        fitter.add(level, time, params);
+        no_drift_fitter.add(level - time * truth.drift, 0.0, params);
+    }
+    REQUIRE(fitter.get_num_events() == n_events);
+
+    SquiggleScalings fit;
+    REQUIRE(fitter.solve(true, fit));
+    REQUIRE(fit.shift == Approx(truth.shift).epsilon(0.05));
+    REQUIRE(fit.scale == Approx(truth.scale).epsilon(0.01));
+    REQUIRE(fit.drift == Approx(truth.drift).epsilon(0.05));
+    REQUIRE(fit.var == Approx(truth.var).epsilon(0.02));
+
+    // the residual from the normal equations is the residual of the fit, which
+    // is a little smaller than that of the true scalings
+    REQUIRE(fit.var <= sqrt(sum_sq_z / n_events));
+
+    REQUIRE(no_drift_fitter.solve(false, fit));
+    REQUIRE(fit.scale == Approx(truth.scale).epsilon(0.01));
+    REQUIRE(fit.drift == 0.0);
+    REQUIRE(fit.var == 1.0);
+
+    // too few events to fit
+    ScalingsFitter empty_fitter(false);
+    REQUIRE(!empty_fitter.solve(true, fit));
+}
+
 size_t factorial(size_t n)
 {
     if(n == 0 || n == 1) {
@@ -350,6 +1056,86 @@ void test_combinations(size_t n, size_t k, CombinationOption option, std::vector
     REQUIRE(idx == expected.size());
 }
 
+TEST_CASE( "recalibrate from aligned pairs", "[scalings]") {
+
+    const PoreModel* pore_model = PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    REQUIRE(pore_model != NULL);
+
+    // homopolymers give runs of the same k-mer
+    std::default_random_engine generator(3);
+    std::string sequence;
+    for(size_t i = 0; i < 600; ++i) {
+        sequence.append(i % 100 == 50 ? "AAAAAAAAAA" : std::string(1, "ACGT"[generator() % 4]));
+    }
+    std::vector<uint32_t> kmer_ranks;
+    pore_model->pmalphabet->kmer_ranks(sequence, pore_model->k, kmer_ranks);
+    size_t n_kmers = kmer_ranks.size();
+
+    // 0 to 3 events per k-mer, with events on the boundary of two k-mers aligned to both
+    SquiggleRead sr;
+    sr.events[0].set_sample_rate(4000.0);
+    std::vector<AlignedPair> event_alignment;
+    for(size_t ki = 0; ki < n_kmers; ++ki) {
+        size_t n = generator() % 4;
+        if(n > 0 && !sr.events[0].empty() && generator() % 3 == 0) {
+            event_alignment.push_back({ (int)ki, (int)sr.events[0].size() - 1 });
+        }
+        for(size_t j = 0; j < n; ++j) {
+            SquiggleEvent event;
+            event.mean = 1.1 * pore_model->level_mean[kmer_ranks[ki]] + 5.0 + (int)(generator() % 11) - 5;
+            event.stdv = 1.0f;
+            event.start_time = sr.events[0].size() * 0.002f;
+            event.duration = 0.002f;
+            event_alignment.push_back({ (int)ki, (int)sr.events[0].size() });
+            sr.events[0].push_back(event);
+        }
+    }
+    REQUIRE(event_alignment.front().read_pos == 0);
+
+    // the map from k-mers to events, as SquiggleRead builds it from the alignment
+    std::vector<EventRangeForBase> base_to_event_map(n_kmers);
+    int prev_event_idx = -1;
+    for(const AlignedPair& ap : event_alignment) {
+        IndexPair& elem = base_to_event_map[ap.ref_pos].indices[0];
+        if(ap.read_pos != prev_event_idx) {
+            if(elem.start == -1) {
+                elem.start = ap.read_pos;
+            }
+            elem.stop = ap.read_pos;
+        }
+        prev_event_idx = ap.read_pos;
+    }
+
+    // both alignments fit the scalings to the same events in the same order
+    std::vector<EventAlignment> alignment_1d =
+        sr.get_eventalignment_for_1d_basecalls(sequence, "nucleotide", base_to_event_map, pore_model->k, 0, 0);
+    for(bool scale_drift : { false, true }) {
+        REQUIRE(recalibrate_model(sr, *pore_model, 0, alignment_1d, true, scale_drift));
+        SquiggleScalings expected = sr.scalings[0];
+        sr.scalings[0].set4(0.0, 1.0, 0.0, 1.0);
+
+        REQUIRE(recalibrate_model(sr, *pore_model, 0, event_alignment, kmer_ranks, true, scale_drift));
+        REQUIRE(sr.scalings[0].shift == expected.shift);
+        REQUIRE(sr.scalings[0].scale == expected.scale);
+        REQUIRE(sr.scalings[0].drift == expected.drift);
+        REQUIRE(sr.scalings[0].var == expected.var);
+        REQUIRE(sr.scalings[0].scale == Approx(1.1).epsilon(0.05));
+
+        // a cap above the number of events uses all of them
+        sr.scalings[0].set4(0.0, 1.0, 0.0, 1.0);
+        REQUIRE(recalibrate_model(sr, *pore_model, 0, event_alignment, kmer_ranks, true, scale_drift, event_alignment.size()));
+        REQUIRE(sr.scalings[0].shift == expected.shift);
+        REQUIRE(sr.scalings[0].scale == expected.scale);
+
+        // a lower cap fits to every other event, which gives nearly the same scalings
+        sr.scalings[0].set4(0.0, 1.0, 0.0, 1.0);
+        REQUIRE(recalibrate_model(sr, *pore_model, 0, event_alignment, kmer_ranks, true, scale_drift, (event_alignment.size() + 1) / 2));
+        REQUIRE(sr.scalings[0].shift != expected.shift);
+        REQUIRE(sr.scalings[0].scale == Approx(expected.scale).epsilon(0.02));
+        REQUIRE(fabs(sr.scalings[0].shift - expected.shift) < 2.0);
+    }
+}
+
 TEST_CASE( "combinations", "[combinations]") {
     test_combinations(1, 1, CO_WITHOUT_REPLACEMENT, {"0"});
     test_combinations(2, 1, CO_WITHOUT_REPLACEMENT, { "0", "1" });
@@ -452,6 +1238,116 @@ TEST_CASE( "hmm", "[hmm]") {
     }
 }
 
+TEST_CASE( "banded hmm", "[hmm]") {
+
+    // simulate events for a random sequence from the r9.4 model
+    SquiggleRead sr;
+    sr.pore_type = PT_R9;
+    sr.base_model[0] = PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    sr.scalings[0].set4(0.0, 1.0, 0.0, 1.0);
+    sr.events[0].set_sample_rate(4000.0);
+    const PoreModel* pore_model = sr.base_model[0];
+    REQUIRE(pore_model != NULL);
+
+    std::default_random_engine generator(7);
+    std::string sequence;
+    for(size_t i = 0; i < 500; ++i) {
+        sequence.append(1, "ACGT"[generator() % 4]);
+    }
+    HMMInputSequence hmm_sequence(sequence);
+
+    // 0 to 3 events per kmer, the seed is off by up to 10 events
+    size_t n_kmers = sequence.size() - pore_model->k + 1;
+    std::vector<int> kmer_seed_rows(n_kmers);
+    for(size_t ki = 0; ki < n_kmers; ++ki) {
+        size_t n = ki == 0 || ki == n_kmers - 1 ? 1 : generator() % 4;
+        int noise = ki == 0 ? 0 : (int)(generator() % 21) - 10;
+        kmer_seed_rows[ki] = std::max(ki == 0 ? 0 : kmer_seed_rows[ki - 1], (int)sr.events[0].size() + noise);
+
+        PoreModelStateParams params = pore_model->get_parameters(hmm_sequence.get_kmer_rank(ki, pore_model->k, false));
+        std::normal_distribution<float> distribution(params.level_mean, params.level_stdv);
+        for(size_t j = 0; j < n; ++j) {
+            SquiggleEvent event;
+            event.mean = distribution(generator);
+            event.stdv = 1.0f;
+            event.start_time = 0.0f;
+            event.duration = 0.002f;
+            sr.events[0].push_back(event);
+        }
+    }
+    sr.events_per_base[0] = (double)sr.events[0].size() / n_kmers;
+
+    HMMInputData input;
+    input.read = &sr;
+    input.pore_model = pore_model;
+    input.event_start_idx = 0;
+    input.event_stop_idx = sr.events[0].size() - 1;
+    input.event_stride = 1;
+    input.rc = false;
+    input.strand = 0;
+
+    // the band follows the best path so the alignment is the same as with the full matrix
+    std::vector<HMMAlignmentState> full = profile_hmm_align(hmm_sequence, input);
+    std::vector<HMMAlignmentState> banded = profile_hmm_align_banded(hmm_sequence, input, kmer_seed_rows);
+    REQUIRE(banded.size() == full.size());
+    for(size_t i = 0; i < full.size(); ++i) {
+        REQUIRE(banded[i].event_idx == full[i].event_idx);
+        REQUIRE(banded[i].kmer_idx == full[i].kmer_idx);
+        REQUIRE(banded[i].state == full[i].state);
+    }
+    REQUIRE(banded.back().l_fm == Approx(full.back().l_fm));
+}
+
+TEST_CASE( "adaptive banded event alignment", "[raw_loader]") {
+
+    // 1 to 3 events per kmer of a random sequence, with the generator and noise spelled
+    // out so that the events, and the expected alignment, are the same on every platform
+    SquiggleRead sr;
+    sr.pore_type = PT_R9;
+    sr.scalings[0].set4(0.0, 1.0, 0.0, 1.0);
+    sr.events[0].set_sample_rate(4000.0);
+    const PoreModel* pore_model = PoreModelSet::get_model("r9.4_450bps", "nucleotide", "template", 6);
+    REQUIRE(pore_model != NULL);
+
+    std::minstd_rand generator(11);
+    std::string sequence;
+    for(size_t i = 0; i < 200; ++i) {
+        sequence.append(1, "ACGT"[generator() % 4]);
+    }
+    HMMInputSequence hmm_sequence(sequence);
+
+    size_t n_kmers = sequence.size() - pore_model->k + 1;
+    for(size_t ki = 0; ki < n_kmers; ++ki) {
+        size_t n = 1 + generator() % 3;
+        uint32_t rank = hmm_sequence.get_kmer_rank(ki, pore_model->k, false);
+        for(size_t j = 0; j < n; ++j) {
+            SquiggleEvent event;
+            event.mean = pore_model->level_mean[rank] + pore_model->level_stdv[rank] * ((int)(generator() % 401) - 200) / 100.0f;
+            event.stdv = 1.0f;
+            event.start_time = 0.0f;
+            event.duration = 0.002f;
+            sr.events[0].push_back(event);
+        }
+    }
+
+    // every event is aligned, this is the number of events aligned to each kmer
+    const std::string expected_events_per_kmer =
+        "12213232114123121423322212131143131231332123121221132123121223311112312113212132212212132131221123132213213231312241111323332132213132"
+        "4122221231231213323113223312113121122321221333213211232111121";
+
+    std::vector<AlignedPair> alignment = adaptive_banded_simple_event_align(sr, *pore_model, sequence);
+    REQUIRE(alignment.size() == sr.events[0].size());
+
+    std::string events_per_kmer(n_kmers, '0');
+    for(size_t i = 0; i < alignment.size(); ++i) {
+        REQUIRE(alignment[i].read_pos == (int)i);
+        REQUIRE(alignment[i].ref_pos >= 0);
+        REQUIRE(alignment[i].ref_pos < (int)n_kmers);
+        events_per_kmer[alignment[i].ref_pos] += 1;
+    }
+    REQUIRE(events_per_kmer == expected_events_per_kmer);
+}
+
 std::vector< StateTrainingData >
 generate_training_data(const ParamMixture& mixture, size_t n_data,
                        const std::array< float, 2 >& scaled_read_var_rg = { .5f, 1.5f },
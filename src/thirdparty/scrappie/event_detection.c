@@ -7,92 +7,84 @@
 #include "event_detection.h"
 #include "scrappie_stdlib.h"
 
+// number of samples processed at once by the streaming detector; this
+// bounds its memory use, independent of the length of the read
+#define DETECTOR_CHUNK_SIZE 4096
+
 typedef struct {
     int DEF_PEAK_POS;
     float DEF_PEAK_VAL;
-    float *signal;
-    size_t signal_length;
     float threshold;
     size_t window_length;
     size_t masked_to;
     int peak_pos;
     float peak_value;
     bool valid_peak;
+    // cumulative sums up to (excluding) peak_pos
+    double peak_sum;
+    double peak_sumsq;
 } Detector;
 typedef Detector *DetectorPtr;
 
-/**
- *   Compute cumulative sum and sum of squares for a vector of data
- *
- *   Element i  sum (sumsq) is the sum (sum of squares) up to but
- *   excluding element i of the inputy data.
- *
- *   @param data      double[d_length]   Data to be summed over (in)
- *   @param sum       double[d_length + 1]   Vector to store sum (out)
- *   @param sumsq     double[d_length + 1]   Vector to store sum of squares (out)
- *   @param d_length                     Length of data vector
- **/
-void compute_sum_sumsq(const float *data, double *sum,
-                       double *sumsq, size_t d_length) {
-    RETURN_NULL_IF(NULL == data, );
-    RETURN_NULL_IF(NULL == sum, );
-    RETURN_NULL_IF(NULL == sumsq, );
-    assert(d_length > 0);
-
-    sum[0] = 0.0f;
-    sumsq[0] = 0.0f;
-    for (size_t i = 0; i < d_length; ++i) {
-        sum[i + 1] = sum[i] + data[i];
-        sumsq[i + 1] = sumsq[i] + data[i] * data[i];
-    }
-}
+struct event_detector {
+    detector_param param;
+    Detector short_detector;
+    Detector long_detector;
+
+    // the larger of the two window lengths
+    size_t max_window;
+
+    // number of samples added so far
+    size_t nsample;
+
+    // index of the next sample to run through the peak detectors
+    size_t next_sample;
+
+    // sum[j] (sumsq[j]) is the sum (sum of squares) of the samples before
+    // sample index sum_start + j. Only the prefix sums needed for the t-statistic
+    // windows around the unprocessed samples are kept.
+    double *sum;
+    double *sumsq;
+    size_t sum_start;
+    size_t sum_length;
+    size_t sum_capacity;
+
+    // scratch space for the conversion of raw values and the t-statistics
+    float *converted;
+    float *tstat1;
+    float *tstat2;
+
+    // the end of the last emitted event
+    size_t boundary_pos;
+    double boundary_sum;
+    double boundary_sumsq;
+
+    event_table et;
+    size_t event_capacity;
+};
 
 /**
  *   Compute windowed t-statistic from summary information
  *
- *   @param sum       double[d_length]  Cumulative sums of data (in)
- *   @param sumsq     double[d_length]  Cumulative sum of squares of data (in)
- *   @param d_length                    Length of data vector
- *   @param w_length                    Window length to calculate t-statistic over
+ *   Element j of the output is the t-statistic for the sample at offset j + w_length
+ *   from the start of sum, comparing the windows to its left and to its right
  *
- *   @returns float array containing tstats.  Returns NULL on error
+ *   @param sum       double[n + 2 * w_length]  Cumulative sums of data (in)
+ *   @param sumsq     double[n + 2 * w_length]  Cumulative sum of squares of data (in)
+ *   @param n                                   Number of t-statistics to calculate
+ *   @param w_length                            Window length to calculate t-statistic over
+ *   @param tstat     float[n]                  The t-statistics (out)
  **/
-float *compute_tstat(const double *sum, const double *sumsq,
-                     size_t d_length, size_t w_length) {
-    assert(d_length > 0);
-    assert(w_length > 0);
-    RETURN_NULL_IF(NULL == sum, NULL);
-    RETURN_NULL_IF(NULL == sumsq, NULL);
-
-    float *tstat = calloc(d_length, sizeof(float));
-    RETURN_NULL_IF(NULL == tstat, NULL);
-
+static void compute_tstat(const double *sum, const double *sumsq,
+                          size_t n, size_t w_length, float *tstat) {
     const float eta = FLT_MIN;
     const float w_lengthf = (float)w_length;
 
-    // Quick return:
-    //   t-test not defined for number of points less than 2
-    //   need at least as many points as twice the window length
-    if (d_length < 2 * w_length || w_length < 2) {
-        for (size_t i = 0; i < d_length; ++i) {
-            tstat[i] = 0.0f;
-        }
-        return tstat;
-    }
-    // fudge boundaries
-    for (size_t i = 0; i < w_length; ++i) {
-        tstat[i] = 0;
-        tstat[d_length - i - 1] = 0;
-    }
-
-    // get to work on the rest
-    for (size_t i = w_length; i <= d_length - w_length; ++i) {
-        double sum1 = sum[i];
-        double sumsq1 = sumsq[i];
-        if (i > w_length) {
-            sum1 -= sum[i - w_length];
-            sumsq1 -= sumsq[i - w_length];
-        }
+    // no dependencies between iterations so the compiler can vectorize this loop
+    for (size_t j = 0; j < n; ++j) {
+        const size_t i = j + w_length;
+        double sum1 = sum[i] - sum[i - w_length];
+        double sumsq1 = sumsq[i] - sumsq[i - w_length];
         float sum2 = (float)(sum[i + w_length] - sum[i]);
         float sumsq2 = (float)(sumsq[i + w_length] - sumsq[i]);
         float mean1 = sum1 / w_lengthf;
@@ -101,100 +93,16 @@ float *compute_tstat(const double *sum, const double *sumsq,
             + sumsq2 / w_lengthf - mean2 * mean2;
 
         // Prevent problem due to very small variances
-        combined_var = fmaxf(combined_var, eta);
+        // (same as fmaxf, written so that the loop vectorizes)
+        combined_var = combined_var > eta ? combined_var : eta;
 
         //t-stat
         //  Formula is a simplified version of Student's t-statistic for the
         //  special case where there are two samples of equal size with
         //  differing variance
         const float delta_mean = mean2 - mean1;
-        tstat[i] = fabs(delta_mean) / sqrt(combined_var / w_lengthf);
+        tstat[j] = fabs(delta_mean) / sqrt(combined_var / w_lengthf);
     }
-
-    return tstat;
-}
-
-/**
- *
- *   @returns array of length nsample whose elements contain peak positions
- *   Remaining elements are padded by zeros.
- **/
-size_t *short_long_peak_detector(DetectorPtr short_detector,
-                                 DetectorPtr long_detector,
-                                 const float peak_height) {
-    assert(short_detector->signal_length == long_detector->signal_length);
-    RETURN_NULL_IF(NULL == short_detector->signal, NULL);
-    RETURN_NULL_IF(NULL == long_detector->signal, NULL);
-
-    const size_t ndetector = 2;
-    DetectorPtr detectors[] = { short_detector, long_detector };
-
-    size_t *peaks = calloc(short_detector->signal_length, sizeof(size_t));
-    RETURN_NULL_IF(NULL == peaks, NULL);
-
-    size_t peak_count = 0;
-    for (size_t i = 0; i < short_detector->signal_length; i++) {
-        for (int k = 0; k < ndetector; k++) {
-            DetectorPtr detector = detectors[k];
-            //Carry on if we've been masked out
-            if (detector->masked_to >= i) {
-                continue;
-            }
-
-            float current_value = detector->signal[i];
-
-            if (detector->peak_pos == detector->DEF_PEAK_POS) {
-                //CASE 1: We've not yet recorded a maximum
-                if (current_value < detector->peak_value) {
-                    //Either record a deeper minimum...
-                    detector->peak_value = current_value;
-                } else if (current_value - detector->peak_value >
-                           peak_height) {
-                    // ...or we've seen a qualifying maximum
-                    detector->peak_value = current_value;
-                    detector->peak_pos = i;
-                    //otherwise, wait to rise high enough to be considered a peak
-                }
-            } else {
-                //CASE 2: In an existing peak, waiting to see if it is good
-                if (current_value > detector->peak_value) {
-                    //Update the peak
-                    detector->peak_value = current_value;
-                    detector->peak_pos = i;
-                }
-                //Dominate other tstat signals if we're going to fire at some point
-                if (detector == short_detector) {
-                    if (detector->peak_value > detector->threshold) {
-                        long_detector->masked_to =
-                            detector->peak_pos + detector->window_length;
-                        long_detector->peak_pos =
-                            long_detector->DEF_PEAK_POS;
-                        long_detector->peak_value =
-                            long_detector->DEF_PEAK_VAL;
-                        long_detector->valid_peak = false;
-                    }
-                }
-                //Have we convinced ourselves we've seen a peak
-                if (detector->peak_value - current_value > peak_height
-                    && detector->peak_value > detector->threshold) {
-                    detector->valid_peak = true;
-                }
-                //Finally, check the distance if this is a good peak
-                if (detector->valid_peak
-                    && (i - detector->peak_pos) >
-                    detector->window_length / 2) {
-                    //Emit the boundary and reset
-                    peaks[peak_count] = detector->peak_pos;
-                    peak_count++;
-                    detector->peak_pos = detector->DEF_PEAK_POS;
-                    detector->peak_value = current_value;
-                    detector->valid_peak = false;
-                }
-            }
-        }
-    }
-
-    return peaks;
 }
 
 /**  Create an event given boundaries
@@ -204,116 +112,335 @@ size_t *short_long_peak_detector(DetectorPtr short_detector,
  *
  *  @param start Index of lower bound
  *  @param end Index of upper bound
- *  @param sums
- *  @param sumsqs
- *  @param nsample  Total number of samples in read
+ *  @param start_sum, start_sumsq  Cumulative sums up to the lower bound
+ *  @param end_sum, end_sumsq  Cumulative sums up to the upper bound
  *
- *  @returns An initialised event.  A 'null' event is returned on error.
+ *  @returns An initialised event.
  **/
-event_t create_event(size_t start, size_t end, double const *sums,
-                     double const *sumsqs, size_t nsample) {
-    assert(start < nsample);
-    assert(end <= nsample);
-
+static event_t create_event(size_t start, size_t end,
+                            double start_sum, double start_sumsq,
+                            double end_sum, double end_sumsq) {
     event_t event = { 0 };
     event.pos = -1;
     event.state = -1;
-    RETURN_NULL_IF(NULL == sums, event);
-    RETURN_NULL_IF(NULL == sumsqs, event);
 
     event.start = (uint64_t)start;
     event.length = (float)(end - start);
-    event.mean = (float)(sums[end] - sums[start]) / event.length;
-    const float deltasqr = (sumsqs[end] - sumsqs[start]);
+    event.mean = (float)(end_sum - start_sum) / event.length;
+    const float deltasqr = (end_sumsq - start_sumsq);
     const float var = deltasqr / event.length - event.mean * event.mean;
     event.stdv = sqrtf(fmaxf(var, 0.0f));
 
     return event;
 }
 
-event_table create_events(size_t const *peaks, double const *sums,
-                          double const *sumsqs, size_t nsample) {
-    event_table et = { 0 };
-    RETURN_NULL_IF(NULL == sums, et);
-    RETURN_NULL_IF(NULL == sumsqs, et);
-    RETURN_NULL_IF(NULL == peaks, et);
-
-    // Count number of events found
-    size_t n = 1;
-    for (size_t i = 0; i < nsample; ++i) {
-        if (peaks[i] > 0 && peaks[i] < nsample) {
-            n++;
+/**  Close the current event at a boundary and start a new one
+ **/
+static void emit_event(struct event_detector *ed, size_t pos, double sum, double sumsq) {
+    if (ed->et.n == ed->event_capacity) {
+        ed->event_capacity = ed->event_capacity == 0 ? 1024 : 2 * ed->event_capacity;
+        ed->et.event = realloc(ed->et.event, ed->event_capacity * sizeof(event_t));
+        assert(NULL != ed->et.event);
+    }
+
+    ed->et.event[ed->et.n++] = create_event(ed->boundary_pos, pos,
+                                            ed->boundary_sum, ed->boundary_sumsq,
+                                            sum, sumsq);
+    ed->boundary_pos = pos;
+    ed->boundary_sum = sum;
+    ed->boundary_sumsq = sumsq;
+}
+
+static void set_peak(DetectorPtr detector, size_t i, float value, double sum, double sumsq) {
+    detector->peak_value = value;
+    detector->peak_pos = i;
+    detector->peak_sum = sum;
+    detector->peak_sumsq = sumsq;
+}
+
+/**  Advance the short and long peak detectors by one sample
+ *
+ *   Boundaries are emitted as events as soon as each peak is confirmed.
+ **/
+static void short_long_peak_detector_step(struct event_detector *ed, size_t i,
+                                          float short_value, float long_value,
+                                          double sum, double sumsq) {
+    DetectorPtr short_detector = &ed->short_detector;
+    DetectorPtr long_detector = &ed->long_detector;
+    const float peak_height = ed->param.peak_height;
+
+    const size_t ndetector = 2;
+    DetectorPtr detectors[] = { short_detector, long_detector };
+    const float values[] = { short_value, long_value };
+
+    for (int k = 0; k < ndetector; k++) {
+        DetectorPtr detector = detectors[k];
+        //Carry on if we've been masked out
+        if (detector->masked_to >= i) {
+            continue;
+        }
+
+        float current_value = values[k];
+
+        if (detector->peak_pos == detector->DEF_PEAK_POS) {
+            //CASE 1: We've not yet recorded a maximum
+            if (current_value < detector->peak_value) {
+                //Either record a deeper minimum...
+                detector->peak_value = current_value;
+            } else if (current_value - detector->peak_value >
+                       peak_height) {
+                // ...or we've seen a qualifying maximum
+                set_peak(detector, i, current_value, sum, sumsq);
+                //otherwise, wait to rise high enough to be considered a peak
+            }
+        } else {
+            //CASE 2: In an existing peak, waiting to see if it is good
+            if (current_value > detector->peak_value) {
+                //Update the peak
+                set_peak(detector, i, current_value, sum, sumsq);
+            }
+            //Dominate other tstat signals if we're going to fire at some point
+            if (detector == short_detector) {
+                if (detector->peak_value > detector->threshold) {
+                    long_detector->masked_to =
+                        detector->peak_pos + detector->window_length;
+                    long_detector->peak_pos =
+                        long_detector->DEF_PEAK_POS;
+                    long_detector->peak_value =
+                        long_detector->DEF_PEAK_VAL;
+                    long_detector->valid_peak = false;
+                }
+            }
+            //Have we convinced ourselves we've seen a peak
+            if (detector->peak_value - current_value > peak_height
+                && detector->peak_value > detector->threshold) {
+                detector->valid_peak = true;
+            }
+            //Finally, check the distance if this is a good peak
+            if (detector->valid_peak
+                && (i - detector->peak_pos) >
+                detector->window_length / 2) {
+                //Emit the boundary and reset
+                emit_event(ed, detector->peak_pos, detector->peak_sum, detector->peak_sumsq);
+                detector->peak_pos = detector->DEF_PEAK_POS;
+                detector->peak_value = current_value;
+                detector->valid_peak = false;
+            }
         }
     }
+}
 
-    et.event = calloc(n, sizeof(event_t));
-    RETURN_NULL_IF(NULL == et.event, et);
+/**  Fill tstat for samples [start, end) of the read
+ *
+ *   The t-statistic is zero for samples that do not have a full window on both
+ *   sides, given that nsample samples have been added so far
+ **/
+static void fill_tstat(const struct event_detector *ed, size_t start, size_t end,
+                       size_t nsample, size_t w_length, float *tstat) {
+    size_t lo = start;
+    size_t hi = start;
+    // t-test not defined for number of points less than 2
+    if (w_length >= 2) {
+        lo = start > w_length ? start : w_length;
+        hi = nsample + 1 > w_length ? nsample + 1 - w_length : 0;
+        hi = hi < end ? hi : end;
+    }
 
-    et.n = n;
-    et.end = et.n;
+    if (lo < hi) {
+        const size_t offset = lo - w_length - ed->sum_start;
+        compute_tstat(ed->sum + offset, ed->sumsq + offset, hi - lo, w_length, tstat + (lo - start));
+    } else {
+        hi = lo = end;
+    }
 
+    for (size_t i = start; i < lo; ++i) {
+        tstat[i - start] = 0.0f;
+    }
+    for (size_t i = hi; i < end; ++i) {
+        tstat[i - start] = 0.0f;
+    }
+}
 
-    // First event -- starts at zero
-    et.event[0] = create_event(0, peaks[0], sums, sumsqs, nsample);
-    // Other events -- peak[i-1] -> peak[i]
-    for(size_t ev=1 ; ev < n - 1 ; ev++){
-        et.event[ev] = create_event(peaks[ev - 1], peaks[ev], sums, sumsqs, nsample);
+/**  Run the peak detectors over all samples before end
+ *
+ *   Every sample before end must either have a full window to its right
+ *   or be at the end of the read.
+ **/
+static void process_samples(struct event_detector *ed, size_t end) {
+    const size_t start = ed->next_sample;
+    if (start >= end) {
+        return;
     }
-    // Last event -- ends at nsample
-    et.event[n - 1] = create_event(peaks[n - 2], nsample, sums, sumsqs, nsample);
 
-    return et;
+    fill_tstat(ed, start, end, ed->nsample, ed->param.window_length1, ed->tstat1);
+    fill_tstat(ed, start, end, ed->nsample, ed->param.window_length2, ed->tstat2);
+
+    for (size_t i = start; i < end; ++i) {
+        const size_t j = i - ed->sum_start;
+        short_long_peak_detector_step(ed, i, ed->tstat1[i - start], ed->tstat2[i - start],
+                                      ed->sum[j], ed->sumsq[j]);
+    }
+    ed->next_sample = end;
+
+    // discard the prefix sums that are no longer needed
+    const size_t keep_from = end > ed->max_window ? end - ed->max_window : 0;
+    if (keep_from > ed->sum_start) {
+        const size_t shift = keep_from - ed->sum_start;
+        ed->sum_length -= shift;
+        memmove(ed->sum, ed->sum + shift, ed->sum_length * sizeof(double));
+        memmove(ed->sumsq, ed->sumsq + shift, ed->sum_length * sizeof(double));
+        ed->sum_start = keep_from;
+    }
 }
 
-event_table detect_events(raw_table const rt, detector_param const edparam) {
+/**  Add at most DETECTOR_CHUNK_SIZE converted samples to the detector
+ **/
+static void add_converted_chunk(struct event_detector *ed, const float *data, size_t n) {
+    assert(n <= DETECTOR_CHUNK_SIZE);
+    assert(ed->sum_length + n <= ed->sum_capacity);
 
-    event_table et = { 0 };
-    RETURN_NULL_IF(NULL == rt.raw, et);
+    double *sum = ed->sum + ed->sum_length - 1;
+    double *sumsq = ed->sumsq + ed->sum_length - 1;
+    for (size_t i = 0; i < n; ++i) {
+        sum[i + 1] = sum[i] + data[i];
+        sumsq[i + 1] = sumsq[i] + data[i] * data[i];
+    }
+    ed->sum_length += n;
+    ed->nsample += n;
 
-    double *sums = calloc(rt.n + 1, sizeof(double));
-    double *sumsqs = calloc(rt.n + 1, sizeof(double));
+    // the samples that have a full window to their right can be processed now
+    if (ed->nsample >= ed->max_window) {
+        process_samples(ed, ed->nsample - ed->max_window + 1);
+    }
+}
 
-    compute_sum_sumsq(rt.raw, sums, sumsqs, rt.n);
-    float *tstat1 = compute_tstat(sums, sumsqs, rt.n, edparam.window_length1);
-    float *tstat2 = compute_tstat(sums, sumsqs, rt.n, edparam.window_length2);
+event_detector *event_detector_create(detector_param const edparam) {
+    event_detector *ed = calloc(1, sizeof(event_detector));
+    RETURN_NULL_IF(NULL == ed, NULL);
 
-    Detector short_detector = {
-        .DEF_PEAK_POS = -1,
-        .DEF_PEAK_VAL = FLT_MAX,
-        .signal = tstat1,
-        .signal_length = rt.n,
-        .threshold = edparam.threshold1,
-        .window_length = edparam.window_length1,
-        .masked_to = 0,
-        .peak_pos = -1,
-        .peak_value = FLT_MAX,
-        .valid_peak = false
-    };
+    ed->param = edparam;
+    ed->max_window = edparam.window_length1 > edparam.window_length2 ?
+        edparam.window_length1 : edparam.window_length2;
 
-    Detector long_detector = {
+    const Detector default_detector = {
         .DEF_PEAK_POS = -1,
         .DEF_PEAK_VAL = FLT_MAX,
-        .signal = tstat2,
-        .signal_length = rt.n,
-        .threshold = edparam.threshold2,
-        .window_length = edparam.window_length2,
+        .threshold = 0.0f,
+        .window_length = 0,
         .masked_to = 0,
         .peak_pos = -1,
         .peak_value = FLT_MAX,
-        .valid_peak = false
+        .valid_peak = false,
+        .peak_sum = 0.0,
+        .peak_sumsq = 0.0
     };
 
-    size_t *peaks =
-        short_long_peak_detector(&short_detector, &long_detector,
-                                 edparam.peak_height);
+    ed->short_detector = default_detector;
+    ed->short_detector.threshold = edparam.threshold1;
+    ed->short_detector.window_length = edparam.window_length1;
+
+    ed->long_detector = default_detector;
+    ed->long_detector.threshold = edparam.threshold2;
+    ed->long_detector.window_length = edparam.window_length2;
+
+    ed->sum_capacity = DETECTOR_CHUNK_SIZE + 2 * ed->max_window + 1;
+    ed->sum = calloc(ed->sum_capacity, sizeof(double));
+    ed->sumsq = calloc(ed->sum_capacity, sizeof(double));
+    ed->converted = calloc(DETECTOR_CHUNK_SIZE, sizeof(float));
+    ed->tstat1 = calloc(DETECTOR_CHUNK_SIZE + ed->max_window, sizeof(float));
+    ed->tstat2 = calloc(DETECTOR_CHUNK_SIZE + ed->max_window, sizeof(float));
+    if (NULL == ed->sum || NULL == ed->sumsq || NULL == ed->converted ||
+        NULL == ed->tstat1 || NULL == ed->tstat2) {
+        event_table et = event_detector_finish(ed);
+        free(et.event);
+        return NULL;
+    }
+
+    // the sum before the first sample
+    ed->sum_length = 1;
+    return ed;
+}
+
+void event_detector_add_raw(event_detector *ed, float const *raw, size_t nsample) {
+    RETURN_NULL_IF(NULL == ed, );
+    RETURN_NULL_IF(NULL == raw, );
+
+    for (size_t start = 0; start < nsample; start += DETECTOR_CHUNK_SIZE) {
+        const size_t n = (nsample - start < DETECTOR_CHUNK_SIZE) ?
+            nsample - start : DETECTOR_CHUNK_SIZE;
+        add_converted_chunk(ed, raw + start, n);
+    }
+}
+
+void event_detector_add_raw_int16(event_detector *ed, int16_t const *raw, size_t nsample,
+                                  float offset, float raw_unit) {
+    RETURN_NULL_IF(NULL == ed, );
+    RETURN_NULL_IF(NULL == raw, );
+
+    float *converted = ed->converted;
+    for (size_t start = 0; start < nsample; start += DETECTOR_CHUNK_SIZE) {
+        const size_t n = (nsample - start < DETECTOR_CHUNK_SIZE) ?
+            nsample - start : DETECTOR_CHUNK_SIZE;
+
+        // branch-free conversion to pA, vectorized by the compiler
+        const int16_t *chunk = raw + start;
+        for (size_t i = 0; i < n; ++i) {
+            converted[i] = ((float)chunk[i] + offset) * raw_unit;
+        }
+        add_converted_chunk(ed, converted, n);
+    }
+}
+
+event_table event_detector_finish(event_detector *ed) {
+    event_table et = { 0 };
+    RETURN_NULL_IF(NULL == ed, et);
+
+    if (ed->nsample > 0 && NULL != ed->sum) {
+        // the remaining samples do not have full windows to their right
+        process_samples(ed, ed->nsample);
 
-    et = create_events(peaks, sums, sumsqs, rt.n);
+        // Last event -- ends at nsample
+        const size_t j = ed->nsample - ed->sum_start;
+        emit_event(ed, ed->nsample, ed->sum[j], ed->sumsq[j]);
 
-    free(peaks);
-    free(tstat2);
-    free(tstat1);
-    free(sumsqs);
-    free(sums);
+        et = ed->et;
+        et.start = 0;
+        et.end = et.n;
+    } else {
+        free(ed->et.event);
+    }
+
+    free(ed->tstat2);
+    free(ed->tstat1);
+    free(ed->converted);
+    free(ed->sumsq);
+    free(ed->sum);
+    free(ed);
 
     return et;
 }
+
+event_table detect_events(raw_table const rt, detector_param const edparam) {
+
+    event_table et = { 0 };
+    RETURN_NULL_IF(NULL == rt.raw, et);
+
+    event_detector *ed = event_detector_create(edparam);
+    RETURN_NULL_IF(NULL == ed, et);
+
+    event_detector_add_raw(ed, rt.raw, rt.n);
+    return event_detector_finish(ed);
+}
+
+event_table detect_events_int16(int16_t const *raw, size_t nsample, float offset,
+                                float raw_unit, detector_param const edparam) {
+
+    event_table et = { 0 };
+    RETURN_NULL_IF(NULL == raw, et);
+
+    event_detector *ed = event_detector_create(edparam);
+    RETURN_NULL_IF(NULL == ed, et);
+
+    event_detector_add_raw_int16(ed, raw, nsample, offset, raw_unit);
+    return event_detector_finish(ed);
+}
@@ -31,4 +31,27 @@ static detector_param const event_detection_rna = {
 
 event_table detect_events(raw_table const rt, detector_param const edparam);
 
+// As detect_events, but directly on raw ADC values which are converted to pA
+// on the fly as (raw[i] + offset) * raw_unit
+event_table detect_events_int16(int16_t const *raw, size_t nsample, float offset,
+                                float raw_unit, detector_param const edparam);
+
+// Streaming event detection. Samples are added in chunks of any size and events
+// are emitted as soon as their boundaries are known, using a fixed amount of
+// memory (besides the events) however long the read is. The events are identical
+// to calling detect_events on the whole signal.
+typedef struct event_detector event_detector;
+
+event_detector *event_detector_create(detector_param const edparam);
+
+// add the next chunk of the signal, in pA
+void event_detector_add_raw(event_detector *ed, float const *raw, size_t nsample);
+
+// add the next chunk of the signal as raw ADC values
+void event_detector_add_raw_int16(event_detector *ed, int16_t const *raw, size_t nsample,
+                                  float offset, float raw_unit);
+
+// detect the final events, free the detector and return all events. The caller owns et.event
+event_table event_detector_finish(event_detector *ed);
+
 #endif                          /* EVENT_DETECTION_H */
@@ -128,7 +128,7 @@ struct FullStateTrainingData
                           const std::string& next_kmer)
         : MinimalStateTrainingData(sr, ea, rank, prev_kmer, next_kmer)
     {
-        this->duration = sr.events[ea.strand_idx][ea.event_idx].duration;
+        this->duration = sr.get_duration(ea.event_idx, ea.strand_idx);
         this->ref_position = ea.ref_position;
         this->ref_strand = ea.rc;
         this->z = z_score(sr, pore_model, rank, ea.event_idx, ea.strand_idx);